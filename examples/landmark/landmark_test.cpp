@@ -1,5 +1,6 @@
+#include <algorithm>
+#include <cmath>
 #include <cstdio>
-#include <opencv2/opencv.hpp>
 #define NTT_MICRO_NN_IMPLEMENTATION
 #include <ntt_very_super_micro_dnn/ntt_tensor.hpp>
 
@@ -223,9 +224,55 @@ int main(void)
     Clip2DLayer clip46(0, 6);
     Conv2DLayer conv47(conv47_weight, conv47_bias.reshape_clone({conv47_bias.getTotalElements(), 1}), 1, 1, 1152);
     Clip2DLayer clip47(0, 6);
-    GlobalAveragePooling2DLayer gap47;
 
-    std::vector<Layer *> chunk15 = {&conv46, &clip46, &conv47, &clip47, &gap47};
+    // conv47, clip47 and the global average pooling in one pass, without the 1152 planes
+    Conv2DPoolingLayer gap47(conv47, clip47);
+
+    std::vector<Layer *> chunk15 = {&conv46, &clip46, &gap47};
+
+    // the chunks are the inverted residual blocks, the ones which keep the shape add their input
+    std::vector<Layer *> *chunks[] = {&chunk1, &chunk2, &chunk3, &chunk4, &chunk5,
+                                      &chunk6, &chunk7, &chunk8, &chunk9, &chunk10,
+                                      &chunk11, &chunk12, &chunk13, &chunk14, &chunk15};
+    const bool isResidual[] = {false, true, false, true, false,
+                               true, true, false, true, true,
+                               false, true, true, true, false};
+
+    Graph landmark;
+    size_t node = landmark.add_input();
+    for (size_t i = 0; i < 15; i++)
+    {
+        const size_t block = landmark.add_layers(*chunks[i], node);
+        node = isResidual[i] ? landmark.add_node(GraphOperation::Add, {node, block}) : block;
+    }
+
+    // a synthetic 112x112 frame through the graph and through the blocks one after the other
+    Tensor image({conv1_weight.get_shape()[1], 1, 112, 112}, 0.0f);
+    float *pixels = image.get_mutable_data();
+    for (size_t i = 0; i < image.getTotalElements(); i++)
+    {
+        pixels[i] = static_cast<float>(i * 37 % 255) / 255.0f;
+    }
+
+    Tensor expected = image;
+    for (size_t i = 0; i < 15; i++)
+    {
+        Tensor block = expected;
+        for (Layer *layer : *chunks[i])
+        {
+            block = layer->forward(block);
+        }
+        expected = isResidual[i] ? expected + block : block;
+    }
+
+    const Tensor output = landmark.forward(image);
+    float difference = 0.0f;
+    for (size_t i = 0; i < output.getTotalElements(); i++)
+    {
+        difference = std::max(difference, std::fabs(output.get_data()[i] - expected.get_data()[i]));
+    }
+    printf("%zu features, the largest difference with the sequential blocks is %g\n",
+           output.getTotalElements(), difference);
 
     return 0;
 }
\ No newline at end of file
@@ -23,23 +23,16 @@ int main(void)
         // "C:/Users/Acer/Project/ntt-very-super-micro-dnn/examples/test_idx_9915_label_4.png",
         &width, &height, &channels, 0);
 
-    Tensor inputMatrix({static_cast<size_t>(height), static_cast<size_t>(width)});
-    if (data)
-    {
-        for (size_t i = 0; i < height; i++)
-        {
-            for (size_t j = 0; j < width; j++)
-            {
-                inputMatrix.set_element({i, j}, data[i * height + j]);
-            }
-        }
-    }
-    else
+    if (!data)
     {
         printf("Error vcb\n");
         exit(-1);
     }
 
+    // the bytes scaled to [0, 1] in one pass, as [1, 1, height, width]
+    Tensor inputMatrix = Tensor::from_image(data, static_cast<size_t>(height), static_cast<size_t>(width),
+                                            static_cast<size_t>(channels));
+
     Conv2DLayer conv2d1(conv2d1_weight, conv2d1_bias.reshape_clone({16, 1}), 1, 1);
     FlattenLayer flattenLayer;
     FullyConnectedLayer fc4(fc4_weight, fc4_bias.reshape_clone({10, 1}));
@@ -47,8 +40,7 @@ int main(void)
 
     std::vector<Layer *> layers = {&conv2d1, &flattenLayer, &fc4, &softmaxLayer};
 
-    Tensor output = inputMatrix.reshape_clone({1, 1, static_cast<size_t>(height), static_cast<size_t>(width)});
-    output = output / 255.0f;
+    Tensor output = inputMatrix;
 
     for (Layer *layer : layers)
     {
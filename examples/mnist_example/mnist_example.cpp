@@ -22,25 +22,17 @@ int main(void)
         "C:/Users/Acer/Project/ntt-very-super-micro-dnn/examples/test_idx_2691_label_8.png",
         // "C:/Users/Acer/Project/ntt-very-super-micro-dnn/examples/test_idx_9915_label_4.png",
         &width, &height, &channels, 0);
-    Tensor inputMatrix({static_cast<size_t>(height), static_cast<size_t>(width)});
-    if (data)
-    {
-        for (size_t i = 0; i < height; i++)
-        {
-            for (size_t j = 0; j < width; j++)
-            {
-                inputMatrix.set_element({i, j}, data[i * height + j]);
-            }
-        }
-    }
-    else
+    if (!data)
     {
         printf("Error vcb\n");
         exit(-1);
     }
 
+    // the bytes scaled to [0, 1] in one pass, as [1, 1, height, width]
+    Tensor inputMatrix = Tensor::from_image(data, static_cast<size_t>(height), static_cast<size_t>(width),
+                                            static_cast<size_t>(channels));
+
     printf("Width: %d, Height: %d, Channel: %d", width, height, channels);
-    inputMatrix = inputMatrix / 255.0f;
 
     FullyConnectedLayer fc1(fc1_weight, fc1_bias.reshape_clone({fc1_bias.get_shape()[0], 1}));
     ReLULayer relu1 = ReLULayer();
@@ -0,0 +1,39 @@
+#include <cstdio>
+#include <string>
+
+#define NTT_MICRO_NN_IMPLEMENTATION
+#include <ntt_very_super_micro_dnn/ntt_tensor.hpp>
+
+using namespace ntt;
+
+// packs the .bin weights of a model into one compressed bundle, named after their files:
+//      weight_bundle landmark.nttb data/conv1_weight.bin data/conv1_bias.bin ...
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        printf("Usage: %s bundle weights.bin...\n", argv[0]);
+        return -1;
+    }
+
+    WeightBundle bundle;
+    size_t bytes = 0;
+    for (int i = 2; i < argc; i++)
+    {
+        const std::string path = argv[i];
+        const size_t slash = path.find_last_of("/\\");
+        const std::string file = slash == std::string::npos ? path : path.substr(slash + 1);
+        const Tensor weights = Tensor::from_bytes(path);
+
+        bundle.set(file.substr(0, file.find_last_of('.')), weights);
+        bytes += weights.getTotalElements() * sizeof(float);
+    }
+    bundle.save(argv[1]);
+
+    // the weights come back from the bundle with WeightBundle::from_bytes(argv[1]).get(name)
+    WeightBundle loaded = WeightBundle::from_bytes(argv[1]);
+    std::ifstream file(argv[1], std::ios::binary | std::ios::ate);
+    printf("%zu tensors, %zu bytes of weights in %zu bytes\n",
+           loaded.size(), bytes, static_cast<size_t>(file.tellg()));
+    return 0;
+}
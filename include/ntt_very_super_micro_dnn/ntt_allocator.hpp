@@ -0,0 +1,569 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <vector>
+
+#if defined(NTT_MICRO_NN_STATIC)
+#define NTT_MICRO_NN_API static
+#elif defined(NTT_MICRO_NN_EXTERN)
+#define NTT_MICRO_NN_API extern
+#else
+#define NTT_MICRO_NN_API
+#endif
+
+#ifdef NTT_MICRO_NN_IMPLEMENTATION
+#include <cstdio>
+#include <cstdlib>
+#if defined(_WIN32)
+#include <malloc.h>
+#elif defined(__linux__)
+#include <sys/mman.h>
+#endif
+#endif // NTT_MICRO_NN_IMPLEMENTATION
+
+#define NTT_ERROR_MESSAGE_SIZE 1994
+#define NTT_DEFAULT_ALIGNMENT 64
+#define NTT_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define NTT_POOL_MIN_BLOCK_SIZE 64
+#define NTT_POOL_MAX_BLOCK_SIZE (256 * 1024 * 1024)
+#define NTT_POOL_THREAD_CACHE_BLOCKS 4
+
+#ifdef NTT_MICRO_NN_IMPLEMENTATION
+namespace
+{
+#endif // NTT_MICRO_NN_IMPLEMENTATION
+    namespace ntt
+    {
+        /**
+         * The interface which is used by the Tensor and the Matrix for getting their
+         *      buffers. Implement it for plugging a pool or an arena into the library.
+         */
+        class Allocator
+        {
+        public:
+            virtual ~Allocator() {}
+
+            /**
+             * @param bytes: the number of bytes which are requested.
+             * @return: the pointer to the allocated memory, never nullptr.
+             */
+            virtual void *allocate(size_t bytes) = 0;
+
+            /**
+             * @param pointer: the memory which was returned by allocate.
+             * @param bytes: the same number of bytes which was passed to allocate.
+             */
+            virtual void deallocate(void *pointer, size_t bytes) = 0;
+        };
+
+        /**
+         * The default allocator, every buffer starts at a multiple of the alignment (64 bytes
+         *      by default, a full cache line and an AVX-512 register). Large buffers can be
+         *      backed by huge pages for reducing the TLB misses when reading big weights.
+         */
+        class AlignedAllocator : public Allocator
+        {
+        public:
+            /**
+             * @param alignment: the alignment of the buffers, must be a power of two.
+             * @param useHugePages: whether the buffers which are bigger than the hugePageThreshold
+             *      are backed by huge pages (only supported on Linux, ignored elsewhere).
+             * @param hugePageThreshold: the minimum size of a buffer which will use huge pages.
+             */
+            AlignedAllocator(size_t alignment = NTT_DEFAULT_ALIGNMENT,
+                             bool useHugePages = false,
+                             size_t hugePageThreshold = NTT_HUGE_PAGE_SIZE);
+
+            void *allocate(size_t bytes) override;
+            void deallocate(void *pointer, size_t bytes) override;
+
+            inline size_t get_alignment() const { return m_alignment; }
+
+        private:
+            size_t m_alignment;
+            bool m_useHugePages;
+            size_t m_hugePageThreshold;
+        };
+
+        /**
+         * @return: the allocator which is used by the current thread, the one installed by a
+         *      ScopedAllocator if there is any, otherwise the global default allocator.
+         */
+        Allocator *get_default_allocator();
+
+        /**
+         * Replace the global default allocator, passing nullptr restores the built-in
+         *      AlignedAllocator. Buffers remember their allocator, so changing it does not
+         *      affect the tensors which are already alive.
+         */
+        void set_default_allocator(Allocator *allocator);
+
+        /**
+         * Install an allocator for the current thread only, until the end of the scope.
+         *      Useful for routing the temporaries of a forward pass into a thread-local pool.
+         */
+        class ScopedAllocator
+        {
+        public:
+            ScopedAllocator(Allocator *allocator);
+            ~ScopedAllocator();
+
+        private:
+            Allocator *m_previous;
+        };
+
+        class PoolAllocator;
+
+        /**
+         * The blocks which are cached by one thread for one pool. It is shared between the
+         *      pool and the thread, whichever goes away first hands the blocks to the other.
+         */
+        struct PoolThreadCache
+        {
+            std::mutex mutex;
+            std::vector<std::vector<void *>> blocks;
+            PoolAllocator *pool;
+        };
+
+        struct PoolStatistics
+        {
+            size_t hits;      // allocations served from a cached block
+            size_t misses;    // allocations which went to the upstream allocator
+            size_t bytesHeld; // bytes which are cached by the pool, not used by anyone
+        };
+
+        /**
+         * A size-class pool for the transient tensors of the forward passes. The requests
+         *      are rounded up to one of the size classes (4 classes per power of two), a
+         *      released block is kept in a cache of the releasing thread first, then in a
+         *      shared depot, and handed back for the next request of the same class. That
+         *      way the multi-megabyte activations are recycled between the inferences
+         *      instead of being mapped and unmapped by the system allocator every time.
+         *
+         * The pool must outlive every buffer which was allocated from it.
+         */
+        class PoolAllocator : public Allocator
+        {
+        public:
+            /**
+             * @param upstream: the allocator for the new blocks, nullptr for an AlignedAllocator.
+             * @param maxBlockSize: bigger requests are not pooled and go straight to the upstream.
+             * @param threadCacheBlocks: the number of blocks per size class cached by each thread.
+             */
+            PoolAllocator(Allocator *upstream = nullptr,
+                          size_t maxBlockSize = NTT_POOL_MAX_BLOCK_SIZE,
+                          size_t threadCacheBlocks = NTT_POOL_THREAD_CACHE_BLOCKS);
+            ~PoolAllocator();
+
+            void *allocate(size_t bytes) override;
+            void deallocate(void *pointer, size_t bytes) override;
+
+            PoolStatistics get_statistics() const;
+
+            /**
+             * Return every cached block (of all threads) to the upstream allocator.
+             */
+            void trim();
+
+        public:
+            /**
+             * @return: the size of the class which the request of the given bytes is rounded up to.
+             */
+            static size_t get_class_size(size_t bytes);
+
+        private:
+            friend struct PoolThreadCacheList;
+
+            static size_t get_class_index(size_t bytes);
+            PoolThreadCache *get_thread_cache();
+            void release_block(size_t classIndex, void *pointer);
+            void flush_thread_cache(PoolThreadCache *cache);
+
+        private:
+            AlignedAllocator m_alignedAllocator;
+            Allocator *m_upstream;
+            size_t m_maxBlockSize;
+            size_t m_threadCacheBlocks;
+            size_t m_numberOfClasses;
+            std::vector<size_t> m_classSizes;
+            size_t m_id;
+
+            mutable std::mutex m_mutex;
+            std::vector<std::vector<void *>> m_depot;
+            std::vector<std::shared_ptr<PoolThreadCache>> m_threadCaches;
+
+            std::atomic<size_t> m_hits;
+            std::atomic<size_t> m_misses;
+            std::atomic<size_t> m_bytesHeld;
+        };
+
+#ifdef NTT_MICRO_NN_IMPLEMENTATION
+        static AlignedAllocator s_alignedAllocator;
+        static Allocator *s_defaultAllocator = &s_alignedAllocator;
+        static thread_local Allocator *s_threadAllocator = nullptr;
+
+        AlignedAllocator::AlignedAllocator(size_t alignment, bool useHugePages, size_t hugePageThreshold)
+            : m_alignment(alignment), m_useHugePages(useHugePages),
+              m_hugePageThreshold(hugePageThreshold)
+        {
+            if (alignment < sizeof(void *) || (alignment & (alignment - 1)) != 0)
+            {
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(buffer, sizeof(buffer),
+                         "Alignment must be a power of two not less than %zu: %zu",
+                         sizeof(void *), alignment);
+                throw std::invalid_argument(buffer);
+            }
+        }
+
+        void *AlignedAllocator::allocate(size_t bytes)
+        {
+            size_t alignment = m_alignment;
+            bool hugePages = m_useHugePages && bytes >= m_hugePageThreshold;
+
+#if defined(__linux__)
+            if (hugePages && alignment < NTT_HUGE_PAGE_SIZE)
+            {
+                alignment = NTT_HUGE_PAGE_SIZE;
+            }
+#else
+            hugePages = false;
+#endif
+
+            // round up the size, so the end of the buffer never shares a cache line
+            size_t alignedBytes = (bytes + alignment - 1) / alignment * alignment;
+            if (alignedBytes == 0)
+            {
+                alignedBytes = alignment;
+            }
+
+            void *pointer = nullptr;
+#if defined(_WIN32)
+            pointer = _aligned_malloc(alignedBytes, alignment);
+#else
+            if (posix_memalign(&pointer, alignment, alignedBytes) != 0)
+            {
+                pointer = nullptr;
+            }
+#endif
+
+            if (pointer == nullptr)
+            {
+                throw std::bad_alloc();
+            }
+
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+            if (hugePages)
+            {
+                madvise(pointer, alignedBytes, MADV_HUGEPAGE);
+            }
+#endif
+
+            return pointer;
+        }
+
+        void AlignedAllocator::deallocate(void *pointer, size_t bytes)
+        {
+            (void)bytes;
+#if defined(_WIN32)
+            _aligned_free(pointer);
+#else
+            free(pointer);
+#endif
+        }
+
+        Allocator *get_default_allocator()
+        {
+            return s_threadAllocator != nullptr ? s_threadAllocator : s_defaultAllocator;
+        }
+
+        void set_default_allocator(Allocator *allocator)
+        {
+            s_defaultAllocator = allocator != nullptr ? allocator : &s_alignedAllocator;
+        }
+
+        ScopedAllocator::ScopedAllocator(Allocator *allocator)
+            : m_previous(s_threadAllocator)
+        {
+            s_threadAllocator = allocator;
+        }
+
+        ScopedAllocator::~ScopedAllocator()
+        {
+            s_threadAllocator = m_previous;
+        }
+
+        static std::atomic<size_t> s_nextPoolId(1);
+
+        // serializes the destruction of the pools with the exit of the threads
+        static std::mutex s_poolLifetimeMutex;
+
+        /**
+         * The caches of the current thread, keyed by the id of the pool (ids are never reused,
+         *      so an entry of a destroyed pool can never be picked up by a new one). When the
+         *      thread exits, its blocks are moved to the depots of the pools which are alive.
+         */
+        struct PoolThreadCacheList
+        {
+            std::vector<std::pair<size_t, std::shared_ptr<PoolThreadCache>>> caches;
+
+            ~PoolThreadCacheList()
+            {
+                std::lock_guard<std::mutex> lifetimeLock(s_poolLifetimeMutex);
+
+                for (size_t i = 0; i < caches.size(); i++)
+                {
+                    PoolThreadCache *cache = caches[i].second.get();
+                    if (cache->pool != nullptr)
+                    {
+                        cache->pool->flush_thread_cache(cache);
+                    }
+                }
+            }
+        };
+
+        static thread_local PoolThreadCacheList s_threadCaches;
+
+        PoolAllocator::PoolAllocator(Allocator *upstream, size_t maxBlockSize, size_t threadCacheBlocks)
+            : m_upstream(upstream != nullptr ? upstream : &m_alignedAllocator),
+              m_maxBlockSize(get_class_size(maxBlockSize)),
+              m_threadCacheBlocks(threadCacheBlocks),
+              m_id(s_nextPoolId.fetch_add(1)),
+              m_hits(0), m_misses(0), m_bytesHeld(0)
+        {
+            for (size_t classSize = NTT_POOL_MIN_BLOCK_SIZE; classSize <= m_maxBlockSize;
+                 classSize = get_class_size(classSize + 1))
+            {
+                m_classSizes.push_back(classSize);
+            }
+
+            m_numberOfClasses = m_classSizes.size();
+            m_depot.resize(m_numberOfClasses);
+        }
+
+        PoolAllocator::~PoolAllocator()
+        {
+            std::lock_guard<std::mutex> lifetimeLock(s_poolLifetimeMutex);
+            trim();
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (size_t i = 0; i < m_threadCaches.size(); i++)
+            {
+                std::lock_guard<std::mutex> cacheLock(m_threadCaches[i]->mutex);
+                m_threadCaches[i]->pool = nullptr;
+            }
+        }
+
+        size_t PoolAllocator::get_class_index(size_t bytes)
+        {
+            if (bytes <= NTT_POOL_MIN_BLOCK_SIZE)
+            {
+                return 0;
+            }
+
+            // 4 classes per power of two: 2^p, 1.25 * 2^p, 1.5 * 2^p, 1.75 * 2^p
+            size_t power = 0;
+            while ((size_t(1) << (power + 1)) <= bytes - 1)
+            {
+                power++;
+            }
+
+            size_t base = size_t(1) << power;
+            size_t step = base / 4;
+            size_t subClass = (bytes - 1 - base) / step;
+
+            size_t minPower = 0;
+            while ((size_t(2) << minPower) <= NTT_POOL_MIN_BLOCK_SIZE)
+            {
+                minPower++;
+            }
+
+            return (power - minPower) * 4 + subClass + 1;
+        }
+
+        size_t PoolAllocator::get_class_size(size_t bytes)
+        {
+            if (bytes <= NTT_POOL_MIN_BLOCK_SIZE)
+            {
+                return NTT_POOL_MIN_BLOCK_SIZE;
+            }
+
+            size_t power = 0;
+            while ((size_t(1) << (power + 1)) <= bytes - 1)
+            {
+                power++;
+            }
+
+            size_t base = size_t(1) << power;
+            size_t step = base / 4;
+            return base + ((bytes - 1 - base) / step + 1) * step;
+        }
+
+        PoolThreadCache *PoolAllocator::get_thread_cache()
+        {
+            std::vector<std::pair<size_t, std::shared_ptr<PoolThreadCache>>> &caches = s_threadCaches.caches;
+            for (size_t i = 0; i < caches.size(); i++)
+            {
+                if (caches[i].first == m_id)
+                {
+                    return caches[i].second.get();
+                }
+            }
+
+            std::shared_ptr<PoolThreadCache> cache = std::make_shared<PoolThreadCache>();
+            cache->blocks.resize(m_numberOfClasses);
+            cache->pool = this;
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_threadCaches.push_back(cache);
+            }
+
+            caches.push_back(std::make_pair(m_id, cache));
+            return cache.get();
+        }
+
+        void PoolAllocator::flush_thread_cache(PoolThreadCache *cache)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            std::lock_guard<std::mutex> cacheLock(cache->mutex);
+
+            for (size_t classIndex = 0; classIndex < m_numberOfClasses; classIndex++)
+            {
+                std::vector<void *> &blocks = cache->blocks[classIndex];
+                m_depot[classIndex].insert(m_depot[classIndex].end(), blocks.begin(), blocks.end());
+                blocks.clear();
+            }
+
+            for (size_t i = 0; i < m_threadCaches.size(); i++)
+            {
+                if (m_threadCaches[i].get() == cache)
+                {
+                    m_threadCaches.erase(m_threadCaches.begin() + i);
+                    break;
+                }
+            }
+        }
+
+        void *PoolAllocator::allocate(size_t bytes)
+        {
+            if (bytes > m_maxBlockSize)
+            {
+                m_misses.fetch_add(1, std::memory_order_relaxed);
+                return m_upstream->allocate(bytes);
+            }
+
+            size_t classIndex = get_class_index(bytes);
+            size_t classSize = m_classSizes[classIndex];
+            PoolThreadCache *cache = get_thread_cache();
+
+            {
+                std::lock_guard<std::mutex> lock(cache->mutex);
+                std::vector<void *> &blocks = cache->blocks[classIndex];
+                if (!blocks.empty())
+                {
+                    void *pointer = blocks.back();
+                    blocks.pop_back();
+                    m_hits.fetch_add(1, std::memory_order_relaxed);
+                    m_bytesHeld.fetch_sub(classSize, std::memory_order_relaxed);
+                    return pointer;
+                }
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                std::vector<void *> &blocks = m_depot[classIndex];
+                if (!blocks.empty())
+                {
+                    void *pointer = blocks.back();
+                    blocks.pop_back();
+                    m_hits.fetch_add(1, std::memory_order_relaxed);
+                    m_bytesHeld.fetch_sub(classSize, std::memory_order_relaxed);
+                    return pointer;
+                }
+            }
+
+            m_misses.fetch_add(1, std::memory_order_relaxed);
+            return m_upstream->allocate(classSize);
+        }
+
+        void PoolAllocator::deallocate(void *pointer, size_t bytes)
+        {
+            if (bytes > m_maxBlockSize)
+            {
+                m_upstream->deallocate(pointer, bytes);
+                return;
+            }
+
+            size_t classIndex = get_class_index(bytes);
+            m_bytesHeld.fetch_add(m_classSizes[classIndex], std::memory_order_relaxed);
+            release_block(classIndex, pointer);
+        }
+
+        void PoolAllocator::release_block(size_t classIndex, void *pointer)
+        {
+            PoolThreadCache *cache = get_thread_cache();
+
+            {
+                std::lock_guard<std::mutex> lock(cache->mutex);
+                std::vector<void *> &blocks = cache->blocks[classIndex];
+                if (blocks.size() < m_threadCacheBlocks)
+                {
+                    blocks.push_back(pointer);
+                    return;
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_depot[classIndex].push_back(pointer);
+        }
+
+        PoolStatistics PoolAllocator::get_statistics() const
+        {
+            PoolStatistics statistics;
+            statistics.hits = m_hits.load(std::memory_order_relaxed);
+            statistics.misses = m_misses.load(std::memory_order_relaxed);
+            statistics.bytesHeld = m_bytesHeld.load(std::memory_order_relaxed);
+            return statistics;
+        }
+
+        void PoolAllocator::trim()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            for (size_t i = 0; i < m_threadCaches.size(); i++)
+            {
+                PoolThreadCache *cache = m_threadCaches[i].get();
+                std::lock_guard<std::mutex> cacheLock(cache->mutex);
+
+                for (size_t classIndex = 0; classIndex < m_numberOfClasses; classIndex++)
+                {
+                    std::vector<void *> &blocks = cache->blocks[classIndex];
+                    m_depot[classIndex].insert(m_depot[classIndex].end(), blocks.begin(), blocks.end());
+                    blocks.clear();
+                }
+            }
+
+            for (size_t classIndex = 0; classIndex < m_numberOfClasses; classIndex++)
+            {
+                std::vector<void *> &blocks = m_depot[classIndex];
+                for (size_t i = 0; i < blocks.size(); i++)
+                {
+                    m_upstream->deallocate(blocks[i], m_classSizes[classIndex]);
+                }
+                blocks.clear();
+            }
+
+            m_bytesHeld.store(0, std::memory_order_relaxed);
+        }
+#endif // NTT_MICRO_NN_IMPLEMENTATION
+    }
+
+#ifdef NTT_MICRO_NN_IMPLEMENTATION
+} // namespace
+#endif // NTT_MICRO_NN_IMPLEMENTATION
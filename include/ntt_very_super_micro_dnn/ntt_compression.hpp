@@ -0,0 +1,242 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+// the log2 of the entries of the hash table which finds the matches of the LZ codec
+#ifndef NTT_LZ_HASH_BITS
+#define NTT_LZ_HASH_BITS 14
+#endif
+
+#ifdef NTT_MICRO_NN_IMPLEMENTATION
+namespace
+{
+#endif // NTT_MICRO_NN_IMPLEMENTATION
+    namespace ntt
+    {
+        /**
+         * Groups the bytes of the values by their position: output holds the first byte of
+         *      every value, then the second ones... The sign and exponent bytes of floats are
+         *      alike, so they end up together where the codec finds repetitions. The bytes
+         *      after the last whole value are copied as they are.
+         */
+        inline void shuffle_bytes(const uint8_t *input, uint8_t *output, size_t size, size_t width)
+        {
+            const size_t count = size / width;
+            for (size_t i = 0; i < count; i++)
+            {
+                for (size_t b = 0; b < width; b++)
+                {
+                    output[b * count + i] = input[i * width + b];
+                }
+            }
+
+            if (size > count * width)
+            {
+                std::memcpy(output + count * width, input + count * width, size - count * width);
+            }
+        }
+
+        /**
+         * The inverse of shuffle_bytes.
+         */
+        inline void unshuffle_bytes(const uint8_t *input, uint8_t *output, size_t size, size_t width)
+        {
+            const size_t count = size / width;
+            for (size_t b = 0; b < width; b++)
+            {
+                const uint8_t *plane = input + b * count;
+                for (size_t i = 0; i < count; i++)
+                {
+                    output[i * width + b] = plane[i];
+                }
+            }
+
+            if (size > count * width)
+            {
+                std::memcpy(output + count * width, input + count * width, size - count * width);
+            }
+        }
+
+        static const size_t s_lzMinMatch = 4;
+        static const size_t s_lzMaxOffset = 65535;
+
+        inline void write_lz_length(std::vector<uint8_t> &output, size_t length)
+        {
+            for (; length >= 255; length -= 255)
+            {
+                output.push_back(255);
+            }
+            output.push_back(static_cast<uint8_t>(length));
+        }
+
+        /**
+         * One sequence of the LZ stream: a token with the two lengths (4 bits each, 15 is
+         *      continued by bytes up to 255), the literals, then the offset on 2 bytes and the
+         *      match when there is one. The last sequence only has literals.
+         */
+        inline void write_lz_sequence(std::vector<uint8_t> &output, const uint8_t *literals, size_t literalCount,
+                                      size_t offset, size_t matchLength)
+        {
+            const size_t match = matchLength == 0 ? 0 : matchLength - s_lzMinMatch;
+            output.push_back(static_cast<uint8_t>(((literalCount < 15 ? literalCount : 15) << 4) | (match < 15 ? match : 15)));
+            if (literalCount >= 15)
+            {
+                write_lz_length(output, literalCount - 15);
+            }
+            output.insert(output.end(), literals, literals + literalCount);
+
+            if (matchLength == 0)
+            {
+                return;
+            }
+
+            output.push_back(static_cast<uint8_t>(offset & 0xFF));
+            output.push_back(static_cast<uint8_t>(offset >> 8));
+            if (match >= 15)
+            {
+                write_lz_length(output, match - 15);
+            }
+        }
+
+        /**
+         * A byte-oriented LZ77 codec in the spirit of LZ4: greedy matches of at least 4 bytes
+         *      within the last 64 KiB, found through a hash of the next 4 bytes. There is no
+         *      entropy coding, so the decompression is a sequence of copies.
+         */
+        inline void lz_compress(const uint8_t *input, size_t size, std::vector<uint8_t> &output)
+        {
+            output.clear();
+            output.reserve(size + size / 255 + 16);
+
+            const size_t empty = static_cast<size_t>(-1);
+            std::vector<size_t> table(static_cast<size_t>(1) << NTT_LZ_HASH_BITS, empty);
+            size_t anchor = 0;
+            size_t i = 0;
+
+            while (i + s_lzMinMatch <= size)
+            {
+                uint32_t sequence;
+                std::memcpy(&sequence, input + i, sizeof(sequence));
+                const size_t hash = static_cast<uint32_t>(sequence * 2654435761u) >> (32 - NTT_LZ_HASH_BITS);
+                const size_t candidate = table[hash];
+                table[hash] = i;
+
+                if (candidate == empty || i - candidate > s_lzMaxOffset ||
+                    std::memcmp(input + candidate, input + i, s_lzMinMatch) != 0)
+                {
+                    i++;
+                    continue;
+                }
+
+                size_t length = s_lzMinMatch;
+                while (i + length < size && input[candidate + length] == input[i + length])
+                {
+                    length++;
+                }
+
+                write_lz_sequence(output, input + anchor, i - anchor, i - candidate, length);
+                i += length;
+                anchor = i;
+            }
+
+            if (anchor < size || size == 0)
+            {
+                write_lz_sequence(output, input + anchor, size - anchor, 0, 0);
+            }
+        }
+
+        inline size_t read_lz_length(const uint8_t *input, size_t size, size_t &position, size_t length)
+        {
+            if (length < 15)
+            {
+                return length;
+            }
+
+            uint8_t byte = 255;
+            while (byte == 255)
+            {
+                if (position >= size)
+                {
+                    throw std::runtime_error("Truncated LZ stream");
+                }
+                byte = input[position++];
+                length += byte;
+            }
+
+            return length;
+        }
+
+        /**
+         * Decompresses exactly outputSize bytes, throws std::runtime_error when the stream is
+         *      corrupted instead of reading or writing out of the buffers.
+         */
+        inline void lz_decompress(const uint8_t *input, size_t size, uint8_t *output, size_t outputSize)
+        {
+            size_t position = 0;
+            size_t written = 0;
+
+            while (position < size)
+            {
+                const uint8_t token = input[position++];
+                const size_t literalCount = read_lz_length(input, size, position, token >> 4);
+                if (literalCount > size - position || literalCount > outputSize - written)
+                {
+                    throw std::runtime_error("Corrupted LZ stream: the literals overflow");
+                }
+
+                // the buffers may be null when there is nothing to copy
+                if (literalCount > 0)
+                {
+                    std::memcpy(output + written, input + position, literalCount);
+                }
+                position += literalCount;
+                written += literalCount;
+
+                if (position == size)
+                {
+                    break;
+                }
+
+                if (size - position < 2)
+                {
+                    throw std::runtime_error("Truncated LZ stream");
+                }
+                const size_t offset = input[position] | (static_cast<size_t>(input[position + 1]) << 8);
+                position += 2;
+
+                const size_t length = read_lz_length(input, size, position, token & 15) + s_lzMinMatch;
+                if (offset == 0 || offset > written || length > outputSize - written)
+                {
+                    throw std::runtime_error("Corrupted LZ stream: the match is out of the output");
+                }
+
+                // the match may overlap the bytes it writes, e.g. a run of one byte
+                uint8_t *target = output + written;
+                const uint8_t *source = target - offset;
+                if (offset >= length)
+                {
+                    std::memcpy(target, source, length);
+                }
+                else
+                {
+                    for (size_t i = 0; i < length; i++)
+                    {
+                        target[i] = source[i];
+                    }
+                }
+                written += length;
+            }
+
+            if (written != outputSize)
+            {
+                throw std::runtime_error("Corrupted LZ stream: the output is incomplete");
+            }
+        }
+    }
+
+#ifdef NTT_MICRO_NN_IMPLEMENTATION
+} // namespace
+#endif // NTT_MICRO_NN_IMPLEMENTATION
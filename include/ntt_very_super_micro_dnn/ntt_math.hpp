@@ -0,0 +1,445 @@
+#pragma once
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define NTT_MATH_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define NTT_MATH_SSE2
+#endif
+
+#ifdef NTT_MICRO_NN_IMPLEMENTATION
+namespace
+{
+#endif // NTT_MICRO_NN_IMPLEMENTATION
+    namespace ntt
+    {
+        /**
+         * The accuracy of the exponentials of the activation layers:
+         *      Exact: std::exp, element by element.
+         *      Accurate: a vectorized degree-6 polynomial, within 3 FLT_EPSILON relative error.
+         *      Fast: a vectorized degree-4 polynomial, within 1e-4 relative error.
+         * The vectorized versions flush the results below FLT_MIN to zero.
+         */
+        enum class ExpAccuracy
+        {
+            Exact,
+            Accurate,
+            Fast
+        };
+
+        // x = n * ln(2) + r with |r| <= ln(2) / 2, ln(2) is split so n * ln2High is exact
+        static const float s_expLog2e = 1.44269504088896341f;
+        static const float s_expLn2High = 0.693359375f;
+        static const float s_expLn2Low = -2.12194440e-4f;
+        static const float s_expMin = -87.3365447506f; // ln(FLT_MIN)
+        static const float s_expMax = 88.7228391117f;  // ln(FLT_MAX)
+
+        // exp(r) = 1 + r + r^2 * p(r), p given from the highest degree
+        static const float s_expAccurateCoefficients[] = {1.9875691500e-4f, 1.3981999507e-3f, 8.3334519073e-3f,
+                                                          4.1665795894e-2f, 1.6666665459e-1f, 5.0000001201e-1f};
+        static const float s_expFastCoefficients[] = {1.0f / 24.0f, 1.0f / 6.0f, 0.5f};
+
+        /**
+         * exp(x) through the polynomial, the scalar reference of the vectorized versions.
+         *      2^n is applied in two halves so the whole range of n stays representable.
+         */
+        template <size_t Count>
+        inline float exp_polynomial(float x, const float (&coefficients)[Count])
+        {
+            if (x != x)
+            {
+                return x;
+            }
+
+            if (x < s_expMin)
+            {
+                return 0.0f;
+            }
+
+            if (x > s_expMax)
+            {
+                return std::numeric_limits<float>::infinity();
+            }
+
+            const float n = std::nearbyint(x * s_expLog2e);
+            const float r = (x - n * s_expLn2High) - n * s_expLn2Low;
+
+            float p = coefficients[0];
+            for (size_t i = 1; i < Count; i++)
+            {
+                p = p * r + coefficients[i];
+            }
+
+            const float y = p * (r * r) + r + 1.0f;
+            const int32_t exponent = static_cast<int32_t>(n);
+            const int32_t half = exponent >> 1;
+            const uint32_t bits1 = static_cast<uint32_t>(half + 127) << 23;
+            const uint32_t bits2 = static_cast<uint32_t>(exponent - half + 127) << 23;
+            float power1;
+            float power2;
+            std::memcpy(&power1, &bits1, sizeof(float));
+            std::memcpy(&power2, &bits2, sizeof(float));
+
+            return y * power1 * power2;
+        }
+
+#if defined(NTT_MATH_AVX2)
+        template <size_t Count>
+        inline __m256 exp_polynomial(__m256 x, const float (&coefficients)[Count])
+        {
+            const __m256 clamped = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(s_expMin)), _mm256_set1_ps(s_expMax));
+            const __m256i exponent = _mm256_cvtps_epi32(_mm256_mul_ps(clamped, _mm256_set1_ps(s_expLog2e)));
+            const __m256 n = _mm256_cvtepi32_ps(exponent);
+            const __m256 r = _mm256_sub_ps(_mm256_sub_ps(clamped, _mm256_mul_ps(n, _mm256_set1_ps(s_expLn2High))),
+                                           _mm256_mul_ps(n, _mm256_set1_ps(s_expLn2Low)));
+
+            __m256 p = _mm256_set1_ps(coefficients[0]);
+            for (size_t i = 1; i < Count; i++)
+            {
+                p = _mm256_add_ps(_mm256_mul_ps(p, r), _mm256_set1_ps(coefficients[i]));
+            }
+
+            __m256 y = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(p, _mm256_mul_ps(r, r)), r), _mm256_set1_ps(1.0f));
+            const __m256i half = _mm256_srai_epi32(exponent, 1);
+            const __m256i bias = _mm256_set1_epi32(127);
+            y = _mm256_mul_ps(y, _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(half, bias), 23)));
+            y = _mm256_mul_ps(y, _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(_mm256_sub_epi32(exponent, half), bias), 23)));
+
+            // underflow, overflow and NaN like the scalar version
+            y = _mm256_andnot_ps(_mm256_cmp_ps(x, _mm256_set1_ps(s_expMin), _CMP_LT_OQ), y);
+            y = _mm256_blendv_ps(y, _mm256_set1_ps(std::numeric_limits<float>::infinity()),
+                                 _mm256_cmp_ps(x, _mm256_set1_ps(s_expMax), _CMP_GT_OQ));
+            return _mm256_blendv_ps(y, x, _mm256_cmp_ps(x, x, _CMP_UNORD_Q));
+        }
+#elif defined(NTT_MATH_SSE2)
+        template <size_t Count>
+        inline __m128 exp_polynomial(__m128 x, const float (&coefficients)[Count])
+        {
+            const __m128 clamped = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(s_expMin)), _mm_set1_ps(s_expMax));
+            const __m128i exponent = _mm_cvtps_epi32(_mm_mul_ps(clamped, _mm_set1_ps(s_expLog2e)));
+            const __m128 n = _mm_cvtepi32_ps(exponent);
+            const __m128 r = _mm_sub_ps(_mm_sub_ps(clamped, _mm_mul_ps(n, _mm_set1_ps(s_expLn2High))),
+                                        _mm_mul_ps(n, _mm_set1_ps(s_expLn2Low)));
+
+            __m128 p = _mm_set1_ps(coefficients[0]);
+            for (size_t i = 1; i < Count; i++)
+            {
+                p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(coefficients[i]));
+            }
+
+            __m128 y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(p, _mm_mul_ps(r, r)), r), _mm_set1_ps(1.0f));
+            const __m128i half = _mm_srai_epi32(exponent, 1);
+            const __m128i bias = _mm_set1_epi32(127);
+            y = _mm_mul_ps(y, _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(half, bias), 23)));
+            y = _mm_mul_ps(y, _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(_mm_sub_epi32(exponent, half), bias), 23)));
+
+            // underflow, overflow and NaN like the scalar version
+            y = _mm_andnot_ps(_mm_cmplt_ps(x, _mm_set1_ps(s_expMin)), y);
+            const __m128 overflow = _mm_cmpgt_ps(x, _mm_set1_ps(s_expMax));
+            y = _mm_or_ps(_mm_andnot_ps(overflow, y), _mm_and_ps(overflow, _mm_set1_ps(std::numeric_limits<float>::infinity())));
+            const __m128 nan = _mm_cmpunord_ps(x, x);
+            return _mm_or_ps(_mm_andnot_ps(nan, y), _mm_and_ps(nan, x));
+        }
+#endif
+
+        /**
+         * output[i] = exp(sign * (input[i] - shift)) for the whole array, 8 (AVX2) or 4 (SSE2)
+         *      elements at a time.
+         * @return: the sum of the outputs.
+         */
+        template <size_t Count>
+        inline float exp_polynomial_array(const float *input, float *output, size_t size, float shift, float sign,
+                                          const float (&coefficients)[Count])
+        {
+            size_t i = 0;
+            float sum = 0.0f;
+
+#if defined(NTT_MATH_AVX2)
+            const __m256 shifts = _mm256_set1_ps(shift);
+            const __m256 signs = _mm256_set1_ps(sign);
+            __m256 sums = _mm256_setzero_ps();
+            for (; i + 8 <= size; i += 8)
+            {
+                const __m256 x = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(input + i), shifts), signs);
+                const __m256 y = exp_polynomial(x, coefficients);
+                _mm256_storeu_ps(output + i, y);
+                sums = _mm256_add_ps(sums, y);
+            }
+
+            float lanes[8];
+            _mm256_storeu_ps(lanes, sums);
+            for (size_t j = 0; j < 8; j++)
+            {
+                sum += lanes[j];
+            }
+#elif defined(NTT_MATH_SSE2)
+            const __m128 shifts = _mm_set1_ps(shift);
+            const __m128 signs = _mm_set1_ps(sign);
+            __m128 sums = _mm_setzero_ps();
+            for (; i + 4 <= size; i += 4)
+            {
+                const __m128 x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(input + i), shifts), signs);
+                const __m128 y = exp_polynomial(x, coefficients);
+                _mm_storeu_ps(output + i, y);
+                sums = _mm_add_ps(sums, y);
+            }
+
+            float lanes[4];
+            _mm_storeu_ps(lanes, sums);
+            for (size_t j = 0; j < 4; j++)
+            {
+                sum += lanes[j];
+            }
+#endif
+
+            for (; i < size; i++)
+            {
+                output[i] = exp_polynomial((input[i] - shift) * sign, coefficients);
+                sum += output[i];
+            }
+
+            return sum;
+        }
+
+        /**
+         * output[i] = exp(sign * (input[i] - shift)), the output may be the input.
+         * @return: the sum of the outputs.
+         */
+        inline float exp_array(const float *input, float *output, size_t size, const ExpAccuracy &accuracy,
+                               float shift = 0.0f, float sign = 1.0f)
+        {
+            switch (accuracy)
+            {
+            case ExpAccuracy::Accurate:
+                return exp_polynomial_array(input, output, size, shift, sign, s_expAccurateCoefficients);
+            case ExpAccuracy::Fast:
+                return exp_polynomial_array(input, output, size, shift, sign, s_expFastCoefficients);
+            default:
+            {
+                float sum = 0.0f;
+                for (size_t i = 0; i < size; i++)
+                {
+                    output[i] = std::exp((input[i] - shift) * sign);
+                    sum += output[i];
+                }
+                return sum;
+            }
+            }
+        }
+
+        /**
+         * output[i] = 1 / (1 + exp(-input[i])), the output may be the input.
+         */
+        inline void sigmoid_array(const float *input, float *output, size_t size, const ExpAccuracy &accuracy)
+        {
+            exp_array(input, output, size, accuracy, 0.0f, -1.0f);
+            for (size_t i = 0; i < size; i++)
+            {
+                output[i] = 1.0f / (1.0f + output[i]);
+            }
+        }
+
+        /**
+         * The softmax of the whole array in three passes over it: the maximum, the shifted
+         *      exponentials with their sum, and the scale. Subtracting the maximum keeps the
+         *      exponentials in [0, 1] whatever the inputs are. The output may be the input.
+         */
+        inline void softmax_array(const float *input, float *output, size_t size, const ExpAccuracy &accuracy)
+        {
+            if (size == 0)
+            {
+                return;
+            }
+
+            float maximum = input[0];
+            for (size_t i = 1; i < size; i++)
+            {
+                maximum = input[i] > maximum ? input[i] : maximum;
+            }
+
+            const float scale = 1.0f / exp_array(input, output, size, accuracy, maximum);
+            for (size_t i = 0; i < size; i++)
+            {
+                output[i] *= scale;
+            }
+        }
+
+        /**
+         * log(softmax(input)) = input - max - log(sum(exp(input - max))), the exponentials
+         *      go through the output so it must not be the input.
+         */
+        inline void log_softmax_array(const float *input, float *output, size_t size, const ExpAccuracy &accuracy)
+        {
+            if (size == 0)
+            {
+                return;
+            }
+
+            float maximum = input[0];
+            for (size_t i = 1; i < size; i++)
+            {
+                maximum = input[i] > maximum ? input[i] : maximum;
+            }
+
+            const float shift = maximum + std::log(exp_array(input, output, size, accuracy, maximum));
+            for (size_t i = 0; i < size; i++)
+            {
+                output[i] = input[i] - shift;
+            }
+        }
+
+        /**
+         * The softmax (or log-softmax) of the columns of a [rows, columns] block whose rows
+         *      are stride elements apart. The rows are processed whole, so the maximum, the
+         *      sum and the scale are vectorized over the columns. The output may be the input.
+         */
+        inline void softmax_columns(const float *input, float *output, size_t rows, size_t stride, size_t columns,
+                                    const ExpAccuracy &accuracy, bool isLog)
+        {
+            std::vector<float> maximums(input, input + columns);
+            std::vector<float> sums(columns, 0.0f);
+            std::vector<float> exponentials(columns);
+
+            for (size_t i = 1; i < rows; i++)
+            {
+                const float *row = input + i * stride;
+                for (size_t j = 0; j < columns; j++)
+                {
+                    maximums[j] = row[j] > maximums[j] ? row[j] : maximums[j];
+                }
+            }
+
+            for (size_t i = 0; i < rows; i++)
+            {
+                const float *row = input + i * stride;
+                float *outputRow = output + i * stride;
+                for (size_t j = 0; j < columns; j++)
+                {
+                    outputRow[j] = row[j] - maximums[j];
+                }
+
+                exp_array(outputRow, isLog ? exponentials.data() : outputRow, columns, accuracy);
+                const float *values = isLog ? exponentials.data() : outputRow;
+                for (size_t j = 0; j < columns; j++)
+                {
+                    sums[j] += values[j];
+                }
+            }
+
+            for (size_t j = 0; j < columns; j++)
+            {
+                sums[j] = isLog ? std::log(sums[j]) : 1.0f / sums[j];
+            }
+
+            for (size_t i = 0; i < rows; i++)
+            {
+                float *outputRow = output + i * stride;
+                for (size_t j = 0; j < columns; j++)
+                {
+                    outputRow[j] = isLog ? outputRow[j] - sums[j] : outputRow[j] * sums[j];
+                }
+            }
+        }
+
+        /**
+         * output[i] = input[i] * scales[i] + shifts[i] from bytes to floats, 8 (AVX2) or 4
+         *      (SSE2) elements at a time. The scales and shifts hold one value per element so
+         *      the interleaved channels of a pixel row are converted in one pass.
+         */
+        inline void bytes_to_float_array(const uint8_t *input, float *output, size_t size,
+                                         const float *scales, const float *shifts)
+        {
+            size_t i = 0;
+
+#if defined(NTT_MATH_AVX2)
+            for (; i + 8 <= size; i += 8)
+            {
+                const __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(input + i));
+                const __m256 x = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes));
+                _mm256_storeu_ps(output + i, _mm256_add_ps(_mm256_mul_ps(x, _mm256_loadu_ps(scales + i)),
+                                                           _mm256_loadu_ps(shifts + i)));
+            }
+#elif defined(NTT_MATH_SSE2)
+            const __m128i zero = _mm_setzero_si128();
+            for (; i + 4 <= size; i += 4)
+            {
+                int32_t packed;
+                std::memcpy(&packed, input + i, sizeof(packed));
+                const __m128i words = _mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero);
+                const __m128 x = _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero));
+                _mm_storeu_ps(output + i, _mm_add_ps(_mm_mul_ps(x, _mm_loadu_ps(scales + i)),
+                                                     _mm_loadu_ps(shifts + i)));
+            }
+#endif
+
+            for (; i < size; i++)
+            {
+                output[i] = static_cast<float>(input[i]) * scales[i] + shifts[i];
+            }
+        }
+
+        /**
+         * output[i] = input[i] * scales[i] + shifts[i], the output may be the input.
+         */
+        inline void affine_array(const float *input, float *output, size_t size, const float *scales, const float *shifts)
+        {
+            size_t i = 0;
+
+#if defined(NTT_MATH_AVX2)
+            for (; i + 8 <= size; i += 8)
+            {
+                _mm256_storeu_ps(output + i, _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(input + i), _mm256_loadu_ps(scales + i)),
+                                                           _mm256_loadu_ps(shifts + i)));
+            }
+#elif defined(NTT_MATH_SSE2)
+            for (; i + 4 <= size; i += 4)
+            {
+                _mm_storeu_ps(output + i, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(input + i), _mm_loadu_ps(scales + i)),
+                                                     _mm_loadu_ps(shifts + i)));
+            }
+#endif
+
+            for (; i < size; i++)
+            {
+                output[i] = input[i] * scales[i] + shifts[i];
+            }
+        }
+
+        /**
+         * output[i] += input[i] * scale, the rows of a weighted sum.
+         */
+        inline void add_scaled_array(const float *input, float *output, size_t size, float scale)
+        {
+            size_t i = 0;
+
+#if defined(NTT_MATH_AVX2)
+            const __m256 scales = _mm256_set1_ps(scale);
+            for (; i + 8 <= size; i += 8)
+            {
+                _mm256_storeu_ps(output + i, _mm256_add_ps(_mm256_loadu_ps(output + i), _mm256_mul_ps(_mm256_loadu_ps(input + i), scales)));
+            }
+#elif defined(NTT_MATH_SSE2)
+            const __m128 scales = _mm_set1_ps(scale);
+            for (; i + 4 <= size; i += 4)
+            {
+                _mm_storeu_ps(output + i, _mm_add_ps(_mm_loadu_ps(output + i), _mm_mul_ps(_mm_loadu_ps(input + i), scales)));
+            }
+#endif
+
+            for (; i < size; i++)
+            {
+                output[i] += input[i] * scale;
+            }
+        }
+    }
+
+#ifdef NTT_MICRO_NN_IMPLEMENTATION
+} // namespace
+#endif // NTT_MICRO_NN_IMPLEMENTATION
@@ -4,8 +4,15 @@
 #include <vector>
 #include <sstream>
 #include <cmath>
+#include <cstdio>
 #include <exception>
 #include <limits>
+#include <memory>
+#include <type_traits>
+
+#include "ntt_allocator.hpp"
+#include "ntt_math.hpp"
+#include "ntt_transpose.hpp"
 
 #if defined(NTT_MICRO_NN_STATIC)
 #define NTT_MICRO_NN_API static
@@ -22,6 +29,15 @@
 
 #define NTT_ERROR_MESSAGE_SIZE 1994
 
+// the loops of the static matrices up to this number of iterations are fully unrolled
+#ifndef NTT_STATIC_UNROLL_LIMIT
+#define NTT_STATIC_UNROLL_LIMIT 32
+#endif
+
+#ifndef NTT_STATIC_MATRIX_ALIGNMENT
+#define NTT_STATIC_MATRIX_ALIGNMENT 32
+#endif
+
 #ifdef NTT_MICRO_NN_IMPLEMENTATION
 namespace
 {
@@ -47,13 +63,33 @@ namespace
 #endif
         constexpr NTT_MICRO_NN_API value_type default_value = 0;
 
+        /**
+         * The base of every lazy matrix expression (CRTP), built with lazy():
+         *
+         *          Matrix result = lazy(a) * 2 + b - c;
+         *
+         *      The operators of an expression only build a tree, the whole tree is evaluated
+         *      in one loop when it is assigned to a Matrix, so the chain allocates only the
+         *      final result. A dot product followed by an element-wise operation is folded
+         *      into the dot product loop (the epilogue). The operators between two matrices
+         *      compute their result right away.
+         */
+        template <typename Derived>
+        class MatrixExpression
+        {
+        public:
+            inline const Derived &derived() const { return static_cast<const Derived &>(*this); }
+            inline size_t get_rows() const { return derived().get_rows(); }
+            inline size_t get_columns() const { return derived().get_columns(); }
+        };
+
         /**
          * The main object of the library, it will contains the whole information
          *      and data of a matrix, and will be used to perform the operations
          *      between the matrices. This library is designed specifically for the
          *      Neural Network library (header-only) project.
          */
-        class Matrix
+        class Matrix : public MatrixExpression<Matrix>
         {
         public:
             /**
@@ -72,11 +108,18 @@ namespace
              */
             Matrix(const Matrix &other);
 
+            /**
+             * Evaluate a lazy expression into a new matrix, see MatrixExpression.
+             * @param expression: the expression to be evaluated.
+             */
+            template <typename Derived>
+            Matrix(const MatrixExpression<Derived> &expression);
+
             ~Matrix();
 
             inline size_t get_rows() const { return m_rows; }
             inline size_t get_columns() const { return m_columns; }
-            inline const value_type get_element(size_t rowIndex, size_t columnIndex) const
+            inline value_type get_element(size_t rowIndex, size_t columnIndex) const
             {
                 return m_data[rowIndex * m_columns + columnIndex];
             }
@@ -84,6 +127,10 @@ namespace
             {
                 m_data[rowIndex * m_columns + columnIndex] = value;
             }
+            inline value_type evaluate(size_t index) const { return m_data[index]; }
+            inline void bind() const {}
+            inline const value_type *get_data() const { return m_data; }
+            inline value_type *get_data() { return m_data; }
 
             /**
              * The dot product operation between two matrices, which is different from the
@@ -99,6 +146,11 @@ namespace
              */
             Matrix transpose();
 
+            /**
+             * Transpose the matrix without allocating, only for the square matrices and the vectors.
+             */
+            void transpose_in_place();
+
             void reshape(size_t rows, size_t columns);
             Matrix toShape(size_t rows, size_t columns);
 
@@ -135,13 +187,16 @@ namespace
             bool operator==(const Matrix &other) const;
             void operator=(const Matrix &other);
 
-            Matrix operator+(const Matrix &other);
-            Matrix operator+(value_type value);
-            Matrix operator-(const Matrix &other);
-            Matrix operator-(value_type value);
-            Matrix operator*(const Matrix &other);
-            Matrix operator*(value_type value);
-            Matrix operator/(value_type value);
+            Matrix operator+(const Matrix &other) const;
+            Matrix operator+(value_type value) const;
+            Matrix operator-(const Matrix &other) const;
+            Matrix operator-(value_type value) const;
+            Matrix operator*(const Matrix &other) const;
+            Matrix operator*(value_type value) const;
+            Matrix operator/(value_type value) const;
+
+            template <typename Derived>
+            void operator=(const MatrixExpression<Derived> &expression);
 
             std::string to_string() const;
 
@@ -156,12 +211,699 @@ namespace
 
             static Matrix create_identity_matrix(size_t size);
 
+        private:
+            void allocate_data();
+            void release_data();
+
         private:
             size_t m_rows;
             size_t m_columns;
             value_type *m_data;
+            Allocator *m_allocator;
+        };
+
+        struct MatrixAddOperation
+        {
+            static inline value_type apply(value_type a, value_type b) { return a + b; }
+        };
+
+        struct MatrixSubtractOperation
+        {
+            static inline value_type apply(value_type a, value_type b) { return a - b; }
+        };
+
+        struct MatrixMultiplyOperation
+        {
+            static inline value_type apply(value_type a, value_type b) { return a * b; }
+        };
+
+        struct MatrixDivideOperation
+        {
+            static inline value_type apply(value_type a, value_type b) { return a / b; }
         };
 
+        /**
+         * The matrices are referenced by the expressions and the intermediate expressions are
+         *      stored by value, so an expression must be evaluated while the matrices it reads
+         *      are alive: keep it within the statement which builds it.
+         */
+        template <typename Expression>
+        struct MatrixExpressionStorage
+        {
+            using type = const Expression;
+        };
+
+        template <>
+        struct MatrixExpressionStorage<Matrix>
+        {
+            using type = const Matrix &;
+        };
+
+        template <typename Left, typename Right, typename Operation>
+        class MatrixBinaryExpression : public MatrixExpression<MatrixBinaryExpression<Left, Right, Operation>>
+        {
+        public:
+            MatrixBinaryExpression(const Left &left, const Right &right)
+                : m_left(left), m_right(right)
+            {
+            }
+
+            inline size_t get_rows() const { return m_left.get_rows(); }
+            inline size_t get_columns() const { return m_left.get_columns(); }
+            inline value_type evaluate(size_t index) const
+            {
+                return Operation::apply(m_left.evaluate(index), m_right.evaluate(index));
+            }
+
+            inline void bind() const
+            {
+                m_left.bind();
+                m_right.bind();
+            }
+
+            inline const Left &get_left() const { return m_left; }
+            inline const Right &get_right() const { return m_right; }
+
+        private:
+            typename MatrixExpressionStorage<Left>::type m_left;
+            typename MatrixExpressionStorage<Right>::type m_right;
+        };
+
+        template <typename Expression, typename Operation>
+        class MatrixScalarExpression : public MatrixExpression<MatrixScalarExpression<Expression, Operation>>
+        {
+        public:
+            MatrixScalarExpression(const Expression &expression, value_type value)
+                : m_expression(expression), m_value(value)
+            {
+            }
+
+            inline size_t get_rows() const { return m_expression.get_rows(); }
+            inline size_t get_columns() const { return m_expression.get_columns(); }
+            inline value_type evaluate(size_t index) const
+            {
+                return Operation::apply(m_expression.evaluate(index), m_value);
+            }
+
+            inline void bind() const { m_expression.bind(); }
+
+        private:
+            typename MatrixExpressionStorage<Expression>::type m_expression;
+            value_type m_value;
+        };
+
+        inline const Matrix &materialize(const Matrix &matrix)
+        {
+            return matrix;
+        }
+
+        template <typename Expression>
+        inline Matrix materialize(const MatrixExpression<Expression> &expression)
+        {
+            return Matrix(expression);
+        }
+
+        struct MatrixNoEpilogue
+        {
+            inline void operator()(size_t, value_type *) const {}
+        };
+
+        /**
+         * The dot product loop, the rows of the result are accumulated over the contiguous
+         *      rows of the right matrix, the epilogue is applied on every row as soon as it is
+         *      finished (while it is still in the cache).
+         */
+        template <typename Left, typename Right, typename Epilogue>
+        void multiply_matrices(const Left &left, const Right &right, Matrix &result, const Epilogue &epilogue)
+        {
+            const size_t rows = left.get_rows();
+            const size_t columns = right.get_columns();
+            const size_t depth = left.get_columns();
+            const value_type *leftData = left.get_data();
+            const value_type *rightData = right.get_data();
+            value_type *resultData = result.get_data();
+
+            for (size_t i = 0; i < rows; i++)
+            {
+                value_type *row = resultData + i * columns;
+                for (size_t j = 0; j < columns; j++)
+                {
+                    row[j] = 0;
+                }
+
+                for (size_t k = 0; k < depth; k++)
+                {
+                    const value_type value = leftData[i * depth + k];
+                    const value_type *rightRow = rightData + k * columns;
+                    for (size_t j = 0; j < columns; j++)
+                    {
+                        row[j] += value * rightRow[j];
+                    }
+                }
+
+                epilogue(i, row);
+            }
+        }
+
+        template <typename Left, typename Right>
+        class MatrixProductExpression : public MatrixExpression<MatrixProductExpression<Left, Right>>
+        {
+        public:
+            MatrixProductExpression(const Left &left, const Right &right)
+                : m_left(left), m_right(right)
+            {
+            }
+
+            inline size_t get_rows() const { return m_left.get_rows(); }
+            inline size_t get_columns() const { return m_right.get_columns(); }
+
+            /**
+             * Only used when the product is nested inside another expression, the product is then
+             *      computed once by bind, before the evaluation loop.
+             */
+            inline value_type evaluate(size_t index) const { return m_result->evaluate(index); }
+
+            inline void bind() const
+            {
+                if (!m_result)
+                {
+                    m_result = std::make_shared<Matrix>(get_rows(), get_columns());
+                    evaluate_into(*m_result, MatrixNoEpilogue());
+                }
+            }
+
+            template <typename Epilogue>
+            void evaluate_into(Matrix &result, const Epilogue &epilogue) const
+            {
+                const auto &left = materialize(m_left);
+                const auto &right = materialize(m_right);
+                multiply_matrices(left, right, result, epilogue);
+            }
+
+        private:
+            typename MatrixExpressionStorage<Left>::type m_left;
+            typename MatrixExpressionStorage<Right>::type m_right;
+            mutable std::shared_ptr<Matrix> m_result;
+        };
+
+        template <typename Expression, typename Operation>
+        struct MatrixEpilogue
+        {
+            const Expression &expression;
+            size_t columns;
+
+            inline void operator()(size_t rowIndex, value_type *row) const
+            {
+                const size_t offset = rowIndex * columns;
+                for (size_t j = 0; j < columns; j++)
+                {
+                    row[j] = Operation::apply(row[j], expression.evaluate(offset + j));
+                }
+            }
+        };
+
+        template <typename Expression>
+        void assign_expression(Matrix &result, const Expression &expression)
+        {
+            expression.bind();
+
+            value_type *data = result.get_data();
+            const size_t size = result.get_rows() * result.get_columns();
+            for (size_t i = 0; i < size; i++)
+            {
+                data[i] = expression.evaluate(i);
+            }
+        }
+
+        template <typename Left, typename Right>
+        void assign_expression(Matrix &result, const MatrixProductExpression<Left, Right> &expression)
+        {
+            expression.evaluate_into(result, MatrixNoEpilogue());
+        }
+
+        template <typename Left, typename Right, typename Other, typename Operation>
+        void assign_expression(Matrix &result,
+                               const MatrixBinaryExpression<MatrixProductExpression<Left, Right>, Other, Operation> &expression)
+        {
+            expression.get_right().bind();
+
+            MatrixEpilogue<Other, Operation> epilogue = {expression.get_right(), result.get_columns()};
+            expression.get_left().evaluate_into(result, epilogue);
+        }
+
+        template <typename Derived>
+        Matrix::Matrix(const MatrixExpression<Derived> &expression)
+            : m_rows(expression.get_rows()), m_columns(expression.get_columns()),
+              m_data(nullptr), m_allocator(nullptr)
+        {
+            allocate_data();
+            assign_expression(*this, expression.derived());
+        }
+
+        template <typename Derived>
+        void Matrix::operator=(const MatrixExpression<Derived> &expression)
+        {
+            // the expression may read this matrix, evaluate it aside and take its buffer
+            Matrix result(expression);
+
+            value_type *data = m_data;
+            Allocator *allocator = m_allocator;
+            size_t rows = m_rows;
+            size_t columns = m_columns;
+
+            m_data = result.m_data;
+            m_allocator = result.m_allocator;
+            m_rows = result.m_rows;
+            m_columns = result.m_columns;
+
+            result.m_data = data;
+            result.m_allocator = allocator;
+            result.m_rows = rows;
+            result.m_columns = columns;
+        }
+
+        template <typename Left, typename Right>
+        void check_same_size(const MatrixExpression<Left> &left, const MatrixExpression<Right> &right,
+                             const char *operation)
+        {
+            if (left.get_rows() != right.get_rows() || left.get_columns() != right.get_columns())
+            {
+                char message[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(
+                    message, sizeof(message),
+                    "The matrix with the size (%zu, %zu) cannot be %s the matrix with the size (%zu, %zu)",
+                    left.get_rows(), left.get_columns(), operation, right.get_rows(), right.get_columns());
+                throw std::invalid_argument(message);
+            }
+        }
+
+        template <typename Left, typename Right>
+        MatrixBinaryExpression<Left, Right, MatrixAddOperation>
+        operator+(const MatrixExpression<Left> &left, const MatrixExpression<Right> &right)
+        {
+            check_same_size(left, right, "added to");
+            return MatrixBinaryExpression<Left, Right, MatrixAddOperation>(left.derived(), right.derived());
+        }
+
+        template <typename Left, typename Right>
+        MatrixBinaryExpression<Left, Right, MatrixSubtractOperation>
+        operator-(const MatrixExpression<Left> &left, const MatrixExpression<Right> &right)
+        {
+            check_same_size(left, right, "subtracted from");
+            return MatrixBinaryExpression<Left, Right, MatrixSubtractOperation>(left.derived(), right.derived());
+        }
+
+        template <typename Left, typename Right>
+        MatrixProductExpression<Left, Right>
+        operator*(const MatrixExpression<Left> &left, const MatrixExpression<Right> &right)
+        {
+            if (left.get_columns() != right.get_rows())
+            {
+                char message[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(
+                    message, sizeof(message),
+                    "The first matrix has size (%zu, %zu) which is not matching "
+                    "with the second matrix with size (%zu, %zu)",
+                    left.get_rows(), left.get_columns(), right.get_rows(), right.get_columns());
+                throw std::invalid_argument(message);
+            }
+
+            return MatrixProductExpression<Left, Right>(left.derived(), right.derived());
+        }
+
+        template <typename Expression>
+        MatrixScalarExpression<Expression, MatrixAddOperation>
+        operator+(const MatrixExpression<Expression> &expression, value_type value)
+        {
+            return MatrixScalarExpression<Expression, MatrixAddOperation>(expression.derived(), value);
+        }
+
+        template <typename Expression>
+        MatrixScalarExpression<Expression, MatrixSubtractOperation>
+        operator-(const MatrixExpression<Expression> &expression, value_type value)
+        {
+            return MatrixScalarExpression<Expression, MatrixSubtractOperation>(expression.derived(), value);
+        }
+
+        template <typename Expression>
+        MatrixScalarExpression<Expression, MatrixMultiplyOperation>
+        operator*(const MatrixExpression<Expression> &expression, value_type value)
+        {
+            return MatrixScalarExpression<Expression, MatrixMultiplyOperation>(expression.derived(), value);
+        }
+
+        template <typename Expression>
+        MatrixScalarExpression<Expression, MatrixDivideOperation>
+        operator/(const MatrixExpression<Expression> &expression, value_type value)
+        {
+            return MatrixScalarExpression<Expression, MatrixDivideOperation>(expression.derived(), value);
+        }
+
+        /**
+         * The matrix as an expression, so the operators which follow build a tree instead of
+         *      computing every step, see MatrixExpression.
+         */
+        inline const MatrixExpression<Matrix> &lazy(const Matrix &matrix)
+        {
+            return matrix;
+        }
+
+        // the expressions reference the matrices, a temporary would be destroyed before the evaluation
+        void lazy(const Matrix &&) = delete;
+
+        template <typename T>
+        struct MatrixAddOperationOf
+        {
+            inline T operator()(T a, T b) const { return a + b; }
+        };
+
+        template <typename T>
+        struct MatrixSubtractOperationOf
+        {
+            inline T operator()(T a, T b) const { return a - b; }
+        };
+
+        template <typename T>
+        struct MatrixMultiplyOperationOf
+        {
+            inline T operator()(T a, T b) const { return a * b; }
+        };
+
+        template <typename T>
+        struct MatrixDivideOperationOf
+        {
+            inline T operator()(T a, T b) const { return a / b; }
+        };
+
+        /**
+         * Calls function(index) for every index in [Index, Count) without a loop.
+         */
+        template <size_t Index, size_t Count>
+        struct StaticUnroll
+        {
+            template <typename Function>
+            static inline void run(const Function &function)
+            {
+                function(Index);
+                StaticUnroll<Index + 1, Count>::run(function);
+            }
+        };
+
+        template <size_t Count>
+        struct StaticUnroll<Count, Count>
+        {
+            template <typename Function>
+            static inline void run(const Function &) {}
+        };
+
+        template <size_t Count, bool Unrolled = (Count <= NTT_STATIC_UNROLL_LIMIT)>
+        struct StaticLoop
+        {
+            template <typename Function>
+            static inline void run(const Function &function)
+            {
+                StaticUnroll<0, Count>::run(function);
+            }
+        };
+
+        template <size_t Count>
+        struct StaticLoop<Count, false>
+        {
+            template <typename Function>
+            static inline void run(const Function &function)
+            {
+                for (size_t i = 0; i < Count; i++)
+                {
+                    function(i);
+                }
+            }
+        };
+
+        template <typename T>
+        inline bool isStaticElementEqual(T a, T b, std::true_type)
+        {
+            return std::fabs(a - b) < std::numeric_limits<T>::epsilon();
+        }
+
+        template <typename T>
+        inline bool isStaticElementEqual(T a, T b, std::false_type)
+        {
+            return a == b;
+        }
+
+        /**
+         * A matrix with a shape known at compile time, for the models whose shapes are all
+         *      static. The elements are stored inline (on the stack for a local variable, keep
+         *      the big ones static or in a std::unique_ptr), the mismatching shapes are
+         *      rejected by the compiler and the small loops are fully unrolled so the
+         *      compiler can vectorize them.
+         *
+         *      It is a MatrixExpression as well, so it can be mixed with the dynamic Matrix:
+         *
+         *          StaticMatrix<float, 128, 784> weights = ...;
+         *          Matrix output = weights * input + biases;
+         */
+        template <typename T, size_t Rows, size_t Columns>
+        class StaticMatrix : public MatrixExpression<StaticMatrix<T, Rows, Columns>>
+        {
+        public:
+            static constexpr size_t rows = Rows;
+            static constexpr size_t columns = Columns;
+            static constexpr size_t size = Rows * Columns;
+
+            StaticMatrix(T defaultValue = 0)
+            {
+                fill(defaultValue);
+            }
+
+            /**
+             * Copy a dynamic matrix, throws std::invalid_argument if its size is not matching.
+             * @param matrix: the matrix to be copied.
+             */
+            explicit StaticMatrix(const Matrix &matrix)
+            {
+                if (matrix.get_rows() != Rows || matrix.get_columns() != Columns)
+                {
+                    char message[NTT_ERROR_MESSAGE_SIZE];
+                    snprintf(
+                        message, sizeof(message),
+                        "The matrix with the size (%zu, %zu) cannot be converted to the static matrix with the size (%zu, %zu)",
+                        matrix.get_rows(), matrix.get_columns(), Rows, Columns);
+                    throw std::invalid_argument(message);
+                }
+
+                const value_type *data = matrix.get_data();
+                for (size_t i = 0; i < size; i++)
+                {
+                    m_data[i] = static_cast<T>(data[i]);
+                }
+            }
+
+            static constexpr size_t get_rows() { return Rows; }
+            static constexpr size_t get_columns() { return Columns; }
+
+            inline T get_element(size_t rowIndex, size_t columnIndex) const
+            {
+                return m_data[rowIndex * Columns + columnIndex];
+            }
+            inline void set_element(size_t rowIndex, size_t columnIndex, T value)
+            {
+                m_data[rowIndex * Columns + columnIndex] = value;
+            }
+            inline value_type evaluate(size_t index) const { return static_cast<value_type>(m_data[index]); }
+            inline void bind() const {}
+            inline const T *get_data() const { return m_data; }
+            inline T *get_data() { return m_data; }
+
+            void fill(T value)
+            {
+                StaticLoop<size>::run([&](size_t i)
+                                      { m_data[i] = value; });
+            }
+
+            Matrix to_matrix() const
+            {
+                Matrix matrix(Rows, Columns);
+                value_type *data = matrix.get_data();
+                for (size_t i = 0; i < size; i++)
+                {
+                    data[i] = static_cast<value_type>(m_data[i]);
+                }
+
+                return matrix;
+            }
+
+            template <size_t OtherRows, size_t OtherColumns>
+            StaticMatrix<T, Rows, OtherColumns> dot(const StaticMatrix<T, OtherRows, OtherColumns> &other) const
+            {
+                static_assert(Columns == OtherRows, "The number of columns of the first matrix must match the number of rows of the second one");
+
+                StaticMatrix<T, Rows, OtherColumns> result;
+                T *resultData = result.get_data();
+                const T *otherData = other.get_data();
+
+                for (size_t i = 0; i < Rows; i++)
+                {
+                    T *row = resultData + i * OtherColumns;
+                    for (size_t k = 0; k < Columns; k++)
+                    {
+                        const T value = m_data[i * Columns + k];
+                        const T *otherRow = otherData + k * OtherColumns;
+                        StaticLoop<OtherColumns>::run([&](size_t j)
+                                                      { row[j] += value * otherRow[j]; });
+                    }
+                }
+
+                return result;
+            }
+
+            template <size_t OtherRows, size_t OtherColumns>
+            StaticMatrix add(const StaticMatrix<T, OtherRows, OtherColumns> &other) const
+            {
+                static_assert(Rows == OtherRows && Columns == OtherColumns, "The matrices must have the same size to be added");
+                return elementwise(other, MatrixAddOperationOf<T>());
+            }
+
+            template <size_t OtherRows, size_t OtherColumns>
+            StaticMatrix subtract(const StaticMatrix<T, OtherRows, OtherColumns> &other) const
+            {
+                static_assert(Rows == OtherRows && Columns == OtherColumns, "The matrices must have the same size to be subtracted");
+                return elementwise(other, MatrixSubtractOperationOf<T>());
+            }
+
+            StaticMatrix<T, Columns, Rows> transpose() const
+            {
+                StaticMatrix<T, Columns, Rows> result;
+                T *resultData = result.get_data();
+
+                if (size > NTT_STATIC_UNROLL_LIMIT * NTT_STATIC_UNROLL_LIMIT)
+                {
+                    transpose_matrix(m_data, Columns, resultData, Rows, Rows, Columns);
+                    return result;
+                }
+
+                for (size_t i = 0; i < Rows; i++)
+                {
+                    const T *row = m_data + i * Columns;
+                    StaticLoop<Columns>::run([&](size_t j)
+                                             { resultData[j * Rows + i] = row[j]; });
+                }
+
+                return result;
+            }
+
+            bool operator==(const StaticMatrix &other) const
+            {
+                for (size_t i = 0; i < size; i++)
+                {
+                    if (!isStaticElementEqual(m_data[i], other.m_data[i], std::is_floating_point<T>()))
+                        return false;
+                }
+
+                return true;
+            }
+
+            template <size_t OtherRows, size_t OtherColumns>
+            StaticMatrix<T, Rows, OtherColumns> operator*(const StaticMatrix<T, OtherRows, OtherColumns> &other) const
+            {
+                return dot(other);
+            }
+
+            template <size_t OtherRows, size_t OtherColumns>
+            StaticMatrix operator+(const StaticMatrix<T, OtherRows, OtherColumns> &other) const
+            {
+                return add(other);
+            }
+
+            template <size_t OtherRows, size_t OtherColumns>
+            StaticMatrix operator-(const StaticMatrix<T, OtherRows, OtherColumns> &other) const
+            {
+                return subtract(other);
+            }
+
+            StaticMatrix operator+(T value) const { return scalar(value, MatrixAddOperationOf<T>()); }
+            StaticMatrix operator-(T value) const { return scalar(value, MatrixSubtractOperationOf<T>()); }
+            StaticMatrix operator*(T value) const { return scalar(value, MatrixMultiplyOperationOf<T>()); }
+            StaticMatrix operator/(T value) const { return scalar(value, MatrixDivideOperationOf<T>()); }
+
+            static StaticMatrix create_from_vector_vector(const std::vector<std::vector<T>> &vector)
+            {
+                if (vector.size() != Rows || (Rows > 0 && vector[0].size() != Columns))
+                {
+                    char message[NTT_ERROR_MESSAGE_SIZE];
+                    snprintf(
+                        message, sizeof(message),
+                        "The vector with the size (%zu, %zu) cannot be converted to the static matrix with the size (%zu, %zu)",
+                        vector.size(), vector.empty() ? (size_t)0 : vector[0].size(), Rows, Columns);
+                    throw std::invalid_argument(message);
+                }
+
+                for (size_t i = 1; i < Rows; i++)
+                {
+                    if (vector[i].size() != Columns)
+                    {
+                        char message[NTT_ERROR_MESSAGE_SIZE];
+                        snprintf(
+                            message, sizeof(message),
+                            "The row %zu of the vector has %zu elements instead of %zu",
+                            i, vector[i].size(), Columns);
+                        throw std::invalid_argument(message);
+                    }
+                }
+
+                StaticMatrix matrix;
+                for (size_t i = 0; i < Rows; i++)
+                {
+                    for (size_t j = 0; j < Columns; j++)
+                    {
+                        matrix.set_element(i, j, vector[i][j]);
+                    }
+                }
+
+                return matrix;
+            }
+
+        private:
+            template <typename Operation>
+            StaticMatrix elementwise(const StaticMatrix &other, Operation operation) const
+            {
+                StaticMatrix result;
+                StaticLoop<size>::run([&](size_t i)
+                                      { result.m_data[i] = operation(m_data[i], other.m_data[i]); });
+                return result;
+            }
+
+            template <typename Operation>
+            StaticMatrix scalar(T value, Operation operation) const
+            {
+                StaticMatrix result;
+                StaticLoop<size>::run([&](size_t i)
+                                      { result.m_data[i] = operation(m_data[i], value); });
+                return result;
+            }
+
+        private:
+            alignas(NTT_STATIC_MATRIX_ALIGNMENT) T m_data[size > 0 ? size : 1];
+        };
+
+        template <typename T, size_t Rows, size_t Columns>
+        struct MatrixExpressionStorage<StaticMatrix<T, Rows, Columns>>
+        {
+            using type = const StaticMatrix<T, Rows, Columns> &;
+        };
+
+        template <size_t Rows, size_t Columns>
+        inline const StaticMatrix<value_type, Rows, Columns> &materialize(const StaticMatrix<value_type, Rows, Columns> &matrix)
+        {
+            return matrix;
+        }
+
+        template <typename T, size_t Rows, size_t Columns>
+        inline Matrix materialize(const StaticMatrix<T, Rows, Columns> &matrix)
+        {
+            return matrix.to_matrix();
+        }
+
         /**
          * Base class for all layers of the neural network.
          */
@@ -195,7 +937,11 @@ namespace
         class Softmax : public Layer
         {
         public:
+            Softmax(const ExpAccuracy &accuracy = ExpAccuracy::Accurate);
             virtual Matrix forward(const Matrix &input) override;
+
+        private:
+            ExpAccuracy m_accuracy;
         };
 
         class ClipLayer : public Layer
@@ -212,7 +958,11 @@ namespace
         class Sigmoid : public Layer
         {
         public:
+            Sigmoid(const ExpAccuracy &accuracy = ExpAccuracy::Accurate);
             virtual Matrix forward(const Matrix &input) override;
+
+        private:
+            ExpAccuracy m_accuracy;
         };
 
 /**
@@ -228,9 +978,9 @@ namespace
         }
 
         Matrix::Matrix(size_t rows, size_t columns, value_type defaultValue)
-            : m_rows(rows), m_columns(columns), m_data(nullptr)
+            : m_rows(rows), m_columns(columns), m_data(nullptr), m_allocator(nullptr)
         {
-            m_data = (value_type *)malloc(rows * columns * sizeof(value_type));
+            allocate_data();
 
             for (size_t i = 0; i < rows; i++)
             {
@@ -243,20 +993,31 @@ namespace
 
         Matrix::~Matrix()
         {
-            if (m_data != nullptr)
-            {
-                free(m_data);
-                m_data = nullptr;
-            }
+            release_data();
         }
 
         Matrix::Matrix(const Matrix &other)
-            : m_rows(other.m_rows), m_columns(other.m_columns)
+            : m_rows(other.m_rows), m_columns(other.m_columns), m_data(nullptr), m_allocator(nullptr)
         {
-            m_data = (value_type *)malloc(m_rows * m_columns * sizeof(value_type));
+            allocate_data();
             memcpy(m_data, other.m_data, m_rows * m_columns * sizeof(value_type));
         }
 
+        void Matrix::allocate_data()
+        {
+            m_allocator = get_default_allocator();
+            m_data = (value_type *)m_allocator->allocate(m_rows * m_columns * sizeof(value_type));
+        }
+
+        void Matrix::release_data()
+        {
+            if (m_data != nullptr)
+            {
+                m_allocator->deallocate(m_data, m_rows * m_columns * sizeof(value_type));
+                m_data = nullptr;
+            }
+        }
+
         Matrix Matrix::dot(const Matrix &other)
         {
             if (m_columns != other.m_rows)
@@ -289,16 +1050,33 @@ namespace
         Matrix Matrix::transpose()
         {
             Matrix result(m_columns, m_rows);
+            transpose_matrix(m_data, m_columns, result.m_data, m_rows, m_rows, m_columns);
 
-            for (size_t i = 0; i < m_rows; i++)
+            return result;
+        }
+
+        void Matrix::transpose_in_place()
+        {
+            if (m_rows == m_columns)
             {
-                for (size_t j = 0; j < m_columns; j++)
-                {
-                    result.set_element(j, i, get_element(i, j));
-                }
+                transpose_square_in_place(m_data, m_rows, m_columns);
+                return;
             }
 
-            return result;
+            if (m_rows != 1 && m_columns != 1)
+            {
+                char message[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(
+                    message, sizeof(message),
+                    "The matrix with the size (%zu, %zu) cannot be transposed in place",
+                    m_rows, m_columns);
+                throw std::invalid_argument(message);
+            }
+
+            // a vector keeps the same elements in the same order
+            size_t rows = m_rows;
+            m_rows = m_columns;
+            m_columns = rows;
         }
 
         void Matrix::reshape(size_t rows, size_t columns)
@@ -533,57 +1311,39 @@ namespace
             return maxIndex;
         }
 
-        Matrix Matrix::operator-(const Matrix &other)
+        Matrix Matrix::operator+(const Matrix &other) const
         {
-            return subtract(other);
+            return lazy(*this) + other;
         }
 
-        Matrix Matrix::operator-(value_type value)
+        Matrix Matrix::operator+(value_type value) const
         {
-            return subtract(Matrix(m_rows, m_columns, value));
+            return lazy(*this) + value;
         }
 
-        Matrix Matrix::operator+(const Matrix &other)
+        Matrix Matrix::operator-(const Matrix &other) const
         {
-            return add(other);
+            return lazy(*this) - other;
         }
 
-        Matrix Matrix::operator+(value_type value)
+        Matrix Matrix::operator-(value_type value) const
         {
-            return add(Matrix(m_rows, m_columns, value));
+            return lazy(*this) - value;
         }
 
-        Matrix Matrix::operator*(const Matrix &other)
+        Matrix Matrix::operator*(const Matrix &other) const
         {
-            return dot(other);
+            return lazy(*this) * other;
         }
 
-        Matrix Matrix::operator*(value_type value)
+        Matrix Matrix::operator*(value_type value) const
         {
-            Matrix result(m_rows, m_columns);
-            for (size_t i = 0; i < m_rows; i++)
-            {
-                for (size_t j = 0; j < m_columns; j++)
-                {
-                    result.set_element(i, j, get_element(i, j) * value);
-                }
-            }
-
-            return result;
+            return lazy(*this) * value;
         }
 
-        Matrix Matrix::operator/(value_type value)
+        Matrix Matrix::operator/(value_type value) const
         {
-            Matrix result(m_rows, m_columns);
-            for (size_t i = 0; i < m_rows; i++)
-            {
-                for (size_t j = 0; j < m_columns; j++)
-                {
-                    result.set_element(i, j, get_element(i, j) / value);
-                }
-            }
-
-            return result;
+            return lazy(*this) / value;
         }
 
         bool Matrix::operator==(const Matrix &other) const
@@ -610,15 +1370,16 @@ namespace
 
         void Matrix::operator=(const Matrix &other)
         {
-            if (m_data != nullptr)
+            if (this == &other)
             {
-                free(m_data);
-                m_data = nullptr;
+                return;
             }
 
+            release_data();
+
             m_rows = other.m_rows;
             m_columns = other.m_columns;
-            m_data = (value_type *)malloc(m_rows * m_columns * sizeof(value_type));
+            allocate_data();
             memcpy(m_data, other.m_data, m_rows * m_columns * sizeof(value_type));
         }
 
@@ -696,7 +1457,7 @@ namespace
 
         Matrix FullyConnectedLayer::forward(const Matrix &input)
         {
-            return m_weights * input + m_biases;
+            return lazy(m_weights) * input + m_biases;
         }
 
         Matrix ReLU::forward(const Matrix &input)
@@ -713,19 +1474,43 @@ namespace
             return result;
         }
 
-        Matrix Sigmoid::forward(const Matrix &input)
+        /**
+         * Runs a float kernel over all the elements of the matrix, through a float copy when
+         *      the matrix holds integers.
+         */
+        template <typename Kernel>
+        static Matrix apply_float_kernel(const Matrix &input, Kernel kernel)
         {
             Matrix result(input.get_rows(), input.get_columns());
-            for (size_t i = 0; i < input.get_rows(); i++)
+            const size_t size = input.get_rows() * input.get_columns();
+
+#if defined(NTT_MICRO_NN_I8) || defined(NTT_MICRO_NN_I16) || defined(NTT_MICRO_NN_I32) || defined(NTT_MICRO_NN_I64)
+            std::vector<float> values(input.get_data(), input.get_data() + size);
+            kernel(values.data(), values.data(), size);
+
+            value_type *resultData = result.get_data();
+            for (size_t i = 0; i < size; i++)
             {
-                for (size_t j = 0; j < input.get_columns(); j++)
-                {
-                    result.set_element(i, j, 1.0f / (1.0f + std::exp(-input.get_element(i, j))));
-                }
+                resultData[i] = static_cast<value_type>(values[i]);
             }
+#else
+            kernel(input.get_data(), result.get_data(), size);
+#endif
             return result;
         }
 
+        Sigmoid::Sigmoid(const ExpAccuracy &accuracy)
+            : m_accuracy(accuracy)
+        {
+        }
+
+        Matrix Sigmoid::forward(const Matrix &input)
+        {
+            const ExpAccuracy accuracy = m_accuracy;
+            return apply_float_kernel(input, [accuracy](const float *values, float *result, size_t size)
+                                      { sigmoid_array(values, result, size, accuracy); });
+        }
+
         ClipLayer::ClipLayer(value_type min, value_type max)
             : m_min(min), m_max(max)
         {
@@ -745,27 +1530,16 @@ namespace
             return result;
         }
 
-        Matrix Softmax::forward(const Matrix &input)
+        Softmax::Softmax(const ExpAccuracy &accuracy)
+            : m_accuracy(accuracy)
         {
-            Matrix result(input.get_rows(), input.get_columns());
-            value_type sum = 0.0f;
-            for (size_t i = 0; i < input.get_rows(); i++)
-            {
-                for (size_t j = 0; j < input.get_columns(); j++)
-                {
-                    sum += std::exp(input.get_element(i, j));
-                }
-            }
-
-            for (size_t i = 0; i < input.get_rows(); i++)
-            {
-                for (size_t j = 0; j < input.get_columns(); j++)
-                {
-                    result.set_element(i, j, std::exp(input.get_element(i, j)) / sum);
-                }
-            }
+        }
 
-            return result;
+        Matrix Softmax::forward(const Matrix &input)
+        {
+            const ExpAccuracy accuracy = m_accuracy;
+            return apply_float_kernel(input, [accuracy](const float *values, float *result, size_t size)
+                                      { softmax_array(values, result, size, accuracy); });
         }
     }
 
@@ -1,10 +1,26 @@
 #pragma once
+#include <atomic>
 #include <cstdint>
 #include <stdexcept>
 #include <vector>
 #include <cmath>
 #include <exception>
 #include <limits>
+#include <memory>
+#include <new>
+#include <utility>
+
+#include "ntt_allocator.hpp"
+#include "ntt_compression.hpp"
+#include "ntt_math.hpp"
+#include "ntt_thread_pool.hpp"
+#include "ntt_transpose.hpp"
+
+// the awaitables of AsyncLayer need the C++20 coroutines
+#if defined(__cpp_impl_coroutine) && !defined(NTT_NO_COROUTINES)
+#include <coroutine>
+#define NTT_COROUTINES 1
+#endif
 
 #if defined(NTT_MICRO_NN_STATIC)
 #define NTT_MICRO_NN_API static
@@ -19,12 +35,56 @@
 #include <string>
 #include <cstdlib>
 #include <fstream>
+#include <chrono>
 #endif // NTT_MICRO_NN_IMPLEMENTATION
 
 #define NTT_ERROR_MESSAGE_SIZE 1994
 #define NTT_DEFAULT_MAX_SIZE 19941994
 #define NTT_DEFAULT_VALUE 0.0f
 
+// the Winograd convolutions are only used automatically from these numbers of channels
+#ifndef NTT_WINOGRAD_MIN_CHANNELS
+#define NTT_WINOGRAD_MIN_CHANNELS 16
+#endif
+#ifndef NTT_WINOGRAD_4X4_MIN_CHANNELS
+#define NTT_WINOGRAD_4X4_MIN_CHANNELS 64
+#endif
+// the number of tiles which are transformed together, small enough to stay in the cache
+#ifndef NTT_WINOGRAD_TILE_BLOCK
+#define NTT_WINOGRAD_TILE_BLOCK 64
+#endif
+// the tile of the GEMM micro-kernel of the fully connected layer: the weight rows of a
+// packed panel and the batch columns which are accumulated in registers
+#ifndef NTT_GEMM_PANEL_ROWS
+#define NTT_GEMM_PANEL_ROWS 8
+#endif
+#ifndef NTT_GEMM_PANEL_COLUMNS
+#define NTT_GEMM_PANEL_COLUMNS 4
+#endif
+// the columns of a strided softmax which are normalized together by one thread
+#ifndef NTT_SOFTMAX_COLUMN_BLOCK
+#define NTT_SOFTMAX_COLUMN_BLOCK 256
+#endif
+// the layers switch to the sparse kernels when at most this fraction of the weights is stored
+#ifndef NTT_SPARSE_MAX_DENSITY
+#define NTT_SPARSE_MAX_DENSITY 0.3f
+#endif
+// the bytes of the chunks of WeightBundle which are compressed independently (a multiple of 4)
+#ifndef NTT_BUNDLE_CHUNK_SIZE
+#define NTT_BUNDLE_CHUNK_SIZE (1 << 18)
+#endif
+// the frames which wait between two stages of a pipeline
+#ifndef NTT_PIPELINE_QUEUE_CAPACITY
+#define NTT_PIPELINE_QUEUE_CAPACITY 2
+#endif
+// 1 to pin the stage k of the pipelines on the core k (Linux only)
+#ifndef NTT_PIPELINE_AFFINITY
+#define NTT_PIPELINE_AFFINITY 0
+#endif
+#if NTT_PIPELINE_AFFINITY && defined(__linux__) && defined(NTT_MICRO_NN_IMPLEMENTATION)
+#include <pthread.h>
+#endif
+
 #ifdef NTT_MICRO_NN_IMPLEMENTATION
 namespace
 {
@@ -53,6 +113,131 @@ namespace
 
         class Layer;
 
+        /**
+         * How the four dimensions of an activation are ordered in the memory. CNHW
+         *      ([channel, batch, height, width]) is the layout used by default, the other ones
+         *      keep the channels of a pixel together so the layer kernels can process several
+         *      channels at once with SIMD:
+         *
+         *          NHWC:    [batch, height, width, channel]
+         *          NCHW8c:  [batch, channel / 8, height, width, 8]
+         *          NCHW16c: [batch, channel / 16, height, width, 16]
+         *
+         *      The blocked layouts pad the channels with zeros up to a full block.
+         */
+        enum class TensorLayout
+        {
+            CNHW,
+            NHWC,
+            NCHW8c,
+            NCHW16c
+        };
+
+        /**
+         * How Tensor::from_image maps the bytes of an image to the values of the activation:
+         *      value = (byte * scale - mean[c]) / deviation[c] for the channel c of the tensor,
+         *      mean and deviation hold one value per channel, one for all the channels or none.
+         *      isReversed swaps the order of the channels (BGR <-> RGB).
+         */
+        class ImageNormalization
+        {
+        public:
+            ImageNormalization(const float &scale = 1.0f / 255.0f,
+                               const std::vector<float> &mean = std::vector<float>(),
+                               const std::vector<float> &deviation = std::vector<float>(),
+                               const bool &isReversed = false)
+                : scale(scale), mean(mean), deviation(deviation), isReversed(isReversed)
+            {
+            }
+
+            float scale;
+            std::vector<float> mean;
+            std::vector<float> deviation;
+            bool isReversed;
+        };
+
+        /**
+         * How Tensor::from_image resamples an image:
+         *      Bilinear: between the centers of the 4 nearest pixels.
+         *      Area: the average of the pixels under the target pixel, bilinear when enlarging.
+         */
+        enum class ResizeMode
+        {
+            Bilinear,
+            Area
+        };
+
+        /**
+         * The crop of the image which Tensor::from_image resizes to height x width. A crop
+         *      width or height of 0 goes to the border of the image. With isLetterboxed the
+         *      crop keeps its aspect ratio and is centered, the rest of the target is filled
+         *      with the byte padding.
+         */
+        class ImageResize
+        {
+        public:
+            ImageResize(const size_t &height, const size_t &width, const ResizeMode &mode = ResizeMode::Bilinear,
+                        const bool &isLetterboxed = false, const uint8_t &padding = 0)
+                : height(height), width(width), mode(mode), isLetterboxed(isLetterboxed), padding(padding),
+                  cropX(0), cropY(0), cropWidth(0), cropHeight(0)
+            {
+            }
+
+            /**
+             * Where the crop lands in the target, throws std::invalid_argument when the crop
+             *      is not in the image. A target point (x, y) comes from the image point
+             *      (cropX + (x - left) * cropWidth / columns, cropY + (y - top) * cropHeight / rows).
+             */
+            void get_placement(const size_t &imageHeight, const size_t &imageWidth,
+                               size_t &top, size_t &left, size_t &rows, size_t &columns) const;
+
+            size_t height;
+            size_t width;
+            ResizeMode mode;
+            bool isLetterboxed;
+            uint8_t padding;
+
+            size_t cropX;
+            size_t cropY;
+            size_t cropWidth;
+            size_t cropHeight;
+        };
+
+        /**
+         * The base of every lazy tensor expression (CRTP), built with lazy():
+         *
+         *          Tensor result = lazy(a) * 2.0f + b - c;
+         *
+         *      The operators only record the operations (and check that the shapes can be
+         *      broadcast), the whole chain is evaluated in one loop with a single allocation
+         *      when the expression is converted to a Tensor. The operands are shared with
+         *      the expression, so it may outlive the statement.
+         */
+        template <typename Derived>
+        class TensorExpression
+        {
+        public:
+            inline const Derived &derived() const { return static_cast<const Derived &>(*this); }
+            inline const shape_type &get_shape() const { return derived().get_shape(); }
+        };
+
+        /**
+         * The reference-counted buffer behind one or more tensors. Copies of a tensor
+         *      share the same storage, the data is only duplicated when one of the
+         *      owners is going to modify it (copy-on-write). The header and the data
+         *      live in a single block which is returned to the allocator it came from.
+         *      viewCount is the number of owners which are write views (see write_view).
+         */
+        struct TensorStorage
+        {
+            float *data;
+            size_t size;
+            std::atomic<size_t> refCount;
+            std::atomic<size_t> viewCount;
+            Allocator *allocator;
+            size_t bytes;
+        };
+
         class Shape
         {
         public:
@@ -75,21 +260,131 @@ namespace
             shape_type m_currentIndex;
         };
 
+        /**
+         * The fast replacement of the Shape for the loops over whole tensors. It walks over a
+         *      shape row by row while keeping the flat offsets of any number of operands, each
+         *      one with its own strides (a stride of 0 repeats the same element). The
+         *      dimensions which are contiguous for every operand are collapsed beforehand, so
+         *      the inner rows are as long as possible and the caller only needs a plain loop:
+         *
+         *          ShapeIterator it(shape, {a.get_strides(), b.get_strides()});
+         *          while (!it.is_end())
+         *          {
+         *              for (size_t i = 0; i < it.get_inner_size(); i++)
+         *                  b[it.get_offset(1) + i * it.get_inner_stride(1)] = a[it.get_offset(0) + ...];
+         *              it.next();
+         *          }
+         */
+        class ShapeIterator
+        {
+        public:
+            ShapeIterator(const shape_type &shape, const std::vector<stride_type> &strides);
+
+            inline bool is_end() const { return m_end; }
+            void next();
+            void reset();
+
+            inline size_t get_inner_size() const { return m_innerSize; }
+            inline size_t get_inner_stride(size_t operand) const { return m_innerStrides[operand]; }
+            inline size_t get_offset(size_t operand) const { return m_offsets[operand]; }
+
+        private:
+            shape_type m_shape;
+            std::vector<stride_type> m_strides;
+            stride_type m_innerStrides;
+            shape_type m_currentIndex;
+            std::vector<size_t> m_offsets;
+            size_t m_innerSize;
+            bool m_end;
+        };
+
         class Tensor
         {
         public:
             Tensor(const shape_type &shape, float defaultValue = NTT_DEFAULT_VALUE);
             Tensor(const Tensor &other);
+
+            /**
+             * Takes the storage of other, which is left empty and may only be destroyed or
+             *      assigned. A write view stays a view.
+             */
+            Tensor(Tensor &&other);
+
+            /**
+             * Evaluate a lazy expression into a new tensor, see TensorExpression.
+             * @param expression: the expression to be evaluated.
+             */
+            template <typename Derived>
+            Tensor(const TensorExpression<Derived> &expression);
+
             ~Tensor();
 
             inline shape_type get_shape() const { return m_shape; }
+            inline const stride_type &get_strides() const { return m_strides; }
             inline const size_t getTotalElements() const { return m_totalElements; }
             float get_element(const shape_type &indexes) const;
             void set_element(const shape_type &indexes, float value);
             void reshape(const shape_type &newShape);
-            Tensor reshape_clone(const shape_type &newShape);
+            Tensor reshape_clone(const shape_type &newShape) const;
+
+            /**
+             * The rows [begin, end) of the first axis (e.g. a range of channels of a CNHW
+             *      activation) without copying: the slice shares the storage of this tensor
+             *      and, like the copies, only gets its own data when it is modified.
+             */
+            Tensor slice(const size_t &begin, const size_t &end) const;
+
+            /**
+             * Like slice, but the writes through get_mutable_data go into the storage of this
+             *      tensor, which is detached first when it is shared. Used to compute parts of
+             *      a tensor in place (e.g. the inputs of a concatenation). While views of the
+             *      storage are alive:
+             *          - the slices of a view are views too and write through as well,
+             *          - this tensor writes into the same storage instead of detaching from it,
+             *          - the copies of this tensor and of its views (including their slices
+             *            which are not views) get their own elements right away, so the
+             *            writes through the views never show in them.
+             *      Once the views are destroyed, the storage is copied on write again.
+             */
+            Tensor write_view(const size_t &begin, const size_t &end);
             Tensor transpose(const size_t &axis1, const size_t &axis2) const;
 
+            /**
+             * Reorder the dimensions, e.g. permute({0, 2, 3, 1}) turns NCHW into NHWC. The
+             *      dimensions which stay next to each other are copied as a single one and the
+             *      actual transposition runs through the blocked transpose kernel.
+             * @param axes: the axis of this tensor which becomes the i-th axis of the result.
+             */
+            Tensor permute(const shape_type &axes) const;
+
+            /**
+             * Swap two axes of the same size without allocating.
+             */
+            void transpose_in_place(const size_t &axis1, const size_t &axis2);
+
+            /**
+             * The layout of a 4D activation, see TensorLayout.
+             */
+            inline TensorLayout get_layout() const { return m_layout; }
+
+            /**
+             * @return: the number of channels of the activation (without the padding of the
+             *      blocked layouts).
+             */
+            size_t get_channels() const;
+
+            /**
+             * Reorder the activation into another layout.
+             */
+            Tensor to_layout(const TensorLayout &layout) const;
+
+            /**
+             * Declare the layout of the data which is already in this tensor (nothing is moved).
+             * @param layout: the layout, the shape must be the one of this layout.
+             * @param channels: the number of channels, only used by the blocked layouts.
+             */
+            void set_layout(const TensorLayout &layout, const size_t &channels);
+
             std::string to_string() const;
             std::string flatten() const;
 
@@ -99,11 +394,24 @@ namespace
             Tensor argmax(const size_t &axis) const;
 
         public:
+            /**
+             * The binary operations broadcast their operands like NumPy: the shapes are aligned
+             *      to the right and every dimension must either match or be 1 on one side.
+             *      The scalar versions never build a temporary tensor.
+             */
             Tensor add(const Tensor &other) const;
+            Tensor add(const float &other) const;
             Tensor negative() const;
+            Tensor multiply(const Tensor &other) const;
             Tensor multiply(const float &other) const;
+            Tensor divide(const Tensor &other) const;
             Tensor divide(const float &other) const;
             Tensor subtract(const Tensor &other) const;
+            Tensor subtract(const float &other) const;
+            Tensor maximum(const Tensor &other) const;
+            Tensor maximum(const float &other) const;
+            Tensor minimum(const Tensor &other) const;
+            Tensor minimum(const float &other) const;
 
             void save(const std::string &filename) const;
 
@@ -114,10 +422,37 @@ namespace
             Tensor operator+(const float &other) const;
             Tensor operator-(const Tensor &other) const;
             Tensor operator-(const float &other) const;
+            Tensor operator*(const Tensor &other) const;
             Tensor operator*(const float &other) const;
+            Tensor operator/(const Tensor &other) const;
             Tensor operator/(const float &other) const;
 
+            /**
+             * The in-place versions write into this tensor, the other operand is broadcast
+             *      to the shape of this one (which is never changed).
+             */
+            Tensor &operator+=(const Tensor &other);
+            Tensor &operator+=(const float &other);
+            Tensor &operator-=(const Tensor &other);
+            Tensor &operator-=(const float &other);
+            Tensor &operator*=(const Tensor &other);
+            Tensor &operator*=(const float &other);
+            Tensor &operator/=(const Tensor &other);
+            Tensor &operator/=(const float &other);
+
         public:
+            /**
+             * @return: the shape of the result of a broadcast operation between the two shapes,
+             *      throws std::invalid_argument if they are not compatible.
+             */
+            static shape_type broadcast_shape(const shape_type &shape1, const shape_type &shape2);
+
+            /**
+             * @return: the strides which are reading this tensor as if it had the given
+             *      broadcast shape (the repeated dimensions get the stride 0).
+             */
+            stride_type get_broadcast_strides(const shape_type &shape) const;
+
             static Tensor from_vector(const vec &data);
             static Tensor from_vector(const tensor2d &data);
             static Tensor from_vector(const tensor3d &data);
@@ -125,1404 +460,7272 @@ namespace
 
             static Tensor from_bytes(const std::string &filename);
 
+            /**
+             * Converts an 8-bit image with interleaved channels (HWC, as stb_image and the
+             *      cameras give it) into a normalized activation of one image in a single pass.
+             *      The default layout gives [channels, 1, height, width], which is NCHW as well.
+             * @param rowStride: the bytes between two rows, 0 for width * channels.
+             */
+            static Tensor from_image(const uint8_t *pixels, const size_t &height, const size_t &width,
+                                     const size_t &channels,
+                                     const ImageNormalization &normalization = ImageNormalization(),
+                                     const TensorLayout &layout = TensorLayout::CNHW,
+                                     const size_t &rowStride = 0);
+
+            /**
+             * Crops and resizes (or letterboxes) the image while it is converted, without any
+             *      intermediate image. The activation has the height and width of the resize.
+             */
+            static Tensor from_image(const uint8_t *pixels, const size_t &height, const size_t &width,
+                                     const size_t &channels, const ImageResize &resize,
+                                     const ImageNormalization &normalization = ImageNormalization(),
+                                     const TensorLayout &layout = TensorLayout::CNHW,
+                                     const size_t &rowStride = 0);
+
+        public:
+            /**
+             * Raw access to the elements. The mutable version detaches the tensor from the
+             *      storage shared with other tensors before returning the pointer.
+             */
+            inline const float *get_data() const { return m_data; }
+            float *get_mutable_data();
+
+            /**
+             * The number of tensors which are sharing the same storage with this one.
+             */
+            size_t use_count() const;
+            inline bool is_shared() const { return use_count() > 1; }
+
         private:
+            /**
+             * The rows [begin, end) of other, writing through to its storage when isView.
+             */
+            Tensor(const Tensor &other, const size_t &begin, const size_t &end, const bool &isView);
+
             static size_t reloadTotalElements(const shape_type &shape);
             bool is_index_in_range(const shape_type &indexes) const;
             void reload_new_strides();
 
+            template <typename Operation>
+            Tensor broadcast_operation(const Tensor &other, Operation operation) const;
+            template <typename Operation>
+            Tensor scalar_operation(const float &other, Operation operation) const;
+            template <typename Operation>
+            void broadcast_operation_in_place(const Tensor &other, Operation operation);
+            template <typename Operation>
+            void scalar_operation_in_place(const float &other, Operation operation);
+
+            void allocate_storage(size_t size);
+            void release_storage();
+            void detach();
+
+            /**
+             * Shares the storage of other, or copies its elements when write views of that
+             *      storage are alive and this handle is not one. Expects no storage.
+             */
+            void take_storage(const Tensor &other, const bool &isView);
+
         private:
             shape_type m_shape;
             stride_type m_strides;
             size_t m_totalElements;
+            TensorStorage *m_storage;
             float *m_data;
+            TensorLayout m_layout;
+            size_t m_channels;
+            bool m_isView;
         };
 
-        class Layer
+        struct AddOperation
         {
-        public:
-            virtual Tensor forward(const Tensor &input) = 0;
+            inline float operator()(float a, float b) const { return a + b; }
         };
 
-        class ReLULayer : public Layer
+        struct SubtractOperation
         {
-        public:
-            Tensor forward(const Tensor &input) override;
+            inline float operator()(float a, float b) const { return a - b; }
         };
 
-        class Clip2DLayer : public Layer
+        struct MultiplyOperation
         {
-        public:
-            Clip2DLayer(const float &min, const float &max);
-            Tensor forward(const Tensor &input) override;
-
-        private:
-            float m_min;
-            float m_max;
+            inline float operator()(float a, float b) const { return a * b; }
         };
 
-        class FullyConnectedLayer : public Layer
+        struct DivideOperation
         {
-        public:
-            FullyConnectedLayer(const Tensor &weights, const Tensor &bias);
-            Tensor forward(const Tensor &input) override;
-
-        private:
-            Tensor m_weights;
-            Tensor m_bias;
+            inline float operator()(float a, float b) const { return a / b; }
         };
 
-        class SoftmaxLayer : public Layer
+        struct MaximumOperation
         {
-        public:
-            Tensor forward(const Tensor &input) override;
+            inline float operator()(float a, float b) const { return a > b ? a : b; }
         };
 
-        class SigmoidLayer : public Layer
+        struct MinimumOperation
         {
-        public:
-            Tensor forward(const Tensor &input) override;
+            inline float operator()(float a, float b) const { return a < b ? a : b; }
         };
 
-        class FlattenLayer : public Layer
+        class TensorLeafExpression : public TensorExpression<TensorLeafExpression>
         {
         public:
-            Tensor forward(const Tensor &input) override;
-        };
+            explicit TensorLeafExpression(const Tensor &tensor)
+                : m_tensor(tensor), m_shape(tensor.get_shape()), m_row(nullptr), m_stride(0)
+            {
+            }
 
-        class Conv2DLayer : public Layer
-        {
-        public:
-            Conv2DLayer(const Tensor &weights, const Tensor &bias,
-                        const size_t &stride = 1, const size_t &padding = 0,
-                        const size_t &group = 1);
-            Tensor forward(const Tensor &input) override;
+            inline const shape_type &get_shape() const { return m_shape; }
 
-        private:
-            Tensor m_weights;
-            Tensor m_bias;
-            size_t m_stride;
-            size_t m_padding;
-            size_t m_group;
-        };
+            /**
+             * The operands of the ShapeIterator which walks over the result, in the order of
+             *      the leaves.
+             */
+            inline void collect_strides(const shape_type &shape, std::vector<stride_type> &strides) const
+            {
+                strides.push_back(m_tensor.get_broadcast_strides(shape));
+            }
 
-        class GlobalAveragePooling2DLayer : public Layer
-        {
-        public:
-            Tensor forward(const Tensor &input) override;
-        };
+            /**
+             * Point the leaves to the current row of the iterator.
+             */
+            inline void bind(const ShapeIterator &it, size_t &operand) const
+            {
+                m_row = m_tensor.get_data() + it.get_offset(operand);
+                m_stride = it.get_inner_stride(operand);
+                operand++;
+            }
 
-        class MaxPooling2DLayer : public Layer
-        {
-        public:
-            MaxPooling2DLayer(const size_t &poolSize, const size_t &stride = 1,
-                              const size_t &padding = 0);
-            Tensor forward(const Tensor &input) override;
+            inline float evaluate(size_t index) const { return m_row[index * m_stride]; }
 
         private:
-            size_t m_poolSize;
-            size_t m_stride;
-            size_t m_padding;
+            Tensor m_tensor;
+            shape_type m_shape;
+            mutable const float *m_row;
+            mutable size_t m_stride;
         };
 
-#ifdef NTT_MICRO_NN_IMPLEMENTATION
-        static float getMax(const float &a, const float &b)
+        template <typename Left, typename Right, typename Operation>
+        class TensorBinaryExpression : public TensorExpression<TensorBinaryExpression<Left, Right, Operation>>
         {
-            return a > b ? a : b;
-        }
+        public:
+            TensorBinaryExpression(const Left &left, const Right &right)
+                : m_left(left), m_right(right),
+                  m_shape(Tensor::broadcast_shape(left.get_shape(), right.get_shape()))
+            {
+            }
 
-        static float getMin(const float &a, const float &b)
-        {
-            return a < b ? a : b;
-        }
+            inline const shape_type &get_shape() const { return m_shape; }
 
-        Shape::Shape(const shape_type &shape) : m_shape(shape)
-        {
-            m_currentIndex.clear();
-            for (size_t i = 0; i < shape.size(); i++)
+            inline void collect_strides(const shape_type &shape, std::vector<stride_type> &strides) const
             {
-                m_currentIndex.push_back(0);
+                m_left.collect_strides(shape, strides);
+                m_right.collect_strides(shape, strides);
             }
-        }
 
-        bool Shape::is_first_element() const
-        {
-            for (size_t i = 0; i < m_currentIndex.size(); i++)
+            inline void bind(const ShapeIterator &it, size_t &operand) const
             {
-                if (m_currentIndex[i] != 0)
-                {
-                    return false;
-                }
+                m_left.bind(it, operand);
+                m_right.bind(it, operand);
             }
 
-            return true;
-        }
-
-        bool Shape::is_end() const
-        {
-            for (size_t i = 0; i < m_currentIndex.size(); i++)
+            inline float evaluate(size_t index) const
             {
-                if (m_currentIndex[i] >= m_shape[i])
-                {
-                    return true;
-                }
+                return Operation()(m_left.evaluate(index), m_right.evaluate(index));
             }
 
-            return false;
-        }
+        private:
+            Left m_left;
+            Right m_right;
+            shape_type m_shape;
+        };
 
-        void Shape::next()
+        template <typename Expression, typename Operation>
+        class TensorScalarExpression : public TensorExpression<TensorScalarExpression<Expression, Operation>>
         {
-            if (is_end())
+        public:
+            TensorScalarExpression(const Expression &expression, float value)
+                : m_expression(expression), m_value(value)
             {
-                return;
             }
 
-            for (size_t i = m_currentIndex.size() - 1; i >= 0; i--)
-            {
-                size_t matchedShape = m_shape[i];
-
-                if (i == 0)
-                {
-                    m_currentIndex[i]++;
-                    break;
-                }
+            inline const shape_type &get_shape() const { return m_expression.get_shape(); }
 
-                if (m_currentIndex[i] < matchedShape - 1)
-                {
-                    m_currentIndex[i]++;
-                    break;
-                }
-                else
-                {
-                    m_currentIndex[i] = 0;
-                }
+            inline void collect_strides(const shape_type &shape, std::vector<stride_type> &strides) const
+            {
+                m_expression.collect_strides(shape, strides);
             }
-        }
 
-        void Shape::reset()
-        {
-            for (size_t i = 0; i < m_currentIndex.size(); i++)
+            inline void bind(const ShapeIterator &it, size_t &operand) const
             {
-                m_currentIndex[i] = 0;
+                m_expression.bind(it, operand);
             }
-        }
 
-        size_t Shape::get_number_of_new_lines() const
-        {
-            size_t result = 0;
-            for (size_t i = m_shape.size() - 1; i >= 0; i--)
+            inline float evaluate(size_t index) const
             {
-                if (m_currentIndex[i] == 0)
-                {
-                    result++;
-                }
-                else
-                {
-                    break;
-                }
+                return Operation()(m_expression.evaluate(index), m_value);
             }
 
-            return result;
-        }
+        private:
+            Expression m_expression;
+            float m_value;
+        };
 
-        std::string Shape::to_string() const
+        inline TensorLeafExpression lazy(const Tensor &tensor)
         {
-            char buffer[NTT_ERROR_MESSAGE_SIZE];
+            return TensorLeafExpression(tensor);
+        }
 
-            std::string shapeString = "";
+        template <typename Derived>
+        Tensor::Tensor(const TensorExpression<Derived> &expression)
+            : m_shape(expression.get_shape()), m_storage(nullptr), m_data(nullptr),
+              m_layout(TensorLayout::CNHW), m_channels(0), m_isView(false)
+        {
+            m_totalElements = reloadTotalElements(m_shape);
+            allocate_storage(m_totalElements);
+            reload_new_strides();
 
-            shapeString += "[";
-            for (size_t i = 0; i < m_shape.size(); i++)
-            {
-                shapeString += std::to_string(m_shape[i]);
+            const Derived &root = expression.derived();
+            std::vector<stride_type> strides;
+            root.collect_strides(m_shape, strides);
+            strides.push_back(m_strides);
 
-                if (i != m_shape.size() - 1)
-                {
-                    shapeString += ", ";
-                }
-            }
-            shapeString += "]";
+            ShapeIterator it(m_shape, strides);
+            const size_t resultOperand = strides.size() - 1;
 
-            std::string indexString = "";
-            indexString += "[";
-            for (size_t i = 0; i < m_currentIndex.size(); i++)
+            while (!it.is_end())
             {
-                indexString += std::to_string(m_currentIndex[i]);
+                size_t operand = 0;
+                root.bind(it, operand);
 
-                if (i != m_currentIndex.size() - 1)
+                float *output = m_data + it.get_offset(resultOperand);
+                const size_t outputStride = it.get_inner_stride(resultOperand);
+                for (size_t i = 0; i < it.get_inner_size(); i++)
                 {
-                    indexString += ", ";
+                    output[i * outputStride] = root.evaluate(i);
                 }
-            }
-            indexString += "]";
 
-            snprintf(
-                buffer, sizeof(buffer),
-                "Shape: %s - Index: %s",
-                shapeString.c_str(), indexString.c_str());
+                it.next();
+            }
+        }
 
-            return std::string(buffer);
+        template <typename Left, typename Right>
+        TensorBinaryExpression<Left, Right, AddOperation>
+        operator+(const TensorExpression<Left> &left, const TensorExpression<Right> &right)
+        {
+            return TensorBinaryExpression<Left, Right, AddOperation>(left.derived(), right.derived());
         }
 
-        std::string Shape::convert_shape_to_string(const shape_type &shape)
+        template <typename Left>
+        TensorBinaryExpression<Left, TensorLeafExpression, AddOperation>
+        operator+(const TensorExpression<Left> &left, const Tensor &right)
         {
-            std::string result = "[";
-            for (size_t i = 0; i < shape.size(); i++)
-            {
-                result += std::to_string(shape[i]);
+            return TensorBinaryExpression<Left, TensorLeafExpression, AddOperation>(left.derived(), lazy(right));
+        }
 
-                if (i != shape.size() - 1)
-                {
-                    result += ", ";
-                }
-            }
-            result += "]";
-            return result;
+        template <typename Right>
+        TensorBinaryExpression<TensorLeafExpression, Right, AddOperation>
+        operator+(const Tensor &left, const TensorExpression<Right> &right)
+        {
+            return TensorBinaryExpression<TensorLeafExpression, Right, AddOperation>(lazy(left), right.derived());
         }
 
-        bool Shape::is_shape_equal(const shape_type &shape1, const shape_type &shape2)
+        template <typename Expression>
+        TensorScalarExpression<Expression, AddOperation>
+        operator+(const TensorExpression<Expression> &expression, float value)
+        {
+            return TensorScalarExpression<Expression, AddOperation>(expression.derived(), value);
+        }
+
+        template <typename Left, typename Right>
+        TensorBinaryExpression<Left, Right, SubtractOperation>
+        operator-(const TensorExpression<Left> &left, const TensorExpression<Right> &right)
+        {
+            return TensorBinaryExpression<Left, Right, SubtractOperation>(left.derived(), right.derived());
+        }
+
+        template <typename Left>
+        TensorBinaryExpression<Left, TensorLeafExpression, SubtractOperation>
+        operator-(const TensorExpression<Left> &left, const Tensor &right)
+        {
+            return TensorBinaryExpression<Left, TensorLeafExpression, SubtractOperation>(left.derived(), lazy(right));
+        }
+
+        template <typename Right>
+        TensorBinaryExpression<TensorLeafExpression, Right, SubtractOperation>
+        operator-(const Tensor &left, const TensorExpression<Right> &right)
+        {
+            return TensorBinaryExpression<TensorLeafExpression, Right, SubtractOperation>(lazy(left), right.derived());
+        }
+
+        template <typename Expression>
+        TensorScalarExpression<Expression, SubtractOperation>
+        operator-(const TensorExpression<Expression> &expression, float value)
+        {
+            return TensorScalarExpression<Expression, SubtractOperation>(expression.derived(), value);
+        }
+
+        template <typename Left, typename Right>
+        TensorBinaryExpression<Left, Right, MultiplyOperation>
+        operator*(const TensorExpression<Left> &left, const TensorExpression<Right> &right)
+        {
+            return TensorBinaryExpression<Left, Right, MultiplyOperation>(left.derived(), right.derived());
+        }
+
+        template <typename Left>
+        TensorBinaryExpression<Left, TensorLeafExpression, MultiplyOperation>
+        operator*(const TensorExpression<Left> &left, const Tensor &right)
+        {
+            return TensorBinaryExpression<Left, TensorLeafExpression, MultiplyOperation>(left.derived(), lazy(right));
+        }
+
+        template <typename Right>
+        TensorBinaryExpression<TensorLeafExpression, Right, MultiplyOperation>
+        operator*(const Tensor &left, const TensorExpression<Right> &right)
+        {
+            return TensorBinaryExpression<TensorLeafExpression, Right, MultiplyOperation>(lazy(left), right.derived());
+        }
+
+        template <typename Expression>
+        TensorScalarExpression<Expression, MultiplyOperation>
+        operator*(const TensorExpression<Expression> &expression, float value)
+        {
+            return TensorScalarExpression<Expression, MultiplyOperation>(expression.derived(), value);
+        }
+
+        template <typename Left, typename Right>
+        TensorBinaryExpression<Left, Right, DivideOperation>
+        operator/(const TensorExpression<Left> &left, const TensorExpression<Right> &right)
+        {
+            return TensorBinaryExpression<Left, Right, DivideOperation>(left.derived(), right.derived());
+        }
+
+        template <typename Left>
+        TensorBinaryExpression<Left, TensorLeafExpression, DivideOperation>
+        operator/(const TensorExpression<Left> &left, const Tensor &right)
+        {
+            return TensorBinaryExpression<Left, TensorLeafExpression, DivideOperation>(left.derived(), lazy(right));
+        }
+
+        template <typename Right>
+        TensorBinaryExpression<TensorLeafExpression, Right, DivideOperation>
+        operator/(const Tensor &left, const TensorExpression<Right> &right)
+        {
+            return TensorBinaryExpression<TensorLeafExpression, Right, DivideOperation>(lazy(left), right.derived());
+        }
+
+        template <typename Expression>
+        TensorScalarExpression<Expression, DivideOperation>
+        operator/(const TensorExpression<Expression> &expression, float value)
+        {
+            return TensorScalarExpression<Expression, DivideOperation>(expression.derived(), value);
+        }
+
+        /**
+         * How Conv2DLayer computes a convolution in the default layout. Automatic picks
+         *      Winograd for the 3x3 stride-1 convolutions with enough channels (F(4x4, 3x3)
+         *      for the widest ones) and the direct loops otherwise.
+         */
+        enum class ConvolutionAlgorithm
+        {
+            Automatic,
+            Direct,
+            Winograd2x2,
+            Winograd4x4
+        };
+
+        /**
+         * How SparseWeights stores the weights which are not zero: one by one (CSR), or in
+         *      blocks of 1x4 or 4x4 weights which are kept whole as soon as one of them is not
+         *      zero. Automatic picks the largest block which stores less than 1.5 times the
+         *      number of weights which are not zero.
+         */
+        enum class SparseFormat
+        {
+            Automatic,
+            CSR,
+            Block1x4,
+            Block4x4
+        };
+
+        /**
+         * A pruned weight matrix [rows, columns] in the compressed sparse row format, the
+         *      elements of the CSR format being blocks of weights for the block formats.
+         */
+        class SparseWeights
+        {
+        public:
+            SparseWeights();
+
+            /**
+             * @param weights: a 2D tensor, or a 4D one [O, I, 1, 1] of a pointwise convolution.
+             * @param threshold: the weights whose absolute value is not above it are dropped.
+             */
+            static SparseWeights from_dense(const Tensor &weights, const float &threshold = 0.0f,
+                                            const SparseFormat &format = SparseFormat::Automatic);
+
+            /**
+             * Load dense weights saved by Tensor::save and sparsify them, see from_dense.
+             */
+            static SparseWeights from_bytes(const std::string &filename, const float &threshold = 0.0f,
+                                            const SparseFormat &format = SparseFormat::Automatic);
+
+            Tensor to_dense() const;
+
+            inline SparseFormat get_format() const { return m_format; }
+            inline size_t get_rows() const { return m_rows; }
+            inline size_t get_columns() const { return m_columns; }
+
+            /**
+             * @return: the fraction of the weights which are stored (with the zeros of the blocks).
+             */
+            float get_density() const;
+
+            /**
+             * result[i * resultStride + j] += sum_k weights[i][k] * input[k * inputStride + j]
+             *      for j < columns. Every output adds its products in the order of k.
+             */
+            void multiply(const float *input, const size_t &inputStride, const size_t &columns,
+                          float *result, const size_t &resultStride) const;
+
+        private:
+            SparseFormat m_format;
+            size_t m_rows;
+            size_t m_columns;
+            size_t m_blockRows;
+            size_t m_blockColumns;
+
+            // CSR over the rows of blocks: the blocks of the row r are [m_rowOffsets[r], m_rowOffsets[r + 1])
+            std::vector<size_t> m_rowOffsets;
+            std::vector<size_t> m_columnIndexes;
+            std::vector<float> m_values;
+        };
+
+        /**
+         * The weights of a layer rearranged for its kernels, one tensor per format (e.g.
+         *      "gemm8" for the panels of the fully connected layer, "blocked8" or "winograd4x4"
+         *      for the convolution). The layers pack the weights of the kernels they run (the
+         *      blocked formats of the convolution on its first input in that layout) and take
+         *      the formats which are already in the given cache as they are, so the cache can
+         *      be saved next to the model and loaded at the next start instead of packing
+         *      again. Copies of a cache share the storage of the tensors.
+         */
+        class PackedWeightCache
+        {
+        public:
+            inline bool empty() const { return m_entries.empty(); }
+            bool contains(const std::string &format) const;
+
+            /**
+             * @return: the packed weights of the format, throws std::out_of_range when they
+             *      are not in the cache.
+             */
+            const Tensor &get(const std::string &format) const;
+            void set(const std::string &format, const Tensor &weights);
+
+            void save(const std::string &filename) const;
+            static PackedWeightCache from_bytes(const std::string &filename);
+
+        private:
+            std::vector<std::pair<std::string, Tensor>> m_entries;
+        };
+
+        /**
+         * The named weights of a model in one compressed file. Every tensor is cut into chunks
+         *      of NTT_BUNDLE_CHUNK_SIZE bytes whose bytes are shuffled (shuffle_bytes) then
+         *      compressed with the LZ codec, or stored as they are when that does not help.
+         *      The chunks are independent, so they are compressed and decompressed in parallel
+         *      on the thread pool, and from_bytes reads the file with one sequential read.
+         */
+        class WeightBundle
+        {
+        public:
+            inline size_t size() const { return m_entries.size(); }
+            bool contains(const std::string &name) const;
+
+            /**
+             * @return: the weights of the name, throws std::out_of_range when they are not in
+             *      the bundle.
+             */
+            const Tensor &get(const std::string &name) const;
+            void set(const std::string &name, const Tensor &weights);
+            std::vector<std::string> get_names() const;
+
+            void save(const std::string &filename) const;
+
+            /**
+             * Throws std::runtime_error when the file is not a bundle or is corrupted.
+             */
+            static WeightBundle from_bytes(const std::string &filename);
+
+        private:
+            std::vector<std::pair<std::string, Tensor>> m_entries;
+        };
+
+        class Layer
+        {
+        public:
+            virtual ~Layer() {}
+            virtual Tensor forward(const Tensor &input) = 0;
+
+            /**
+             * Whether the layer has a kernel for the activations in the given layout, the
+             *      layers only accept the default layout (CNHW) unless they override it.
+             */
+            virtual bool supports_layout(const TensorLayout &layout) const { return layout == TensorLayout::CNHW; }
+
+            /**
+             * Writes the output into a tensor which already has its shape and layout, e.g. a
+             *      write_view of a concatenation. @return: false when the layer has no such
+             *      kernel or the output does not fit, forward must be used then.
+             */
+            virtual bool forward_into(const Tensor &, Tensor &) { return false; }
+        };
+
+        class ReLULayer : public Layer
+        {
+        public:
+            Tensor forward(const Tensor &input) override;
+            bool supports_layout(const TensorLayout &) const override { return true; }
+            bool forward_into(const Tensor &input, Tensor &output) override;
+        };
+
+        class Clip2DLayer : public Layer
+        {
+        public:
+            Clip2DLayer(const float &min, const float &max);
+            Tensor forward(const Tensor &input) override;
+            bool supports_layout(const TensorLayout &) const override { return true; }
+            bool forward_into(const Tensor &input, Tensor &output) override;
+
+            inline float get_min() const { return m_min; }
+            inline float get_max() const { return m_max; }
+
+        private:
+            float m_min;
+            float m_max;
+        };
+
+        class FullyConnectedLayer : public Layer
+        {
+        public:
+            /**
+             * The weights are packed into panels of NTT_GEMM_PANEL_ROWS rows, each one stored
+             *      input by input, unless the cache already has them.
+             */
+            FullyConnectedLayer(const Tensor &weights, const Tensor &bias,
+                                const PackedWeightCache &packedWeights = PackedWeightCache());
+
+            /**
+             * Always use the sparse kernel, e.g. for weights from SparseWeights::from_bytes.
+             */
+            FullyConnectedLayer(const SparseWeights &weights, const Tensor &bias);
+            Tensor forward(const Tensor &input) override;
+
+            inline const PackedWeightCache &get_packed_weights() const { return m_packedWeights; }
+            inline const Tensor &get_weights() const { return m_weights; }
+            inline const Tensor &get_bias() const { return m_bias; }
+
+            /**
+             * Whether the weights are sparse enough (see NTT_SPARSE_MAX_DENSITY) to skip the zeros.
+             */
+            inline bool is_sparse() const { return m_isSparse; }
+
+        private:
+            Tensor m_weights;
+            Tensor m_bias;
+            PackedWeightCache m_packedWeights;
+            SparseWeights m_sparseWeights;
+            bool m_isSparse;
+        };
+
+        /**
+         * The max, exp and sum, and scale passes over the whole tensor, or over one axis
+         *      (e.g. 0 for the classes of a [classes, batch] output). The slices along the
+         *      axis are normalized in parallel on the default ThreadPool.
+         */
+        class SoftmaxLayer : public Layer
+        {
+        public:
+            SoftmaxLayer(const ExpAccuracy &accuracy = ExpAccuracy::Accurate);
+            SoftmaxLayer(const size_t &axis, const ExpAccuracy &accuracy = ExpAccuracy::Accurate);
+            Tensor forward(const Tensor &input) override;
+
+        protected:
+            ExpAccuracy m_accuracy;
+            bool m_isWholeTensor;
+            size_t m_axis;
+        };
+
+        /**
+         * log(softmax(x)) computed as x - max - log(sum(exp(x - max))), like SoftmaxLayer.
+         */
+        class LogSoftmaxLayer : public SoftmaxLayer
+        {
+        public:
+            LogSoftmaxLayer(const ExpAccuracy &accuracy = ExpAccuracy::Accurate);
+            LogSoftmaxLayer(const size_t &axis, const ExpAccuracy &accuracy = ExpAccuracy::Accurate);
+            Tensor forward(const Tensor &input) override;
+        };
+
+        class SigmoidLayer : public Layer
+        {
+        public:
+            SigmoidLayer(const ExpAccuracy &accuracy = ExpAccuracy::Accurate);
+            Tensor forward(const Tensor &input) override;
+            bool supports_layout(const TensorLayout &) const override { return true; }
+
+        private:
+            ExpAccuracy m_accuracy;
+        };
+
+        class FlattenLayer : public Layer
+        {
+        public:
+            Tensor forward(const Tensor &input) override;
+        };
+
+        /**
+         * Gives the activation another shape with the same number of elements, the data is
+         *      not moved.
+         */
+        class ReshapeLayer : public Layer
+        {
+        public:
+            ReshapeLayer(const shape_type &shape);
+            Tensor forward(const Tensor &input) override;
+
+            inline const shape_type &get_shape() const { return m_shape; }
+
+        private:
+            shape_type m_shape;
+        };
+
+        /**
+         * Scales and shifts every channel (the first axis, so [C, N, H, W] activations and
+         *      [C, N] outputs of the fully connected layers) in the default layout:
+         *      scale * x + shift, with scale = gamma / sqrt(variance + epsilon) and
+         *      shift = beta - mean * scale for a batch normalization.
+         */
+        class BatchNormLayer : public Layer
+        {
+        public:
+            BatchNormLayer(const Tensor &gamma, const Tensor &beta, const Tensor &mean, const Tensor &variance,
+                           const float &epsilon = 1e-5f);
+
+            /**
+             * An affine per channel layer (e.g. the Scale of the exported models).
+             */
+            BatchNormLayer(const Tensor &scale, const Tensor &shift);
+            Tensor forward(const Tensor &input) override;
+            bool forward_into(const Tensor &input, Tensor &output) override;
+
+            /**
+             * @return: [channels, 1] tensors which broadcast over the bias of the layers.
+             */
+            inline const Tensor &get_scale() const { return m_scale; }
+            inline const Tensor &get_shift() const { return m_shift; }
+
+            /**
+             * Whether the scales are 1 and the shifts 0.
+             */
+            bool is_identity() const;
+
+        private:
+            Tensor m_scale;
+            Tensor m_shift;
+        };
+
+        class Conv2DLayer : public Layer
+        {
+        public:
+            /**
+             * The weights are transformed for the selected algorithm and packed for the
+             *      NCHW8c kernels here, the formats which are already in the cache are reused.
+             */
+            Conv2DLayer(const Tensor &weights, const Tensor &bias,
+                        const size_t &stride = 1, const size_t &padding = 0,
+                        const size_t &group = 1,
+                        const PackedWeightCache &packedWeights = PackedWeightCache());
+            Tensor forward(const Tensor &input) override;
+
+            /**
+             * The regular and the depthwise convolutions have kernels for every layout.
+             */
+            bool supports_layout(const TensorLayout &layout) const override;
+
+            /**
+             * Choose the algorithm of the default layout, the weights are transformed once here.
+             *      Throws std::invalid_argument when Winograd is requested for a convolution
+             *      which is not a 3x3 stride-1 one without groups.
+             */
+            void set_convolution_algorithm(const ConvolutionAlgorithm &algorithm);
+
+            /**
+             * @return: the algorithm which is used (never Automatic).
+             */
+            inline ConvolutionAlgorithm get_convolution_algorithm() const { return m_algorithm; }
+
+            /**
+             * Every format which was packed so far, including the ones of the layouts which
+             *      were only seen by forward.
+             */
+            inline const PackedWeightCache &get_packed_weights() const { return m_packedWeights; }
+
+            inline const Tensor &get_weights() const { return m_weights; }
+            inline const Tensor &get_bias() const { return m_bias; }
+            inline size_t get_stride() const { return m_stride; }
+            inline size_t get_padding() const { return m_padding; }
+            inline size_t get_group() const { return m_group; }
+
+            /**
+             * Whether the pointwise convolution (1x1, stride 1, no padding or groups) skips
+             *      the zero weights in the default layout. The bias is added once to the sum
+             *      instead of a fraction per input channel, so the results may differ by a
+             *      rounding error from the dense kernel.
+             */
+            inline bool is_sparse() const { return m_isSparse; }
+
+            /**
+             * The convolution clipped to [min, max] then averaged over the height and the
+             *      width, in the default layout: [output channels, batch, 1, 1]. Every output
+             *      row is clipped and summed as soon as it is computed, so the output planes
+             *      are never stored. Like in the sparse kernel the bias is added once.
+             */
+            Tensor forward_global_pooling(const Tensor &input, const float &min, const float &max) const;
+
+        private:
+            Tensor forward_with_layout(const Tensor &input);
+            const Tensor &pack_weights(const size_t &block);
+            void pack_bias(const size_t &block, const size_t &batch);
+            Tensor forward_winograd(const Tensor &input);
+            Tensor forward_sparse(const Tensor &input);
+
+        private:
+            Tensor m_weights;
+            Tensor m_bias;
+            size_t m_stride;
+            size_t m_padding;
+            size_t m_group;
+
+            // "blockedN": [output block, input channel, kernel y, kernel x, output lane] for the
+            // layouts, "winogradNxN": [frequency, output channel, input channel]
+            PackedWeightCache m_packedWeights;
+
+            // the bias of the last input, divided like in the default kernel
+            size_t m_packedBlock;
+            size_t m_packedBatch;
+            std::vector<float> m_packedBias;
+
+            ConvolutionAlgorithm m_algorithm;
+
+            SparseWeights m_sparseWeights;
+            bool m_isSparse;
+        };
+
+        class GlobalAveragePooling2DLayer : public Layer
+        {
+        public:
+            Tensor forward(const Tensor &input) override;
+            bool supports_layout(const TensorLayout &) const override { return true; }
+
+        private:
+            Tensor forward_with_layout(const Tensor &input);
+        };
+
+        /**
+         * A convolution, an optional clip and a global average pooling in one pass (see
+         *      Conv2DLayer::forward_global_pooling), e.g. for the head of the landmark model:
+         *
+         *          Conv2DPoolingLayer fused47(conv47, clip47);
+         *          std::vector<Layer *> chunk15 = {&conv46, &clip46, &fused47};
+         *
+         *      The layers are referenced, not copied, and must outlive this one.
+         */
+        class Conv2DPoolingLayer : public Layer
+        {
+        public:
+            Conv2DPoolingLayer(const Conv2DLayer &conv);
+            Conv2DPoolingLayer(const Conv2DLayer &conv, const Clip2DLayer &clip);
+            Tensor forward(const Tensor &input) override;
+
+        private:
+            const Conv2DLayer *m_conv;
+            float m_min;
+            float m_max;
+        };
+
+        enum class PoolingMode
+        {
+            Max,
+            Average,
+            L2
+        };
+
+        /**
+         * Max, average or L2 (square root of the sum of the squares) pooling over square
+         *      windows. The padding is never read: the windows are clipped to the input, so
+         *      the maximum ignores it and the average only divides by the elements inside.
+         *      Every window is reduced over its rows first, over whole input rows so the
+         *      loops run across the width, then over its columns.
+         */
+        class Pooling2DLayer : public Layer
+        {
+        public:
+            Pooling2DLayer(const PoolingMode &mode, const size_t &poolSize, const size_t &stride = 1,
+                           const size_t &padding = 0);
+            Tensor forward(const Tensor &input) override;
+            bool supports_layout(const TensorLayout &) const override { return true; }
+
+            /**
+             * Max pooling in the default layout which also gives, for every output, the
+             *      index y * width + x of its maximum in the input plane (the first one of the
+             *      window in the row order), see unpool. The indices are floats, so the
+             *      planes are limited to 2^24 elements, where they are still exact.
+             */
+            Tensor forward_with_indices(const Tensor &input, Tensor &indices) const;
+
+            /**
+             * Puts the pooled values back at the positions of their maximum in planes of
+             *      height x width, the other elements are zeros.
+             */
+            static Tensor unpool(const Tensor &values, const Tensor &indices,
+                                 const size_t &height, const size_t &width);
+
+            inline PoolingMode get_mode() const { return m_mode; }
+
+        private:
+            Tensor forward_with_layout(const Tensor &input) const;
+
+        private:
+            PoolingMode m_mode;
+            size_t m_poolSize;
+            size_t m_stride;
+            size_t m_padding;
+        };
+
+        class MaxPooling2DLayer : public Pooling2DLayer
+        {
+        public:
+            MaxPooling2DLayer(const size_t &poolSize, const size_t &stride = 1,
+                              const size_t &padding = 0);
+        };
+
+        class AveragePooling2DLayer : public Pooling2DLayer
+        {
+        public:
+            AveragePooling2DLayer(const size_t &poolSize, const size_t &stride = 1,
+                                  const size_t &padding = 0);
+        };
+
+        /**
+         * Converts the activations into another layout.
+         */
+        class ReorderLayer : public Layer
+        {
+        public:
+            ReorderLayer(const TensorLayout &layout);
+            Tensor forward(const Tensor &input) override;
+            bool supports_layout(const TensorLayout &) const override { return true; }
+
+        private:
+            TensorLayout m_layout;
+        };
+
+        /**
+         * The layout propagation pass over a chain of layers: every run of consecutive layers
+         *      which support the layout is executed in it, with one reorder before the run and
+         *      one after it, so the activations are only converted at the boundaries of the
+         *      model (or around the layers which only work in CNHW, like Flatten).
+         *
+         *          LayoutPlan plan({&conv1, &clip1, &conv2, &gap, &flatten, &fc});
+         *          Tensor output = plan.forward(input); // CNHW in, CNHW out
+         *
+         *      The element-wise layers keep the layout of their input, the padding channels of
+         *      the blocked layouts are not meaningful after them and are never read back.
+         */
+        class LayoutPlan : public Layer
+        {
+        public:
+            LayoutPlan(const std::vector<Layer *> &layers, const TensorLayout &layout = TensorLayout::NCHW8c);
+            Tensor forward(const Tensor &input) override;
+
+            /**
+             * @return: the layers which are executed, including the inserted reorders.
+             */
+            inline const std::vector<Layer *> &get_layers() const { return m_layers; }
+
+        private:
+            std::vector<Layer *> m_layers;
+            std::vector<std::shared_ptr<ReorderLayer>> m_reorders;
+        };
+
+        enum class GraphOperation
+        {
+            Input,
+            Constant,
+            Layer,
+            Add,
+            Multiply,
+            Concat,
+            Slice
+        };
+
+        /**
+         * The optimizations applied by Graph::optimize.
+         */
+        enum class GraphPass
+        {
+            // evaluates once the nodes which only read constants
+            FoldConstants,
+            // merges the batch normalizations into the weights and the bias of the convolution
+            // or fully connected layer before them
+            FoldBatchNorm,
+            // removes the identity batch normalizations and clips, and all but the last of the
+            // consecutive flattens and reshapes
+            EliminateIdentities,
+            // merges the consecutive clips and ReLUs into one clip
+            MergeClips
+        };
+
+        /**
+         * A network as a directed acyclic graph, for the models which are not a chain of
+         *      layers (e.g. the skip connections of the inverted residual blocks):
+         *
+         *          Graph graph;
+         *          size_t input = graph.add_input();
+         *          size_t block = graph.add_layers({&expand, &clip1, &depthwise, &clip2, &project}, input);
+         *          graph.add_node(GraphOperation::Add, {input, block});
+         *          Tensor output = graph.forward(image); // the last node unless set_outputs is called
+         *
+         *      The nodes are added in the execution order, so a node only reads the nodes which
+         *      were added before it. Every intermediate tensor is released after its last
+         *      reader, and an Add or Multiply writes into one of its operands when it is that
+         *      operand's last reader (see is_in_place). The operands of Add and Multiply are
+         *      broadcast like Tensor::add, Concat joins its inputs along an axis of the
+         *      default layout. The layers are referenced, not copied.
+         *
+         *      The slices of the channels (see add_split) share the storage of their input.
+         *      The shapes of every node are kept from one forward to the next, so a channel
+         *      Concat allocates its output before its inputs are computed and the layers
+         *      which are only read by it write into their part of it (see writes_into_concat).
+         */
+        class Graph : public Layer
+        {
+        public:
+            Graph();
+
+            /**
+             * @return: the index of the new node, the inputs of forward are given to the input
+             *      nodes in the order they were added.
+             */
+            size_t add_input();
+
+            /**
+             * A tensor which is the same for every forward, e.g. the weights of a Multiply.
+             */
+            size_t add_constant(const Tensor &value);
+            size_t add_layer(Layer &layer, const size_t &input);
+
+            /**
+             * A chain of layers after the input node, @return: the node of the last layer.
+             */
+            size_t add_layers(const std::vector<Layer *> &layers, const size_t &input);
+
+            /**
+             * Add, Multiply or Concat (along the axis) of the given nodes, throws
+             *      std::invalid_argument when a node does not exist yet.
+             */
+            size_t add_node(const GraphOperation &operation, const std::vector<size_t> &inputs,
+                            const size_t &axis = 0);
+
+            /**
+             * The channels [begin, end) of the input (its first axis), without a copy.
+             */
+            size_t add_slice(const size_t &input, const size_t &begin, const size_t &end);
+
+            /**
+             * Consecutive slices of the given numbers of channels, @return: their nodes.
+             */
+            std::vector<size_t> add_split(const size_t &input, const std::vector<size_t> &sizes);
+
+            void set_outputs(const std::vector<size_t> &outputs);
+
+            std::vector<Tensor> forward(const std::vector<Tensor> &inputs);
+
+            /**
+             * The graph with one input and one output as a layer.
+             */
+            Tensor forward(const Tensor &input) override;
+
+            /**
+             * Whether the node is an Add or a Multiply which reuses the storage of one of its
+             *      operands. It still copies when that operand is smaller than the broadcast
+             *      result.
+             */
+            bool is_in_place(const size_t &node);
+
+            /**
+             * Whether the node is a layer which computes its output directly into the output
+             *      of the channel Concat reading it, from the second forward on (the first one
+             *      gives the shapes). Only the layers with a forward_into kernel do it, the
+             *      other inputs are copied into the preallocated output.
+             */
+            bool writes_into_concat(const size_t &node);
+
+            inline size_t get_node_count() const { return m_nodes.size(); }
+
+            /**
+             * Runs the passes in order, e.g. once after loading the model. The nodes which are
+             *      not read anymore are removed, so the indices of the nodes change except for
+             *      the inputs: the outputs are the same nodes in the same order. The graph is
+             *      left unchanged when a pass throws. The folded layers are owned by the graph.
+             */
+            void optimize(const std::vector<GraphPass> &passes = {GraphPass::FoldConstants, GraphPass::FoldBatchNorm,
+                                                                  GraphPass::EliminateIdentities, GraphPass::MergeClips});
+
+            /**
+             * @return: the operation of the node and, for the layers, the layer.
+             */
+            GraphOperation get_operation(const size_t &node) const;
+            Layer *get_layer(const size_t &node) const;
+
+        private:
+            struct Node
+            {
+                GraphOperation operation;
+                Layer *layer;
+                std::vector<size_t> inputs;
+                size_t axis;
+                std::shared_ptr<Tensor> constant;
+                size_t begin;
+                size_t end;
+            };
+
+            void check_node(const size_t &node) const;
+            void plan();
+            std::shared_ptr<Tensor> execute_node(const Node &node, std::vector<std::shared_ptr<Tensor>> &values,
+                                                 const size_t &target) const;
+
+            /**
+             * @return: the first channel of the input in the output of the Concat, from the
+             *      shapes of the last forward.
+             */
+            size_t get_concat_offset(const size_t &concat, const size_t &input) const;
+            std::shared_ptr<Tensor> execute_concat(const size_t &concat, std::vector<std::shared_ptr<Tensor>> &values,
+                                                   std::vector<std::shared_ptr<Tensor>> &buffers,
+                                                   const std::vector<bool> &isWritten) const;
+
+            /**
+             * @return: the number of nodes reading each node, the outputs count as a reader.
+             */
+            std::vector<size_t> count_readers() const;
+            void fold_constants();
+            void fold_batch_norms();
+            void eliminate_identities();
+            void merge_clips();
+            void remove_dead_nodes();
+
+        private:
+            std::vector<Node> m_nodes;
+            std::vector<size_t> m_inputs;
+            std::vector<size_t> m_outputs;
+
+            // the memory plan: the last node reading each node, and the operand which is
+            // overwritten by each node (the node count when there is none)
+            bool m_isPlanned;
+            std::vector<size_t> m_lastReaders;
+            std::vector<size_t> m_inPlaceOperands;
+
+            // the channel Concat which each node is written into (the node count when there is
+            // none), and the shapes of the last forward
+            std::vector<size_t> m_concatTargets;
+            std::vector<shape_type> m_shapes;
+
+            std::vector<std::shared_ptr<Layer>> m_ownedLayers;
+        };
+
+        /**
+         * A layer whose weights stay in their files (Tensor::save) until it runs. forward
+         *      loads the weights, builds the layer with the factory, runs it and releases it:
+         *
+         *          StreamedLayer conv1({"conv1_weight.bin", "conv1_bias.bin"},
+         *                              [](const std::vector<Tensor> &weights)
+         *                              { return std::unique_ptr<Layer>(new Conv2DLayer(weights[0], weights[1], 1, 1)); });
+         *          StreamedLayer::chain({&conv1, &conv2, &conv3});
+         *
+         *      A chained layer starts loading the next one on the thread pool before it runs,
+         *      so the reads and the weight transforms of the factory overlap the compute and
+         *      at most two streamed layers of a chain hold their weights at a time. A forward
+         *      whose load did not start on the pool yet loads the layer itself instead of
+         *      waiting, so the layers may run on the workers of the same pool (AsyncLayer).
+         */
+        class StreamedLayer : public Layer
+        {
+        public:
+            typedef std::function<std::unique_ptr<Layer>(const std::vector<Tensor> &weights)> Factory;
+
+            /**
+             * @param pool: the threads of the prefetches.
+             */
+            StreamedLayer(const std::vector<std::string> &files, const Factory &factory,
+                          ThreadPool &pool = ThreadPool::get_default());
+            ~StreamedLayer();
+            Tensor forward(const Tensor &input) override;
+
+            /**
+             * Starts loading the layer on the pool, nothing is done when it is loaded already.
+             */
+            void prefetch();
+
+            /**
+             * Frees the weights, they are loaded again by the next forward. A load in
+             *      progress on the pool is waited for first, so the weights never exist twice,
+             *      and a load which did not start is dropped.
+             */
+            void release();
+
+            /**
+             * @return: whether the weights are loaded or being loaded.
+             */
+            bool is_loaded() const;
+
+            /**
+             * Every layer prefetches the next one of the list when it runs.
+             */
+            static void chain(const std::vector<StreamedLayer *> &layers);
+
+        private:
+            /**
+             * @return: whether the load of the pool started, else it will do nothing.
+             */
+            bool claim_loading();
+
+        private:
+            std::vector<std::string> m_files;
+            Factory m_factory;
+            ThreadPool *m_pool;
+            StreamedLayer *m_next;
+            std::future<std::shared_ptr<Layer>> m_loading;
+
+            // set by whichever of the pool task and this layer takes the load first
+            std::shared_ptr<std::atomic<bool>> m_isClaimed;
+        };
+
+        /**
+         * Runs the chunks of a model as a pipeline over a stream of frames. Every stage is a
+         *      thread running consecutive chunks, which hands its outputs to the next stage
+         *      through a bounded SpscQueue, so frame N + 1 is in the first chunk while frame N
+         *      is in a later one. The outputs come out in the order of the frames:
+         *
+         *          Pipeline pipeline({chunk1, chunk2, ..., chunk15}, 4);
+         *          pipeline.balance(frame); // the stages from the measured latency of the chunks
+         *          pipeline.push(frame1);
+         *          pipeline.push(frame2);
+         *          Tensor output1 = pipeline.pop();
+         *
+         *      push waits while the first queue is full, so the frames in flight and their
+         *      latency stay bounded by get_max_in_flight. push and pop are called from a
+         *      single thread, and the layers must not be used elsewhere while the pipeline runs.
+         */
+        class Pipeline
+        {
+        public:
+            /**
+             * @param stages: the number of threads, 0 for one per chunk up to the number of
+             *      hardware threads. The chunks are spread evenly until balance is called.
+             * @param capacity: the frames which can wait before every stage.
+             */
+            Pipeline(const std::vector<std::vector<Layer *>> &chunks, const size_t &stages = 0,
+                     const size_t &capacity = NTT_PIPELINE_QUEUE_CAPACITY);
+            ~Pipeline();
+
+            Pipeline(const Pipeline &) = delete;
+            Pipeline &operator=(const Pipeline &) = delete;
+
+            /**
+             * Waits while the first queue is full. Throws std::logic_error when
+             *      get_max_in_flight frames are in flight already, since nothing would pop them.
+             */
+            void push(const Tensor &frame);
+
+            /**
+             * @return: false when the first queue is full, the frame is not pushed then.
+             */
+            bool try_push(const Tensor &frame);
+
+            /**
+             * Waits for the output of the oldest frame, throws the exception of its layers if
+             *      one failed and std::logic_error when no frame is in flight.
+             */
+            Tensor pop();
+
+            /**
+             * @return: false when the oldest frame is not out yet.
+             */
+            bool try_pop(Tensor &output);
+
+            /**
+             * Measures the latency of every chunk on the sample (the best of the runs) and
+             *      splits the chunks into the stages which minimize the slowest stage. Throws
+             *      std::logic_error when frames are in flight. When a layer throws, the
+             *      exception is passed on and the stages keep their previous boundaries.
+             */
+            void balance(const Tensor &sample, const size_t &runs = 3);
+
+            inline size_t get_stage_count() const { return m_boundaries.size() - 1; }
+
+            /**
+             * @return: the first chunk of every stage, then the number of chunks.
+             */
+            inline const std::vector<size_t> &get_boundaries() const { return m_boundaries; }
+
+            /**
+             * @return: the seconds per chunk measured by balance.
+             */
+            inline const std::vector<double> &get_chunk_latencies() const { return m_latencies; }
+            inline size_t get_in_flight() const { return m_inFlight; }
+
+            /**
+             * @return: the frames which fit in the queues and the stages before a pop.
+             */
+            inline size_t get_max_in_flight() const
+            {
+                return (get_stage_count() + 1) * m_capacity + get_stage_count();
+            }
+
+        private:
+            struct Frame
+            {
+                std::shared_ptr<Tensor> tensor;
+                std::exception_ptr error;
+            };
+
+            void start();
+            void stop();
+            void run_stage(const size_t &stage);
+
+        private:
+            std::vector<std::vector<Layer *>> m_chunks;
+            size_t m_capacity;
+            std::vector<size_t> m_boundaries;
+            std::vector<double> m_latencies;
+
+            // the queue before every stage, then the outputs
+            std::vector<std::unique_ptr<SpscQueue<Frame>>> m_queues;
+            std::vector<std::thread> m_threads;
+            std::atomic<bool> m_isStopping;
+            size_t m_inFlight;
+        };
+
+        /**
+         * Runs a layer (a whole model usually) on the thread pool, so the callers never wait
+         *      for an inference:
+         *
+         *          AsyncLayer model(landmark);
+         *          std::future<Tensor> output = model.submit(frame);
+         *          model.submit(frame, [](const Tensor *output, std::exception_ptr error) { ... });
+         *          Tensor output = co_await model.forward_async(frame); // C++20
+         *
+         *      The inputs of a layer run one after the other in the order they were submitted,
+         *      since the layers are not reentrant, while the kernels of every inference still
+         *      spread over the pool. Inputs of several AsyncLayers run at the same time on the
+         *      threads of the same pool.
+         */
+        class AsyncLayer
+        {
+        public:
+            /**
+             * @param output: the result, nullptr when the layer threw error.
+             */
+            typedef std::function<void(const Tensor *output, std::exception_ptr error)> Callback;
+
+            explicit AsyncLayer(Layer &layer, ThreadPool &pool = ThreadPool::get_default());
+
+            /**
+             * Waits for the inputs which were submitted already.
+             */
+            ~AsyncLayer();
+
+            AsyncLayer(const AsyncLayer &) = delete;
+            AsyncLayer &operator=(const AsyncLayer &) = delete;
+
+            std::future<Tensor> submit(const Tensor &input);
+
+            /**
+             * Calls the callback on the pool thread once the output is ready, the exceptions of
+             *      the callback are ignored.
+             */
+            void submit(const Tensor &input, const Callback &callback);
+
+            /**
+             * @return: the inputs which were submitted and did not start yet.
+             */
+            size_t get_pending() const;
+
+#ifdef NTT_COROUTINES
+            /**
+             * co_await suspends the coroutine until the output is ready, it resumes on the pool
+             *      thread which ran the layer.
+             */
+            class Awaitable
+            {
+            public:
+                Awaitable(AsyncLayer &layer, const Tensor &input)
+                    : m_layer(&layer), m_input(input)
+                {
+                }
+
+                bool await_ready() const noexcept { return false; }
+
+                void await_suspend(std::coroutine_handle<> handle)
+                {
+                    m_layer->submit(m_input, [this, handle](const Tensor *output, std::exception_ptr error)
+                                    {
+                        if (output != nullptr)
+                        {
+                            m_output = std::make_shared<Tensor>(*output);
+                        }
+                        m_error = error;
+                        handle.resume(); });
+                }
+
+                Tensor await_resume()
+                {
+                    if (m_error)
+                    {
+                        std::rethrow_exception(m_error);
+                    }
+                    return *m_output;
+                }
+
+            private:
+                AsyncLayer *m_layer;
+                Tensor m_input;
+                std::shared_ptr<Tensor> m_output;
+                std::exception_ptr m_error;
+            };
+
+            inline Awaitable forward_async(const Tensor &input) { return Awaitable(*this, input); }
+#endif // NTT_COROUTINES
+
+        private:
+            void run_requests();
+
+        private:
+            Layer *m_layer;
+            ThreadPool *m_pool;
+
+            mutable std::mutex m_mutex;
+            std::condition_variable m_idle;
+            std::deque<std::pair<Tensor, Callback>> m_requests;
+            bool m_isRunning;
+        };
+
+#ifdef NTT_MICRO_NN_IMPLEMENTATION
+        static float getMax(const float &a, const float &b)
+        {
+            return a > b ? a : b;
+        }
+
+        static float getMin(const float &a, const float &b)
+        {
+            return a < b ? a : b;
+        }
+
+        Shape::Shape(const shape_type &shape) : m_shape(shape)
+        {
+            m_currentIndex.clear();
+            for (size_t i = 0; i < shape.size(); i++)
+            {
+                m_currentIndex.push_back(0);
+            }
+        }
+
+        bool Shape::is_first_element() const
+        {
+            for (size_t i = 0; i < m_currentIndex.size(); i++)
+            {
+                if (m_currentIndex[i] != 0)
+                {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+        bool Shape::is_end() const
+        {
+            for (size_t i = 0; i < m_currentIndex.size(); i++)
+            {
+                if (m_currentIndex[i] >= m_shape[i])
+                {
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        void Shape::next()
+        {
+            if (is_end())
+            {
+                return;
+            }
+
+            for (size_t i = m_currentIndex.size(); i-- > 0;)
+            {
+                size_t matchedShape = m_shape[i];
+
+                if (i == 0)
+                {
+                    m_currentIndex[i]++;
+                    break;
+                }
+
+                if (m_currentIndex[i] < matchedShape - 1)
+                {
+                    m_currentIndex[i]++;
+                    break;
+                }
+                else
+                {
+                    m_currentIndex[i] = 0;
+                }
+            }
+        }
+
+        void Shape::reset()
+        {
+            for (size_t i = 0; i < m_currentIndex.size(); i++)
+            {
+                m_currentIndex[i] = 0;
+            }
+        }
+
+        size_t Shape::get_number_of_new_lines() const
+        {
+            size_t result = 0;
+            for (size_t i = m_shape.size(); i-- > 0;)
+            {
+                if (m_currentIndex[i] == 0)
+                {
+                    result++;
+                }
+                else
+                {
+                    break;
+                }
+            }
+
+            return result;
+        }
+
+        std::string Shape::to_string() const
+        {
+            char buffer[NTT_ERROR_MESSAGE_SIZE];
+
+            std::string shapeString = "";
+
+            shapeString += "[";
+            for (size_t i = 0; i < m_shape.size(); i++)
+            {
+                shapeString += std::to_string(m_shape[i]);
+
+                if (i != m_shape.size() - 1)
+                {
+                    shapeString += ", ";
+                }
+            }
+            shapeString += "]";
+
+            std::string indexString = "";
+            indexString += "[";
+            for (size_t i = 0; i < m_currentIndex.size(); i++)
+            {
+                indexString += std::to_string(m_currentIndex[i]);
+
+                if (i != m_currentIndex.size() - 1)
+                {
+                    indexString += ", ";
+                }
+            }
+            indexString += "]";
+
+            snprintf(
+                buffer, sizeof(buffer),
+                "Shape: %s - Index: %s",
+                shapeString.c_str(), indexString.c_str());
+
+            return std::string(buffer);
+        }
+
+        std::string Shape::convert_shape_to_string(const shape_type &shape)
+        {
+            std::string result = "[";
+            for (size_t i = 0; i < shape.size(); i++)
+            {
+                result += std::to_string(shape[i]);
+
+                if (i != shape.size() - 1)
+                {
+                    result += ", ";
+                }
+            }
+            result += "]";
+            return result;
+        }
+
+        bool Shape::is_shape_equal(const shape_type &shape1, const shape_type &shape2)
         {
             if (shape1.size() != shape2.size())
             {
                 return false;
             }
 
-            for (size_t i = 0; i < shape1.size(); i++)
+            for (size_t i = 0; i < shape1.size(); i++)
+            {
+                if (shape1[i] != shape2[i])
+                {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+        ShapeIterator::ShapeIterator(const shape_type &shape, const std::vector<stride_type> &strides)
+            : m_strides(strides.size()), m_innerStrides(strides.size(), 0),
+              m_offsets(strides.size(), 0), m_innerSize(1), m_end(false)
+        {
+            for (size_t operand = 0; operand < strides.size(); operand++)
+            {
+                if (strides[operand].size() != shape.size())
+                {
+                    char buffer[NTT_ERROR_MESSAGE_SIZE];
+                    snprintf(buffer, sizeof(buffer),
+                             "Strides mismatch: %s for the shape %s",
+                             Shape::convert_shape_to_string(strides[operand]).c_str(),
+                             Shape::convert_shape_to_string(shape).c_str());
+                    throw std::invalid_argument(buffer);
+                }
+            }
+
+            // drop the dimensions of size 1 and merge the ones which are contiguous for all operands
+            for (size_t i = 0; i < shape.size(); i++)
+            {
+                if (shape[i] == 0)
+                {
+                    m_end = true;
+                }
+
+                if (shape[i] == 1)
+                {
+                    continue;
+                }
+
+                bool canMerge = !m_shape.empty();
+                for (size_t operand = 0; operand < strides.size() && canMerge; operand++)
+                {
+                    canMerge = m_strides[operand].back() == strides[operand][i] * shape[i];
+                }
+
+                if (canMerge)
+                {
+                    m_shape.back() *= shape[i];
+                    for (size_t operand = 0; operand < strides.size(); operand++)
+                    {
+                        m_strides[operand].back() = strides[operand][i];
+                    }
+                    continue;
+                }
+
+                m_shape.push_back(shape[i]);
+                for (size_t operand = 0; operand < strides.size(); operand++)
+                {
+                    m_strides[operand].push_back(strides[operand][i]);
+                }
+            }
+
+            if (!m_shape.empty())
+            {
+                m_innerSize = m_shape.back();
+                for (size_t operand = 0; operand < strides.size(); operand++)
+                {
+                    m_innerStrides[operand] = m_strides[operand].back();
+                }
+            }
+
+            m_currentIndex.assign(m_shape.size(), 0);
+        }
+
+        void ShapeIterator::next()
+        {
+            if (m_end)
+            {
+                return;
+            }
+
+            // the last dimension is walked by the caller, advance the outer ones like an odometer
+            for (size_t i = m_shape.size() > 0 ? m_shape.size() - 1 : 0; i-- > 0;)
+            {
+                m_currentIndex[i]++;
+                for (size_t operand = 0; operand < m_offsets.size(); operand++)
+                {
+                    m_offsets[operand] += m_strides[operand][i];
+                }
+
+                if (m_currentIndex[i] < m_shape[i])
+                {
+                    return;
+                }
+
+                for (size_t operand = 0; operand < m_offsets.size(); operand++)
+                {
+                    m_offsets[operand] -= m_strides[operand][i] * m_shape[i];
+                }
+                m_currentIndex[i] = 0;
+            }
+
+            m_end = true;
+        }
+
+        void ShapeIterator::reset()
+        {
+            m_end = false;
+            for (size_t i = 0; i < m_currentIndex.size(); i++)
+            {
+                if (m_shape[i] == 0)
+                {
+                    m_end = true;
+                }
+                m_currentIndex[i] = 0;
+            }
+
+            for (size_t operand = 0; operand < m_offsets.size(); operand++)
+            {
+                m_offsets[operand] = 0;
+            }
+        }
+
+        std::string Tensor::flatten() const
+        {
+            std::string result = "[";
+            for (size_t i = 0; i < getTotalElements(); i++)
+            {
+                result += std::to_string(m_data[i]) + ", ";
+            }
+            result += "]";
+
+            return result;
+        }
+
+        float Tensor::max() const
+        {
+            float max = m_data[0];
+            for (size_t i = 0; i < getTotalElements(); i++)
+            {
+                if (m_data[i] > max)
+                {
+                    max = m_data[i];
+                }
+            }
+
+            return max;
+        }
+
+        Tensor Tensor::max(const size_t &axis) const
+        {
+            shape_type newShape = m_shape;
+            newShape[axis] = 1;
+            Tensor result(newShape, 0.0f);
+
+            const size_t axisSize = m_shape[axis];
+            const size_t axisStride = m_strides[axis];
+            ShapeIterator it(newShape, {m_strides, result.m_strides});
+
+            while (!it.is_end())
+            {
+                const float *input = m_data + it.get_offset(0);
+                float *output = result.m_data + it.get_offset(1);
+
+                for (size_t i = 0; i < it.get_inner_size(); i++)
+                {
+                    const float *line = input + i * it.get_inner_stride(0);
+                    float maxValue = line[0];
+
+                    for (size_t j = 1; j < axisSize; j++)
+                    {
+                        maxValue = getMax(maxValue, line[j * axisStride]);
+                    }
+
+                    output[i * it.get_inner_stride(1)] = maxValue;
+                }
+
+                it.next();
+            }
+
+            return result;
+        }
+
+        shape_type Tensor::argmax() const
+        {
+            size_t maxIndex = 0;
+            for (size_t i = 1; i < m_totalElements; i++)
+            {
+                if (m_data[i] > m_data[maxIndex])
+                {
+                    maxIndex = i;
+                }
+            }
+
+            shape_type result(m_shape.size(), 0);
+            for (size_t i = 0; i < result.size(); i++)
+            {
+                result[i] = maxIndex / m_strides[i];
+                maxIndex %= m_strides[i];
+            }
+
+            return result;
+        }
+
+        Tensor Tensor::argmax(const size_t &axis) const
+        {
+            shape_type newShape = m_shape;
+            newShape[axis] = 1;
+            Tensor result(newShape, 0.0f);
+
+            const size_t axisSize = m_shape[axis];
+            const size_t axisStride = m_strides[axis];
+            ShapeIterator it(newShape, {m_strides, result.m_strides});
+
+            while (!it.is_end())
+            {
+                const float *input = m_data + it.get_offset(0);
+                float *output = result.m_data + it.get_offset(1);
+
+                for (size_t i = 0; i < it.get_inner_size(); i++)
+                {
+                    const float *line = input + i * it.get_inner_stride(0);
+                    size_t maxValueIndex = 0;
+
+                    for (size_t j = 1; j < axisSize; j++)
+                    {
+                        if (line[j * axisStride] > line[maxValueIndex * axisStride])
+                        {
+                            maxValueIndex = j;
+                        }
+                    }
+
+                    output[i * it.get_inner_stride(1)] = (float)maxValueIndex;
+                }
+
+                it.next();
+            }
+
+            return result;
+        }
+
+        shape_type Tensor::broadcast_shape(const shape_type &shape1, const shape_type &shape2)
+        {
+            const size_t dimensions = getMax(shape1.size(), shape2.size());
+            shape_type result(dimensions, 1);
+
+            for (size_t i = 0; i < dimensions; i++)
+            {
+                size_t size1 = i < shape1.size() ? shape1[shape1.size() - 1 - i] : 1;
+                size_t size2 = i < shape2.size() ? shape2[shape2.size() - 1 - i] : 1;
+
+                if (size1 != size2 && size1 != 1 && size2 != 1)
+                {
+                    char buffer[NTT_ERROR_MESSAGE_SIZE];
+                    snprintf(buffer, sizeof(buffer),
+                             "Shape mismatch: %s != %s",
+                             Shape::convert_shape_to_string(shape1).c_str(),
+                             Shape::convert_shape_to_string(shape2).c_str());
+                    throw std::invalid_argument(buffer);
+                }
+
+                result[dimensions - 1 - i] = size1 == 1 ? size2 : size1;
+            }
+
+            return result;
+        }
+
+        stride_type Tensor::get_broadcast_strides(const shape_type &shape) const
+        {
+            // a dimension which is repeated gets the stride 0
+            stride_type result(shape.size(), 0);
+            const size_t offset = shape.size() - m_shape.size();
+
+            for (size_t i = 0; i < m_shape.size(); i++)
+            {
+                if (m_shape[i] != 1)
+                {
+                    result[offset + i] = m_strides[i];
+                }
+            }
+
+            return result;
+        }
+
+        template <typename Operation>
+        Tensor Tensor::broadcast_operation(const Tensor &other, Operation operation) const
+        {
+            if (other.m_totalElements == 1 && other.m_shape.size() <= m_shape.size())
+            {
+                return scalar_operation(other.m_data[0], operation);
+            }
+
+            shape_type resultShape = broadcast_shape(m_shape, other.m_shape);
+            Tensor result(resultShape, 0.0f);
+
+            if (Shape::is_shape_equal(m_shape, other.m_shape))
+            {
+                for (size_t i = 0; i < m_totalElements; i++)
+                {
+                    result.m_data[i] = operation(m_data[i], other.m_data[i]);
+                }
+
+                return result;
+            }
+
+            ShapeIterator it(resultShape, {get_broadcast_strides(resultShape),
+                                           other.get_broadcast_strides(resultShape),
+                                           result.m_strides});
+
+            while (!it.is_end())
+            {
+                const float *first = m_data + it.get_offset(0);
+                const float *second = other.m_data + it.get_offset(1);
+                float *output = result.m_data + it.get_offset(2);
+                const size_t firstStride = it.get_inner_stride(0);
+                const size_t secondStride = it.get_inner_stride(1);
+
+                if (firstStride == 1 && secondStride == 0)
+                {
+                    // per-channel case, e.g. adding a bias
+                    const float value = second[0];
+                    for (size_t i = 0; i < it.get_inner_size(); i++)
+                    {
+                        output[i] = operation(first[i], value);
+                    }
+                }
+                else
+                {
+                    for (size_t i = 0; i < it.get_inner_size(); i++)
+                    {
+                        output[i] = operation(first[i * firstStride], second[i * secondStride]);
+                    }
+                }
+
+                it.next();
+            }
+
+            return result;
+        }
+
+        template <typename Operation>
+        Tensor Tensor::scalar_operation(const float &other, Operation operation) const
+        {
+            Tensor result(m_shape, 0.0f);
+            const float value = other;
+
+            for (size_t i = 0; i < m_totalElements; i++)
+            {
+                result.m_data[i] = operation(m_data[i], value);
+            }
+
+            return result;
+        }
+
+        template <typename Operation>
+        void Tensor::broadcast_operation_in_place(const Tensor &other, Operation operation)
+        {
+            if (other.m_totalElements == 1 && other.m_shape.size() <= m_shape.size())
+            {
+                scalar_operation_in_place(other.m_data[0], operation);
+                return;
+            }
+
+            if (!Shape::is_shape_equal(broadcast_shape(m_shape, other.m_shape), m_shape))
+            {
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(buffer, sizeof(buffer),
+                         "Cannot broadcast %s into %s in place",
+                         Shape::convert_shape_to_string(other.m_shape).c_str(),
+                         Shape::convert_shape_to_string(m_shape).c_str());
+                throw std::invalid_argument(buffer);
+            }
+
+            // keep the operand alive and unchanged even if it shares the storage with this tensor
+            Tensor operand = other;
+            detach();
+
+            ShapeIterator it(m_shape, {m_strides, operand.get_broadcast_strides(m_shape)});
+
+            while (!it.is_end())
+            {
+                float *output = m_data + it.get_offset(0);
+                const float *second = operand.m_data + it.get_offset(1);
+                const size_t outputStride = it.get_inner_stride(0);
+                const size_t secondStride = it.get_inner_stride(1);
+
+                for (size_t i = 0; i < it.get_inner_size(); i++)
+                {
+                    output[i * outputStride] = operation(output[i * outputStride], second[i * secondStride]);
+                }
+
+                it.next();
+            }
+        }
+
+        template <typename Operation>
+        void Tensor::scalar_operation_in_place(const float &other, Operation operation)
+        {
+            const float value = other;
+            detach();
+
+            for (size_t i = 0; i < m_totalElements; i++)
+            {
+                m_data[i] = operation(m_data[i], value);
+            }
+        }
+
+        Tensor Tensor::add(const Tensor &other) const
+        {
+            return broadcast_operation(other, AddOperation());
+        }
+
+        Tensor Tensor::add(const float &other) const
+        {
+            return scalar_operation(other, AddOperation());
+        }
+
+        Tensor Tensor::multiply(const Tensor &other) const
+        {
+            return broadcast_operation(other, MultiplyOperation());
+        }
+
+        Tensor Tensor::multiply(const float &other) const
+        {
+            return scalar_operation(other, MultiplyOperation());
+        }
+
+        Tensor Tensor::divide(const Tensor &other) const
+        {
+            return broadcast_operation(other, DivideOperation());
+        }
+
+        Tensor Tensor::divide(const float &other) const
+        {
+            return scalar_operation(other, DivideOperation());
+        }
+
+        Tensor Tensor::negative() const
+        {
+            Tensor result(m_shape, 0.0f);
+
+            for (size_t i = 0; i < getTotalElements(); i++)
+            {
+                result.m_data[i] = -m_data[i];
+            }
+
+            return result;
+        }
+
+        Tensor Tensor::subtract(const Tensor &other) const
+        {
+            return broadcast_operation(other, SubtractOperation());
+        }
+
+        Tensor Tensor::subtract(const float &other) const
+        {
+            return scalar_operation(other, SubtractOperation());
+        }
+
+        Tensor Tensor::maximum(const Tensor &other) const
+        {
+            return broadcast_operation(other, MaximumOperation());
+        }
+
+        Tensor Tensor::maximum(const float &other) const
+        {
+            return scalar_operation(other, MaximumOperation());
+        }
+
+        Tensor Tensor::minimum(const Tensor &other) const
+        {
+            return broadcast_operation(other, MinimumOperation());
+        }
+
+        Tensor Tensor::minimum(const float &other) const
+        {
+            return scalar_operation(other, MinimumOperation());
+        }
+
+        Tensor Tensor::operator+(const Tensor &other) const
+        {
+            return add(other);
+        }
+
+        Tensor Tensor::operator+(const float &other) const
+        {
+            return add(other);
+        }
+
+        Tensor Tensor::operator-(const Tensor &other) const
+        {
+            return subtract(other);
+        }
+
+        Tensor Tensor::operator-(const float &other) const
+        {
+            return subtract(other);
+        }
+
+        Tensor &Tensor::operator+=(const Tensor &other)
+        {
+            broadcast_operation_in_place(other, AddOperation());
+            return *this;
+        }
+
+        Tensor &Tensor::operator+=(const float &other)
+        {
+            scalar_operation_in_place(other, AddOperation());
+            return *this;
+        }
+
+        Tensor &Tensor::operator-=(const Tensor &other)
+        {
+            broadcast_operation_in_place(other, SubtractOperation());
+            return *this;
+        }
+
+        Tensor &Tensor::operator-=(const float &other)
+        {
+            scalar_operation_in_place(other, SubtractOperation());
+            return *this;
+        }
+
+        Tensor &Tensor::operator*=(const Tensor &other)
+        {
+            broadcast_operation_in_place(other, MultiplyOperation());
+            return *this;
+        }
+
+        Tensor &Tensor::operator*=(const float &other)
+        {
+            scalar_operation_in_place(other, MultiplyOperation());
+            return *this;
+        }
+
+        Tensor &Tensor::operator/=(const Tensor &other)
+        {
+            broadcast_operation_in_place(other, DivideOperation());
+            return *this;
+        }
+
+        Tensor &Tensor::operator/=(const float &other)
+        {
+            scalar_operation_in_place(other, DivideOperation());
+            return *this;
+        }
+
+        void Tensor::operator=(const Tensor &other)
+        {
+            if (this == &other)
+            {
+                return;
+            }
+
+            // other keeps the storage alive when it is shared with this tensor
+            release_storage();
+            take_storage(other, false);
+        }
+
+        bool Tensor::operator==(const Tensor &other) const
+        {
+            if (m_shape != other.m_shape)
+            {
+                return false;
+            }
+
+            for (size_t i = 0; i < m_totalElements; i++)
+            {
+                if (std::fabs(m_data[i] - other.m_data[i]) > std::numeric_limits<float>::epsilon())
+                {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+        Tensor Tensor::operator*(const Tensor &other) const
+        {
+            return multiply(other);
+        }
+
+        Tensor Tensor::operator*(const float &other) const
+        {
+            return multiply(other);
+        }
+
+        Tensor Tensor::operator/(const Tensor &other) const
+        {
+            return divide(other);
+        }
+
+        Tensor Tensor::operator/(const float &other) const
+        {
+            return divide(other);
+        }
+
+        Tensor Tensor::from_vector(const vec &data)
+        {
+            Tensor tensor({data.size()}, 0.0f);
+            for (size_t i = 0; i < data.size(); i++)
+            {
+                tensor.set_element({i}, data[i]);
+            }
+
+            return tensor;
+        }
+
+        Tensor Tensor::from_vector(const tensor2d &data)
+        {
+            Tensor tensor({data.size(), data[0].size()}, 0.0f);
+            for (size_t i = 0; i < data.size(); i++)
+            {
+                for (size_t j = 0; j < data[i].size(); j++)
+                {
+                    tensor.set_element({i, j}, data[i][j]);
+                }
+            }
+
+            return tensor;
+        }
+
+        Tensor Tensor::from_vector(const tensor3d &data)
+        {
+            Tensor tensor({data.size(), data[0].size(), data[0][0].size()}, 0.0f);
+            for (size_t i = 0; i < data.size(); i++)
+            {
+                for (size_t j = 0; j < data[i].size(); j++)
+                {
+                    for (size_t k = 0; k < data[i][j].size(); k++)
+                    {
+                        tensor.set_element({i, j, k}, data[i][j][k]);
+                    }
+                }
+            }
+            return tensor;
+        }
+
+        Tensor Tensor::from_vector(const tensor4d &data)
+        {
+            Tensor tensor({data.size(), data[0].size(), data[0][0].size(), data[0][0][0].size()}, 0.0f);
+            for (size_t i = 0; i < data.size(); i++)
+            {
+                for (size_t j = 0; j < data[i].size(); j++)
+                {
+                    for (size_t k = 0; k < data[i][j].size(); k++)
+                    {
+                        for (size_t l = 0; l < data[i][j][k].size(); l++)
+                        {
+                            tensor.set_element({i, j, k, l}, data[i][j][k][l]);
+                        }
+                    }
+                }
+            }
+            return tensor;
+        }
+
+        size_t Tensor::reloadTotalElements(const shape_type &shape)
+        {
+            size_t result = 1;
+            for (size_t i = 0; i < shape.size(); i++)
+            {
+                result *= shape[i];
+            }
+            return result;
+        }
+
+        bool Tensor::is_index_in_range(const shape_type &indexes) const
+        {
+            for (size_t i = 0; i < indexes.size(); i++)
+            {
+                if (indexes[i] >= m_shape[i])
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        Tensor::Tensor(const shape_type &shape, float defaultValue)
+            : m_shape(shape), m_storage(nullptr), m_data(nullptr),
+              m_layout(TensorLayout::CNHW), m_channels(0), m_isView(false)
+        {
+            m_totalElements = reloadTotalElements(m_shape);
+
+            allocate_storage(getTotalElements());
+
+            for (size_t i = 0; i < getTotalElements(); i++)
+            {
+                m_data[i] = defaultValue;
+            }
+
+            reload_new_strides();
+        }
+
+        Tensor::Tensor(const Tensor &other)
+            : m_storage(nullptr), m_data(nullptr), m_isView(false)
+        {
+            take_storage(other, false);
+        }
+
+        Tensor::Tensor(Tensor &&other)
+            : m_shape(std::move(other.m_shape)), m_strides(std::move(other.m_strides)),
+              m_totalElements(other.m_totalElements),
+              m_storage(other.m_storage), m_data(other.m_data),
+              m_layout(other.m_layout), m_channels(other.m_channels), m_isView(other.m_isView)
+        {
+            other.m_totalElements = 0;
+            other.m_storage = nullptr;
+            other.m_data = nullptr;
+            other.m_isView = false;
+        }
+
+        Tensor::Tensor(const Tensor &other, const size_t &begin, const size_t &end, const bool &isView)
+            : m_storage(nullptr), m_data(nullptr), m_isView(false)
+        {
+            const shape_type &shape = other.m_shape;
+            if (shape.empty() || begin > end || end > shape[0] || other.m_layout != TensorLayout::CNHW)
+            {
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(buffer, sizeof(buffer),
+                         "Invalid slice [%zu, %zu) of %s", begin, end,
+                         Shape::convert_shape_to_string(shape).c_str());
+                throw std::invalid_argument(buffer);
+            }
+
+            take_storage(other, isView);
+
+            const size_t rowSize = m_shape[0] == 0 ? 0 : m_totalElements / m_shape[0];
+
+            m_shape[0] = end - begin;
+            m_totalElements = (end - begin) * rowSize;
+            m_data += begin * rowSize;
+        }
+
+        void Tensor::take_storage(const Tensor &other, const bool &isView)
+        {
+            m_shape = other.m_shape;
+            m_strides = other.m_strides;
+            m_totalElements = other.m_totalElements;
+            m_layout = other.m_layout;
+            m_channels = other.m_channels;
+
+            if (!isView && other.m_storage->viewCount.load(std::memory_order_acquire) > 0)
+            {
+                // the views would write into a shared storage behind the back of the copy
+                allocate_storage(m_totalElements);
+                memcpy(m_data, other.m_data, m_totalElements * sizeof(float));
+                m_isView = false;
+                return;
+            }
+
+            other.m_storage->refCount.fetch_add(1, std::memory_order_relaxed);
+            if (isView)
+            {
+                other.m_storage->viewCount.fetch_add(1, std::memory_order_relaxed);
+            }
+            m_storage = other.m_storage;
+            m_data = other.m_data;
+            m_isView = isView;
+        }
+
+        static const size_t s_storageHeaderSize =
+            (sizeof(TensorStorage) + NTT_DEFAULT_ALIGNMENT - 1) / NTT_DEFAULT_ALIGNMENT * NTT_DEFAULT_ALIGNMENT;
+
+        static void destroy_storage(TensorStorage *storage)
+        {
+            Allocator *allocator = storage->allocator;
+            size_t bytes = storage->bytes;
+            storage->~TensorStorage();
+            allocator->deallocate(storage, bytes);
+        }
+
+        void Tensor::allocate_storage(size_t size)
+        {
+            Allocator *allocator = get_default_allocator();
+            size_t bytes = s_storageHeaderSize + sizeof(float) * size;
+            unsigned char *block = (unsigned char *)allocator->allocate(bytes);
+
+            m_storage = new (block) TensorStorage();
+            m_storage->data = (float *)(block + s_storageHeaderSize);
+            m_storage->size = size;
+            m_storage->refCount.store(1, std::memory_order_relaxed);
+            m_storage->viewCount.store(0, std::memory_order_relaxed);
+            m_storage->allocator = allocator;
+            m_storage->bytes = bytes;
+            m_data = m_storage->data;
+        }
+
+        void Tensor::release_storage()
+        {
+            if (m_storage == nullptr)
+            {
+                return;
+            }
+
+            if (m_isView)
+            {
+                m_storage->viewCount.fetch_sub(1, std::memory_order_acq_rel);
+                m_isView = false;
+            }
+
+            if (m_storage->refCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                destroy_storage(m_storage);
+            }
+
+            m_storage = nullptr;
+            m_data = nullptr;
+        }
+
+        void Tensor::detach()
+        {
+            // the views and the tensor they were taken from write into the same storage
+            if (m_isView || m_storage->viewCount.load(std::memory_order_acquire) > 0 ||
+                m_storage->refCount.load(std::memory_order_acquire) == 1)
+            {
+                return;
+            }
+
+            const float *source = m_data;
+            TensorStorage *sharedStorage = m_storage;
+
+            allocate_storage(m_totalElements);
+            memcpy(m_data, source, m_totalElements * sizeof(float));
+
+            if (sharedStorage->refCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                destroy_storage(sharedStorage);
+            }
+        }
+
+        float *Tensor::get_mutable_data()
+        {
+            detach();
+            return m_data;
+        }
+
+        size_t Tensor::use_count() const
+        {
+            return m_storage->refCount.load(std::memory_order_acquire);
+        }
+
+        void Tensor::reload_new_strides()
+        {
+            size_t currentStride = 1;
+            for (size_t i = 1; i < m_shape.size(); i++)
+            {
+                currentStride *= m_shape[i];
+            }
+
+            m_strides.clear();
+            for (size_t i = 1; i < m_shape.size(); i++)
+            {
+                m_strides.push_back(currentStride);
+                currentStride /= m_shape[i];
+            }
+
+            m_strides.push_back(1);
+        }
+
+        Tensor::~Tensor()
+        {
+            release_storage();
+        }
+
+        float Tensor::get_element(const shape_type &indexes) const
+        {
+            if (indexes.size() != m_shape.size())
+            {
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(buffer, sizeof(buffer),
+                         "Shape mismatch: %s != %s",
+                         Shape::convert_shape_to_string(indexes).c_str(),
+                         Shape::convert_shape_to_string(m_shape).c_str());
+                throw std::invalid_argument(buffer);
+            }
+
+            if (!is_index_in_range(indexes))
+            {
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(buffer, sizeof(buffer),
+                         "Index is out of range: %s not in range of %s",
+                         Shape::convert_shape_to_string(indexes).c_str(),
+                         Shape::convert_shape_to_string(m_shape).c_str());
+                throw std::out_of_range(buffer);
+            }
+
+            size_t index = 0;
+            for (size_t i = 0; i < indexes.size(); i++)
+            {
+                index += indexes[i] * m_strides[i];
+            }
+
+            return m_data[index];
+        }
+
+        void Tensor::set_element(const shape_type &indexes, float value)
+        {
+            if (!is_index_in_range(indexes))
+            {
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(buffer, sizeof(buffer),
+                         "Index is out of range: %s not in range of %s",
+                         Shape::convert_shape_to_string(indexes).c_str(),
+                         Shape::convert_shape_to_string(m_shape).c_str());
+                throw std::out_of_range(buffer);
+            }
+
+            size_t index = 0;
+            for (size_t i = 0; i < indexes.size(); i++)
+            {
+                index += indexes[i] * m_strides[i];
+            }
+
+            detach();
+            m_data[index] = value;
+        }
+
+        void Tensor::reshape(const shape_type &newShape)
+        {
+            if (reloadTotalElements(newShape) != getTotalElements())
+            {
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(buffer, sizeof(buffer),
+                         "Total elements mismatch: %zu (%s) != %zu (%s)",
+                         reloadTotalElements(newShape),
+                         Shape::convert_shape_to_string(newShape).c_str(),
+                         getTotalElements(),
+                         Shape::convert_shape_to_string(m_shape).c_str());
+                throw std::invalid_argument(buffer);
+            }
+
+            m_shape = newShape;
+            m_layout = TensorLayout::CNHW;
+            m_channels = 0;
+            reload_new_strides();
+        }
+
+        Tensor Tensor::reshape_clone(const shape_type &newShape) const
+        {
+            Tensor newTensor(*this);
+            newTensor.reshape(newShape);
+            return newTensor;
+        }
+
+        Tensor Tensor::slice(const size_t &begin, const size_t &end) const
+        {
+            return Tensor(*this, begin, end, m_isView);
+        }
+
+        Tensor Tensor::write_view(const size_t &begin, const size_t &end)
+        {
+            detach();
+
+            // moved out, the copies of a view are not views
+            return Tensor(*this, begin, end, true);
+        }
+
+        Tensor Tensor::transpose(const size_t &axis1, const size_t &axis2) const
+        {
+            if (axis1 >= m_shape.size() || axis2 >= m_shape.size())
+            {
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(buffer, sizeof(buffer),
+                         "Invalid axis: %zu or %zu not in range of %zu",
+                         axis1, axis2, m_shape.size());
+                throw std::invalid_argument(buffer);
+            }
+
+            shape_type axes(m_shape.size());
+            for (size_t i = 0; i < axes.size(); i++)
+            {
+                axes[i] = i;
+            }
+            axes[axis1] = axis2;
+            axes[axis2] = axis1;
+
+            return permute(axes);
+        }
+
+        Tensor Tensor::permute(const shape_type &axes) const
+        {
+            std::vector<bool> used(m_shape.size(), false);
+            bool isValid = axes.size() == m_shape.size();
+            for (size_t i = 0; i < axes.size() && isValid; i++)
+            {
+                isValid = axes[i] < m_shape.size() && !used[axes[i]];
+                if (isValid)
+                {
+                    used[axes[i]] = true;
+                }
+            }
+
+            if (!isValid)
+            {
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(buffer, sizeof(buffer),
+                         "Invalid axes: %s for the shape %s",
+                         Shape::convert_shape_to_string(axes).c_str(),
+                         Shape::convert_shape_to_string(m_shape).c_str());
+                throw std::invalid_argument(buffer);
+            }
+
+            shape_type newShape(axes.size());
+            stride_type sourceStrides(axes.size());
+            for (size_t i = 0; i < axes.size(); i++)
+            {
+                newShape[i] = m_shape[axes[i]];
+                sourceStrides[i] = m_strides[axes[i]];
+            }
+
+            Tensor result(newShape, 0.0f);
+            if (m_totalElements == 0)
+            {
+                return result;
+            }
+
+            // drop the dimensions of size 1 and merge the ones which are contiguous on both sides
+            shape_type shape;
+            stride_type source;
+            stride_type target;
+            for (size_t i = 0; i < newShape.size(); i++)
+            {
+                if (newShape[i] == 1)
+                {
+                    continue;
+                }
+
+                if (!shape.empty() &&
+                    source.back() == sourceStrides[i] * newShape[i] &&
+                    target.back() == result.m_strides[i] * newShape[i])
+                {
+                    shape.back() *= newShape[i];
+                    source.back() = sourceStrides[i];
+                    target.back() = result.m_strides[i];
+                    continue;
+                }
+
+                shape.push_back(newShape[i]);
+                source.push_back(sourceStrides[i]);
+                target.push_back(result.m_strides[i]);
+            }
+
+            if (shape.empty() || source.back() == 1)
+            {
+                // the rows are contiguous on both sides
+                ShapeIterator it(shape, {source, target});
+                while (!it.is_end())
+                {
+                    std::memcpy(result.m_data + it.get_offset(1), m_data + it.get_offset(0),
+                                it.get_inner_size() * sizeof(float));
+                    it.next();
+                }
+
+                return result;
+            }
+
+            // the last dimension of the result and the one which is contiguous in the source
+            // form a matrix to be transposed, the other ones are walked over
+            const size_t last = shape.size() - 1;
+            size_t inner = 0;
+            while (source[inner] != 1)
+            {
+                inner++;
+            }
+
+            shape_type outerShape;
+            stride_type outerSource;
+            stride_type outerTarget;
+            for (size_t i = 0; i < last; i++)
+            {
+                if (i != inner)
+                {
+                    outerShape.push_back(shape[i]);
+                    outerSource.push_back(source[i]);
+                    outerTarget.push_back(target[i]);
+                }
+            }
+
+            ShapeIterator it(outerShape, {outerSource, outerTarget});
+            while (!it.is_end())
+            {
+                for (size_t i = 0; i < it.get_inner_size(); i++)
+                {
+                    transpose_matrix(m_data + it.get_offset(0) + i * it.get_inner_stride(0), source[last],
+                                     result.m_data + it.get_offset(1) + i * it.get_inner_stride(1), target[inner],
+                                     shape[last], shape[inner]);
+                }
+
+                it.next();
+            }
+
+            return result;
+        }
+
+        void Tensor::transpose_in_place(const size_t &axis1, const size_t &axis2)
+        {
+            if (axis1 >= m_shape.size() || axis2 >= m_shape.size() || m_shape[axis1] != m_shape[axis2])
+            {
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(buffer, sizeof(buffer),
+                         "Cannot swap the axes %zu and %zu of %s in place",
+                         axis1, axis2, Shape::convert_shape_to_string(m_shape).c_str());
+                throw std::invalid_argument(buffer);
+            }
+
+            if (axis1 == axis2)
+            {
+                return;
+            }
+
+            detach();
+
+            // every slice over the two axes is a square matrix
+            shape_type outerShape;
+            stride_type outerStrides;
+            for (size_t i = 0; i < m_shape.size(); i++)
+            {
+                if (i != axis1 && i != axis2)
+                {
+                    outerShape.push_back(m_shape[i]);
+                    outerStrides.push_back(m_strides[i]);
+                }
+            }
+
+            const size_t rowStride = m_strides[axis1 < axis2 ? axis1 : axis2];
+            const size_t columnStride = m_strides[axis1 < axis2 ? axis2 : axis1];
+
+            ShapeIterator it(outerShape, {outerStrides});
+            while (!it.is_end())
+            {
+                for (size_t i = 0; i < it.get_inner_size(); i++)
+                {
+                    transpose_square_in_place(m_data + it.get_offset(0) + i * it.get_inner_stride(0),
+                                              m_shape[axis1], rowStride, columnStride);
+                }
+
+                it.next();
+            }
+        }
+
+        static size_t get_layout_block(const TensorLayout &layout)
+        {
+            switch (layout)
+            {
+            case TensorLayout::NCHW8c:
+                return 8;
+            case TensorLayout::NCHW16c:
+                return 16;
+            default:
+                return 0;
+            }
+        }
+
+        size_t Tensor::get_channels() const
+        {
+            switch (m_layout)
+            {
+            case TensorLayout::NHWC:
+                return m_shape[3];
+            case TensorLayout::NCHW8c:
+            case TensorLayout::NCHW16c:
+                return m_channels;
+            default:
+                return m_shape.empty() ? 0 : m_shape[0];
+            }
+        }
+
+        void Tensor::set_layout(const TensorLayout &layout, const size_t &channels)
+        {
+            const size_t block = get_layout_block(layout);
+            bool isValid = true;
+
+            if (layout == TensorLayout::NHWC)
+            {
+                isValid = m_shape.size() == 4;
+            }
+            else if (block != 0)
+            {
+                isValid = m_shape.size() == 5 && m_shape[4] == block &&
+                          channels <= m_shape[1] * block && channels + block > m_shape[1] * block;
+            }
+
+            if (!isValid)
+            {
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(buffer, sizeof(buffer),
+                         "The shape %s with %zu channels does not match the layout",
+                         Shape::convert_shape_to_string(m_shape).c_str(), channels);
+                throw std::invalid_argument(buffer);
+            }
+
+            m_layout = layout;
+            m_channels = block != 0 ? channels : 0;
+        }
+
+        Tensor Tensor::to_layout(const TensorLayout &layout) const
+        {
+            if (layout == m_layout)
+            {
+                return *this;
+            }
+
+            const size_t block = get_layout_block(m_layout);
+            if (m_shape.size() != (block != 0 ? 5 : 4))
+            {
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(buffer, sizeof(buffer),
+                         "Only the 4D activations can be reordered: %s",
+                         Shape::convert_shape_to_string(m_shape).c_str());
+                throw std::invalid_argument(buffer);
+            }
+
+            // every conversion goes through the default layout
+            Tensor plain = *this;
+            if (m_layout == TensorLayout::NHWC)
+            {
+                plain = permute({3, 0, 1, 2});
+            }
+            else if (block != 0)
+            {
+                // [N, C / b, H, W, b] -> [C / b, b, N, H, W], then drop the padding channels
+                plain = permute({1, 4, 0, 2, 3});
+                plain.reshape({m_shape[1] * block, m_shape[0], m_shape[2], m_shape[3]});
+
+                if (m_channels != m_shape[1] * block)
+                {
+                    Tensor trimmed({m_channels, m_shape[0], m_shape[2], m_shape[3]}, 0.0f);
+                    std::memcpy(trimmed.m_data, plain.m_data, trimmed.m_totalElements * sizeof(float));
+                    plain = trimmed;
+                }
+            }
+            plain.m_layout = TensorLayout::CNHW;
+            plain.m_channels = 0;
+
+            if (layout == TensorLayout::CNHW)
+            {
+                return plain;
+            }
+
+            if (layout == TensorLayout::NHWC)
+            {
+                Tensor result = plain.permute({1, 2, 3, 0});
+                result.m_layout = TensorLayout::NHWC;
+                return result;
+            }
+
+            const size_t targetBlock = get_layout_block(layout);
+            const size_t channels = plain.m_shape[0];
+            const size_t blocks = (channels + targetBlock - 1) / targetBlock;
+
+            if (blocks * targetBlock != channels)
+            {
+                // the channels are outermost, the padding is appended at the end
+                Tensor padded({blocks * targetBlock, plain.m_shape[1], plain.m_shape[2], plain.m_shape[3]}, 0.0f);
+                std::memcpy(padded.m_data, plain.m_data, plain.m_totalElements * sizeof(float));
+                plain = padded;
+            }
+
+            plain.reshape({blocks, targetBlock, plain.m_shape[1], plain.m_shape[2], plain.m_shape[3]});
+            Tensor result = plain.permute({2, 0, 3, 4, 1});
+            result.m_layout = layout;
+            result.m_channels = channels;
+            return result;
+        }
+
+        void Tensor::save(const std::string &filename) const
+        {
+            unsigned char shape_size = m_shape.size();
+            size_t total_size = 1 + shape_size * sizeof(size_t) + m_totalElements * sizeof(float);
+            unsigned char *full_tensor_data =
+                (unsigned char *)malloc(sizeof(unsigned char) * total_size);
+
+            size_t current_index = 0;
+            full_tensor_data[current_index++] = shape_size;
+            for (size_t i = 0; i < shape_size; i++)
+            {
+                TensorShapeData data;
+                data.value = m_shape[i];
+                memcpy(full_tensor_data + current_index, &data.bytes, sizeof(data.bytes));
+                current_index += sizeof(data.bytes);
+            }
+
+            memcpy(full_tensor_data + current_index, m_data, m_totalElements * sizeof(float));
+
+            std::ofstream file(filename, std::ios::binary | std::ios::ate);
+            file.write(reinterpret_cast<const char *>(full_tensor_data), total_size);
+            file.close();
+
+            free(full_tensor_data);
+        }
+
+        Tensor Tensor::from_bytes(const std::string &filename)
+        {
+            std::ifstream file(filename, std::ios::binary | std::ios::ate);
+            if (!file.is_open())
+            {
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(
+                    buffer, sizeof(buffer),
+                    "Failed to open file: %s",
+                    filename.c_str());
+                throw std::runtime_error(buffer);
+            }
+            size_t file_size = file.tellg();
+            file.seekg(0, std::ios::beg);
+
+            // the header, then the elements straight into the tensor without a copy of the file
+            unsigned char shape_size = 0;
+            file.read(reinterpret_cast<char *>(&shape_size), 1);
+            shape_type shape(shape_size);
+            for (size_t i = 0; i < shape_size; i++)
+            {
+                TensorShapeData data;
+                file.read(reinterpret_cast<char *>(data.bytes), sizeof(data.bytes));
+                shape[i] = data.value;
+            }
+
+            const size_t header_size = 1 + shape_size * sizeof(TensorShapeData);
+            size_t total_elements = 1;
+            for (size_t i = 0; i < shape_size; i++)
+            {
+                total_elements *= shape[i];
+            }
+
+            if (!file || file_size < header_size || (file_size - header_size) / sizeof(float) < total_elements)
+            {
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(
+                    buffer, sizeof(buffer),
+                    "The file %s is too small for the shape %s",
+                    filename.c_str(), Shape::convert_shape_to_string(shape).c_str());
+                throw std::runtime_error(buffer);
+            }
+
+            Tensor result(shape, 0.0f);
+            file.read(reinterpret_cast<char *>(result.m_data), result.getTotalElements() * sizeof(float));
+            return result;
+        }
+
+        std::string Tensor::to_string() const
+        {
+            std::string result = "[\n";
+
+            size_t currentTabNumber = 0;
+
+            for (size_t i = 0; i < m_shape.size(); i++)
+            {
+                currentTabNumber++;
+                for (size_t j = 0; j < currentTabNumber; j++)
+                {
+                    result += "\t";
+                }
+                result += "[\n";
+            }
+
+            currentTabNumber++;
+
+            Shape shape(m_shape);
+
+            while (!shape.is_end())
+            {
+                if (shape.is_first_element())
+                {
+                    for (size_t i = 0; i < currentTabNumber; i++)
+                    {
+                        result += "\t";
+                    }
+
+                    result += std::to_string(get_element(shape.get_current_index())) + ", \n";
+
+                    shape.next();
+                    continue;
+                }
+
+                size_t numberOfNewLines = shape.get_number_of_new_lines();
+                for (int i = numberOfNewLines - 1; i >= 0; i--)
+                {
+                    currentTabNumber--;
+                    for (size_t j = 0; j < currentTabNumber; j++)
+                    {
+                        result += "\t";
+                    }
+                    result += "],\n";
+                }
+
+                for (int i = 0; i < numberOfNewLines; i++)
+                {
+                    for (size_t j = 0; j < currentTabNumber; j++)
+                    {
+                        result += "\t";
+                    }
+                    result += "[\n";
+                    currentTabNumber++;
+                }
+
+                for (size_t i = 0; i < currentTabNumber; i++)
+                {
+                    result += "\t";
+                }
+
+                result += std::to_string(get_element(shape.get_current_index())) + ", \n";
+
+                shape.next();
+            }
+
+            while (currentTabNumber > 0)
+            {
+                currentTabNumber--;
+                for (size_t j = 0; j < currentTabNumber; j++)
+                {
+                    result += "\t";
+                }
+                result += "]\n";
+            }
+
+            return result;
+        }
+
+        /**
+         * Whether an element-wise layer can write its output for the input into the tensor.
+         */
+        static bool is_same_activation(const Tensor &input, const Tensor &output)
+        {
+            return input.get_layout() == output.get_layout() &&
+                   Shape::is_shape_equal(input.get_shape(), output.get_shape());
+        }
+
+        /**
+         * A tensor for the output of an element-wise layer, in the layout of the input.
+         */
+        static Tensor create_activation(const Tensor &input)
+        {
+            Tensor result(input.get_shape(), 0.0f);
+            if (input.get_layout() != TensorLayout::CNHW)
+            {
+                result.set_layout(input.get_layout(), input.get_channels());
+            }
+
+            return result;
+        }
+
+        Tensor ReLULayer::forward(const Tensor &input)
+        {
+            Tensor result = create_activation(input);
+            forward_into(input, result);
+            return result;
+        }
+
+        bool ReLULayer::forward_into(const Tensor &input, Tensor &output)
+        {
+            if (!is_same_activation(input, output))
+            {
+                return false;
+            }
+
+            const float *inputData = input.get_data();
+            float *resultData = output.get_mutable_data();
+
+            for (size_t i = 0; i < input.getTotalElements(); i++)
+            {
+                resultData[i] = getMax(0.0f, inputData[i]);
+            }
+
+            return true;
+        }
+
+        Clip2DLayer::Clip2DLayer(const float &min, const float &max)
+            : m_min(min), m_max(max)
+        {
+        }
+
+        Tensor Clip2DLayer::forward(const Tensor &input)
+        {
+            Tensor result = create_activation(input);
+            forward_into(input, result);
+            return result;
+        }
+
+        bool Clip2DLayer::forward_into(const Tensor &input, Tensor &output)
+        {
+            if (!is_same_activation(input, output))
+            {
+                return false;
+            }
+
+            const float *inputData = input.get_data();
+            float *resultData = output.get_mutable_data();
+
+            for (size_t i = 0; i < input.getTotalElements(); i++)
+            {
+                resultData[i] = getMax(m_min, getMin(inputData[i], m_max));
+            }
+
+            return true;
+        }
+
+        /**
+         * @return: the number of blocks with at least one weight above the threshold.
+         */
+        static size_t count_sparse_blocks(const float *weights, const size_t &rows, const size_t &columns,
+                                          const size_t &blockRows, const size_t &blockColumns, const float &threshold)
+        {
+            size_t count = 0;
+
+            for (size_t i = 0; i < rows; i += blockRows)
+            {
+                for (size_t j = 0; j < columns; j += blockColumns)
+                {
+                    bool isEmpty = true;
+                    for (size_t r = i; r < i + blockRows && r < rows && isEmpty; r++)
+                    {
+                        for (size_t c = j; c < j + blockColumns && c < columns; c++)
+                        {
+                            if (std::fabs(weights[r * columns + c]) > threshold)
+                            {
+                                isEmpty = false;
+                                break;
+                            }
+                        }
+                    }
+
+                    count += isEmpty ? 0 : 1;
+                }
+            }
+
+            return count;
+        }
+
+        SparseWeights::SparseWeights()
+            : m_format(SparseFormat::CSR), m_rows(0), m_columns(0),
+              m_blockRows(1), m_blockColumns(1), m_rowOffsets(1, 0)
+        {
+        }
+
+        SparseWeights SparseWeights::from_dense(const Tensor &weights, const float &threshold, const SparseFormat &format)
+        {
+            const shape_type shape = weights.get_shape();
+            if (shape.size() != 2 && !(shape.size() == 4 && shape[2] == 1 && shape[3] == 1))
+            {
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(buffer, sizeof(buffer),
+                         "Sparse weights must be a 2D tensor or the weights of a 1x1 convolution: %s",
+                         Shape::convert_shape_to_string(shape).c_str());
+                throw std::invalid_argument(buffer);
+            }
+
+            const float *data = weights.get_data();
+            SparseWeights result;
+            result.m_format = format;
+            result.m_rows = shape[0];
+            result.m_columns = shape[1];
+
+            if (format == SparseFormat::Automatic)
+            {
+                // the blocks are only worth it when they do not store many more zeros
+                const size_t nonZeros = count_sparse_blocks(data, result.m_rows, result.m_columns, 1, 1, threshold);
+                result.m_format = SparseFormat::CSR;
+
+                if (count_sparse_blocks(data, result.m_rows, result.m_columns, 4, 4, threshold) * 16 * 2 < nonZeros * 3)
+                {
+                    result.m_format = SparseFormat::Block4x4;
+                }
+                else if (count_sparse_blocks(data, result.m_rows, result.m_columns, 1, 4, threshold) * 4 * 2 < nonZeros * 3)
+                {
+                    result.m_format = SparseFormat::Block1x4;
+                }
+            }
+
+            result.m_blockRows = result.m_format == SparseFormat::Block4x4 ? 4 : 1;
+            result.m_blockColumns = result.m_format == SparseFormat::CSR ? 1 : 4;
+            const size_t blockSize = result.m_blockRows * result.m_blockColumns;
+
+            for (size_t i = 0; i < result.m_rows; i += result.m_blockRows)
+            {
+                for (size_t j = 0; j < result.m_columns; j += result.m_blockColumns)
+                {
+                    float block[16] = {};
+                    bool isEmpty = true;
+
+                    // the weights below the threshold and the ones outside of the matrix are zeros
+                    for (size_t r = 0; r < result.m_blockRows && i + r < result.m_rows; r++)
+                    {
+                        for (size_t c = 0; c < result.m_blockColumns && j + c < result.m_columns; c++)
+                        {
+                            const float weight = data[(i + r) * result.m_columns + j + c];
+                            if (std::fabs(weight) > threshold)
+                            {
+                                block[r * result.m_blockColumns + c] = weight;
+                                isEmpty = false;
+                            }
+                        }
+                    }
+
+                    if (!isEmpty)
+                    {
+                        result.m_columnIndexes.push_back(j);
+                        result.m_values.insert(result.m_values.end(), block, block + blockSize);
+                    }
+                }
+
+                result.m_rowOffsets.push_back(result.m_columnIndexes.size());
+            }
+
+            return result;
+        }
+
+        SparseWeights SparseWeights::from_bytes(const std::string &filename, const float &threshold, const SparseFormat &format)
+        {
+            return from_dense(Tensor::from_bytes(filename), threshold, format);
+        }
+
+        Tensor SparseWeights::to_dense() const
+        {
+            Tensor result({m_rows, m_columns}, 0.0f);
+            float *data = result.get_mutable_data();
+            const size_t blockSize = m_blockRows * m_blockColumns;
+
+            for (size_t i = 0; i + 1 < m_rowOffsets.size(); i++)
+            {
+                for (size_t b = m_rowOffsets[i]; b < m_rowOffsets[i + 1]; b++)
+                {
+                    for (size_t r = 0; r < m_blockRows && i * m_blockRows + r < m_rows; r++)
+                    {
+                        for (size_t c = 0; c < m_blockColumns && m_columnIndexes[b] + c < m_columns; c++)
+                        {
+                            data[(i * m_blockRows + r) * m_columns + m_columnIndexes[b] + c] =
+                                m_values[b * blockSize + r * m_blockColumns + c];
+                        }
+                    }
+                }
+            }
+
+            return result;
+        }
+
+        float SparseWeights::get_density() const
+        {
+            if (m_rows == 0 || m_columns == 0)
+            {
+                return 0.0f;
+            }
+
+            return static_cast<float>(m_values.size()) / static_cast<float>(m_rows * m_columns);
+        }
+
+        void SparseWeights::multiply(const float *input, const size_t &inputStride, const size_t &columns,
+                                     float *result, const size_t &resultStride) const
+        {
+            const size_t blockSize = m_blockRows * m_blockColumns;
+
+            // the blocks of a row are sorted by column, so every output still sees k in order
+            for (size_t i = 0; i + 1 < m_rowOffsets.size(); i++)
+            {
+                for (size_t b = m_rowOffsets[i]; b < m_rowOffsets[i + 1]; b++)
+                {
+                    const float *block = m_values.data() + b * blockSize;
+
+                    for (size_t r = 0; r < m_blockRows && i * m_blockRows + r < m_rows; r++)
+                    {
+                        float *resultRow = result + (i * m_blockRows + r) * resultStride;
+
+                        for (size_t c = 0; c < m_blockColumns && m_columnIndexes[b] + c < m_columns; c++)
+                        {
+                            const float weight = block[r * m_blockColumns + c];
+                            const float *inputRow = input + (m_columnIndexes[b] + c) * inputStride;
+
+                            for (size_t j = 0; j < columns; j++)
+                            {
+                                resultRow[j] += weight * inputRow[j];
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        /**
+         * The cheap test before building the sparse weights: whether few enough weights are
+         *      not zero for the sparse kernels to win.
+         */
+        static bool is_sparse_enough(const Tensor &weights)
+        {
+            const float *data = weights.get_data();
+            size_t nonZeros = 0;
+
+            for (size_t i = 0; i < weights.getTotalElements(); i++)
+            {
+                nonZeros += data[i] != 0.0f ? 1 : 0;
+            }
+
+            return nonZeros <= NTT_SPARSE_MAX_DENSITY * weights.getTotalElements();
+        }
+
+        bool PackedWeightCache::contains(const std::string &format) const
+        {
+            for (size_t i = 0; i < m_entries.size(); i++)
+            {
+                if (m_entries[i].first == format)
+                {
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        const Tensor &PackedWeightCache::get(const std::string &format) const
+        {
+            for (size_t i = 0; i < m_entries.size(); i++)
+            {
+                if (m_entries[i].first == format)
+                {
+                    return m_entries[i].second;
+                }
+            }
+
+            char buffer[NTT_ERROR_MESSAGE_SIZE];
+            snprintf(buffer, sizeof(buffer), "No packed weights in the format: %s", format.c_str());
+            throw std::out_of_range(buffer);
+        }
+
+        void PackedWeightCache::set(const std::string &format, const Tensor &weights)
+        {
+            for (size_t i = 0; i < m_entries.size(); i++)
+            {
+                if (m_entries[i].first == format)
+                {
+                    m_entries[i].second = weights;
+                    return;
+                }
+            }
+
+            m_entries.push_back(std::make_pair(format, weights));
+        }
+
+        static void write_size(std::ofstream &file, const size_t &value)
+        {
+            TensorShapeData data;
+            data.value = value;
+            file.write(reinterpret_cast<const char *>(data.bytes), sizeof(data.bytes));
+        }
+
+        static size_t read_size(std::ifstream &file)
+        {
+            TensorShapeData data;
+            file.read(reinterpret_cast<char *>(data.bytes), sizeof(data.bytes));
+            return data.value;
+        }
+
+        void PackedWeightCache::save(const std::string &filename) const
+        {
+            // the number of formats, then for each one its name and the tensor like in Tensor::save
+            std::ofstream file(filename, std::ios::binary);
+            write_size(file, m_entries.size());
+
+            for (size_t i = 0; i < m_entries.size(); i++)
+            {
+                const std::string &format = m_entries[i].first;
+                const Tensor &weights = m_entries[i].second;
+                const shape_type shape = weights.get_shape();
+                const unsigned char shapeSize = static_cast<unsigned char>(shape.size());
+
+                write_size(file, format.size());
+                file.write(format.data(), format.size());
+                file.write(reinterpret_cast<const char *>(&shapeSize), 1);
+                for (size_t j = 0; j < shape.size(); j++)
+                {
+                    write_size(file, shape[j]);
+                }
+                file.write(reinterpret_cast<const char *>(weights.get_data()), weights.getTotalElements() * sizeof(float));
+            }
+        }
+
+        PackedWeightCache PackedWeightCache::from_bytes(const std::string &filename)
+        {
+            std::ifstream file(filename, std::ios::binary | std::ios::ate);
+            if (!file.is_open())
+            {
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(buffer, sizeof(buffer), "Failed to open file: %s", filename.c_str());
+                throw std::runtime_error(buffer);
+            }
+            const size_t fileSize = file.tellg();
+            file.seekg(0, std::ios::beg);
+
+            PackedWeightCache result;
+            bool isValid = true;
+            const size_t count = read_size(file);
+
+            for (size_t i = 0; i < count && isValid && file.good(); i++)
+            {
+                // the sizes read from a corrupted file must not allocate more than it holds
+                const size_t formatSize = read_size(file);
+                if (!file.good() || formatSize > fileSize)
+                {
+                    isValid = false;
+                    break;
+                }
+                std::string format(formatSize, '\0');
+                file.read(&format[0], format.size());
+
+                unsigned char shapeSize = 0;
+                file.read(reinterpret_cast<char *>(&shapeSize), 1);
+                shape_type shape(shapeSize);
+                size_t elements = 1;
+                for (size_t j = 0; j < shape.size() && isValid; j++)
+                {
+                    shape[j] = read_size(file);
+                    isValid = shape[j] == 0 || elements <= fileSize / shape[j];
+                    elements *= shape[j];
+                }
+
+                if (!isValid || !file.good() || elements > fileSize / sizeof(float))
+                {
+                    isValid = false;
+                    break;
+                }
+
+                Tensor weights(shape, 0.0f);
+                file.read(reinterpret_cast<char *>(weights.get_mutable_data()), weights.getTotalElements() * sizeof(float));
+                result.set(format, weights);
+            }
+
+            if (!isValid || !file.good())
+            {
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(buffer, sizeof(buffer), "Truncated packed weights file: %s", filename.c_str());
+                throw std::runtime_error(buffer);
+            }
+
+            return result;
+        }
+
+        bool WeightBundle::contains(const std::string &name) const
+        {
+            for (size_t i = 0; i < m_entries.size(); i++)
+            {
+                if (m_entries[i].first == name)
+                {
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        const Tensor &WeightBundle::get(const std::string &name) const
+        {
+            for (size_t i = 0; i < m_entries.size(); i++)
+            {
+                if (m_entries[i].first == name)
+                {
+                    return m_entries[i].second;
+                }
+            }
+
+            char buffer[NTT_ERROR_MESSAGE_SIZE];
+            snprintf(buffer, sizeof(buffer), "No weights in the bundle with the name: %s", name.c_str());
+            throw std::out_of_range(buffer);
+        }
+
+        void WeightBundle::set(const std::string &name, const Tensor &weights)
+        {
+            for (size_t i = 0; i < m_entries.size(); i++)
+            {
+                if (m_entries[i].first == name)
+                {
+                    m_entries[i].second = weights;
+                    return;
+                }
+            }
+
+            m_entries.push_back(std::make_pair(name, weights));
+        }
+
+        std::vector<std::string> WeightBundle::get_names() const
+        {
+            std::vector<std::string> names;
+            for (size_t i = 0; i < m_entries.size(); i++)
+            {
+                names.push_back(m_entries[i].first);
+            }
+
+            return names;
+        }
+
+        static const char s_bundleMagic[] = {'N', 'T', 'T', 'B'};
+
+        /**
+         * How the bytes of a chunk of WeightBundle are stored.
+         */
+        enum class BundleCodec : unsigned char
+        {
+            Stored = 0,
+            ShuffledLz = 1
+        };
+
+        /**
+         * A chunk of a tensor of WeightBundle: its bytes in the tensor and in the file.
+         */
+        struct BundleChunk
+        {
+            unsigned char *data;
+            size_t size;
+            size_t storedSize;
+            BundleCodec codec;
+            size_t payload;
+        };
+
+        static size_t get_chunk_count(const size_t &bytes)
+        {
+            static_assert(NTT_BUNDLE_CHUNK_SIZE % sizeof(float) == 0, "NTT_BUNDLE_CHUNK_SIZE must be a multiple of 4");
+            return (bytes + NTT_BUNDLE_CHUNK_SIZE - 1) / NTT_BUNDLE_CHUNK_SIZE;
+        }
+
+        void WeightBundle::save(const std::string &filename) const
+        {
+            // the chunks of all the tensors are compressed at once
+            std::vector<const unsigned char *> sources;
+            std::vector<size_t> sizes;
+            for (size_t i = 0; i < m_entries.size(); i++)
+            {
+                const Tensor &weights = m_entries[i].second;
+                const unsigned char *data = reinterpret_cast<const unsigned char *>(weights.get_data());
+                const size_t bytes = weights.getTotalElements() * sizeof(float);
+                for (size_t offset = 0; offset < bytes; offset += NTT_BUNDLE_CHUNK_SIZE)
+                {
+                    sources.push_back(data + offset);
+                    sizes.push_back(bytes - offset < NTT_BUNDLE_CHUNK_SIZE ? bytes - offset : NTT_BUNDLE_CHUNK_SIZE);
+                }
+            }
+
+            std::vector<std::vector<uint8_t>> payloads(sources.size());
+            ThreadPool::get_default().parallel_for(sources.size(), 1, [&](size_t begin, size_t end)
+                                                   {
+                std::vector<uint8_t> shuffled;
+                for (size_t i = begin; i < end; i++)
+                {
+                    shuffled.resize(sizes[i]);
+                    shuffle_bytes(sources[i], shuffled.data(), sizes[i], sizeof(float));
+                    lz_compress(shuffled.data(), sizes[i], payloads[i]);
+
+                    // stored as they are when the codec does not help
+                    if (payloads[i].size() >= sizes[i])
+                    {
+                        payloads[i].clear();
+                    }
+                } });
+
+            // the magic and the number of tensors, then for each one its name, its shape and
+            //      its chunks (size, stored size, codec), then the payloads of all the chunks
+            std::ofstream file(filename, std::ios::binary);
+            file.write(s_bundleMagic, sizeof(s_bundleMagic));
+            write_size(file, m_entries.size());
+
+            size_t chunk = 0;
+            for (size_t i = 0; i < m_entries.size(); i++)
+            {
+                const std::string &name = m_entries[i].first;
+                const shape_type shape = m_entries[i].second.get_shape();
+                const unsigned char shapeSize = static_cast<unsigned char>(shape.size());
+
+                write_size(file, name.size());
+                file.write(name.data(), name.size());
+                file.write(reinterpret_cast<const char *>(&shapeSize), 1);
+                for (size_t j = 0; j < shape.size(); j++)
+                {
+                    write_size(file, shape[j]);
+                }
+
+                const size_t chunks = get_chunk_count(m_entries[i].second.getTotalElements() * sizeof(float));
+                for (size_t j = 0; j < chunks; j++, chunk++)
+                {
+                    const BundleCodec codec = payloads[chunk].empty() ? BundleCodec::Stored : BundleCodec::ShuffledLz;
+                    write_size(file, sizes[chunk]);
+                    write_size(file, codec == BundleCodec::Stored ? sizes[chunk] : payloads[chunk].size());
+                    file.write(reinterpret_cast<const char *>(&codec), 1);
+                }
+            }
+
+            for (size_t i = 0; i < payloads.size(); i++)
+            {
+                if (payloads[i].empty())
+                {
+                    file.write(reinterpret_cast<const char *>(sources[i]), sizes[i]);
+                }
+                else
+                {
+                    file.write(reinterpret_cast<const char *>(payloads[i].data()), payloads[i].size());
+                }
+            }
+        }
+
+        WeightBundle WeightBundle::from_bytes(const std::string &filename)
+        {
+            std::ifstream file(filename, std::ios::binary | std::ios::ate);
+            if (!file.is_open())
+            {
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(buffer, sizeof(buffer), "Failed to open file: %s", filename.c_str());
+                throw std::runtime_error(buffer);
+            }
+            const size_t fileSize = file.tellg();
+            file.seekg(0, std::ios::beg);
+
+            char magic[sizeof(s_bundleMagic)] = {0};
+            file.read(magic, sizeof(magic));
+            if (!file.good() || std::memcmp(magic, s_bundleMagic, sizeof(magic)) != 0)
+            {
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(buffer, sizeof(buffer), "Not a weight bundle: %s", filename.c_str());
+                throw std::runtime_error(buffer);
+            }
+
+            WeightBundle result;
+            std::vector<BundleChunk> chunks;
+            size_t payloadSize = 0;
+            bool isValid = true;
+            const size_t count = read_size(file);
+
+            for (size_t i = 0; i < count && isValid && file.good(); i++)
+            {
+                std::string name(read_size(file), '\0');
+                if (name.size() > fileSize)
+                {
+                    isValid = false;
+                    break;
+                }
+                file.read(&name[0], name.size());
+
+                unsigned char shapeSize = 0;
+                file.read(reinterpret_cast<char *>(&shapeSize), 1);
+                shape_type shape(shapeSize);
+                size_t elements = 1;
+                for (size_t j = 0; j < shape.size(); j++)
+                {
+                    shape[j] = read_size(file);
+                    elements *= shape[j];
+                }
+
+                // a corrupted shape must not allocate more than the file can hold, the codec
+                //      expands the bytes at most 255 times
+                const size_t bytes = elements * sizeof(float);
+                if (!file.good() || bytes / 256 > fileSize)
+                {
+                    isValid = false;
+                    break;
+                }
+
+                Tensor weights(shape, 0.0f);
+                unsigned char *data = reinterpret_cast<unsigned char *>(weights.get_mutable_data());
+                size_t offset = 0;
+                for (size_t j = 0; j < get_chunk_count(bytes); j++)
+                {
+                    BundleChunk chunk;
+                    chunk.data = data + offset;
+                    chunk.size = read_size(file);
+                    chunk.storedSize = read_size(file);
+                    file.read(reinterpret_cast<char *>(&chunk.codec), 1);
+                    chunk.payload = payloadSize;
+
+                    isValid = isValid && chunk.size <= bytes - offset &&
+                              (chunk.codec == BundleCodec::ShuffledLz ||
+                               (chunk.codec == BundleCodec::Stored && chunk.storedSize == chunk.size));
+                    offset += chunk.size;
+                    payloadSize += chunk.storedSize;
+                    chunks.push_back(chunk);
+                }
+
+                isValid = isValid && offset == bytes;
+                result.m_entries.push_back(std::make_pair(name, weights));
+            }
+
+            const size_t headerSize = file.good() ? static_cast<size_t>(file.tellg()) : fileSize;
+            if (!isValid || !file.good() || fileSize - headerSize < payloadSize)
+            {
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(buffer, sizeof(buffer), "Corrupted weight bundle: %s", filename.c_str());
+                throw std::runtime_error(buffer);
+            }
+
+            std::vector<uint8_t> payloads(payloadSize);
+            file.read(reinterpret_cast<char *>(payloads.data()), payloadSize);
+
+            ThreadPool::get_default().parallel_for(chunks.size(), 1, [&](size_t begin, size_t end)
+                                                   {
+                std::vector<uint8_t> shuffled;
+                for (size_t i = begin; i < end; i++)
+                {
+                    const BundleChunk &chunk = chunks[i];
+                    const uint8_t *payload = payloads.data() + chunk.payload;
+                    if (chunk.codec == BundleCodec::Stored)
+                    {
+                        std::memcpy(chunk.data, payload, chunk.size);
+                        continue;
+                    }
+
+                    shuffled.resize(chunk.size);
+                    lz_decompress(payload, chunk.storedSize, shuffled.data(), chunk.size);
+                    unshuffle_bytes(shuffled.data(), chunk.data, chunk.size, sizeof(float));
+                } });
+
+            return result;
+        }
+
+        /**
+         * @return: whether the cache already has the packed weights of the format. Throws
+         *      std::invalid_argument when the cached tensor does not have the expected shape,
+         *      e.g. when the cache was saved for another model.
+         */
+        static bool has_cached_weights(const PackedWeightCache &cache, const std::string &format,
+                                       const shape_type &shape)
+        {
+            if (!cache.contains(format))
+            {
+                return false;
+            }
+
+            const Tensor &cached = cache.get(format);
+            if (!Shape::is_shape_equal(cached.get_shape(), shape))
+            {
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(buffer, sizeof(buffer),
+                         "Packed weights %s do not match the layer: %s != %s", format.c_str(),
+                         Shape::convert_shape_to_string(cached.get_shape()).c_str(),
+                         Shape::convert_shape_to_string(shape).c_str());
+                throw std::invalid_argument(buffer);
+            }
+
+            return true;
+        }
+
+        static std::string get_gemm_format()
+        {
+            return "gemm" + std::to_string(NTT_GEMM_PANEL_ROWS);
+        }
+
+        /**
+         * The GEMM micro-kernel of the fully connected layer: a packed panel of weights
+         *      ([input][NTT_GEMM_PANEL_ROWS]) times Columns contiguous columns of the input.
+         *      The whole tile is accumulated in registers and every output still adds its
+         *      products in the order of the inputs.
+         */
+        template <size_t Columns>
+        static inline void multiply_gemm_panel(const float *panel, const float *input, const size_t &inputSize,
+                                               const size_t &batchSize, float *result, const size_t &rows)
+        {
+            float accumulators[NTT_GEMM_PANEL_ROWS][Columns] = {};
+
+            for (size_t k = 0; k < inputSize; k++)
+            {
+                const float *weights = panel + k * NTT_GEMM_PANEL_ROWS;
+                const float *inputRow = input + k * batchSize;
+
+                for (size_t r = 0; r < NTT_GEMM_PANEL_ROWS; r++)
+                {
+                    for (size_t c = 0; c < Columns; c++)
+                    {
+                        accumulators[r][c] += weights[r] * inputRow[c];
+                    }
+                }
+            }
+
+            for (size_t r = 0; r < rows; r++)
+            {
+                for (size_t c = 0; c < Columns; c++)
+                {
+                    result[r * batchSize + c] = accumulators[r][c];
+                }
+            }
+        }
+
+        static void check_fully_connected_weights(const Tensor &weights, const Tensor &bias)
+        {
+            if (weights.get_shape().size() != 2)
+            {
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(buffer, sizeof(buffer),
+                         "Weights must be a 2D tensor: %s",
+                         Shape::convert_shape_to_string(weights.get_shape()).c_str());
+                throw std::invalid_argument(buffer);
+            }
+
+            if (bias.get_shape().size() != 2)
+            {
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(buffer, sizeof(buffer),
+                         "Bias must be a 2D tensor: %s",
+                         Shape::convert_shape_to_string(bias.get_shape()).c_str());
+                throw std::invalid_argument(buffer);
+            }
+
+            if (weights.get_shape()[0] != bias.get_shape()[0])
+            {
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(buffer, sizeof(buffer),
+                         "Weights and bias dimensions mismatch: %s != %s",
+                         Shape::convert_shape_to_string(weights.get_shape()).c_str(),
+                         Shape::convert_shape_to_string(bias.get_shape()).c_str());
+                throw std::invalid_argument(buffer);
+            }
+        }
+
+        FullyConnectedLayer::FullyConnectedLayer(const Tensor &weights, const Tensor &bias,
+                                                 const PackedWeightCache &packedWeights)
+            : m_weights(weights), m_bias(bias), m_packedWeights(packedWeights), m_isSparse(false)
+        {
+            check_fully_connected_weights(m_weights, m_bias);
+
+            // pruned weights, unless the cache says the dense kernel was used when it was saved
+            if (!m_packedWeights.contains(get_gemm_format()) && is_sparse_enough(m_weights))
+            {
+                m_sparseWeights = SparseWeights::from_dense(m_weights);
+                m_isSparse = m_sparseWeights.get_density() <= NTT_SPARSE_MAX_DENSITY;
+            }
+
+            if (m_isSparse)
+            {
+                return;
+            }
+
+            const size_t outputSize = m_weights.get_shape()[0];
+            const size_t inputSize = m_weights.get_shape()[1];
+            const size_t panels = (outputSize + NTT_GEMM_PANEL_ROWS - 1) / NTT_GEMM_PANEL_ROWS;
+            const shape_type packedShape = {panels, inputSize, NTT_GEMM_PANEL_ROWS};
+
+            if (!has_cached_weights(m_packedWeights, get_gemm_format(), packedShape))
+            {
+                // [panel, input, row], the rows after the last output stay zeros
+                Tensor packed(packedShape, 0.0f);
+                const float *source = m_weights.get_data();
+                float *destination = packed.get_mutable_data();
+
+                for (size_t i = 0; i < outputSize; i++)
+                {
+                    for (size_t k = 0; k < inputSize; k++)
+                    {
+                        destination[((i / NTT_GEMM_PANEL_ROWS) * inputSize + k) * NTT_GEMM_PANEL_ROWS + i % NTT_GEMM_PANEL_ROWS] =
+                            source[i * inputSize + k];
+                    }
+                }
+
+                m_packedWeights.set(get_gemm_format(), packed);
+            }
+        }
+
+        FullyConnectedLayer::FullyConnectedLayer(const SparseWeights &weights, const Tensor &bias)
+            : m_weights(weights.to_dense()), m_bias(bias), m_sparseWeights(weights), m_isSparse(true)
+        {
+            // the weights are already sparse, neither sparsified again nor packed into panels
+            check_fully_connected_weights(m_weights, m_bias);
+        }
+
+        Tensor FullyConnectedLayer::forward(const Tensor &input)
+        {
+            // assert the matrix has valid size
+            if (input.get_shape().size() != 2)
+            {
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(buffer, sizeof(buffer),
+                         "Input must be a 2D tensor: %s",
+                         Shape::convert_shape_to_string(input.get_shape()).c_str());
+                throw std::invalid_argument(buffer);
+            }
+
+            if (m_weights.get_shape()[1] != input.get_shape()[0])
+            {
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(buffer, sizeof(buffer),
+                         "Weights and input dimensions mismatch: %s != %s",
+                         Shape::convert_shape_to_string(m_weights.get_shape()).c_str(),
+                         Shape::convert_shape_to_string(input.get_shape()).c_str());
+                throw std::invalid_argument(buffer);
+            }
+
+            const size_t outputSize = m_weights.get_shape()[0];
+            const size_t inputSize = m_weights.get_shape()[1];
+            const size_t batchSize = input.get_shape()[1];
+
+            Tensor result({outputSize, batchSize}, 0.0f);
+            const float *inputData = input.get_data();
+            float *resultData = result.get_mutable_data();
+
+            if (m_isSparse)
+            {
+                m_sparseWeights.multiply(inputData, batchSize, batchSize, resultData, batchSize);
+                result += m_bias;
+                return result;
+            }
+
+            const float *weights = m_packedWeights.get(get_gemm_format()).get_data();
+            const size_t fullColumns = batchSize - batchSize % NTT_GEMM_PANEL_COLUMNS;
+
+            // one panel of rows at a time against tiles of the contiguous batch columns
+            for (size_t i = 0; i < outputSize; i += NTT_GEMM_PANEL_ROWS)
+            {
+                const float *panel = weights + i * inputSize;
+                const size_t rows = outputSize - i < NTT_GEMM_PANEL_ROWS ? outputSize - i : NTT_GEMM_PANEL_ROWS;
+
+                for (size_t j = 0; j < fullColumns; j += NTT_GEMM_PANEL_COLUMNS)
+                {
+                    multiply_gemm_panel<NTT_GEMM_PANEL_COLUMNS>(panel, inputData + j, inputSize, batchSize,
+                                                                resultData + i * batchSize + j, rows);
+                }
+
+                for (size_t j = fullColumns; j < batchSize; j++)
+                {
+                    multiply_gemm_panel<1>(panel, inputData + j, inputSize, batchSize,
+                                           resultData + i * batchSize + j, rows);
+                }
+            }
+
+            // the bias [outputSize, 1] is broadcast over the batch
+            result += m_bias;
+
+            return result;
+        }
+
+        /**
+         * The softmax of the slices along the axis, the whole tensor being a single slice
+         *      when there is no axis. The tensor is seen as [outer, size of the axis, inner]:
+         *      the contiguous slices (inner = 1) are normalized one by one and the strided
+         *      ones in blocks of columns, both spread over the threads.
+         */
+        static Tensor softmax_over_axis(const Tensor &input, const bool &isWholeTensor, const size_t &axis,
+                                        const ExpAccuracy &accuracy, const bool &isLog)
+        {
+            const shape_type shape = input.get_shape();
+            if (!isWholeTensor && axis >= shape.size())
+            {
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(buffer, sizeof(buffer),
+                         "Softmax axis %zu is out of range: %s", axis,
+                         Shape::convert_shape_to_string(shape).c_str());
+                throw std::invalid_argument(buffer);
+            }
+
+            size_t outer = 1;
+            size_t rows = input.getTotalElements();
+            size_t inner = 1;
+            if (!isWholeTensor)
+            {
+                rows = shape[axis];
+                for (size_t i = 0; i < axis; i++)
+                {
+                    outer *= shape[i];
+                }
+                for (size_t i = axis + 1; i < shape.size(); i++)
+                {
+                    inner *= shape[i];
+                }
+            }
+
+            Tensor result(shape, 0.0f);
+            const float *inputData = input.get_data();
+            float *resultData = result.get_mutable_data();
+
+            if (inner == 1)
+            {
+                auto normalizeSlices = [&](size_t begin, size_t end)
+                {
+                    for (size_t i = begin; i < end; i++)
+                    {
+                        if (isLog)
+                        {
+                            log_softmax_array(inputData + i * rows, resultData + i * rows, rows, accuracy);
+                        }
+                        else
+                        {
+                            softmax_array(inputData + i * rows, resultData + i * rows, rows, accuracy);
+                        }
+                    }
+                };
+
+                ThreadPool::get_default().parallel_for(outer, 1, normalizeSlices);
+                return result;
+            }
+
+            const size_t columnBlocks = (inner + NTT_SOFTMAX_COLUMN_BLOCK - 1) / NTT_SOFTMAX_COLUMN_BLOCK;
+            auto normalizeColumns = [&](size_t begin, size_t end)
+            {
+                for (size_t task = begin; task < end; task++)
+                {
+                    const size_t firstColumn = task % columnBlocks * NTT_SOFTMAX_COLUMN_BLOCK;
+                    const size_t offset = task / columnBlocks * rows * inner + firstColumn;
+                    const size_t columns = inner - firstColumn < NTT_SOFTMAX_COLUMN_BLOCK ? inner - firstColumn
+                                                                                          : NTT_SOFTMAX_COLUMN_BLOCK;
+                    softmax_columns(inputData + offset, resultData + offset, rows, inner, columns, accuracy, isLog);
+                }
+            };
+
+            ThreadPool::get_default().parallel_for(outer * columnBlocks, 1, normalizeColumns);
+
+            return result;
+        }
+
+        SoftmaxLayer::SoftmaxLayer(const ExpAccuracy &accuracy)
+            : m_accuracy(accuracy), m_isWholeTensor(true), m_axis(0)
+        {
+        }
+
+        SoftmaxLayer::SoftmaxLayer(const size_t &axis, const ExpAccuracy &accuracy)
+            : m_accuracy(accuracy), m_isWholeTensor(false), m_axis(axis)
+        {
+        }
+
+        Tensor SoftmaxLayer::forward(const Tensor &input)
+        {
+            return softmax_over_axis(input, m_isWholeTensor, m_axis, m_accuracy, false);
+        }
+
+        LogSoftmaxLayer::LogSoftmaxLayer(const ExpAccuracy &accuracy)
+            : SoftmaxLayer(accuracy)
+        {
+        }
+
+        LogSoftmaxLayer::LogSoftmaxLayer(const size_t &axis, const ExpAccuracy &accuracy)
+            : SoftmaxLayer(axis, accuracy)
+        {
+        }
+
+        Tensor LogSoftmaxLayer::forward(const Tensor &input)
+        {
+            return softmax_over_axis(input, m_isWholeTensor, m_axis, m_accuracy, true);
+        }
+
+        SigmoidLayer::SigmoidLayer(const ExpAccuracy &accuracy)
+            : m_accuracy(accuracy)
+        {
+        }
+
+        Tensor SigmoidLayer::forward(const Tensor &input)
+        {
+            Tensor result(input.get_shape(), 0.0f);
+            if (input.get_layout() != TensorLayout::CNHW)
+            {
+                result.set_layout(input.get_layout(), input.get_channels());
+            }
+
+            sigmoid_array(input.get_data(), result.get_mutable_data(), input.getTotalElements(), m_accuracy);
+
+            return result;
+        }
+
+        Tensor FlattenLayer::forward(const Tensor &input)
+        {
+            // the data is always contiguous, flattening only changes the shape
+            return input.reshape_clone({input.getTotalElements(), 1});
+        }
+
+        ReshapeLayer::ReshapeLayer(const shape_type &shape)
+            : m_shape(shape)
+        {
+        }
+
+        Tensor ReshapeLayer::forward(const Tensor &input)
+        {
+            return input.reshape_clone(m_shape);
+        }
+
+        /**
+         * @return: the values as a [channels, 1] tensor, throws std::invalid_argument when
+         *      there are not channels values.
+         */
+        static Tensor get_channel_column(const Tensor &values, const size_t &channels, const char *name)
+        {
+            if (values.getTotalElements() != channels)
+            {
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(buffer, sizeof(buffer),
+                         "The %s must have %zu values: %s", name, channels,
+                         Shape::convert_shape_to_string(values.get_shape()).c_str());
+                throw std::invalid_argument(buffer);
+            }
+
+            return values.reshape_clone({channels, 1});
+        }
+
+        BatchNormLayer::BatchNormLayer(const Tensor &gamma, const Tensor &beta, const Tensor &mean,
+                                       const Tensor &variance, const float &epsilon)
+            : m_scale(get_channel_column(gamma, gamma.getTotalElements(), "gamma")),
+              m_shift(get_channel_column(beta, gamma.getTotalElements(), "beta"))
+        {
+            const size_t channels = gamma.getTotalElements();
+            const Tensor meanColumn = get_channel_column(mean, channels, "mean");
+            const Tensor varianceColumn = get_channel_column(variance, channels, "variance");
+
+            float *scale = m_scale.get_mutable_data();
+            float *shift = m_shift.get_mutable_data();
+            for (size_t i = 0; i < channels; i++)
+            {
+                scale[i] /= std::sqrt(varianceColumn.get_data()[i] + epsilon);
+                shift[i] -= meanColumn.get_data()[i] * scale[i];
+            }
+        }
+
+        BatchNormLayer::BatchNormLayer(const Tensor &scale, const Tensor &shift)
+            : m_scale(get_channel_column(scale, scale.getTotalElements(), "scale")),
+              m_shift(get_channel_column(shift, scale.getTotalElements(), "shift"))
+        {
+        }
+
+        Tensor BatchNormLayer::forward(const Tensor &input)
+        {
+            const shape_type &shape = input.get_shape();
+            const size_t channels = m_scale.getTotalElements();
+            if (input.get_layout() != TensorLayout::CNHW || shape.empty() || shape[0] != channels)
+            {
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(buffer, sizeof(buffer),
+                         "Input must have %zu channels on the first axis: %s", channels,
+                         Shape::convert_shape_to_string(shape).c_str());
+                throw std::invalid_argument(buffer);
+            }
+
+            Tensor result(shape, 0.0f);
+            forward_into(input, result);
+            return result;
+        }
+
+        bool BatchNormLayer::forward_into(const Tensor &input, Tensor &output)
+        {
+            const size_t channels = m_scale.getTotalElements();
+            if (input.get_layout() != TensorLayout::CNHW || !is_same_activation(input, output) ||
+                input.get_shape().empty() || input.get_shape()[0] != channels)
+            {
+                return false;
+            }
+
+            const size_t inner = input.getTotalElements() / channels;
+            const float *scale = m_scale.get_data();
+            const float *shift = m_shift.get_data();
+            const float *inputData = input.get_data();
+            float *resultData = output.get_mutable_data();
+
+            for (size_t c = 0; c < channels; c++)
+            {
+                for (size_t i = c * inner; i < (c + 1) * inner; i++)
+                {
+                    resultData[i] = inputData[i] * scale[c] + shift[c];
+                }
+            }
+
+            return true;
+        }
+
+        bool BatchNormLayer::is_identity() const
+        {
+            for (size_t i = 0; i < m_scale.getTotalElements(); i++)
+            {
+                if (m_scale.get_data()[i] != 1.0f || m_shift.get_data()[i] != 0.0f)
+                {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+        /**
+         * [output block, input channel, kernel y, kernel x, output lane], see pack_weights.
+         */
+        static shape_type get_blocked_weights_shape(const Tensor &weights, const size_t &group, const size_t &block)
+        {
+            const shape_type shape = weights.get_shape();
+            return {(shape[0] + block - 1) / block, group == 1 ? shape[1] : 1, shape[2], shape[3], block};
+        }
+
+        Conv2DLayer::Conv2DLayer(const Tensor &weights, const Tensor &bias,
+                                 const size_t &stride, const size_t &padding,
+                                 const size_t &group, const PackedWeightCache &packedWeights)
+            : m_weights(weights), m_bias(bias),
+              m_stride(stride), m_padding(padding),
+              m_group(group), m_packedWeights(packedWeights), m_packedBlock(0), m_packedBatch(0),
+              m_algorithm(ConvolutionAlgorithm::Direct), m_isSparse(false)
+        {
+            if (m_group != 1 && m_group != m_weights.get_shape()[0] && m_group != 2)
+            {
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(buffer, sizeof(buffer),
+                         "Group must be 1, %zu, or %zu",
+                         2, m_weights.get_shape()[0]);
+                throw std::invalid_argument(buffer);
+            }
+
+            if (m_weights.get_shape().size() != 4)
+            {
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(buffer, sizeof(buffer),
+                         "Weights must be a 4D tensor: %s",
+                         Shape::convert_shape_to_string(m_weights.get_shape()).c_str());
+                throw std::invalid_argument(buffer);
+            }
+
+            if (m_bias.get_shape().size() != 2)
+            {
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(buffer, sizeof(buffer),
+                         "Bias must be a 2D tensor: %s",
+                         Shape::convert_shape_to_string(m_bias.get_shape()).c_str());
+            }
+
+            if (m_weights.get_shape()[0] != m_bias.get_shape()[0])
+            {
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(buffer, sizeof(buffer),
+                         "Weights and bias dimensions mismatch: %s != %s",
+                         Shape::convert_shape_to_string(m_weights.get_shape()).c_str(),
+                         Shape::convert_shape_to_string(m_bias.get_shape()).c_str());
+                throw std::invalid_argument(buffer);
+            }
+
+            set_convolution_algorithm(ConvolutionAlgorithm::Automatic);
+
+            // the blocked weights are packed on their first input, a cache of another model is
+            // still rejected here
+            for (const TensorLayout &layout : {TensorLayout::NCHW8c, TensorLayout::NCHW16c})
+            {
+                const size_t block = get_layout_block(layout);
+                has_cached_weights(m_packedWeights, "blocked" + std::to_string(block),
+                                   get_blocked_weights_shape(m_weights, m_group, block));
+            }
+
+            const shape_type shape = m_weights.get_shape();
+            if (m_group == 1 && shape[2] == 1 && shape[3] == 1 && m_stride == 1 && m_padding == 0 &&
+                is_sparse_enough(m_weights))
+            {
+                m_sparseWeights = SparseWeights::from_dense(m_weights);
+                m_isSparse = m_sparseWeights.get_density() <= NTT_SPARSE_MAX_DENSITY;
+            }
+        }
+
+        Tensor Conv2DLayer::forward(const Tensor &input)
+        {
+            if (input.get_layout() != TensorLayout::CNHW)
+            {
+                return forward_with_layout(input);
+            }
+
+            if (input.get_shape().size() != 4)
+            {
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(buffer, sizeof(buffer),
+                         "Input must be a 4D tensor: %s",
+                         Shape::convert_shape_to_string(input.get_shape()).c_str());
+                throw std::invalid_argument(buffer);
+            }
+
+            if (m_group == 1)
+            {
+                if (m_weights.get_shape()[1] != input.get_shape()[0])
+                {
+                    char buffer[NTT_ERROR_MESSAGE_SIZE];
+                    snprintf(buffer, sizeof(buffer),
+                             "Weights and input dimensions mismatch: %s != %s",
+                             Shape::convert_shape_to_string(m_weights.get_shape()).c_str(),
+                             Shape::convert_shape_to_string(input.get_shape()).c_str());
+                    throw std::invalid_argument(buffer);
+                }
+            }
+            else if (m_group == 2)
+            {
+            }
+            else
+            {
+                if (m_weights.get_shape()[0] != input.get_shape()[0] ||
+                    m_weights.get_shape()[1] != input.get_shape()[1])
+                {
+                    char buffer[NTT_ERROR_MESSAGE_SIZE];
+                    snprintf(buffer, sizeof(buffer),
+                             "Weights and input dimensions mismatch: %s != %s",
+                             Shape::convert_shape_to_string(m_weights.get_shape()).c_str(),
+                             Shape::convert_shape_to_string(input.get_shape()).c_str());
+                    throw std::invalid_argument(buffer);
+                }
+            }
+
+            if (m_isSparse)
+            {
+                return forward_sparse(input);
+            }
+
+            if (m_algorithm != ConvolutionAlgorithm::Direct)
+            {
+                return forward_winograd(input);
+            }
+
+            Tensor extractInput = input;
+
+            // add padding to the input
+            if (m_padding > 0)
+            {
+                shape_type paddedShape = input.get_shape();
+                paddedShape[2] += 2 * m_padding;
+                paddedShape[3] += 2 * m_padding;
+                Tensor paddedInput(paddedShape, 0.0f);
+
+                for (size_t i = 0; i < input.get_shape()[0]; i++)
+                {
+                    for (size_t j = 0; j < input.get_shape()[1]; j++)
+                    {
+                        for (size_t k = 0; k < input.get_shape()[2]; k++)
+                        {
+                            for (size_t l = 0; l < input.get_shape()[3]; l++)
+                            {
+                                paddedInput.set_element({i, j, k + m_padding, l + m_padding},
+                                                        input.get_element({i, j, k, l}));
+                            }
+                        }
+                    }
+                }
+
+                extractInput = paddedInput;
+            }
+
+            shape_type outputShape = {m_bias.get_shape()[0],
+                                      m_bias.get_shape()[1],
+                                      0,  // height
+                                      0}; // width
+
+            outputShape[2] = (extractInput.get_shape()[2] - m_weights.get_shape()[2]) / m_stride + 1;
+            outputShape[3] = (extractInput.get_shape()[3] - m_weights.get_shape()[3]) / m_stride + 1;
+
+            Tensor result(outputShape, 0.0f);
+
+            if (m_group == 1)
+            {
+                for (size_t i = 0; i < m_bias.get_shape()[0]; i++)
+                {
+                    for (size_t j = 0; j < extractInput.get_shape()[1]; j++)
+                    {
+                        float bias_value = m_bias.get_element({i, j});
+
+                        for (size_t k = 0; k < m_weights.get_shape()[1]; k++)
+                        {
+                            // TODO: implement the cross-correlation code
+                            for (size_t l = 0; l < result.get_shape()[2]; l++)
+                            {
+                                for (size_t m = 0; m < result.get_shape()[3]; m++)
+                                {
+                                    size_t input_x = l * m_stride;
+                                    size_t input_y = m * m_stride;
+
+                                    float value = 0.0f;
+
+                                    for (size_t n = 0; n < m_weights.get_shape()[2]; n++)
+                                    {
+                                        for (size_t o = 0; o < m_weights.get_shape()[3]; o++)
+                                        {
+                                            value += m_weights.get_element({i, k, n, o}) *
+                                                     extractInput.get_element({k, j, input_x + n, input_y + o});
+                                        }
+                                    }
+
+                                    result.set_element({i, j, l, m},
+                                                       result.get_element({i, j, l, m}) + value +
+                                                           bias_value / m_weights.get_shape()[1]);
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+            else if (m_group == 2)
+            {
+                throw std::runtime_error("Group 2 is not implemented yet");
+            }
+            else
+            {
+                for (size_t i = 0; i < m_weights.get_shape()[0]; i++)
+                {
+                    for (size_t j = 0; j < m_weights.get_shape()[1]; j++)
+                    {
+                        float bias_value = m_bias.get_element({i, j});
+
+                        for (size_t k = 0; k < result.get_shape()[2]; k++)
+                        {
+                            for (size_t l = 0; l < result.get_shape()[3]; l++)
+                            {
+                                size_t input_x = k * m_stride;
+                                size_t input_y = l * m_stride;
+                                float value = 0.0f;
+
+                                for (size_t m = 0; m < m_weights.get_shape()[2]; m++)
+                                {
+                                    for (size_t n = 0; n < m_weights.get_shape()[3]; n++)
+                                    {
+                                        value += extractInput.get_element({i, j, input_x + m, input_y + n}) *
+                                                 m_weights.get_element({i, j, m, n});
+                                    }
+                                }
+
+                                result.set_element({i, j, k, l},
+                                                   result.get_element({i, j, k, l}) + value +
+                                                       bias_value / m_weights.get_shape()[1]);
+                            }
+                        }
+                    }
+                }
+            }
+            return result;
+        }
+
+        /**
+         * The matrices of Lavin and Gray, "Fast Algorithms for Convolutional Neural Networks":
+         *      the weights are transformed with G g G^T, the input tiles with B^T d B and the
+         *      products back with A^T m A.
+         */
+        struct WinogradMatrices
+        {
+            size_t tile;
+            size_t alpha;
+            const float *g;
+            const float *bt;
+            const float *at;
+        };
+
+        static const float s_winograd2x2G[] = {
+            1.0f, 0.0f, 0.0f,
+            0.5f, 0.5f, 0.5f,
+            0.5f, -0.5f, 0.5f,
+            0.0f, 0.0f, 1.0f};
+
+        static const float s_winograd2x2BT[] = {
+            1.0f, 0.0f, -1.0f, 0.0f,
+            0.0f, 1.0f, 1.0f, 0.0f,
+            0.0f, -1.0f, 1.0f, 0.0f,
+            0.0f, 1.0f, 0.0f, -1.0f};
+
+        static const float s_winograd2x2AT[] = {
+            1.0f, 1.0f, 1.0f, 0.0f,
+            0.0f, 1.0f, -1.0f, -1.0f};
+
+        static const float s_winograd4x4G[] = {
+            1.0f / 4, 0.0f, 0.0f,
+            -1.0f / 6, -1.0f / 6, -1.0f / 6,
+            -1.0f / 6, 1.0f / 6, -1.0f / 6,
+            1.0f / 24, 1.0f / 12, 1.0f / 6,
+            1.0f / 24, -1.0f / 12, 1.0f / 6,
+            0.0f, 0.0f, 1.0f};
+
+        static const float s_winograd4x4BT[] = {
+            4.0f, 0.0f, -5.0f, 0.0f, 1.0f, 0.0f,
+            0.0f, -4.0f, -4.0f, 1.0f, 1.0f, 0.0f,
+            0.0f, 4.0f, -4.0f, -1.0f, 1.0f, 0.0f,
+            0.0f, -2.0f, -1.0f, 2.0f, 1.0f, 0.0f,
+            0.0f, 2.0f, -1.0f, -2.0f, 1.0f, 0.0f,
+            0.0f, 4.0f, 0.0f, -5.0f, 0.0f, 1.0f};
+
+        static const float s_winograd4x4AT[] = {
+            1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 0.0f,
+            0.0f, 1.0f, -1.0f, 2.0f, -2.0f, 0.0f,
+            0.0f, 1.0f, 1.0f, 4.0f, 4.0f, 0.0f,
+            0.0f, 1.0f, -1.0f, 8.0f, -8.0f, 1.0f};
+
+        static WinogradMatrices get_winograd_matrices(const ConvolutionAlgorithm &algorithm)
+        {
+            if (algorithm == ConvolutionAlgorithm::Winograd4x4)
+            {
+                return {4, 6, s_winograd4x4G, s_winograd4x4BT, s_winograd4x4AT};
+            }
+
+            return {2, 4, s_winograd2x2G, s_winograd2x2BT, s_winograd2x2AT};
+        }
+
+        static std::string get_winograd_format(const ConvolutionAlgorithm &algorithm)
+        {
+            return algorithm == ConvolutionAlgorithm::Winograd4x4 ? "winograd4x4" : "winograd2x2";
+        }
+
+        /**
+         * output = matrix * input * matrix^T, the matrix has rows x columns elements and the
+         *      input columns x columns elements.
+         */
+        static void transform_winograd_tile(const float *matrix, const size_t &rows, const size_t &columns,
+                                            const float *input, float *output)
+        {
+            float temporary[6 * 6];
+
+            for (size_t i = 0; i < rows; i++)
+            {
+                for (size_t j = 0; j < columns; j++)
+                {
+                    float sum = 0.0f;
+                    for (size_t l = 0; l < columns; l++)
+                    {
+                        sum += matrix[i * columns + l] * input[l * columns + j];
+                    }
+                    temporary[i * columns + j] = sum;
+                }
+            }
+
+            for (size_t i = 0; i < rows; i++)
+            {
+                for (size_t j = 0; j < rows; j++)
+                {
+                    float sum = 0.0f;
+                    for (size_t l = 0; l < columns; l++)
+                    {
+                        sum += temporary[i * columns + l] * matrix[j * columns + l];
+                    }
+                    output[i * rows + j] = sum;
+                }
+            }
+        }
+
+        void Conv2DLayer::set_convolution_algorithm(const ConvolutionAlgorithm &algorithm)
+        {
+            const shape_type shape = m_weights.get_shape();
+            const bool isEligible = shape[2] == 3 && shape[3] == 3 && m_stride == 1 && m_group == 1;
+            ConvolutionAlgorithm selected = algorithm;
+
+            if (algorithm == ConvolutionAlgorithm::Automatic)
+            {
+                const size_t channels = shape[0] < shape[1] ? shape[0] : shape[1];
+                selected = ConvolutionAlgorithm::Direct;
+
+                if (isEligible && channels >= NTT_WINOGRAD_4X4_MIN_CHANNELS)
+                {
+                    selected = ConvolutionAlgorithm::Winograd4x4;
+                }
+                else if (isEligible && channels >= NTT_WINOGRAD_MIN_CHANNELS)
+                {
+                    selected = ConvolutionAlgorithm::Winograd2x2;
+                }
+            }
+            else if (algorithm != ConvolutionAlgorithm::Direct && !isEligible)
+            {
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(buffer, sizeof(buffer),
+                         "Winograd needs a 3x3 convolution with stride 1 and without groups: %s",
+                         Shape::convert_shape_to_string(shape).c_str());
+                throw std::invalid_argument(buffer);
+            }
+
+            m_algorithm = selected;
+
+            if (selected == ConvolutionAlgorithm::Direct)
+            {
+                return;
+            }
+
+            const WinogradMatrices matrices = get_winograd_matrices(selected);
+            const size_t frequencies = matrices.alpha * matrices.alpha;
+            const size_t outputChannels = shape[0];
+            const size_t inputChannels = shape[1];
+            const shape_type packedShape = {frequencies, outputChannels, inputChannels};
+
+            if (has_cached_weights(m_packedWeights, get_winograd_format(selected), packedShape))
+            {
+                return;
+            }
+
+            Tensor packed(packedShape, 0.0f);
+            const float *weights = m_weights.get_data();
+            float *destination = packed.get_mutable_data();
+            float transformed[6 * 6];
+
+            for (size_t o = 0; o < outputChannels; o++)
+            {
+                for (size_t k = 0; k < inputChannels; k++)
+                {
+                    transform_winograd_tile(matrices.g, matrices.alpha, 3, weights + (o * inputChannels + k) * 9, transformed);
+
+                    for (size_t xi = 0; xi < frequencies; xi++)
+                    {
+                        destination[(xi * outputChannels + o) * inputChannels + k] = transformed[xi];
+                    }
+                }
+            }
+
+            m_packedWeights.set(get_winograd_format(selected), packed);
+        }
+
+        Tensor Conv2DLayer::forward_sparse(const Tensor &input)
+        {
+            const shape_type inputShape = input.get_shape();
+            const size_t batch = inputShape[1];
+            const size_t plane = inputShape[2] * inputShape[3];
+            const size_t outputChannels = m_weights.get_shape()[0];
+            const size_t outputBatch = m_bias.get_shape()[1];
+            Tensor result({outputChannels, outputBatch, inputShape[2], inputShape[3]}, 0.0f);
+
+            const float *inputData = input.get_data();
+            float *outputData = result.get_mutable_data();
+            const float *bias = m_bias.get_data();
+
+            // a sparse GEMM per image: [O, I] x [I, plane], the planes of one image are batch planes apart
+            for (size_t n = 0; n < batch && n < outputBatch; n++)
+            {
+                m_sparseWeights.multiply(inputData + n * plane, batch * plane, plane,
+                                         outputData + n * plane, outputBatch * plane);
+
+                for (size_t o = 0; o < outputChannels; o++)
+                {
+                    float *outputPlane = outputData + (o * outputBatch + n) * plane;
+                    const float value = bias[o * outputBatch + n];
+
+                    for (size_t p = 0; p < plane; p++)
+                    {
+                        outputPlane[p] += value;
+                    }
+                }
+            }
+
+            return result;
+        }
+
+        Tensor Conv2DLayer::forward_winograd(const Tensor &input)
+        {
+            const shape_type inputShape = input.get_shape();
+            const size_t inputChannels = inputShape[0];
+            const size_t batch = inputShape[1];
+            const size_t height = inputShape[2];
+            const size_t width = inputShape[3];
+            const size_t outputChannels = m_weights.get_shape()[0];
+            const size_t outputHeight = height + 2 * m_padding - 2;
+            const size_t outputWidth = width + 2 * m_padding - 2;
+
+            const size_t outputBatch = m_bias.get_shape()[1];
+            Tensor result({outputChannels, outputBatch, outputHeight, outputWidth}, 0.0f);
+
+            const WinogradMatrices matrices = get_winograd_matrices(m_algorithm);
+            const size_t tile = matrices.tile;
+            const size_t alpha = matrices.alpha;
+            const size_t frequencies = alpha * alpha;
+            const size_t tilesX = (outputWidth + tile - 1) / tile;
+            const size_t tiles = ((outputHeight + tile - 1) / tile) * tilesX;
+
+            std::vector<float> transformedInput(frequencies * inputChannels * NTT_WINOGRAD_TILE_BLOCK);
+            std::vector<float> products(frequencies * outputChannels * NTT_WINOGRAD_TILE_BLOCK);
+            const float *inputData = input.get_data();
+            float *outputData = result.get_mutable_data();
+            const float *bias = m_bias.get_data();
+            const float *winogradWeights = m_packedWeights.get(get_winograd_format(m_algorithm)).get_data();
+            float patch[6 * 6];
+            float transformed[6 * 6];
+
+            for (size_t n = 0; n < batch && n < outputBatch; n++)
+            {
+                for (size_t first = 0; first < tiles; first += NTT_WINOGRAD_TILE_BLOCK)
+                {
+                    const size_t count = tiles - first < NTT_WINOGRAD_TILE_BLOCK ? tiles - first : NTT_WINOGRAD_TILE_BLOCK;
+
+                    // input tiles (overlapping by 2), the padding and the borders are zeros
+                    for (size_t k = 0; k < inputChannels; k++)
+                    {
+                        const float *plane = inputData + (k * batch + n) * height * width;
+
+                        for (size_t t = 0; t < count; t++)
+                        {
+                            const size_t y0 = (first + t) / tilesX * tile;
+                            const size_t x0 = (first + t) % tilesX * tile;
+
+                            for (size_t i = 0; i < alpha; i++)
+                            {
+                                for (size_t j = 0; j < alpha; j++)
+                                {
+                                    const size_t y = y0 + i;
+                                    const size_t x = x0 + j;
+                                    const bool isInside = y >= m_padding && y - m_padding < height &&
+                                                          x >= m_padding && x - m_padding < width;
+                                    patch[i * alpha + j] = isInside ? plane[(y - m_padding) * width + x - m_padding] : 0.0f;
+                                }
+                            }
+
+                            transform_winograd_tile(matrices.bt, alpha, alpha, patch, transformed);
+                            for (size_t xi = 0; xi < frequencies; xi++)
+                            {
+                                transformedInput[(xi * inputChannels + k) * count + t] = transformed[xi];
+                            }
+                        }
+                    }
+
+                    // one matrix product per frequency: [output channel, input channel] x [input channel, tile]
+                    for (size_t xi = 0; xi < frequencies; xi++)
+                    {
+                        for (size_t o = 0; o < outputChannels; o++)
+                        {
+                            float *row = products.data() + (xi * outputChannels + o) * count;
+                            const float *weights = winogradWeights + (xi * outputChannels + o) * inputChannels;
+
+                            for (size_t t = 0; t < count; t++)
+                            {
+                                row[t] = 0.0f;
+                            }
+
+                            for (size_t k = 0; k < inputChannels; k++)
+                            {
+                                const float weight = weights[k];
+                                const float *source = transformedInput.data() + (xi * inputChannels + k) * count;
+                                for (size_t t = 0; t < count; t++)
+                                {
+                                    row[t] += weight * source[t];
+                                }
+                            }
+                        }
+                    }
+
+                    // back to the spatial domain, the parts of the tiles outside of the output are dropped
+                    for (size_t o = 0; o < outputChannels; o++)
+                    {
+                        float biasValue = 0.0f;
+                        for (size_t k = 0; k < inputChannels; k++)
+                        {
+                            biasValue += bias[o * outputBatch + n] / inputChannels;
+                        }
+
+                        float *plane = outputData + (o * outputBatch + n) * outputHeight * outputWidth;
+
+                        for (size_t t = 0; t < count; t++)
+                        {
+                            for (size_t xi = 0; xi < frequencies; xi++)
+                            {
+                                patch[xi] = products[(xi * outputChannels + o) * count + t];
+                            }
+
+                            transform_winograd_tile(matrices.at, tile, alpha, patch, transformed);
+
+                            const size_t y0 = (first + t) / tilesX * tile;
+                            const size_t x0 = (first + t) % tilesX * tile;
+                            for (size_t i = 0; i < tile && y0 + i < outputHeight; i++)
+                            {
+                                for (size_t j = 0; j < tile && x0 + j < outputWidth; j++)
+                                {
+                                    plane[(y0 + i) * outputWidth + x0 + j] = transformed[i * tile + j] + biasValue;
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+
+            return result;
+        }
+
+        Tensor GlobalAveragePooling2DLayer::forward(const Tensor &input)
+        {
+            if (input.get_layout() != TensorLayout::CNHW)
+            {
+                return forward_with_layout(input);
+            }
+
+            if (input.get_shape().size() != 4)
+            {
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(buffer, sizeof(buffer),
+                         "Input must be a 4D tensor: %s",
+                         Shape::convert_shape_to_string(input.get_shape()).c_str());
+            }
+
+            shape_type outputShape = {input.get_shape()[0],
+                                      input.get_shape()[1],
+                                      1,
+                                      1};
+
+            Tensor result(outputShape, 0.0f);
+
+            for (size_t i = 0; i < input.get_shape()[0]; i++)
+            {
+                for (size_t j = 0; j < input.get_shape()[1]; j++)
+                {
+                    float sum = 0.0f;
+                    size_t count = 0;
+
+                    for (size_t k = 0; k < input.get_shape()[2]; k++)
+                    {
+                        for (size_t l = 0; l < input.get_shape()[3]; l++)
+                        {
+                            sum += input.get_element({i, j, k, l});
+                            count++;
+                        }
+                    }
+
+                    result.set_element({i, j, 0, 0}, sum / count);
+                }
+            }
+
+            return result;
+        }
+
+        /**
+         * The dimensions of an activation in NHWC or in a blocked layout, NHWC is seen as a
+         *      single block holding all the channels.
+         */
+        struct LayoutDimensions
+        {
+            size_t batch;
+            size_t blocks;
+            size_t height;
+            size_t width;
+            size_t block;
+        };
+
+        static LayoutDimensions get_layout_dimensions(const Tensor &tensor)
+        {
+            const shape_type shape = tensor.get_shape();
+            if (tensor.get_layout() == TensorLayout::NHWC)
+            {
+                return {shape[0], 1, shape[1], shape[2], shape[3]};
+            }
+
+            return {shape[0], shape[1], shape[2], shape[3], shape[4]};
+        }
+
+        static Tensor create_layout_tensor(const TensorLayout &layout, const size_t &batch, const size_t &channels,
+                                           const size_t &height, const size_t &width)
+        {
+            if (layout == TensorLayout::NHWC)
+            {
+                Tensor result({batch, height, width, channels}, 0.0f);
+                result.set_layout(layout, channels);
+                return result;
+            }
+
+            const size_t block = get_layout_block(layout);
+            Tensor result({batch, (channels + block - 1) / block, height, width, block}, 0.0f);
+            result.set_layout(layout, channels);
+            return result;
+        }
+
+        /**
+         * @return: the value of the channel for one of the parameters of ImageNormalization.
+         */
+        static float get_image_parameter(const std::vector<float> &values, const size_t &channel, const float &value)
+        {
+            if (values.empty())
+            {
+                return value;
+            }
+
+            return values.size() == 1 ? values[0] : values[channel];
+        }
+
+        /**
+         * Writes the rows of an image, given in the order of the bytes (HWC), into an
+         *      activation of any layout and normalizes them on the way.
+         */
+        class ImageRowWriter
+        {
+        public:
+            ImageRowWriter(float *output, const size_t &height, const size_t &width, const size_t &channels,
+                           const ImageNormalization &normalization, const TensorLayout &layout)
+                : m_output(output), m_width(width), m_channels(channels), m_isReversed(normalization.isReversed),
+                  m_bases(channels), m_scales(width * channels), m_shifts(width * channels)
+            {
+                const std::vector<float> &mean = normalization.mean;
+                const std::vector<float> &deviation = normalization.deviation;
+                if (channels == 0 || (mean.size() > 1 && mean.size() != channels) ||
+                    (deviation.size() > 1 && deviation.size() != channels))
+                {
+                    char buffer[NTT_ERROR_MESSAGE_SIZE];
+                    snprintf(buffer, sizeof(buffer),
+                             "The normalization has %zu means and %zu deviations for %zu channels",
+                             mean.size(), deviation.size(), channels);
+                    throw std::invalid_argument(buffer);
+                }
+
+                // the value of the channel c of the pixel p goes to m_bases[c] + p * m_step
+                const size_t block = get_layout_block(layout);
+                m_step = layout == TensorLayout::NHWC ? channels : (block != 0 ? block : 1);
+                for (size_t c = 0; c < channels; c++)
+                {
+                    if (layout == TensorLayout::NHWC)
+                    {
+                        m_bases[c] = c;
+                    }
+                    else if (block != 0)
+                    {
+                        m_bases[c] = (c / block) * height * width * block + c % block;
+                    }
+                    else
+                    {
+                        m_bases[c] = c * height * width;
+                    }
+                }
+
+                // the scales and shifts of a whole row in the order of the bytes
+                for (size_t source = 0; source < channels; source++)
+                {
+                    const size_t c = get_channel(source);
+                    const float value = get_image_parameter(deviation, c, 1.0f);
+                    if (value == 0.0f)
+                    {
+                        throw std::invalid_argument("The deviations of the normalization must not be zero");
+                    }
+
+                    for (size_t w = 0; w < width; w++)
+                    {
+                        m_scales[w * channels + source] = normalization.scale / value;
+                        m_shifts[w * channels + source] = -get_image_parameter(mean, c, 0.0f) / value;
+                    }
+                }
+
+                // the rows in the order of the tensor are converted in place
+                m_isDirect = (layout == TensorLayout::NHWC || (layout == TensorLayout::CNHW && channels == 1)) &&
+                             (!m_isReversed || channels == 1);
+            }
+
+            /**
+             * @param row: the width * channels bytes (or byte values as floats) of the row h.
+             * @param buffer: a row of floats for the layouts which are not written in place.
+             */
+            template <typename Value>
+            void write(const size_t &h, const Value *row, std::vector<float> &buffer) const
+            {
+                const size_t rowSize = m_width * m_channels;
+                if (m_isDirect)
+                {
+                    convert(row, m_output + h * rowSize, rowSize);
+                    return;
+                }
+
+                buffer.resize(rowSize);
+                convert(row, buffer.data(), rowSize);
+                for (size_t source = 0; source < m_channels; source++)
+                {
+                    float *target = m_output + m_bases[get_channel(source)] + h * m_width * m_step;
+                    for (size_t w = 0; w < m_width; w++)
+                    {
+                        target[w * m_step] = buffer[w * m_channels + source];
+                    }
+                }
+            }
+
+        private:
+            inline size_t get_channel(const size_t &source) const { return m_isReversed ? m_channels - 1 - source : source; }
+
+            inline void convert(const uint8_t *row, float *output, const size_t &size) const
+            {
+                bytes_to_float_array(row, output, size, m_scales.data(), m_shifts.data());
+            }
+
+            inline void convert(const float *row, float *output, const size_t &size) const
+            {
+                affine_array(row, output, size, m_scales.data(), m_shifts.data());
+            }
+
+        private:
+            float *m_output;
+            size_t m_width;
+            size_t m_channels;
+            bool m_isReversed;
+            bool m_isDirect;
+            size_t m_step;
+            std::vector<size_t> m_bases;
+            std::vector<float> m_scales;
+            std::vector<float> m_shifts;
+        };
+
+        static Tensor create_image_tensor(const TensorLayout &layout, const size_t &channels,
+                                          const size_t &height, const size_t &width)
+        {
+            return layout == TensorLayout::CNHW ? Tensor({channels, 1, height, width}, 0.0f)
+                                                : create_layout_tensor(layout, 1, channels, height, width);
+        }
+
+        static size_t get_image_stride(const size_t &width, const size_t &channels, const size_t &rowStride)
+        {
+            const size_t stride = rowStride == 0 ? width * channels : rowStride;
+            if (stride < width * channels)
+            {
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(buffer, sizeof(buffer),
+                         "The rows of %zu bytes do not fit in a stride of %zu bytes", width * channels, stride);
+                throw std::invalid_argument(buffer);
+            }
+
+            return stride;
+        }
+
+        Tensor Tensor::from_image(const uint8_t *pixels, const size_t &height, const size_t &width,
+                                  const size_t &channels, const ImageNormalization &normalization,
+                                  const TensorLayout &layout, const size_t &rowStride)
+        {
+            const size_t stride = get_image_stride(width, channels, rowStride);
+            Tensor result = create_image_tensor(layout, channels, height, width);
+            const ImageRowWriter writer(result.m_data, height, width, channels, normalization, layout);
+
+            const auto convertRows = [&](size_t begin, size_t end)
+            {
+                std::vector<float> buffer;
+                for (size_t h = begin; h < end; h++)
+                {
+                    writer.write(h, pixels + h * stride, buffer);
+                }
+            };
+            ThreadPool::get_default().parallel_for(height, 1 + 16384 / (width * channels + 1), convertRows);
+
+            return result;
+        }
+
+        void ImageResize::get_placement(const size_t &imageHeight, const size_t &imageWidth,
+                                        size_t &top, size_t &left, size_t &rows, size_t &columns) const
+        {
+            const size_t croppedHeight = cropHeight == 0 ? imageHeight - cropY : cropHeight;
+            const size_t croppedWidth = cropWidth == 0 ? imageWidth - cropX : cropWidth;
+            if (cropY >= imageHeight || cropX >= imageWidth ||
+                croppedHeight > imageHeight - cropY || croppedWidth > imageWidth - cropX || height == 0 || width == 0)
+            {
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(buffer, sizeof(buffer),
+                         "The crop %zux%zu at (%zu, %zu) to %zux%zu does not fit in the image %zux%zu",
+                         croppedWidth, croppedHeight, cropX, cropY, width, height, imageWidth, imageHeight);
+                throw std::invalid_argument(buffer);
+            }
+
+            top = 0;
+            left = 0;
+            rows = height;
+            columns = width;
+            if (!isLetterboxed)
+            {
+                return;
+            }
+
+            const double scaleY = static_cast<double>(height) / static_cast<double>(croppedHeight);
+            const double scaleX = static_cast<double>(width) / static_cast<double>(croppedWidth);
+            const double scale = scaleY < scaleX ? scaleY : scaleX;
+            rows = static_cast<size_t>(std::lround(croppedHeight * scale));
+            columns = static_cast<size_t>(std::lround(croppedWidth * scale));
+            rows = rows == 0 ? 1 : (rows > height ? height : rows);
+            columns = columns == 0 ? 1 : (columns > width ? width : columns);
+            top = (height - rows) / 2;
+            left = (width - columns) / 2;
+        }
+
+        /**
+         * The source pixels of every target pixel along one axis with their weights:
+         *      target t reads indices[starts[t]..starts[t + 1]).
+         */
+        struct ResizeTaps
+        {
+            std::vector<size_t> starts;
+            std::vector<size_t> indices;
+            std::vector<float> weights;
+        };
+
+        static ResizeTaps get_resize_taps(const ResizeMode &mode, const size_t &source, const size_t &target)
+        {
+            ResizeTaps taps;
+            const double scale = static_cast<double>(target) / static_cast<double>(source);
+
+            for (size_t t = 0; t < target; t++)
+            {
+                taps.starts.push_back(taps.indices.size());
+
+                // the area of the source pixels under the target pixel, when it is downscaled
+                if (mode == ResizeMode::Area && scale < 1.0)
+                {
+                    const double begin = t / scale;
+                    const double end = (t + 1) / scale < source ? (t + 1) / scale : static_cast<double>(source);
+                    for (size_t i = static_cast<size_t>(begin); i < end; i++)
+                    {
+                        const double first = begin > i ? begin : static_cast<double>(i);
+                        const double last = end < i + 1 ? end : static_cast<double>(i + 1);
+                        if (last > first)
+                        {
+                            taps.indices.push_back(i);
+                            taps.weights.push_back(static_cast<float>((last - first) / (end - begin)));
+                        }
+                    }
+                    continue;
+                }
+
+                // bilinear between the pixel centers, the borders are repeated
+                double position = (t + 0.5) / scale - 0.5;
+                position = position < 0.0 ? 0.0 : position;
+                size_t index = static_cast<size_t>(position);
+                if (index >= source - 1)
+                {
+                    taps.indices.push_back(source - 1);
+                    taps.weights.push_back(1.0f);
+                    continue;
+                }
+
+                const float fraction = static_cast<float>(position - index);
+                taps.indices.push_back(index);
+                taps.weights.push_back(1.0f - fraction);
+                if (fraction > 0.0f)
+                {
+                    taps.indices.push_back(index + 1);
+                    taps.weights.push_back(fraction);
+                }
+            }
+            taps.starts.push_back(taps.indices.size());
+
+            return taps;
+        }
+
+        Tensor Tensor::from_image(const uint8_t *pixels, const size_t &height, const size_t &width,
+                                  const size_t &channels, const ImageResize &resize,
+                                  const ImageNormalization &normalization, const TensorLayout &layout,
+                                  const size_t &rowStride)
+        {
+            const size_t stride = get_image_stride(width, channels, rowStride);
+            size_t top, left, rows, columns;
+            resize.get_placement(height, width, top, left, rows, columns);
+
+            Tensor result = create_image_tensor(layout, channels, resize.height, resize.width);
+            const ImageRowWriter writer(result.m_data, resize.height, resize.width, channels, normalization, layout);
+
+            const ResizeTaps verticalTaps = get_resize_taps(resize.mode, resize.cropHeight == 0 ? height - resize.cropY : resize.cropHeight, rows);
+            const ResizeTaps horizontalTaps = get_resize_taps(resize.mode, resize.cropWidth == 0 ? width - resize.cropX : resize.cropWidth, columns);
+            const uint8_t *origin = pixels + resize.cropY * stride + resize.cropX * channels;
+            const float padding = static_cast<float>(resize.padding);
+
+            // every target row is the weighted sum of its source rows resized horizontally
+            const auto resizeRows = [&](size_t begin, size_t end)
+            {
+                std::vector<float> row(resize.width * channels);
+                std::vector<float> resized(columns * channels);
+                std::vector<float> buffer;
+
+                for (size_t h = begin; h < end; h++)
+                {
+                    for (size_t i = 0; i < row.size(); i++)
+                    {
+                        row[i] = padding;
+                    }
+
+                    if (h >= top && h < top + rows)
+                    {
+                        float *placed = row.data() + left * channels;
+                        for (size_t i = 0; i < resized.size(); i++)
+                        {
+                            placed[i] = 0.0f;
+                        }
+
+                        for (size_t k = verticalTaps.starts[h - top]; k < verticalTaps.starts[h - top + 1]; k++)
+                        {
+                            const uint8_t *source = origin + verticalTaps.indices[k] * stride;
+                            for (size_t w = 0; w < columns; w++)
+                            {
+                                float *pixel = resized.data() + w * channels;
+                                for (size_t c = 0; c < channels; c++)
+                                {
+                                    pixel[c] = 0.0f;
+                                }
+
+                                for (size_t t = horizontalTaps.starts[w]; t < horizontalTaps.starts[w + 1]; t++)
+                                {
+                                    const uint8_t *bytes = source + horizontalTaps.indices[t] * channels;
+                                    const float weight = horizontalTaps.weights[t];
+                                    for (size_t c = 0; c < channels; c++)
+                                    {
+                                        pixel[c] += bytes[c] * weight;
+                                    }
+                                }
+                            }
+
+                            add_scaled_array(resized.data(), placed, resized.size(), verticalTaps.weights[k]);
+                        }
+                    }
+
+                    writer.write(h, row.data(), buffer);
+                }
+            };
+            ThreadPool::get_default().parallel_for(resize.height, 1 + 4096 / (resize.width * channels + 1), resizeRows);
+
+            return result;
+        }
+
+        static void check_layout_input(const Tensor &input)
+        {
+            if (input.get_shape().size() != (input.get_layout() == TensorLayout::NHWC ? 4 : 5))
+            {
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(buffer, sizeof(buffer),
+                         "Input must be a 4D activation: %s",
+                         Shape::convert_shape_to_string(input.get_shape()).c_str());
+                throw std::invalid_argument(buffer);
+            }
+        }
+
+        /**
+         * @return: the index of the first input row (or column) of the window without the
+         *      padding, or false when it falls in the padding.
+         */
+        static inline bool get_input_position(const size_t &output, const size_t &offset, const size_t &stride,
+                                              const size_t &padding, const size_t &size, size_t &position)
+        {
+            position = output * stride + offset;
+            if (position < padding || position - padding >= size)
+            {
+                return false;
+            }
+
+            position -= padding;
+            return true;
+        }
+
+        /**
+         * Regular convolution, every output pixel accumulates the blocks of output channels at
+         *      once (Block lanes, 0 for a block size only known at runtime). The sums are done in
+         *      the same order as the default kernel, input channel by input channel.
+         */
+        template <size_t Block>
+        static void convolve_with_layout(const float *input, const LayoutDimensions &in, float *output,
+                                         const LayoutDimensions &out, const float *weights, const float *bias,
+                                         const size_t &inputChannels, const size_t &kernelHeight,
+                                         const size_t &kernelWidth, const size_t &stride, const size_t &padding)
+        {
+            const size_t block = Block != 0 ? Block : out.block;
+            std::vector<float> sums(block);
+            float *sum = sums.data();
+
+            for (size_t n = 0; n < out.batch; n++)
             {
-                if (shape1[i] != shape2[i])
+                for (size_t ob = 0; ob < out.blocks; ob++)
                 {
-                    return false;
+                    const float *biasRow = bias + (n * out.blocks + ob) * block;
+
+                    for (size_t oy = 0; oy < out.height; oy++)
+                    {
+                        for (size_t ox = 0; ox < out.width; ox++)
+                        {
+                            float *target = output + (((n * out.blocks + ob) * out.height + oy) * out.width + ox) * block;
+
+                            for (size_t k = 0; k < inputChannels; k++)
+                            {
+                                const float *source = input + (n * in.blocks + k / in.block) * in.height * in.width * in.block +
+                                                      k % in.block;
+                                const float *kernel = weights + (ob * inputChannels + k) * kernelHeight * kernelWidth * block;
+
+                                for (size_t l = 0; l < block; l++)
+                                {
+                                    sum[l] = 0.0f;
+                                }
+
+                                for (size_t ky = 0; ky < kernelHeight; ky++)
+                                {
+                                    size_t iy;
+                                    if (!get_input_position(oy, ky, stride, padding, in.height, iy))
+                                    {
+                                        continue;
+                                    }
+
+                                    for (size_t kx = 0; kx < kernelWidth; kx++)
+                                    {
+                                        size_t ix;
+                                        if (!get_input_position(ox, kx, stride, padding, in.width, ix))
+                                        {
+                                            continue;
+                                        }
+
+                                        const float value = source[(iy * in.width + ix) * in.block];
+                                        const float *w = kernel + (ky * kernelWidth + kx) * block;
+                                        for (size_t l = 0; l < block; l++)
+                                        {
+                                            sum[l] += w[l] * value;
+                                        }
+                                    }
+                                }
+
+                                for (size_t l = 0; l < block; l++)
+                                {
+                                    target[l] = target[l] + sum[l] + biasRow[l];
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        /**
+         * Depthwise convolution, the lanes of a block are independent channels.
+         */
+        template <size_t Block>
+        static void convolve_depthwise_with_layout(const float *input, const LayoutDimensions &in, float *output,
+                                                   const LayoutDimensions &out, const float *weights, const float *bias,
+                                                   const size_t &kernelHeight, const size_t &kernelWidth,
+                                                   const size_t &stride, const size_t &padding)
+        {
+            const size_t block = Block != 0 ? Block : out.block;
+            std::vector<float> sums(block);
+            float *sum = sums.data();
+
+            for (size_t n = 0; n < out.batch; n++)
+            {
+                for (size_t cb = 0; cb < out.blocks; cb++)
+                {
+                    const float *plane = input + (n * in.blocks + cb) * in.height * in.width * block;
+                    const float *biasRow = bias + (n * out.blocks + cb) * block;
+
+                    for (size_t oy = 0; oy < out.height; oy++)
+                    {
+                        for (size_t ox = 0; ox < out.width; ox++)
+                        {
+                            float *target = output + (((n * out.blocks + cb) * out.height + oy) * out.width + ox) * block;
+
+                            for (size_t l = 0; l < block; l++)
+                            {
+                                sum[l] = 0.0f;
+                            }
+
+                            for (size_t ky = 0; ky < kernelHeight; ky++)
+                            {
+                                size_t iy;
+                                if (!get_input_position(oy, ky, stride, padding, in.height, iy))
+                                {
+                                    continue;
+                                }
+
+                                for (size_t kx = 0; kx < kernelWidth; kx++)
+                                {
+                                    size_t ix;
+                                    if (!get_input_position(ox, kx, stride, padding, in.width, ix))
+                                    {
+                                        continue;
+                                    }
+
+                                    const float *source = plane + (iy * in.width + ix) * block;
+                                    const float *w = weights + ((cb * kernelHeight + ky) * kernelWidth + kx) * block;
+                                    for (size_t l = 0; l < block; l++)
+                                    {
+                                        sum[l] += source[l] * w[l];
+                                    }
+                                }
+                            }
+
+                            for (size_t l = 0; l < block; l++)
+                            {
+                                target[l] = target[l] + sum[l] + biasRow[l];
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        bool Conv2DLayer::supports_layout(const TensorLayout &layout) const
+        {
+            return layout == TensorLayout::CNHW || m_group == 1 ||
+                   (m_group == m_weights.get_shape()[0] && m_weights.get_shape()[1] == 1);
+        }
+
+        const Tensor &Conv2DLayer::pack_weights(const size_t &block)
+        {
+            const shape_type shape = m_weights.get_shape();
+            const size_t outputChannels = shape[0];
+            const size_t inputChannels = m_group == 1 ? shape[1] : 1;
+            const size_t kernelSize = shape[2] * shape[3];
+            const std::string format = "blocked" + std::to_string(block);
+            const shape_type packedShape = get_blocked_weights_shape(m_weights, m_group, block);
+
+            if (has_cached_weights(m_packedWeights, format, packedShape))
+            {
+                return m_packedWeights.get(format);
+            }
+
+            Tensor packed(packedShape, 0.0f);
+            const float *weights = m_weights.get_data();
+            float *destination = packed.get_mutable_data();
+
+            // [output block, input channel, kernel y, kernel x, output lane]
+            for (size_t o = 0; o < outputChannels; o++)
+            {
+                for (size_t k = 0; k < inputChannels; k++)
+                {
+                    for (size_t t = 0; t < kernelSize; t++)
+                    {
+                        destination[(((o / block) * inputChannels + k) * kernelSize + t) * block + o % block] =
+                            weights[(o * shape[1] + k) * kernelSize + t];
+                    }
+                }
+            }
+
+            m_packedWeights.set(format, packed);
+            return m_packedWeights.get(format);
+        }
+
+        void Conv2DLayer::pack_bias(const size_t &block, const size_t &batch)
+        {
+            if (m_packedBlock == block && m_packedBatch == batch)
+            {
+                return;
+            }
+
+            const size_t outputChannels = m_weights.get_shape()[0];
+            const size_t blocks = (outputChannels + block - 1) / block;
+            const float *bias = m_bias.get_data();
+
+            // [batch, output channel], already divided like in the default kernel
+            m_packedBias.assign(batch * blocks * block, 0.0f);
+            for (size_t n = 0; n < batch; n++)
+            {
+                for (size_t o = 0; o < outputChannels; o++)
+                {
+                    m_packedBias[n * blocks * block + o] = bias[o * m_bias.get_shape()[1] + n] / m_weights.get_shape()[1];
+                }
+            }
+
+            m_packedBlock = block;
+            m_packedBatch = batch;
+        }
+
+        Tensor Conv2DLayer::forward_with_layout(const Tensor &input)
+        {
+            check_layout_input(input);
+
+            if (!supports_layout(input.get_layout()))
+            {
+                throw std::invalid_argument("The grouped convolution only supports the CNHW layout");
+            }
+
+            const shape_type shape = m_weights.get_shape();
+            const bool isDepthwise = m_group != 1;
+            const LayoutDimensions in = get_layout_dimensions(input);
+
+            if (input.get_channels() != (isDepthwise ? shape[0] : shape[1]) || in.batch != m_bias.get_shape()[1])
+            {
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(buffer, sizeof(buffer),
+                         "Weights and input dimensions mismatch: %s != %s",
+                         Shape::convert_shape_to_string(shape).c_str(),
+                         Shape::convert_shape_to_string(input.get_shape()).c_str());
+                throw std::invalid_argument(buffer);
+            }
+
+            const size_t outputHeight = (in.height + 2 * m_padding - shape[2]) / m_stride + 1;
+            const size_t outputWidth = (in.width + 2 * m_padding - shape[3]) / m_stride + 1;
+            Tensor result = create_layout_tensor(input.get_layout(), in.batch, shape[0], outputHeight, outputWidth);
+            const LayoutDimensions out = get_layout_dimensions(result);
+
+            const float *weights = pack_weights(out.block).get_data();
+            pack_bias(out.block, in.batch);
+
+            const float *inputData = input.get_data();
+            float *outputData = result.get_mutable_data();
+            const float *bias = m_packedBias.data();
+
+            if (isDepthwise)
+            {
+                switch (out.block)
+                {
+                case 8:
+                    convolve_depthwise_with_layout<8>(inputData, in, outputData, out, weights, bias,
+                                                      shape[2], shape[3], m_stride, m_padding);
+                    break;
+                case 16:
+                    convolve_depthwise_with_layout<16>(inputData, in, outputData, out, weights, bias,
+                                                       shape[2], shape[3], m_stride, m_padding);
+                    break;
+                default:
+                    convolve_depthwise_with_layout<0>(inputData, in, outputData, out, weights, bias,
+                                                      shape[2], shape[3], m_stride, m_padding);
+                    break;
+                }
+            }
+            else
+            {
+                switch (out.block)
+                {
+                case 8:
+                    convolve_with_layout<8>(inputData, in, outputData, out, weights, bias,
+                                            shape[1], shape[2], shape[3], m_stride, m_padding);
+                    break;
+                case 16:
+                    convolve_with_layout<16>(inputData, in, outputData, out, weights, bias,
+                                             shape[1], shape[2], shape[3], m_stride, m_padding);
+                    break;
+                default:
+                    convolve_with_layout<0>(inputData, in, outputData, out, weights, bias,
+                                            shape[1], shape[2], shape[3], m_stride, m_padding);
+                    break;
                 }
             }
 
-            return true;
+            return result;
+        }
+
+        Tensor Conv2DLayer::forward_global_pooling(const Tensor &input, const float &min, const float &max) const
+        {
+            const shape_type &inputShape = input.get_shape();
+            const shape_type &weightShape = m_weights.get_shape();
+            if (input.get_layout() != TensorLayout::CNHW || inputShape.size() != 4 ||
+                m_bias.get_shape()[1] != inputShape[1] ||
+                (m_group == 1 ? weightShape[1] != inputShape[0] : weightShape[0] != inputShape[0]) ||
+                inputShape[2] + 2 * m_padding < weightShape[2] || inputShape[3] + 2 * m_padding < weightShape[3])
+            {
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(buffer, sizeof(buffer),
+                         "Weights and input dimensions mismatch: %s != %s",
+                         Shape::convert_shape_to_string(weightShape).c_str(),
+                         Shape::convert_shape_to_string(inputShape).c_str());
+                throw std::invalid_argument(buffer);
+            }
+
+            if (m_group == 2)
+            {
+                throw std::runtime_error("Group 2 is not implemented yet");
+            }
+
+            const size_t outputs = weightShape[0];
+            const size_t batch = inputShape[1];
+            const size_t height = inputShape[2];
+            const size_t width = inputShape[3];
+            const size_t kernelHeight = weightShape[2];
+            const size_t kernelWidth = weightShape[3];
+            const size_t outputHeight = (height + 2 * m_padding - kernelHeight) / m_stride + 1;
+            const size_t outputWidth = (width + 2 * m_padding - kernelWidth) / m_stride + 1;
+
+            // the depthwise weights of an output only see the input channel of the same index
+            const size_t inputsPerOutput = m_group == 1 ? inputShape[0] : 1;
+
+            Tensor result({outputs, batch, 1, 1}, 0.0f);
+            const float *inputData = input.get_data();
+            const float *weightData = m_weights.get_data();
+            const float *biasData = m_bias.get_data();
+            float *resultData = result.get_mutable_data();
+
+            auto poolRange = [&](size_t begin, size_t end)
+            {
+                std::vector<float> row(outputWidth);
+
+                for (size_t plane = begin; plane < end; plane++)
+                {
+                    const size_t o = plane / batch;
+                    const size_t n = plane % batch;
+                    float sum = 0.0f;
+
+                    for (size_t oy = 0; oy < outputHeight; oy++)
+                    {
+                        for (size_t ox = 0; ox < outputWidth; ox++)
+                        {
+                            row[ox] = biasData[o * batch + n];
+                        }
+
+                        for (size_t i = 0; i < inputsPerOutput; i++)
+                        {
+                            const size_t channel = m_group == 1 ? i : o;
+                            const float *source = inputData + (channel * batch + n) * height * width;
+                            const float *kernel = weightData + (o * weightShape[1] + (m_group == 1 ? i : 0)) *
+                                                                   kernelHeight * kernelWidth;
+
+                            for (size_t ky = 0; ky < kernelHeight; ky++)
+                            {
+                                const size_t y = oy * m_stride + ky;
+                                if (y < m_padding || y - m_padding >= height)
+                                {
+                                    continue;
+                                }
+
+                                const float *inputRow = source + (y - m_padding) * width;
+                                for (size_t kx = 0; kx < kernelWidth; kx++)
+                                {
+                                    const float weight = kernel[ky * kernelWidth + kx];
+                                    for (size_t ox = 0; ox < outputWidth; ox++)
+                                    {
+                                        const size_t x = ox * m_stride + kx;
+                                        if (x >= m_padding && x - m_padding < width)
+                                        {
+                                            row[ox] += weight * inputRow[x - m_padding];
+                                        }
+                                    }
+                                }
+                            }
+                        }
+
+                        for (size_t ox = 0; ox < outputWidth; ox++)
+                        {
+                            sum += getMax(min, getMin(row[ox], max));
+                        }
+                    }
+
+                    resultData[plane] = sum / (outputHeight * outputWidth);
+                }
+            };
+
+            ThreadPool::get_default().parallel_for(outputs * batch, 1, poolRange);
+
+            return result;
+        }
+
+        Conv2DPoolingLayer::Conv2DPoolingLayer(const Conv2DLayer &conv)
+            : m_conv(&conv),
+              m_min(-std::numeric_limits<float>::infinity()),
+              m_max(std::numeric_limits<float>::infinity())
+        {
         }
 
-        std::string Tensor::flatten() const
+        Conv2DPoolingLayer::Conv2DPoolingLayer(const Conv2DLayer &conv, const Clip2DLayer &clip)
+            : m_conv(&conv), m_min(clip.get_min()), m_max(clip.get_max())
         {
-            std::string result = "[";
-            for (size_t i = 0; i < getTotalElements(); i++)
-            {
-                result += std::to_string(m_data[i]) + ", ";
-            }
-            result += "]";
+        }
 
-            return result;
+        Tensor Conv2DPoolingLayer::forward(const Tensor &input)
+        {
+            return m_conv->forward_global_pooling(input, m_min, m_max);
         }
 
-        float Tensor::max() const
+        /**
+         * The reductions of the pooling: add folds an input in, merge folds in the partial
+         *      result of a window row and finish gives the output of count inputs.
+         */
+        struct MaxReduction
         {
-            float max = m_data[0];
-            for (size_t i = 0; i < getTotalElements(); i++)
-            {
-                if (m_data[i] > max)
-                {
-                    max = m_data[i];
-                }
-            }
+            static inline float initial() { return -std::numeric_limits<float>::infinity(); }
+            static inline float add(const float &sum, const float &value) { return value > sum ? value : sum; }
+            static inline float merge(const float &sum, const float &partial) { return add(sum, partial); }
+            static inline float finish(const float &sum, const size_t &count) { return count > 0 ? sum : 0.0f; }
+        };
 
-            return max;
+        struct AverageReduction
+        {
+            static inline float initial() { return 0.0f; }
+            static inline float add(const float &sum, const float &value) { return sum + value; }
+            static inline float merge(const float &sum, const float &partial) { return sum + partial; }
+            static inline float finish(const float &sum, const size_t &count) { return count > 0 ? sum / count : 0.0f; }
+        };
+
+        struct L2Reduction
+        {
+            static inline float initial() { return 0.0f; }
+            static inline float add(const float &sum, const float &value) { return sum + value * value; }
+            static inline float merge(const float &sum, const float &partial) { return sum + partial; }
+            static inline float finish(const float &sum, const size_t &) { return std::sqrt(sum); }
+        };
+
+        /**
+         * The range [first, last) of the input covered by the window of an output, without
+         *      the padding (empty when the window only covers padding).
+         */
+        static inline void get_pooling_window(const size_t &output, const size_t &poolSize, const size_t &stride,
+                                              const size_t &padding, const size_t &size, size_t &first, size_t &last)
+        {
+            const size_t start = output * stride;
+            first = start < padding ? 0 : start - padding;
+            last = start + poolSize < padding ? 0 : start + poolSize - padding;
+            last = last < size ? last : size;
+            first = first < last ? first : last;
         }
 
-        Tensor Tensor::max(const size_t &axis) const
+        /**
+         * Pools one plane of height x width pixels of lanes channels each (1 for the default
+         *      layout, the block or all the channels for the other ones). rows is a buffer of
+         *      width * lanes elements for the reduction of the window rows.
+         */
+        template <typename Reduction>
+        static void pool_plane(const float *input, const size_t &height, const size_t &width, const size_t &lanes,
+                               float *output, const size_t &outputHeight, const size_t &outputWidth,
+                               const size_t &poolSize, const size_t &stride, const size_t &padding, float *rows)
         {
-            shape_type newShape = m_shape;
-            newShape[axis] = 1;
-            Tensor result(newShape, 0.0f);
-            Shape newShapeIndex(newShape);
+            const size_t rowSize = width * lanes;
 
-            size_t maxAxisSize = m_shape[axis];
+            // the outputs whose windows are entirely inside the input along the width
+            const size_t firstInner = (padding + stride - 1) / stride;
+            size_t lastInner = width + padding >= poolSize ? (width + padding - poolSize) / stride + 1 : 0;
+            lastInner = lastInner < outputWidth ? lastInner : outputWidth;
 
-            while (!newShapeIndex.is_end())
+            for (size_t oy = 0; oy < outputHeight; oy++)
             {
-                shape_type targetIndexes = newShapeIndex.get_current_index();
-                size_t maxValue = get_element(targetIndexes);
+                size_t firstY;
+                size_t lastY;
+                get_pooling_window(oy, poolSize, stride, padding, height, firstY, lastY);
 
-                for (size_t i = 0; i < maxAxisSize; i++)
+                // the rows of the window, across the whole width
+                for (size_t i = 0; i < rowSize; i++)
                 {
-                    shape_type tempIndexes = targetIndexes;
-                    tempIndexes[axis] = i;
-
-                    if (get_element(tempIndexes) > maxValue)
+                    rows[i] = Reduction::initial();
+                }
+                for (size_t iy = firstY; iy < lastY; iy++)
+                {
+                    const float *row = input + iy * rowSize;
+                    for (size_t i = 0; i < rowSize; i++)
                     {
-                        maxValue = get_element(tempIndexes);
+                        rows[i] = Reduction::add(rows[i], row[i]);
                     }
                 }
 
-                result.set_element(targetIndexes, maxValue);
-                newShapeIndex.next();
-            }
+                float *outputRow = output + oy * outputWidth * lanes;
+                const size_t windowRows = lastY - firstY;
 
-            return result;
-        }
+                // then the columns: the inner outputs together, kernel column by kernel column
+                for (size_t i = firstInner * lanes; i < lastInner * lanes; i++)
+                {
+                    outputRow[i] = Reduction::initial();
+                }
+                for (size_t kx = 0; kx < poolSize; kx++)
+                {
+                    for (size_t ox = firstInner; ox < lastInner; ox++)
+                    {
+                        const float *column = rows + (ox * stride + kx - padding) * lanes;
+                        for (size_t l = 0; l < lanes; l++)
+                        {
+                            outputRow[ox * lanes + l] = Reduction::merge(outputRow[ox * lanes + l], column[l]);
+                        }
+                    }
+                }
+                for (size_t i = firstInner * lanes; i < lastInner * lanes; i++)
+                {
+                    outputRow[i] = Reduction::finish(outputRow[i], windowRows * poolSize);
+                }
 
-        shape_type Tensor::argmax() const
-        {
-            shape_type result(m_shape.size(), 0);
-            Shape argmaxIndex(m_shape);
+                // and the borders one by one
+                for (size_t ox = 0; ox < outputWidth; ox++)
+                {
+                    if (ox == firstInner && firstInner < lastInner)
+                    {
+                        ox = lastInner - 1;
+                        continue;
+                    }
 
-            float maxValue = get_element(argmaxIndex.get_current_index());
-            argmaxIndex.next();
+                    size_t firstX;
+                    size_t lastX;
+                    get_pooling_window(ox, poolSize, stride, padding, width, firstX, lastX);
 
-            while (!argmaxIndex.is_end())
-            {
-                if (get_element(argmaxIndex.get_current_index()) > maxValue)
-                {
-                    maxValue = get_element(argmaxIndex.get_current_index());
-                    for (size_t i = 0; i < result.size(); i++)
+                    for (size_t l = 0; l < lanes; l++)
                     {
-                        result[i] = argmaxIndex.get_current_index()[i];
+                        float sum = Reduction::initial();
+                        for (size_t ix = firstX; ix < lastX; ix++)
+                        {
+                            sum = Reduction::merge(sum, rows[ix * lanes + l]);
+                        }
+                        outputRow[ox * lanes + l] = Reduction::finish(sum, windowRows * (lastX - firstX));
                     }
                 }
-
-                argmaxIndex.next();
             }
-
-            return result;
         }
 
-        Tensor Tensor::argmax(const size_t &axis) const
+        /**
+         * Pools the planes in parallel, each thread with its own row buffer.
+         */
+        template <typename Reduction>
+        static void pool_planes(const float *input, const size_t &planes, const size_t &height, const size_t &width,
+                                const size_t &lanes, float *output, const size_t &outputHeight, const size_t &outputWidth,
+                                const size_t &poolSize, const size_t &stride, const size_t &padding)
         {
-            shape_type newShape = m_shape;
-            newShape[axis] = 1;
-            Tensor result(newShape, 0.0f);
-            Shape newShapeIndex(newShape);
-
-            size_t maxAxisSize = m_shape[axis];
-
-            while (!newShapeIndex.is_end())
+            auto poolRange = [&](size_t begin, size_t end)
             {
-                shape_type targetIndexes = newShapeIndex.get_current_index();
-                size_t maxValue = get_element(targetIndexes);
-                size_t maxValueIndex = 0;
-
-                for (size_t i = 0; i < maxAxisSize; i++)
+                std::vector<float> rows(width * lanes);
+                for (size_t plane = begin; plane < end; plane++)
                 {
-                    shape_type tempIndexes = targetIndexes;
-                    tempIndexes[axis] = i;
-
-                    if (get_element(tempIndexes) > maxValue)
-                    {
-                        maxValue = get_element(tempIndexes);
-                        maxValueIndex = i;
-                    }
+                    pool_plane<Reduction>(input + plane * height * width * lanes, height, width, lanes,
+                                          output + plane * outputHeight * outputWidth * lanes, outputHeight, outputWidth,
+                                          poolSize, stride, padding, rows.data());
                 }
+            };
 
-                result.set_element(targetIndexes, maxValueIndex);
-                newShapeIndex.next();
-            }
+            ThreadPool::get_default().parallel_for(planes, 1, poolRange);
+        }
 
-            return result;
+        static void pool_planes(const PoolingMode &mode, const float *input, const size_t &planes, const size_t &height,
+                                const size_t &width, const size_t &lanes, float *output, const size_t &outputHeight,
+                                const size_t &outputWidth, const size_t &poolSize, const size_t &stride, const size_t &padding)
+        {
+            switch (mode)
+            {
+            case PoolingMode::Max:
+                pool_planes<MaxReduction>(input, planes, height, width, lanes, output, outputHeight, outputWidth,
+                                          poolSize, stride, padding);
+                break;
+            case PoolingMode::Average:
+                pool_planes<AverageReduction>(input, planes, height, width, lanes, output, outputHeight, outputWidth,
+                                              poolSize, stride, padding);
+                break;
+            default:
+                pool_planes<L2Reduction>(input, planes, height, width, lanes, output, outputHeight, outputWidth,
+                                         poolSize, stride, padding);
+                break;
+            }
         }
 
-        Tensor Tensor::add(const Tensor &other) const
+        Pooling2DLayer::Pooling2DLayer(const PoolingMode &mode, const size_t &poolSize, const size_t &stride,
+                                       const size_t &padding)
+            : m_mode(mode), m_poolSize(poolSize), m_stride(stride), m_padding(padding)
         {
-            if (!Shape::is_shape_equal(m_shape, other.m_shape))
+            if (m_poolSize == 0 || m_stride == 0)
             {
                 char buffer[NTT_ERROR_MESSAGE_SIZE];
                 snprintf(buffer, sizeof(buffer),
-                         "Shape mismatch: %s != %s",
-                         Shape::convert_shape_to_string(m_shape).c_str(),
-                         Shape::convert_shape_to_string(other.m_shape).c_str());
+                         "Pool size and stride must be positive: %zu, %zu", m_poolSize, m_stride);
                 throw std::invalid_argument(buffer);
             }
+        }
 
-            Tensor result(m_shape, 0.0f);
+        MaxPooling2DLayer::MaxPooling2DLayer(const size_t &poolSize, const size_t &stride, const size_t &padding)
+            : Pooling2DLayer(PoolingMode::Max, poolSize, stride, padding)
+        {
+        }
 
-            for (size_t i = 0; i < getTotalElements(); i++)
+        AveragePooling2DLayer::AveragePooling2DLayer(const size_t &poolSize, const size_t &stride, const size_t &padding)
+            : Pooling2DLayer(PoolingMode::Average, poolSize, stride, padding)
+        {
+        }
+
+        /**
+         * @return: the shape of the output of a pooling in the default layout, throws
+         *      std::invalid_argument when the input is not 4D or smaller than the window.
+         */
+        static shape_type get_pooling_shape(const Tensor &input, const size_t &poolSize, const size_t &stride,
+                                            const size_t &padding)
+        {
+            shape_type shape = input.get_shape();
+            if (shape.size() != 4 || shape[2] + 2 * padding < poolSize || shape[3] + 2 * padding < poolSize)
             {
-                result.m_data[i] = m_data[i] + other.m_data[i];
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(buffer, sizeof(buffer),
+                         "Input must be a 4D tensor larger than the %zux%zu window: %s", poolSize, poolSize,
+                         Shape::convert_shape_to_string(shape).c_str());
+                throw std::invalid_argument(buffer);
             }
 
-            return result;
+            shape[2] = (shape[2] + 2 * padding - poolSize) / stride + 1;
+            shape[3] = (shape[3] + 2 * padding - poolSize) / stride + 1;
+            return shape;
         }
 
-        Tensor Tensor::multiply(const float &other) const
+        Tensor Pooling2DLayer::forward(const Tensor &input)
         {
-            Tensor result(m_shape, 0.0f);
-
-            for (size_t i = 0; i < getTotalElements(); i++)
+            if (input.get_layout() != TensorLayout::CNHW)
             {
-                result.m_data[i] = m_data[i] * other;
+                return forward_with_layout(input);
             }
 
+            const shape_type inputShape = input.get_shape();
+            Tensor result(get_pooling_shape(input, m_poolSize, m_stride, m_padding), 0.0f);
+            const shape_type outputShape = result.get_shape();
+
+            pool_planes(m_mode, input.get_data(), inputShape[0] * inputShape[1], inputShape[2], inputShape[3], 1,
+                        result.get_mutable_data(), outputShape[2], outputShape[3], m_poolSize, m_stride, m_padding);
+
             return result;
         }
 
-        Tensor Tensor::divide(const float &other) const
+        Tensor Pooling2DLayer::forward_with_indices(const Tensor &input, Tensor &indices) const
         {
-            Tensor result(m_shape, 0.0f);
+            if (m_mode != PoolingMode::Max || input.get_layout() != TensorLayout::CNHW)
+            {
+                throw std::invalid_argument("The indices are only given by the max pooling in the CNHW layout");
+            }
 
-            for (size_t i = 0; i < getTotalElements(); i++)
+            const shape_type inputShape = input.get_shape();
+            const shape_type outputShape = get_pooling_shape(input, m_poolSize, m_stride, m_padding);
+            const size_t height = inputShape[2];
+            const size_t width = inputShape[3];
+            if (height * width > (static_cast<size_t>(1) << 24))
             {
-                result.m_data[i] = m_data[i] / other;
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(buffer, sizeof(buffer), "The planes of %zu x %zu elements have indices above 2^24, not exact as floats",
+                         height, width);
+                throw std::invalid_argument(buffer);
             }
 
-            return result;
-        }
+            Tensor result(outputShape, 0.0f);
+            indices = Tensor(outputShape, 0.0f);
 
-        Tensor Tensor::negative() const
-        {
-            Tensor result(m_shape, 0.0f);
+            const size_t outputHeight = outputShape[2];
+            const size_t outputWidth = outputShape[3];
+            const float *inputData = input.get_data();
+            float *resultData = result.get_mutable_data();
+            float *indexData = indices.get_mutable_data();
 
-            for (size_t i = 0; i < getTotalElements(); i++)
+            for (size_t plane = 0; plane < inputShape[0] * inputShape[1]; plane++)
             {
-                result.m_data[i] = -m_data[i];
+                const float *source = inputData + plane * height * width;
+
+                for (size_t oy = 0; oy < outputHeight; oy++)
+                {
+                    size_t firstY;
+                    size_t lastY;
+                    get_pooling_window(oy, m_poolSize, m_stride, m_padding, height, firstY, lastY);
+
+                    for (size_t ox = 0; ox < outputWidth; ox++)
+                    {
+                        size_t firstX;
+                        size_t lastX;
+                        get_pooling_window(ox, m_poolSize, m_stride, m_padding, width, firstX, lastX);
+
+                        const size_t output = (plane * outputHeight + oy) * outputWidth + ox;
+                        size_t best = firstY * width + firstX;
+                        for (size_t iy = firstY; iy < lastY; iy++)
+                        {
+                            for (size_t ix = firstX; ix < lastX; ix++)
+                            {
+                                best = source[iy * width + ix] > source[best] ? iy * width + ix : best;
+                            }
+                        }
+
+                        const bool isEmpty = firstY == lastY || firstX == lastX;
+                        resultData[output] = isEmpty ? 0.0f : source[best];
+                        indexData[output] = static_cast<float>(best);
+                    }
+                }
             }
 
             return result;
         }
 
-        Tensor Tensor::subtract(const Tensor &other) const
+        Tensor Pooling2DLayer::unpool(const Tensor &values, const Tensor &indices, const size_t &height, const size_t &width)
         {
-            return add(other.negative());
-        }
+            const shape_type shape = values.get_shape();
+            if (shape.size() != 4 || !Shape::is_shape_equal(shape, indices.get_shape()))
+            {
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(buffer, sizeof(buffer),
+                         "Values and indices must be 4D tensors of the same shape: %s != %s",
+                         Shape::convert_shape_to_string(shape).c_str(),
+                         Shape::convert_shape_to_string(indices.get_shape()).c_str());
+                throw std::invalid_argument(buffer);
+            }
 
-        Tensor Tensor::operator+(const Tensor &other) const
-        {
-            return add(other);
-        }
+            Tensor result({shape[0], shape[1], height, width}, 0.0f);
+            const size_t outputs = shape[2] * shape[3];
+            const float *valueData = values.get_data();
+            const float *indexData = indices.get_data();
+            float *resultData = result.get_mutable_data();
 
-        Tensor Tensor::operator+(const float &other) const
-        {
-            Tensor result(m_shape, other);
-            return add(result);
-        }
+            for (size_t plane = 0; plane < shape[0] * shape[1]; plane++)
+            {
+                for (size_t i = 0; i < outputs; i++)
+                {
+                    const size_t index = static_cast<size_t>(indexData[plane * outputs + i]);
+                    if (index < height * width)
+                    {
+                        resultData[plane * height * width + index] = valueData[plane * outputs + i];
+                    }
+                }
+            }
 
-        Tensor Tensor::operator-(const Tensor &other) const
-        {
-            return subtract(other);
+            return result;
         }
 
-        Tensor Tensor::operator-(const float &other) const
+        Tensor Pooling2DLayer::forward_with_layout(const Tensor &input) const
         {
-            Tensor result(m_shape, other);
-            return subtract(result);
-        }
+            check_layout_input(input);
 
-        void Tensor::operator=(const Tensor &other)
-        {
-            if (m_data != nullptr)
+            const LayoutDimensions in = get_layout_dimensions(input);
+            if (in.height + 2 * m_padding < m_poolSize || in.width + 2 * m_padding < m_poolSize)
             {
-                free(m_data);
-                m_data = nullptr;
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(buffer, sizeof(buffer),
+                         "Input must be larger than the %zux%zu window: %s", m_poolSize, m_poolSize,
+                         Shape::convert_shape_to_string(input.get_shape()).c_str());
+                throw std::invalid_argument(buffer);
             }
 
-            m_shape = other.m_shape;
-            m_strides = other.m_strides;
-            m_totalElements = other.m_totalElements;
-            m_data = (float *)malloc(sizeof(float) * m_totalElements);
+            const size_t outputHeight = (in.height + 2 * m_padding - m_poolSize) / m_stride + 1;
+            const size_t outputWidth = (in.width + 2 * m_padding - m_poolSize) / m_stride + 1;
+            Tensor result = create_layout_tensor(input.get_layout(), in.batch, input.get_channels(),
+                                                 outputHeight, outputWidth);
 
-            for (size_t i = 0; i < m_totalElements; i++)
-            {
-                m_data[i] = other.m_data[i];
-            }
+            // the channels of a pixel are the lanes
+            pool_planes(m_mode, input.get_data(), in.batch * in.blocks, in.height, in.width, in.block,
+                        result.get_mutable_data(), outputHeight, outputWidth, m_poolSize, m_stride, m_padding);
+
+            return result;
         }
 
-        bool Tensor::operator==(const Tensor &other) const
+        Tensor GlobalAveragePooling2DLayer::forward_with_layout(const Tensor &input)
         {
-            if (m_shape != other.m_shape)
-            {
-                return false;
-            }
+            check_layout_input(input);
 
-            for (size_t i = 0; i < m_totalElements; i++)
+            const LayoutDimensions in = get_layout_dimensions(input);
+            Tensor result = create_layout_tensor(input.get_layout(), in.batch, input.get_channels(), 1, 1);
+
+            const float *inputData = input.get_data();
+            float *outputData = result.get_mutable_data();
+            const size_t block = in.block;
+            const size_t count = in.height * in.width;
+
+            for (size_t plane = 0; plane < in.batch * in.blocks; plane++)
             {
-                if (std::fabs(m_data[i] - other.m_data[i]) > std::numeric_limits<float>::epsilon())
+                const float *source = inputData + plane * count * block;
+                float *target = outputData + plane * block;
+
+                for (size_t i = 0; i < count; i++)
                 {
-                    return false;
+                    for (size_t l = 0; l < block; l++)
+                    {
+                        target[l] += source[i * block + l];
+                    }
+                }
+
+                for (size_t l = 0; l < block; l++)
+                {
+                    target[l] = target[l] / count;
                 }
             }
 
-            return true;
+            return result;
         }
 
-        Tensor Tensor::operator*(const float &other) const
+        ReorderLayer::ReorderLayer(const TensorLayout &layout)
+            : m_layout(layout)
         {
-            return multiply(other);
         }
 
-        Tensor Tensor::operator/(const float &other) const
+        Tensor ReorderLayer::forward(const Tensor &input)
         {
-            return divide(other);
+            return input.to_layout(m_layout);
         }
 
-        Tensor Tensor::from_vector(const vec &data)
+        LayoutPlan::LayoutPlan(const std::vector<Layer *> &layers, const TensorLayout &layout)
         {
-            Tensor tensor({data.size()}, 0.0f);
-            for (size_t i = 0; i < data.size(); i++)
+            TensorLayout current = TensorLayout::CNHW;
+
+            for (Layer *layer : layers)
             {
-                tensor.set_element({i}, data[i]);
+                const TensorLayout wanted = layer->supports_layout(layout) ? layout : TensorLayout::CNHW;
+                if (wanted != current)
+                {
+                    m_reorders.push_back(std::make_shared<ReorderLayer>(wanted));
+                    m_layers.push_back(m_reorders.back().get());
+                    current = wanted;
+                }
+
+                m_layers.push_back(layer);
             }
 
-            return tensor;
+            if (current != TensorLayout::CNHW)
+            {
+                m_reorders.push_back(std::make_shared<ReorderLayer>(TensorLayout::CNHW));
+                m_layers.push_back(m_reorders.back().get());
+            }
         }
 
-        Tensor Tensor::from_vector(const tensor2d &data)
+        Tensor LayoutPlan::forward(const Tensor &input)
         {
-            Tensor tensor({data.size(), data[0].size()}, 0.0f);
-            for (size_t i = 0; i < data.size(); i++)
+            Tensor output = input;
+            for (Layer *layer : m_layers)
             {
-                for (size_t j = 0; j < data[i].size(); j++)
-                {
-                    tensor.set_element({i, j}, data[i][j]);
-                }
+                output = layer->forward(output);
             }
 
-            return tensor;
+            return output;
         }
 
-        Tensor Tensor::from_vector(const tensor3d &data)
+        /**
+         * Joins the tensors along the axis, the other dimensions must be the same.
+         */
+        static Tensor concat_tensors(const std::vector<const Tensor *> &inputs, const size_t &axis)
         {
-            Tensor tensor({data.size(), data[0].size(), data[0][0].size()}, 0.0f);
-            for (size_t i = 0; i < data.size(); i++)
+            shape_type shape = inputs[0]->get_shape();
+            if (axis >= shape.size())
             {
-                for (size_t j = 0; j < data[i].size(); j++)
-                {
-                    for (size_t k = 0; k < data[i][j].size(); k++)
-                    {
-                        tensor.set_element({i, j, k}, data[i][j][k]);
-                    }
-                }
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(buffer, sizeof(buffer),
+                         "Axis %zu out of range for %s", axis, Shape::convert_shape_to_string(shape).c_str());
+                throw std::invalid_argument(buffer);
             }
-            return tensor;
-        }
 
-        Tensor Tensor::from_vector(const tensor4d &data)
-        {
-            Tensor tensor({data.size(), data[0].size(), data[0][0].size(), data[0][0][0].size()}, 0.0f);
-            for (size_t i = 0; i < data.size(); i++)
+            shape[axis] = 0;
+            for (const Tensor *input : inputs)
             {
-                for (size_t j = 0; j < data[i].size(); j++)
+                shape_type inputShape = input->get_shape();
+                inputShape[axis] = 0;
+                if (input->get_layout() != TensorLayout::CNHW || !Shape::is_shape_equal(inputShape, shape))
                 {
-                    for (size_t k = 0; k < data[i][j].size(); k++)
-                    {
-                        for (size_t l = 0; l < data[i][j][k].size(); l++)
-                        {
-                            tensor.set_element({i, j, k, l}, data[i][j][k][l]);
-                        }
-                    }
+                    char buffer[NTT_ERROR_MESSAGE_SIZE];
+                    snprintf(buffer, sizeof(buffer),
+                             "Only the concatenation axis %zu may differ: %s != %s", axis,
+                             Shape::convert_shape_to_string(input->get_shape()).c_str(),
+                             Shape::convert_shape_to_string(inputs[0]->get_shape()).c_str());
+                    throw std::invalid_argument(buffer);
                 }
             }
-            return tensor;
-        }
 
-        size_t Tensor::reloadTotalElements(const shape_type &shape)
-        {
-            size_t result = 1;
+            size_t outer = 1;
+            size_t inner = 1;
             for (size_t i = 0; i < shape.size(); i++)
             {
-                result *= shape[i];
+                outer *= i < axis ? shape[i] : 1;
+                inner *= i > axis ? shape[i] : 1;
+            }
+            for (const Tensor *input : inputs)
+            {
+                shape[axis] += input->get_shape()[axis];
+            }
+
+            Tensor result(shape, 0.0f);
+            float *resultData = result.get_mutable_data();
+
+            for (size_t o = 0; o < outer; o++)
+            {
+                for (const Tensor *input : inputs)
+                {
+                    const size_t size = input->get_shape()[axis] * inner;
+                    memcpy(resultData, input->get_data() + o * size, size * sizeof(float));
+                    resultData += size;
+                }
             }
+
             return result;
         }
 
-        bool Tensor::is_index_in_range(const shape_type &indexes) const
+        Graph::Graph()
+            : m_isPlanned(false)
+        {
+        }
+
+        void Graph::check_node(const size_t &node) const
         {
-            for (size_t i = 0; i < indexes.size(); i++)
+            if (node >= m_nodes.size())
             {
-                if (indexes[i] >= m_shape[i])
-                {
-                    return false;
-                }
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(buffer, sizeof(buffer),
+                         "Node %zu does not exist, the graph has %zu nodes", node, m_nodes.size());
+                throw std::invalid_argument(buffer);
             }
-            return true;
         }
 
-        Tensor::Tensor(const shape_type &shape, float defaultValue)
-            : m_shape(shape)
+        size_t Graph::add_input()
         {
-            m_totalElements = reloadTotalElements(m_shape);
+            m_inputs.push_back(m_nodes.size());
+            m_nodes.push_back({GraphOperation::Input, nullptr, {}, 0, nullptr, 0, 0});
+            m_isPlanned = false;
+            return m_nodes.size() - 1;
+        }
 
-            m_data = (float *)malloc(sizeof(float) * getTotalElements());
+        size_t Graph::add_constant(const Tensor &value)
+        {
+            m_nodes.push_back({GraphOperation::Constant, nullptr, {}, 0, std::make_shared<Tensor>(value), 0, 0});
+            m_isPlanned = false;
+            return m_nodes.size() - 1;
+        }
 
-            for (size_t i = 0; i < getTotalElements(); i++)
+        size_t Graph::add_layer(Layer &layer, const size_t &input)
+        {
+            check_node(input);
+            m_nodes.push_back({GraphOperation::Layer, &layer, {input}, 0, nullptr, 0, 0});
+            m_isPlanned = false;
+            return m_nodes.size() - 1;
+        }
+
+        size_t Graph::add_layers(const std::vector<Layer *> &layers, const size_t &input)
+        {
+            size_t node = input;
+            for (Layer *layer : layers)
             {
-                m_data[i] = defaultValue;
+                node = add_layer(*layer, node);
             }
 
-            reload_new_strides();
+            return node;
         }
 
-        Tensor::Tensor(const Tensor &other)
+        size_t Graph::add_node(const GraphOperation &operation, const std::vector<size_t> &inputs, const size_t &axis)
         {
-            m_shape = other.m_shape;
-            m_strides = other.m_strides;
-            m_totalElements = other.m_totalElements;
-            m_data = (float *)malloc(sizeof(float) * m_totalElements);
+            if (operation == GraphOperation::Input || operation == GraphOperation::Constant ||
+                operation == GraphOperation::Layer || inputs.empty())
+            {
+                throw std::invalid_argument("Use add_input, add_constant and add_layer for the inputs, the constants "
+                                            "and the layers, the other nodes need at least one input");
+            }
 
-            for (size_t i = 0; i < m_totalElements; i++)
+            for (size_t input : inputs)
             {
-                m_data[i] = other.m_data[i];
+                check_node(input);
             }
+
+            m_nodes.push_back({operation, nullptr, inputs, axis, nullptr, 0, 0});
+            m_isPlanned = false;
+            return m_nodes.size() - 1;
         }
 
-        void Tensor::reload_new_strides()
+        size_t Graph::add_slice(const size_t &input, const size_t &begin, const size_t &end)
         {
-            size_t currentStride = 1;
-            for (size_t i = 1; i < m_shape.size(); i++)
+            check_node(input);
+            if (begin > end)
             {
-                currentStride *= m_shape[i];
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(buffer, sizeof(buffer), "Invalid slice [%zu, %zu)", begin, end);
+                throw std::invalid_argument(buffer);
             }
 
-            m_strides.clear();
-            for (size_t i = 1; i < m_shape.size(); i++)
+            m_nodes.push_back({GraphOperation::Slice, nullptr, {input}, 0, nullptr, begin, end});
+            m_isPlanned = false;
+            return m_nodes.size() - 1;
+        }
+
+        std::vector<size_t> Graph::add_split(const size_t &input, const std::vector<size_t> &sizes)
+        {
+            std::vector<size_t> nodes;
+            size_t begin = 0;
+            for (size_t size : sizes)
             {
-                m_strides.push_back(currentStride);
-                currentStride /= m_shape[i];
+                nodes.push_back(add_slice(input, begin, begin + size));
+                begin += size;
             }
 
-            m_strides.push_back(1);
+            return nodes;
         }
 
-        Tensor::~Tensor()
+        void Graph::set_outputs(const std::vector<size_t> &outputs)
         {
-            if (m_data != nullptr)
+            for (size_t output : outputs)
             {
-                free(m_data);
-                m_data = nullptr;
+                check_node(output);
             }
+
+            m_outputs = outputs;
+            m_isPlanned = false;
         }
 
-        float Tensor::get_element(const shape_type &indexes) const
+        void Graph::plan()
         {
-            if (indexes.size() != m_shape.size())
+            const size_t count = m_nodes.size();
+            if (m_outputs.empty() && count > 0)
             {
-                char buffer[NTT_ERROR_MESSAGE_SIZE];
-                snprintf(buffer, sizeof(buffer),
-                         "Shape mismatch: %s != %s",
-                         Shape::convert_shape_to_string(indexes).c_str(),
-                         Shape::convert_shape_to_string(m_shape).c_str());
-                throw std::invalid_argument(buffer);
+                m_outputs.push_back(count - 1);
             }
 
-            if (!is_index_in_range(indexes))
+            m_lastReaders.assign(count, 0);
+            for (size_t i = 0; i < count; i++)
             {
-                char buffer[NTT_ERROR_MESSAGE_SIZE];
-                snprintf(buffer, sizeof(buffer),
-                         "Index is out of range: %s not in range of %s",
-                         Shape::convert_shape_to_string(indexes).c_str(),
-                         Shape::convert_shape_to_string(m_shape).c_str());
-                throw std::out_of_range(buffer);
+                for (size_t input : m_nodes[i].inputs)
+                {
+                    m_lastReaders[input] = i;
+                }
             }
 
-            size_t index = 0;
-            for (size_t i = 0; i < indexes.size(); i++)
+            // the outputs, the inputs of the caller and the constants are never released or overwritten
+            for (size_t output : m_outputs)
             {
-                index += indexes[i] * m_strides[i];
+                m_lastReaders[output] = count;
+            }
+            for (size_t i = 0; i < count; i++)
+            {
+                const GraphOperation operation = m_nodes[i].operation;
+                if (operation == GraphOperation::Input || operation == GraphOperation::Constant)
+                {
+                    m_lastReaders[i] = count;
+                }
             }
 
-            return m_data[index];
-        }
+            m_inPlaceOperands.assign(count, count);
+            for (size_t i = 0; i < count; i++)
+            {
+                const Node &node = m_nodes[i];
+                if (node.operation != GraphOperation::Add && node.operation != GraphOperation::Multiply)
+                {
+                    continue;
+                }
 
-        void Tensor::set_element(const shape_type &indexes, float value)
-        {
-            if (!is_index_in_range(indexes))
+                for (size_t j = 0; j < node.inputs.size() && m_inPlaceOperands[i] == count; j++)
+                {
+                    size_t reads = 0;
+                    for (size_t input : node.inputs)
+                    {
+                        reads += input == node.inputs[j] ? 1 : 0;
+                    }
+
+                    if (m_lastReaders[node.inputs[j]] == i && reads == 1)
+                    {
+                        m_inPlaceOperands[i] = j;
+                    }
+                }
+            }
+
+            const std::vector<size_t> readers = count_readers();
+            m_concatTargets.assign(count, count);
+            for (size_t i = 0; i < count; i++)
             {
-                char buffer[NTT_ERROR_MESSAGE_SIZE];
-                snprintf(buffer, sizeof(buffer),
-                         "Index is out of range: %s not in range of %s",
-                         Shape::convert_shape_to_string(indexes).c_str(),
-                         Shape::convert_shape_to_string(m_shape).c_str());
-                throw std::out_of_range(buffer);
+                const Node &node = m_nodes[i];
+                if (node.operation != GraphOperation::Concat || node.axis != 0)
+                {
+                    continue;
+                }
+
+                for (size_t input : node.inputs)
+                {
+                    if (m_nodes[input].operation == GraphOperation::Layer && readers[input] == 1)
+                    {
+                        m_concatTargets[input] = i;
+                    }
+                }
             }
 
-            size_t index = 0;
-            for (size_t i = 0; i < indexes.size(); i++)
+            m_shapes.clear();
+            m_isPlanned = true;
+        }
+
+        bool Graph::writes_into_concat(const size_t &node)
+        {
+            check_node(node);
+            if (!m_isPlanned)
             {
-                index += indexes[i] * m_strides[i];
+                plan();
             }
 
-            m_data[index] = value;
+            return m_concatTargets[node] < m_nodes.size();
         }
 
-        void Tensor::reshape(const shape_type &newShape)
+        bool Graph::is_in_place(const size_t &node)
         {
-            if (reloadTotalElements(newShape) != getTotalElements())
+            check_node(node);
+            if (!m_isPlanned)
             {
-                char buffer[NTT_ERROR_MESSAGE_SIZE];
-                snprintf(buffer, sizeof(buffer),
-                         "Total elements mismatch: %zu (%s) != %zu (%s)",
-                         reloadTotalElements(newShape),
-                         Shape::convert_shape_to_string(newShape).c_str(),
-                         getTotalElements(),
-                         Shape::convert_shape_to_string(m_shape).c_str());
-                throw std::invalid_argument(buffer);
+                plan();
             }
 
-            m_shape = newShape;
-            reload_new_strides();
+            return m_inPlaceOperands[node] < m_nodes.size();
         }
 
-        Tensor Tensor::reshape_clone(const shape_type &newShape)
+        GraphOperation Graph::get_operation(const size_t &node) const
         {
-            Tensor newTensor(*this);
-            newTensor.reshape(newShape);
-            return newTensor;
+            check_node(node);
+            return m_nodes[node].operation;
         }
 
-        Tensor Tensor::transpose(const size_t &axis1, const size_t &axis2) const
+        Layer *Graph::get_layer(const size_t &node) const
         {
-            if (axis1 >= m_shape.size() || axis2 >= m_shape.size())
+            check_node(node);
+            return m_nodes[node].layer;
+        }
+
+        std::vector<size_t> Graph::count_readers() const
+        {
+            std::vector<size_t> readers(m_nodes.size(), 0);
+            for (const Node &node : m_nodes)
             {
-                char buffer[NTT_ERROR_MESSAGE_SIZE];
-                snprintf(buffer, sizeof(buffer),
-                         "Invalid axis: %zu or %zu not in range of %zu",
-                         axis1, axis2, m_shape.size());
-                throw std::invalid_argument(buffer);
+                for (size_t input : node.inputs)
+                {
+                    readers[input]++;
+                }
+            }
+            for (size_t output : m_outputs)
+            {
+                readers[output]++;
             }
 
-            shape_type newShape = m_shape;
-            newShape[axis1] = m_shape[axis2];
-            newShape[axis2] = m_shape[axis1];
+            return readers;
+        }
 
-            Tensor result(newShape, 0.0f);
-            Shape shape(m_shape);
+        void Graph::fold_constants()
+        {
+            std::vector<std::shared_ptr<Tensor>> values(m_nodes.size());
 
-            while (!shape.is_end())
+            for (size_t i = 0; i < m_nodes.size(); i++)
             {
-                shape_type targetIndexes = shape.get_current_index();
-                size_t temp = targetIndexes[axis1];
-                targetIndexes[axis1] = targetIndexes[axis2];
-                targetIndexes[axis2] = temp;
+                Node &node = m_nodes[i];
+                if (node.operation == GraphOperation::Input || node.operation == GraphOperation::Constant)
+                {
+                    values[i] = node.constant;
+                    continue;
+                }
 
-                result.set_element(targetIndexes, get_element(shape.get_current_index()));
-                shape.next();
-            }
+                bool isConstant = true;
+                for (size_t input : node.inputs)
+                {
+                    isConstant = isConstant && m_nodes[input].operation == GraphOperation::Constant;
+                }
 
-            return result;
+                if (isConstant)
+                {
+                    values[i] = execute_node(node, values, node.inputs.size());
+                    node = {GraphOperation::Constant, nullptr, {}, 0, values[i], 0, 0};
+                }
+            }
         }
 
-        void Tensor::save(const std::string &filename) const
+        void Graph::fold_batch_norms()
         {
-            unsigned char shape_size = m_shape.size();
-            size_t total_size = 1 + shape_size * sizeof(size_t) + m_totalElements * sizeof(float);
-            unsigned char *full_tensor_data =
-                (unsigned char *)malloc(sizeof(unsigned char) * total_size);
+            std::vector<size_t> readers = count_readers();
 
-            size_t current_index = 0;
-            full_tensor_data[current_index++] = shape_size;
-            for (size_t i = 0; i < shape_size; i++)
+            for (size_t i = 0; i < m_nodes.size(); i++)
             {
-                TensorShapeData data;
-                data.value = m_shape[i];
-                memcpy(full_tensor_data + current_index, &data.bytes, sizeof(data.bytes));
-                current_index += sizeof(data.bytes);
-            }
+                Node &node = m_nodes[i];
+                BatchNormLayer *batchNorm = node.operation == GraphOperation::Layer
+                                                ? dynamic_cast<BatchNormLayer *>(node.layer)
+                                                : nullptr;
+                if (batchNorm == nullptr)
+                {
+                    continue;
+                }
 
-            memcpy(full_tensor_data + current_index, m_data, m_totalElements * sizeof(float));
+                // the output of the layer before is only used by the normalization
+                const size_t previous = node.inputs[0];
+                const Node &source = m_nodes[previous];
+                if (source.operation != GraphOperation::Layer || readers[previous] != 1)
+                {
+                    continue;
+                }
 
-            std::ofstream file(filename, std::ios::binary | std::ios::ate);
-            file.write(reinterpret_cast<const char *>(full_tensor_data), total_size);
-            file.close();
+                const Tensor &scale = batchNorm->get_scale();
+                const Tensor &shift = batchNorm->get_shift();
+                const size_t channels = scale.getTotalElements();
+                std::shared_ptr<Layer> folded;
 
-            free(full_tensor_data);
+                if (Conv2DLayer *conv = dynamic_cast<Conv2DLayer *>(source.layer))
+                {
+                    const shape_type &shape = conv->get_weights().get_shape();
+                    if (shape[0] != channels)
+                    {
+                        continue;
+                    }
+
+                    std::shared_ptr<Conv2DLayer> foldedConv = std::make_shared<Conv2DLayer>(
+                        conv->get_weights() * scale.reshape_clone({channels, 1, 1, 1}),
+                        conv->get_bias() * scale + shift,
+                        conv->get_stride(), conv->get_padding(), conv->get_group());
+                    if (foldedConv->get_convolution_algorithm() != conv->get_convolution_algorithm())
+                    {
+                        foldedConv->set_convolution_algorithm(conv->get_convolution_algorithm());
+                    }
+                    folded = foldedConv;
+                }
+                else if (FullyConnectedLayer *fullyConnected = dynamic_cast<FullyConnectedLayer *>(source.layer))
+                {
+                    if (fullyConnected->get_weights().get_shape()[0] != channels)
+                    {
+                        continue;
+                    }
+
+                    folded = std::make_shared<FullyConnectedLayer>(fullyConnected->get_weights() * scale,
+                                                                   fullyConnected->get_bias() * scale + shift);
+                }
+                else
+                {
+                    continue;
+                }
+
+                m_ownedLayers.push_back(folded);
+                node.layer = folded.get();
+                node.inputs = source.inputs;
+                readers[previous] = 0;
+            }
         }
 
-        Tensor Tensor::from_bytes(const std::string &filename)
+        /**
+         * The range of a clip or of a ReLU, @return: false for the other layers.
+         */
+        static bool get_clip_range(Layer *layer, float &min, float &max)
         {
-            std::ifstream file(filename, std::ios::binary | std::ios::ate);
-            if (!file.is_open())
+            if (Clip2DLayer *clip = dynamic_cast<Clip2DLayer *>(layer))
             {
-                char buffer[NTT_ERROR_MESSAGE_SIZE];
-                snprintf(
-                    buffer, sizeof(buffer),
-                    "Failed to open file: %s",
-                    filename.c_str());
-                throw std::runtime_error(buffer);
+                min = clip->get_min();
+                max = clip->get_max();
+                return true;
             }
-            size_t file_size = file.tellg();
-            file.seekg(0, std::ios::beg);
-            unsigned char *full_tensor_data = (unsigned char *)malloc(sizeof(unsigned char) * file_size);
-            file.read(reinterpret_cast<char *>(full_tensor_data), file_size);
-            file.close();
 
-            size_t current_index = 0;
-            size_t shape_size = full_tensor_data[current_index++];
-            shape_type shape(shape_size);
-            for (size_t i = 0; i < shape_size; i++)
+            if (dynamic_cast<ReLULayer *>(layer) != nullptr)
             {
-                TensorShapeData data;
-                memcpy(&data.bytes, full_tensor_data + current_index, sizeof(data.bytes));
-                current_index += sizeof(data.bytes);
-                shape[i] = data.value;
+                min = 0.0f;
+                max = std::numeric_limits<float>::infinity();
+                return true;
             }
 
-            Tensor result(shape, 0.0f);
-            memcpy(result.m_data, full_tensor_data + current_index, result.getTotalElements() * sizeof(float));
-
-            free(full_tensor_data);
-            return result;
+            return false;
         }
 
-        std::string Tensor::to_string() const
+        static bool is_reshape(Layer *layer)
         {
-            std::string result = "[\n";
+            return dynamic_cast<FlattenLayer *>(layer) != nullptr || dynamic_cast<ReshapeLayer *>(layer) != nullptr;
+        }
 
-            size_t currentTabNumber = 0;
+        void Graph::eliminate_identities()
+        {
+            std::vector<size_t> readers = count_readers();
 
-            for (size_t i = 0; i < m_shape.size(); i++)
+            for (size_t i = 0; i < m_nodes.size(); i++)
             {
-                currentTabNumber++;
-                for (size_t j = 0; j < currentTabNumber; j++)
+                Node &node = m_nodes[i];
+                if (node.operation != GraphOperation::Layer)
                 {
-                    result += "\t";
+                    continue;
                 }
-                result += "[\n";
-            }
 
-            currentTabNumber++;
+                const size_t previous = node.inputs[0];
 
-            Shape shape(m_shape);
+                // only the shape of the last reshape matters
+                if (is_reshape(node.layer) && m_nodes[previous].operation == GraphOperation::Layer &&
+                    is_reshape(m_nodes[previous].layer) && readers[previous] == 1)
+                {
+                    node.inputs = m_nodes[previous].inputs;
+                    readers[previous] = 0;
+                    continue;
+                }
+
+                float min;
+                float max;
+                BatchNormLayer *batchNorm = dynamic_cast<BatchNormLayer *>(node.layer);
+                const bool isIdentity = (batchNorm != nullptr && batchNorm->is_identity()) ||
+                                        (dynamic_cast<Clip2DLayer *>(node.layer) != nullptr &&
+                                         get_clip_range(node.layer, min, max) &&
+                                         min == -std::numeric_limits<float>::infinity() &&
+                                         max == std::numeric_limits<float>::infinity());
+                if (!isIdentity)
+                {
+                    continue;
+                }
+
+                // the readers of the node read its input instead
+                for (size_t j = i + 1; j < m_nodes.size(); j++)
+                {
+                    for (size_t &input : m_nodes[j].inputs)
+                    {
+                        input = input == i ? previous : input;
+                    }
+                }
+                for (size_t &output : m_outputs)
+                {
+                    output = output == i ? previous : output;
+                }
+
+                readers[previous] += readers[i] - 1;
+                readers[i] = 0;
+            }
+        }
+
+        void Graph::merge_clips()
+        {
+            std::vector<size_t> readers = count_readers();
 
-            while (!shape.is_end())
+            for (size_t i = 0; i < m_nodes.size(); i++)
             {
-                if (shape.is_first_element())
+                Node &node = m_nodes[i];
+                float min;
+                float max;
+                if (node.operation != GraphOperation::Layer || !get_clip_range(node.layer, min, max))
                 {
-                    for (size_t i = 0; i < currentTabNumber; i++)
-                    {
-                        result += "\t";
-                    }
-
-                    result += std::to_string(get_element(shape.get_current_index())) + ", \n";
+                    continue;
+                }
 
-                    shape.next();
+                const size_t previous = node.inputs[0];
+                float previousMin;
+                float previousMax;
+                if (m_nodes[previous].operation != GraphOperation::Layer || readers[previous] != 1 ||
+                    !get_clip_range(m_nodes[previous].layer, previousMin, previousMax))
+                {
                     continue;
                 }
 
-                size_t numberOfNewLines = shape.get_number_of_new_lines();
-                for (int i = numberOfNewLines - 1; i >= 0; i--)
+                // clip(clip(x, a, b), c, d) = clip(x, clip(a, c, d), clip(b, c, d))
+                std::shared_ptr<Layer> merged = std::make_shared<Clip2DLayer>(getMax(min, getMin(previousMin, max)),
+                                                                              getMax(min, getMin(previousMax, max)));
+                m_ownedLayers.push_back(merged);
+                node.layer = merged.get();
+                node.inputs = m_nodes[previous].inputs;
+                readers[previous] = 0;
+            }
+        }
+
+        void Graph::remove_dead_nodes()
+        {
+            const size_t count = m_nodes.size();
+            std::vector<bool> isLive(count, false);
+            for (size_t output : m_outputs)
+            {
+                isLive[output] = true;
+            }
+            for (size_t input : m_inputs)
+            {
+                isLive[input] = true;
+            }
+
+            for (size_t i = count; i > 0; i--)
+            {
+                if (isLive[i - 1])
                 {
-                    currentTabNumber--;
-                    for (size_t j = 0; j < currentTabNumber; j++)
+                    for (size_t input : m_nodes[i - 1].inputs)
                     {
-                        result += "\t";
+                        isLive[input] = true;
                     }
-                    result += "],\n";
                 }
+            }
 
-                for (int i = 0; i < numberOfNewLines; i++)
+            std::vector<size_t> indexes(count, count);
+            std::vector<Node> nodes;
+            for (size_t i = 0; i < count; i++)
+            {
+                if (isLive[i])
                 {
-                    for (size_t j = 0; j < currentTabNumber; j++)
+                    indexes[i] = nodes.size();
+                    nodes.push_back(m_nodes[i]);
+                    for (size_t &input : nodes.back().inputs)
                     {
-                        result += "\t";
+                        input = indexes[input];
                     }
-                    result += "[\n";
-                    currentTabNumber++;
                 }
+            }
 
-                for (size_t i = 0; i < currentTabNumber; i++)
-                {
-                    result += "\t";
-                }
+            for (size_t &input : m_inputs)
+            {
+                input = indexes[input];
+            }
+            for (size_t &output : m_outputs)
+            {
+                output = indexes[output];
+            }
 
-                result += std::to_string(get_element(shape.get_current_index())) + ", \n";
+            m_nodes = nodes;
+        }
 
-                shape.next();
+        void Graph::optimize(const std::vector<GraphPass> &passes)
+        {
+            if (m_outputs.empty() && !m_nodes.empty())
+            {
+                m_outputs.push_back(m_nodes.size() - 1);
             }
 
-            while (currentTabNumber > 0)
+            const std::vector<Node> nodes = m_nodes;
+            const std::vector<size_t> inputs = m_inputs;
+            const std::vector<size_t> outputs = m_outputs;
+
+            try
             {
-                currentTabNumber--;
-                for (size_t j = 0; j < currentTabNumber; j++)
+                for (const GraphPass &pass : passes)
                 {
-                    result += "\t";
+                    switch (pass)
+                    {
+                    case GraphPass::FoldConstants:
+                        fold_constants();
+                        break;
+                    case GraphPass::FoldBatchNorm:
+                        fold_batch_norms();
+                        break;
+                    case GraphPass::EliminateIdentities:
+                        eliminate_identities();
+                        break;
+                    case GraphPass::MergeClips:
+                        merge_clips();
+                        break;
+                    }
                 }
-                result += "]\n";
+
+                remove_dead_nodes();
+            }
+            catch (...)
+            {
+                m_nodes = nodes;
+                m_inputs = inputs;
+                m_outputs = outputs;
+                throw;
             }
 
-            return result;
+            m_isPlanned = false;
         }
 
-        Tensor ReLULayer::forward(const Tensor &input)
+        size_t Graph::get_concat_offset(const size_t &concat, const size_t &input) const
         {
-            Tensor result(input.get_shape(), 0.0f);
-            Shape shape(input.get_shape());
-
-            while (!shape.is_end())
+            size_t offset = 0;
+            for (size_t i = 0; m_nodes[concat].inputs[i] != input; i++)
             {
-                float value = input.get_element(shape.get_current_index());
-                result.set_element(shape.get_current_index(), std::max(0.0f, value));
-                shape.next();
+                offset += m_shapes[m_nodes[concat].inputs[i]][0];
             }
 
-            return result;
+            return offset;
         }
 
-        Clip2DLayer::Clip2DLayer(const float &min, const float &max)
-            : m_min(min), m_max(max)
+        std::shared_ptr<Tensor> Graph::execute_concat(const size_t &concat, std::vector<std::shared_ptr<Tensor>> &values,
+                                                      std::vector<std::shared_ptr<Tensor>> &buffers,
+                                                      const std::vector<bool> &isWritten) const
         {
-        }
+            const Node &node = m_nodes[concat];
+            if (!buffers[concat])
+            {
+                buffers[concat] = std::make_shared<Tensor>(m_shapes[concat], 0.0f);
+            }
 
-        Tensor Clip2DLayer::forward(const Tensor &input)
-        {
-            Tensor result(input.get_shape(), 0.0f);
-            Shape shape(input.get_shape());
+            // the inputs which were written are already in place, the others are copied when
+            // they still have the shapes of the last forward
+            std::vector<const Tensor *> operands;
+            std::vector<Tensor> parts;
+            parts.reserve(node.inputs.size());
+            bool hasShapes = true;
+            size_t offset = 0;
 
-            while (!shape.is_end())
+            for (size_t input : node.inputs)
+            {
+                const size_t channels = m_shapes[input][0];
+                if (isWritten[input])
+                {
+                    parts.push_back(buffers[concat]->slice(offset, offset + channels));
+                    operands.push_back(&parts.back());
+                }
+                else
+                {
+                    operands.push_back(values[input].get());
+                    hasShapes = hasShapes && Shape::is_shape_equal(values[input]->get_shape(), m_shapes[input]) &&
+                                values[input]->get_layout() == TensorLayout::CNHW;
+                }
+                offset += channels;
+            }
+
+            if (!hasShapes)
             {
-                float value = input.get_element(shape.get_current_index());
+                std::shared_ptr<Tensor> result = std::make_shared<Tensor>(concat_tensors(operands, 0));
+                buffers[concat].reset();
+                return result;
+            }
 
-                result.set_element(shape.get_current_index(), getMax(m_min, getMin(value, m_max)));
-                shape.next();
+            parts.clear();
+            std::shared_ptr<Tensor> result = buffers[concat];
+            buffers[concat].reset();
+
+            const size_t rowSize = m_shapes[concat][0] == 0 ? 0 : result->getTotalElements() / m_shapes[concat][0];
+            float *resultData = result->get_mutable_data();
+
+            for (size_t j = 0; j < node.inputs.size(); j++)
+            {
+                if (!isWritten[node.inputs[j]])
+                {
+                    memcpy(resultData, operands[j]->get_data(), operands[j]->getTotalElements() * sizeof(float));
+                }
+                resultData += m_shapes[node.inputs[j]][0] * rowSize;
             }
 
             return result;
         }
 
-        FullyConnectedLayer::FullyConnectedLayer(const Tensor &weights, const Tensor &bias)
-            : m_weights(weights), m_bias(bias)
+        std::shared_ptr<Tensor> Graph::execute_node(const Node &node, std::vector<std::shared_ptr<Tensor>> &values,
+                                                    const size_t &target) const
         {
-            if (m_weights.get_shape().size() != 2)
+            switch (node.operation)
             {
-                char buffer[NTT_ERROR_MESSAGE_SIZE];
-                snprintf(buffer, sizeof(buffer),
-                         "Weights must be a 2D tensor: %s",
-                         Shape::convert_shape_to_string(m_weights.get_shape()).c_str());
-                throw std::invalid_argument(buffer);
+            case GraphOperation::Constant:
+                return std::make_shared<Tensor>(*node.constant);
+            case GraphOperation::Layer:
+                return std::make_shared<Tensor>(node.layer->forward(*values[node.inputs[0]]));
+            case GraphOperation::Concat:
+            {
+                std::vector<const Tensor *> operands;
+                for (size_t input : node.inputs)
+                {
+                    operands.push_back(values[input].get());
+                }
+                return std::make_shared<Tensor>(concat_tensors(operands, node.axis));
+            }
+            case GraphOperation::Slice:
+                return std::make_shared<Tensor>(values[node.inputs[0]]->slice(node.begin, node.end));
+            default:
+                break;
             }
 
-            if (m_bias.get_shape().size() != 2)
+            const bool isAdd = node.operation == GraphOperation::Add;
+            std::shared_ptr<Tensor> result;
+
+            // the operand is dead after this node, so it is the only owner of its storage
+            if (target < node.inputs.size())
             {
-                char buffer[NTT_ERROR_MESSAGE_SIZE];
-                snprintf(buffer, sizeof(buffer),
-                         "Bias must be a 2D tensor: %s",
-                         Shape::convert_shape_to_string(m_bias.get_shape()).c_str());
-                throw std::invalid_argument(buffer);
+                result = values[node.inputs[target]];
+                values[node.inputs[target]].reset();
             }
 
-            if (m_weights.get_shape()[0] != m_bias.get_shape()[0])
+            for (size_t j = 0; j < node.inputs.size(); j++)
             {
-                char buffer[NTT_ERROR_MESSAGE_SIZE];
-                snprintf(buffer, sizeof(buffer),
-                         "Weights and bias dimensions mismatch: %s != %s",
-                         Shape::convert_shape_to_string(m_weights.get_shape()).c_str(),
-                         Shape::convert_shape_to_string(m_bias.get_shape()).c_str());
-                throw std::invalid_argument(buffer);
+                if (j == target)
+                {
+                    continue;
+                }
+
+                const Tensor &operand = *values[node.inputs[j]];
+
+                if (!result)
+                {
+                    // shares the storage, which is copied by the first write
+                    result = std::make_shared<Tensor>(operand);
+                }
+                else if (Shape::is_shape_equal(Tensor::broadcast_shape(result->get_shape(), operand.get_shape()),
+                                               result->get_shape()))
+                {
+                    if (isAdd)
+                    {
+                        *result += operand;
+                    }
+                    else
+                    {
+                        *result *= operand;
+                    }
+                }
+                else
+                {
+                    result = std::make_shared<Tensor>(isAdd ? result->add(operand) : result->multiply(operand));
+                }
             }
+
+            return result;
         }
 
-        Tensor FullyConnectedLayer::forward(const Tensor &input)
+        std::vector<Tensor> Graph::forward(const std::vector<Tensor> &inputs)
         {
-            // assert the matrix has valid size
-            if (input.get_shape().size() != 2)
+            if (inputs.size() != m_inputs.size())
             {
                 char buffer[NTT_ERROR_MESSAGE_SIZE];
                 snprintf(buffer, sizeof(buffer),
-                         "Input must be a 2D tensor: %s",
-                         Shape::convert_shape_to_string(input.get_shape()).c_str());
+                         "The graph has %zu inputs, %zu were given", m_inputs.size(), inputs.size());
                 throw std::invalid_argument(buffer);
             }
 
-            if (m_weights.get_shape()[1] != input.get_shape()[0])
+            if (!m_isPlanned)
             {
-                char buffer[NTT_ERROR_MESSAGE_SIZE];
-                snprintf(buffer, sizeof(buffer),
-                         "Weights and input dimensions mismatch: %s != %s",
-                         Shape::convert_shape_to_string(m_weights.get_shape()).c_str(),
-                         Shape::convert_shape_to_string(input.get_shape()).c_str());
-                throw std::invalid_argument(buffer);
+                plan();
             }
 
-            Tensor result({m_weights.get_shape()[0], input.get_shape()[1]}, 0.0f);
+            const size_t count = m_nodes.size();
+            std::vector<std::shared_ptr<Tensor>> values(count);
+            size_t nextInput = 0;
 
-            // dot product
-            for (size_t i = 0; i < m_weights.get_shape()[0]; i++)
+            // the outputs of the channel concatenations, allocated by their first input
+            const bool hasShapes = m_shapes.size() == count;
+            std::vector<std::shared_ptr<Tensor>> buffers(count);
+            std::vector<bool> isWritten(count, false);
+            std::vector<shape_type> shapes(count);
+
+            for (size_t i = 0; i < count; i++)
             {
-                for (size_t j = 0; j < input.get_shape()[1]; j++)
+                const Node &node = m_nodes[i];
+                const size_t concat = m_concatTargets[i];
+
+                if (hasShapes && concat < count)
+                {
+                    if (!buffers[concat])
+                    {
+                        buffers[concat] = std::make_shared<Tensor>(m_shapes[concat], 0.0f);
+                    }
+
+                    const size_t offset = get_concat_offset(concat, i);
+                    Tensor view = buffers[concat]->write_view(offset, offset + m_shapes[i][0]);
+                    isWritten[i] = node.layer->forward_into(*values[node.inputs[0]], view);
+                }
+
+                if (isWritten[i])
+                {
+                    shapes[i] = m_shapes[i];
+                }
+                else
+                {
+                    if (node.operation == GraphOperation::Input)
+                    {
+                        values[i] = std::make_shared<Tensor>(inputs[nextInput++]);
+                    }
+                    else if (node.operation == GraphOperation::Concat && hasShapes && node.axis == 0)
+                    {
+                        values[i] = execute_concat(i, values, buffers, isWritten);
+                    }
+                    else
+                    {
+                        values[i] = execute_node(node, values, m_inPlaceOperands[i]);
+                    }
+                    shapes[i] = values[i]->get_shape();
+                }
+
+                for (size_t input : node.inputs)
                 {
-                    float value = 0.0f;
-                    for (size_t k = 0; k < m_weights.get_shape()[1]; k++)
+                    if (m_lastReaders[input] == i)
                     {
-                        value += m_weights.get_element({i, k}) * input.get_element({k, j});
+                        values[input].reset();
                     }
-                    result.set_element({i, j}, value + m_bias.get_element({i, 0}));
                 }
             }
 
-            return result;
+            m_shapes = shapes;
+
+            std::vector<Tensor> outputs;
+            for (size_t output : m_outputs)
+            {
+                outputs.push_back(*values[output]);
+            }
+
+            return outputs;
         }
 
-        Tensor SoftmaxLayer::forward(const Tensor &input)
+        StreamedLayer::StreamedLayer(const std::vector<std::string> &files, const Factory &factory,
+                                     ThreadPool &pool)
+            : m_files(files), m_factory(factory), m_pool(&pool), m_next(nullptr)
         {
-            Tensor result(input.get_shape(), 0.0f);
-            Shape shape(input.get_shape());
+        }
 
-            float sum = 0.0f;
+        StreamedLayer::~StreamedLayer()
+        {
+            release();
+        }
 
-            while (!shape.is_end())
+        /**
+         * Reads the weights and builds the layer, on the pool when it is prefetched.
+         */
+        static std::shared_ptr<Layer> load_streamed_layer(const std::vector<std::string> &files,
+                                                          const StreamedLayer::Factory &factory)
+        {
+            std::vector<Tensor> weights;
+            for (const std::string &file : files)
             {
-                float value = input.get_element(shape.get_current_index());
-                sum += std::exp(value);
-                shape.next();
+                weights.push_back(Tensor::from_bytes(file));
             }
 
-            shape.reset();
+            return std::shared_ptr<Layer>(factory(weights));
+        }
 
-            while (!shape.is_end())
+        void StreamedLayer::prefetch()
+        {
+            if (is_loaded())
             {
-                float value = input.get_element(shape.get_current_index());
-                result.set_element(shape.get_current_index(), std::exp(value) / sum);
-                shape.next();
+                return;
             }
 
-            return result;
+            // the task owns copies of the files and the factory, release waits for it once it
+            // started, and it does nothing when forward or release claimed the load before
+            const std::vector<std::string> files = m_files;
+            const Factory factory = m_factory;
+            const std::shared_ptr<std::atomic<bool>> isClaimed = std::make_shared<std::atomic<bool>>(false);
+            m_loading = m_pool->submit([files, factory, isClaimed]()
+                                       { return isClaimed->exchange(true) ? std::shared_ptr<Layer>()
+                                                                          : load_streamed_layer(files, factory); });
+            m_isClaimed = isClaimed;
         }
 
-        Tensor SigmoidLayer::forward(const Tensor &input)
+        bool StreamedLayer::claim_loading()
         {
-            Tensor result(input.get_shape(), 0.0f);
-            Shape shape(input.get_shape());
+            return m_loading.valid() && m_isClaimed->exchange(true);
+        }
 
-            while (!shape.is_end())
+        void StreamedLayer::release()
+        {
+            if (claim_loading())
             {
-                float value = input.get_element(shape.get_current_index());
-                result.set_element(shape.get_current_index(), 1.0f / (1.0f + std::exp(-value)));
-                shape.next();
+                m_loading.wait();
             }
-
-            return result;
+            m_loading = std::future<std::shared_ptr<Layer>>();
+            m_isClaimed.reset();
         }
 
-        Tensor FlattenLayer::forward(const Tensor &input)
+        bool StreamedLayer::is_loaded() const
         {
-            Tensor result({input.getTotalElements(), 1}, 0.0f);
-            Shape shape(input.get_shape());
-
-            size_t index = 0;
+            return m_loading.valid();
+        }
 
-            while (!shape.is_end())
+        void StreamedLayer::chain(const std::vector<StreamedLayer *> &layers)
+        {
+            for (size_t i = 0; i < layers.size(); i++)
             {
-                result.set_element({index, 0}, input.get_element(shape.get_current_index()));
-                index++;
-                shape.next();
+                layers[i]->m_next = i + 1 < layers.size() ? layers[i + 1] : nullptr;
             }
-
-            return result;
         }
 
-        Conv2DLayer::Conv2DLayer(const Tensor &weights, const Tensor &bias,
-                                 const size_t &stride, const size_t &padding,
-                                 const size_t &group)
-            : m_weights(weights), m_bias(bias),
-              m_stride(stride), m_padding(padding),
-              m_group(group)
+        Tensor StreamedLayer::forward(const Tensor &input)
         {
-            if (m_group != 1 && m_group != m_weights.get_shape()[0] && m_group != 2)
+            // waiting for a load which did not start could deadlock when this forward runs on
+            // the only free worker, the layer is loaded here then. It is freed when this
+            // forward returns
+            std::shared_ptr<Layer> layer = claim_loading() ? m_loading.get() : nullptr;
+            m_loading = std::future<std::shared_ptr<Layer>>();
+            m_isClaimed.reset();
+            if (!layer)
             {
-                char buffer[NTT_ERROR_MESSAGE_SIZE];
-                snprintf(buffer, sizeof(buffer),
-                         "Group must be 1, %zu, or %zu",
-                         2, m_weights.get_shape()[0]);
-                throw std::invalid_argument(buffer);
+                layer = load_streamed_layer(m_files, m_factory);
             }
 
-            if (m_weights.get_shape().size() != 4)
+            if (m_next != nullptr)
             {
-                char buffer[NTT_ERROR_MESSAGE_SIZE];
-                snprintf(buffer, sizeof(buffer),
-                         "Weights must be a 4D tensor: %s",
-                         Shape::convert_shape_to_string(m_weights.get_shape()).c_str());
-                throw std::invalid_argument(buffer);
+                m_next->prefetch();
             }
 
-            if (m_bias.get_shape().size() != 2)
+            return layer->forward(input);
+        }
+
+        /**
+         * Spins for a while then sleeps, for the threads waiting on a queue.
+         */
+        static void wait_for_queue(size_t &spins)
+        {
+            if (++spins < 1024)
             {
-                char buffer[NTT_ERROR_MESSAGE_SIZE];
-                snprintf(buffer, sizeof(buffer),
-                         "Bias must be a 2D tensor: %s",
-                         Shape::convert_shape_to_string(m_bias.get_shape()).c_str());
+                std::this_thread::yield();
             }
-
-            if (m_weights.get_shape()[0] != m_bias.get_shape()[0])
+            else
             {
-                char buffer[NTT_ERROR_MESSAGE_SIZE];
-                snprintf(buffer, sizeof(buffer),
-                         "Weights and bias dimensions mismatch: %s != %s",
-                         Shape::convert_shape_to_string(m_weights.get_shape()).c_str(),
-                         Shape::convert_shape_to_string(m_bias.get_shape()).c_str());
-                throw std::invalid_argument(buffer);
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
             }
         }
 
-        Tensor Conv2DLayer::forward(const Tensor &input)
+        Pipeline::Pipeline(const std::vector<std::vector<Layer *>> &chunks, const size_t &stages, const size_t &capacity)
+            : m_chunks(chunks), m_capacity(capacity == 0 ? 1 : capacity), m_isStopping(false), m_inFlight(0)
         {
-            if (input.get_shape().size() != 4)
+            if (m_chunks.empty())
             {
-                char buffer[NTT_ERROR_MESSAGE_SIZE];
-                snprintf(buffer, sizeof(buffer),
-                         "Input must be a 4D tensor: %s",
-                         Shape::convert_shape_to_string(input.get_shape()).c_str());
-                throw std::invalid_argument(buffer);
+                throw std::invalid_argument("A pipeline needs at least one chunk");
             }
 
-            if (m_group == 1)
+            size_t count = stages;
+            if (count == 0)
             {
-                if (m_weights.get_shape()[1] != input.get_shape()[0])
-                {
-                    char buffer[NTT_ERROR_MESSAGE_SIZE];
-                    snprintf(buffer, sizeof(buffer),
-                             "Weights and input dimensions mismatch: %s != %s",
-                             Shape::convert_shape_to_string(m_weights.get_shape()).c_str(),
-                             Shape::convert_shape_to_string(input.get_shape()).c_str());
-                    throw std::invalid_argument(buffer);
-                }
+                const size_t threads = std::thread::hardware_concurrency();
+                count = threads == 0 ? 1 : threads;
+            }
+            count = count < m_chunks.size() ? count : m_chunks.size();
+
+            for (size_t i = 0; i <= count; i++)
+            {
+                m_boundaries.push_back(i * m_chunks.size() / count);
+            }
+
+            start();
+        }
+
+        Pipeline::~Pipeline()
+        {
+            stop();
+        }
+
+        void Pipeline::start()
+        {
+            m_isStopping.store(false);
+            m_queues.clear();
+            for (size_t i = 0; i <= get_stage_count(); i++)
+            {
+                m_queues.emplace_back(new SpscQueue<Frame>(m_capacity));
             }
-            else if (m_group == 2)
+
+            for (size_t i = 0; i < get_stage_count(); i++)
             {
+                m_threads.emplace_back([this, i]()
+                                       { run_stage(i); });
+
+#if NTT_PIPELINE_AFFINITY && defined(__linux__)
+                const size_t cores = std::thread::hardware_concurrency();
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                CPU_SET(cores == 0 ? 0 : i % cores, &set);
+                pthread_setaffinity_np(m_threads.back().native_handle(), sizeof(set), &set);
+#endif
             }
-            else
+        }
+
+        void Pipeline::stop()
+        {
+            m_isStopping.store(true);
+            for (size_t i = 0; i < m_threads.size(); i++)
             {
-                if (m_weights.get_shape()[0] != input.get_shape()[0] ||
-                    m_weights.get_shape()[1] != input.get_shape()[1])
-                {
-                    char buffer[NTT_ERROR_MESSAGE_SIZE];
-                    snprintf(buffer, sizeof(buffer),
-                             "Weights and input dimensions mismatch: %s != %s",
-                             Shape::convert_shape_to_string(m_weights.get_shape()).c_str(),
-                             Shape::convert_shape_to_string(input.get_shape()).c_str());
-                    throw std::invalid_argument(buffer);
-                }
+                m_threads[i].join();
             }
 
-            Tensor extractInput = input;
+            m_threads.clear();
+            m_queues.clear();
+            m_inFlight = 0;
+        }
 
-            // add padding to the input
-            if (m_padding > 0)
+        void Pipeline::run_stage(const size_t &stage)
+        {
+            SpscQueue<Frame> &input = *m_queues[stage];
+            SpscQueue<Frame> &output = *m_queues[stage + 1];
+            Frame frame;
+
+            while (true)
             {
-                shape_type paddedShape = input.get_shape();
-                paddedShape[2] += 2 * m_padding;
-                paddedShape[3] += 2 * m_padding;
-                Tensor paddedInput(paddedShape, 0.0f);
+                size_t spins = 0;
+                while (!input.try_pop(frame))
+                {
+                    if (m_isStopping.load(std::memory_order_acquire))
+                    {
+                        return;
+                    }
+                    wait_for_queue(spins);
+                }
 
-                for (size_t i = 0; i < input.get_shape()[0]; i++)
+                // a failed frame goes through the next stages as it is, to keep the order
+                if (!frame.error)
                 {
-                    for (size_t j = 0; j < input.get_shape()[1]; j++)
+                    try
                     {
-                        for (size_t k = 0; k < input.get_shape()[2]; k++)
+                        Tensor tensor = *frame.tensor;
+                        for (size_t i = m_boundaries[stage]; i < m_boundaries[stage + 1]; i++)
                         {
-                            for (size_t l = 0; l < input.get_shape()[3]; l++)
+                            for (Layer *layer : m_chunks[i])
                             {
-                                paddedInput.set_element({i, j, k + m_padding, l + m_padding},
-                                                        input.get_element({i, j, k, l}));
+                                tensor = layer->forward(tensor);
                             }
                         }
+                        frame.tensor = std::make_shared<Tensor>(tensor);
+                    }
+                    catch (...)
+                    {
+                        frame.tensor.reset();
+                        frame.error = std::current_exception();
                     }
                 }
 
-                extractInput = paddedInput;
+                spins = 0;
+                while (!output.try_push(frame))
+                {
+                    if (m_isStopping.load(std::memory_order_acquire))
+                    {
+                        return;
+                    }
+                    wait_for_queue(spins);
+                }
             }
+        }
 
-            shape_type outputShape = {m_bias.get_shape()[0],
-                                      m_bias.get_shape()[1],
-                                      0,  // height
-                                      0}; // width
-
-            outputShape[2] = (extractInput.get_shape()[2] - m_weights.get_shape()[2]) / m_stride + 1;
-            outputShape[3] = (extractInput.get_shape()[3] - m_weights.get_shape()[3]) / m_stride + 1;
+        void Pipeline::push(const Tensor &frame)
+        {
+            if (m_inFlight >= get_max_in_flight())
+            {
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(buffer, sizeof(buffer),
+                         "Cannot push more than %zu frames without a pop", get_max_in_flight());
+                throw std::logic_error(buffer);
+            }
 
-            Tensor result(outputShape, 0.0f);
+            Frame item = {std::make_shared<Tensor>(frame), nullptr};
 
-            if (m_group == 1)
+            size_t spins = 0;
+            while (!m_queues[0]->try_push(item))
             {
-                for (size_t i = 0; i < m_bias.get_shape()[0]; i++)
-                {
-                    for (size_t j = 0; j < extractInput.get_shape()[1]; j++)
-                    {
-                        float bias_value = m_bias.get_element({i, j});
+                wait_for_queue(spins);
+            }
 
-                        for (size_t k = 0; k < m_weights.get_shape()[1]; k++)
-                        {
-                            // TODO: implement the cross-correlation code
-                            for (size_t l = 0; l < result.get_shape()[2]; l++)
-                            {
-                                for (size_t m = 0; m < result.get_shape()[3]; m++)
-                                {
-                                    size_t input_x = l * m_stride;
-                                    size_t input_y = m * m_stride;
+            m_inFlight++;
+        }
 
-                                    float value = 0.0f;
+        bool Pipeline::try_push(const Tensor &frame)
+        {
+            Frame item = {std::make_shared<Tensor>(frame), nullptr};
+            if (!m_queues[0]->try_push(item))
+            {
+                return false;
+            }
 
-                                    for (size_t n = 0; n < m_weights.get_shape()[2]; n++)
-                                    {
-                                        for (size_t o = 0; o < m_weights.get_shape()[3]; o++)
-                                        {
-                                            value += m_weights.get_element({i, k, n, o}) *
-                                                     extractInput.get_element({k, j, input_x + n, input_y + o});
-                                        }
-                                    }
+            m_inFlight++;
+            return true;
+        }
 
-                                    result.set_element({i, j, l, m},
-                                                       result.get_element({i, j, l, m}) + value +
-                                                           bias_value / m_weights.get_shape()[1]);
-                                }
-                            }
-                        }
-                    }
-                }
-            }
-            else if (m_group == 2)
+        bool Pipeline::try_pop(Tensor &output)
+        {
+            Frame frame;
+            if (!m_queues.back()->try_pop(frame))
             {
-                throw std::runtime_error("Group 2 is not implemented yet");
+                return false;
             }
-            else
+
+            m_inFlight--;
+            if (frame.error)
             {
-                for (size_t i = 0; i < m_weights.get_shape()[0]; i++)
-                {
-                    for (size_t j = 0; j < m_weights.get_shape()[1]; j++)
-                    {
-                        float bias_value = m_bias.get_element({i, j});
+                std::rethrow_exception(frame.error);
+            }
 
-                        for (size_t k = 0; k < result.get_shape()[2]; k++)
-                        {
-                            for (size_t l = 0; l < result.get_shape()[3]; l++)
-                            {
-                                size_t input_x = k * m_stride;
-                                size_t input_y = l * m_stride;
-                                float value = 0.0f;
+            output = *frame.tensor;
+            return true;
+        }
 
-                                for (size_t m = 0; m < m_weights.get_shape()[2]; m++)
-                                {
-                                    for (size_t n = 0; n < m_weights.get_shape()[3]; n++)
-                                    {
-                                        value += extractInput.get_element({i, j, input_x + m, input_y + n}) *
-                                                 m_weights.get_element({i, j, m, n});
-                                    }
-                                }
+        Tensor Pipeline::pop()
+        {
+            if (m_inFlight == 0)
+            {
+                throw std::logic_error("No frame is in the pipeline");
+            }
 
-                                result.set_element({i, j, k, l},
-                                                   result.get_element({i, j, k, l}) + value +
-                                                       bias_value / m_weights.get_shape()[1]);
-                            }
-                        }
-                    }
-                }
+            Frame frame;
+            size_t spins = 0;
+            while (!m_queues.back()->try_pop(frame))
+            {
+                wait_for_queue(spins);
             }
-            return result;
-        }
 
-        MaxPooling2DLayer::MaxPooling2DLayer(const size_t &poolSize, const size_t &stride,
-                                             const size_t &padding)
-            : m_poolSize(poolSize), m_stride(stride),
-              m_padding(padding)
-        {
+            m_inFlight--;
+            if (frame.error)
+            {
+                std::rethrow_exception(frame.error);
+            }
+
+            return *frame.tensor;
         }
 
-        Tensor MaxPooling2DLayer::forward(const Tensor &input)
+        void Pipeline::balance(const Tensor &sample, const size_t &runs)
         {
-            if (input.get_shape().size() != 4)
+            if (m_inFlight > 0)
             {
                 char buffer[NTT_ERROR_MESSAGE_SIZE];
                 snprintf(buffer, sizeof(buffer),
-                         "Input must be a 4D tensor: %s",
-                         Shape::convert_shape_to_string(input.get_shape()).c_str());
+                         "Cannot balance the pipeline with %zu frames in flight", m_inFlight);
+                throw std::logic_error(buffer);
             }
 
-            Tensor extractInput = input;
+            const size_t stages = get_stage_count();
+            stop();
 
-            if (m_padding > 0)
+            // the layers are run by this thread only while the stages are stopped, they are
+            // restarted with the previous boundaries when a layer throws
+            const size_t chunks = m_chunks.size();
+            m_latencies.assign(chunks, std::numeric_limits<double>::max());
+            try
             {
-                shape_type paddedShape = input.get_shape();
-                paddedShape[2] += 2 * m_padding;
-                paddedShape[3] += 2 * m_padding;
-                Tensor paddedInput(paddedShape, 0.0f);
-
-                for (size_t i = 0; i < input.get_shape()[0]; i++)
+                for (size_t run = 0; run < (runs == 0 ? 1 : runs); run++)
                 {
-                    for (size_t j = 0; j < input.get_shape()[1]; j++)
+                    Tensor tensor = sample;
+                    for (size_t i = 0; i < chunks; i++)
                     {
-                        for (size_t k = 0; k < input.get_shape()[2]; k++)
+                        const std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+                        for (Layer *layer : m_chunks[i])
                         {
-                            for (size_t l = 0; l < input.get_shape()[3]; l++)
-                            {
-                                paddedInput.set_element({i, j, k + m_padding, l + m_padding},
-                                                        input.get_element({i, j, k, l}));
-                            }
+                            tensor = layer->forward(tensor);
                         }
+                        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+                        m_latencies[i] = seconds < m_latencies[i] ? seconds : m_latencies[i];
                     }
                 }
-
-                extractInput = paddedInput;
+            }
+            catch (...)
+            {
+                m_latencies.clear();
+                start();
+                throw;
             }
 
-            shape_type outputShape = input.get_shape();
-            outputShape[2] = (extractInput.get_shape()[2] - m_poolSize) / m_stride + 1;
-            outputShape[3] = (extractInput.get_shape()[3] - m_poolSize) / m_stride + 1;
-
-            Tensor result(outputShape, 0.0f);
+            // slowest[s][c]: the slowest stage when the first c chunks run on s stages
+            std::vector<double> prefix(chunks + 1, 0.0);
+            for (size_t i = 0; i < chunks; i++)
+            {
+                prefix[i + 1] = prefix[i] + m_latencies[i];
+            }
 
-            for (size_t i = 0; i < extractInput.get_shape()[0]; i++)
+            std::vector<std::vector<double>> slowest(stages + 1, std::vector<double>(chunks + 1, std::numeric_limits<double>::max()));
+            std::vector<std::vector<size_t>> splits(stages + 1, std::vector<size_t>(chunks + 1, 0));
+            slowest[0][0] = 0.0;
+            for (size_t s = 1; s <= stages; s++)
             {
-                for (size_t j = 0; j < extractInput.get_shape()[1]; j++)
+                for (size_t c = s; c <= chunks; c++)
                 {
-                    for (size_t k = 0; k < result.get_shape()[2]; k++)
+                    for (size_t k = s - 1; k < c; k++)
                     {
-                        for (size_t l = 0; l < result.get_shape()[3]; l++)
+                        const double stage = prefix[c] - prefix[k];
+                        const double cost = slowest[s - 1][k] > stage ? slowest[s - 1][k] : stage;
+                        if (cost < slowest[s][c])
                         {
-                            size_t input_x = k * m_stride;
-                            size_t input_y = l * m_stride;
-
-                            float maxValue = extractInput.get_element({i, j, input_x, input_y});
-
-                            for (size_t m = 0; m < m_poolSize; m++)
-                            {
-                                for (size_t n = 0; n < m_poolSize; n++)
-                                {
-                                    float value = extractInput.get_element({i, j, input_x + m, input_y + n});
-                                    if (value > maxValue)
-                                    {
-                                        maxValue = value;
-                                    }
-                                }
-                            }
-
-                            result.set_element({i, j, k, l}, maxValue);
+                            slowest[s][c] = cost;
+                            splits[s][c] = k;
                         }
                     }
                 }
             }
 
-            return result;
+            m_boundaries.assign(stages + 1, chunks);
+            for (size_t s = stages, c = chunks; s > 0; s--)
+            {
+                c = splits[s][c];
+                m_boundaries[s - 1] = c;
+            }
+
+            start();
         }
 
-        Tensor GlobalAveragePooling2DLayer::forward(const Tensor &input)
+        AsyncLayer::AsyncLayer(Layer &layer, ThreadPool &pool)
+            : m_layer(&layer), m_pool(&pool), m_isRunning(false)
+        {
+        }
+
+        AsyncLayer::~AsyncLayer()
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_idle.wait(lock, [this]()
+                        { return !m_isRunning; });
+        }
+
+        std::future<Tensor> AsyncLayer::submit(const Tensor &input)
+        {
+            std::shared_ptr<std::promise<Tensor>> result = std::make_shared<std::promise<Tensor>>();
+            submit(input, [result](const Tensor *output, std::exception_ptr error)
+                   {
+                if (output != nullptr)
+                {
+                    result->set_value(*output);
+                }
+                else
+                {
+                    result->set_exception(error);
+                } });
+
+            return result->get_future();
+        }
+
+        void AsyncLayer::submit(const Tensor &input, const Callback &callback)
         {
-            if (input.get_shape().size() != 4)
             {
-                char buffer[NTT_ERROR_MESSAGE_SIZE];
-                snprintf(buffer, sizeof(buffer),
-                         "Input must be a 4D tensor: %s",
-                         Shape::convert_shape_to_string(input.get_shape()).c_str());
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_requests.emplace_back(input, callback);
+                if (m_isRunning)
+                {
+                    return;
+                }
+                m_isRunning = true;
             }
 
-            shape_type outputShape = {input.get_shape()[0],
-                                      input.get_shape()[1],
-                                      1,
-                                      1};
+            // a single task runs the inputs so the layer is never used by two threads
+            m_pool->submit([this]()
+                           { run_requests(); });
+        }
 
-            Tensor result(outputShape, 0.0f);
+        size_t AsyncLayer::get_pending() const
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_requests.size();
+        }
 
-            for (size_t i = 0; i < input.get_shape()[0]; i++)
+        void AsyncLayer::run_requests()
+        {
+            while (true)
             {
-                for (size_t j = 0; j < input.get_shape()[1]; j++)
+                std::unique_lock<std::mutex> lock(m_mutex);
+                if (m_requests.empty())
                 {
-                    float sum = 0.0f;
-                    size_t count = 0;
+                    m_isRunning = false;
+                    m_idle.notify_all();
+                    return;
+                }
 
-                    for (size_t k = 0; k < input.get_shape()[2]; k++)
-                    {
-                        for (size_t l = 0; l < input.get_shape()[3]; l++)
-                        {
-                            sum += input.get_element({i, j, k, l});
-                            count++;
-                        }
-                    }
+                std::pair<Tensor, Callback> request = std::move(m_requests.front());
+                m_requests.pop_front();
+                lock.unlock();
 
-                    result.set_element({i, j, 0, 0}, sum / count);
+                std::shared_ptr<Tensor> output;
+                std::exception_ptr error;
+                try
+                {
+                    output = std::make_shared<Tensor>(m_layer->forward(request.first));
+                }
+                catch (...)
+                {
+                    error = std::current_exception();
+                }
+
+                try
+                {
+                    request.second(output.get(), error);
+                }
+                catch (...)
+                {
                 }
             }
+        }
 
-            return result;
+        Tensor Graph::forward(const Tensor &input)
+        {
+            if (!m_isPlanned)
+            {
+                plan();
+            }
+
+            if (m_outputs.size() != 1)
+            {
+                char buffer[NTT_ERROR_MESSAGE_SIZE];
+                snprintf(buffer, sizeof(buffer),
+                         "The graph has %zu outputs, forward(const Tensor &) needs one", m_outputs.size());
+                throw std::invalid_argument(buffer);
+            }
+
+            return forward(std::vector<Tensor>{input})[0];
         }
 
 #endif // NTT_MICRO_NN_IMPLEMENTATION
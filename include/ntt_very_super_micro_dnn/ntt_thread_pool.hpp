@@ -0,0 +1,319 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// the number of threads of the default pool, 0 for one per hardware thread
+#ifndef NTT_THREADS
+#define NTT_THREADS 0
+#endif
+
+// the size of the cache lines which the indexes of the queues are kept apart by
+#ifndef NTT_CACHE_LINE_SIZE
+#define NTT_CACHE_LINE_SIZE 64
+#endif
+
+#ifdef NTT_MICRO_NN_IMPLEMENTATION
+namespace
+{
+#endif // NTT_MICRO_NN_IMPLEMENTATION
+    namespace ntt
+    {
+        /**
+         * A fixed set of worker threads which run the chunks of the parallel loops. The
+         *      thread calling parallel_for works on the chunks too and only waits for the
+         *      chunks which were already started, so the loops can be nested without
+         *      running out of threads.
+         */
+        class ThreadPool
+        {
+        public:
+            /**
+             * @param threads: the number of threads including the caller, 0 for one per
+             *      hardware thread.
+             */
+            explicit ThreadPool(size_t threads = 0)
+                : m_isStopping(false)
+            {
+                if (threads == 0)
+                {
+                    threads = std::thread::hardware_concurrency();
+                }
+
+                for (size_t i = 1; i < threads; i++)
+                {
+                    m_workers.emplace_back([this]()
+                                           { run_worker(); });
+                }
+            }
+
+            ~ThreadPool()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_isStopping = true;
+                }
+
+                m_condition.notify_all();
+                for (size_t i = 0; i < m_workers.size(); i++)
+                {
+                    m_workers[i].join();
+                }
+            }
+
+            ThreadPool(const ThreadPool &) = delete;
+            ThreadPool &operator=(const ThreadPool &) = delete;
+
+            inline size_t get_thread_count() const { return m_workers.size() + 1; }
+
+            /**
+             * Calls function(begin, end) over [0, count) in chunks of at least grain
+             *      iterations and returns when all of them are done. The first exception
+             *      thrown by a chunk is thrown again here.
+             */
+            template <typename Function>
+            void parallel_for(size_t count, size_t grain, Function function)
+            {
+                grain = grain == 0 ? 1 : grain;
+                const size_t maxChunks = (count + grain - 1) / grain;
+                const size_t chunks = maxChunks < 4 * get_thread_count() ? maxChunks : 4 * get_thread_count();
+
+                if (chunks <= 1 || m_workers.empty())
+                {
+                    if (count > 0)
+                    {
+                        function(static_cast<size_t>(0), count);
+                    }
+                    return;
+                }
+
+                // shared with the helpers, which may only start after this call returned
+                std::shared_ptr<ParallelLoop> loop = std::make_shared<ParallelLoop>();
+                loop->chunks = chunks;
+                loop->count = count;
+                loop->next = 0;
+                loop->done = 0;
+                loop->body = [function](size_t begin, size_t end)
+                { function(begin, end); };
+
+                const size_t helpers = chunks - 1 < m_workers.size() ? chunks - 1 : m_workers.size();
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    for (size_t i = 0; i < helpers; i++)
+                    {
+                        m_tasks.push_back([loop]()
+                                          { run_chunks(*loop); });
+                    }
+                }
+                m_condition.notify_all();
+
+                run_chunks(*loop);
+
+                std::unique_lock<std::mutex> lock(loop->mutex);
+                loop->finished.wait(lock, [&loop]()
+                                    { return loop->done == loop->chunks; });
+
+                if (loop->exception)
+                {
+                    std::rethrow_exception(loop->exception);
+                }
+            }
+
+            /**
+             * Runs the function on a worker and returns at once, the future holds its result
+             *      or its exception. A pool without workers runs the function here.
+             */
+            template <typename Function>
+            auto submit(Function function) -> std::future<decltype(function())>
+            {
+                typedef decltype(function()) Result;
+
+                // std::function needs a copyable task
+                std::shared_ptr<std::packaged_task<Result()>> task = std::make_shared<std::packaged_task<Result()>>(std::move(function));
+                std::future<Result> result = task->get_future();
+
+                if (m_workers.empty())
+                {
+                    (*task)();
+                    return result;
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_tasks.push_back([task]()
+                                      { (*task)(); });
+                }
+                m_condition.notify_one();
+
+                return result;
+            }
+
+            /**
+             * The pool of the layers, created on first use with NTT_THREADS threads.
+             */
+            static ThreadPool &get_default()
+            {
+                static ThreadPool pool(NTT_THREADS);
+                return pool;
+            }
+
+        private:
+            struct ParallelLoop
+            {
+                size_t chunks;
+                size_t count;
+                std::atomic<size_t> next;
+                std::atomic<size_t> done;
+                std::function<void(size_t, size_t)> body;
+                std::mutex mutex;
+                std::condition_variable finished;
+                std::exception_ptr exception;
+            };
+
+            static void run_chunks(ParallelLoop &loop)
+            {
+                for (size_t chunk = loop.next++; chunk < loop.chunks; chunk = loop.next++)
+                {
+                    try
+                    {
+                        loop.body(chunk * loop.count / loop.chunks, (chunk + 1) * loop.count / loop.chunks);
+                    }
+                    catch (...)
+                    {
+                        std::lock_guard<std::mutex> lock(loop.mutex);
+                        if (!loop.exception)
+                        {
+                            loop.exception = std::current_exception();
+                        }
+                    }
+
+                    std::lock_guard<std::mutex> lock(loop.mutex);
+                    if (++loop.done == loop.chunks)
+                    {
+                        loop.finished.notify_all();
+                    }
+                }
+            }
+
+            void run_worker()
+            {
+                while (true)
+                {
+                    std::function<void()> task;
+                    {
+                        std::unique_lock<std::mutex> lock(m_mutex);
+                        m_condition.wait(lock, [this]()
+                                         { return m_isStopping || !m_tasks.empty(); });
+
+                        if (m_tasks.empty())
+                        {
+                            return;
+                        }
+
+                        task = std::move(m_tasks.front());
+                        m_tasks.pop_front();
+                    }
+
+                    task();
+                }
+            }
+
+        private:
+            std::vector<std::thread> m_workers;
+            std::deque<std::function<void()>> m_tasks;
+            std::mutex m_mutex;
+            std::condition_variable m_condition;
+            bool m_isStopping;
+        };
+
+        /**
+         * A bounded lock-free queue between exactly one producer thread and one consumer
+         *      thread. The producer only writes the tail and the consumer only writes the
+         *      head, each on its own cache line, so neither side ever waits for a lock.
+         */
+        template <typename T>
+        class SpscQueue
+        {
+        public:
+            explicit SpscQueue(const size_t &capacity)
+                : m_size(capacity + 1), m_slots(new Slot[capacity + 1]), m_head(0), m_tail(0)
+            {
+            }
+
+            ~SpscQueue()
+            {
+                for (size_t i = m_head.load(); i != m_tail.load(); i = (i + 1) % m_size)
+                {
+                    get_slot(i)->~T();
+                }
+            }
+
+            SpscQueue(const SpscQueue &) = delete;
+            SpscQueue &operator=(const SpscQueue &) = delete;
+
+            inline size_t get_capacity() const { return m_size - 1; }
+
+            /**
+             * @return: false when the queue is full, the item is not moved then.
+             */
+            bool try_push(T &item)
+            {
+                const size_t tail = m_tail.load(std::memory_order_relaxed);
+                const size_t next = (tail + 1) % m_size;
+                if (next == m_head.load(std::memory_order_acquire))
+                {
+                    return false;
+                }
+
+                new (get_slot(tail)) T(std::move(item));
+                m_tail.store(next, std::memory_order_release);
+                return true;
+            }
+
+            /**
+             * @return: false when the queue is empty.
+             */
+            bool try_pop(T &item)
+            {
+                const size_t head = m_head.load(std::memory_order_relaxed);
+                if (head == m_tail.load(std::memory_order_acquire))
+                {
+                    return false;
+                }
+
+                T *slot = get_slot(head);
+                item = std::move(*slot);
+                slot->~T();
+                m_head.store((head + 1) % m_size, std::memory_order_release);
+                return true;
+            }
+
+        private:
+            typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type Slot;
+
+            inline T *get_slot(const size_t &index) { return reinterpret_cast<T *>(&m_slots[index]); }
+
+        private:
+            size_t m_size;
+            std::unique_ptr<Slot[]> m_slots;
+            char m_headPadding[NTT_CACHE_LINE_SIZE];
+            std::atomic<size_t> m_head;
+            char m_tailPadding[NTT_CACHE_LINE_SIZE];
+            std::atomic<size_t> m_tail;
+        };
+    }
+
+#ifdef NTT_MICRO_NN_IMPLEMENTATION
+} // namespace
+#endif // NTT_MICRO_NN_IMPLEMENTATION
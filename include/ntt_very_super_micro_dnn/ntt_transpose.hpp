@@ -0,0 +1,250 @@
+#pragma once
+#include <cstddef>
+#include <cstring>
+#include <utility>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define NTT_TRANSPOSE_SSE
+#endif
+
+// the side of the square blocks which fit in the L1 cache, the recursion stops there
+#ifndef NTT_TRANSPOSE_BLOCK_SIZE
+#define NTT_TRANSPOSE_BLOCK_SIZE 32
+#endif
+
+#ifdef NTT_MICRO_NN_IMPLEMENTATION
+namespace
+{
+#endif // NTT_MICRO_NN_IMPLEMENTATION
+    namespace ntt
+    {
+        /**
+         * Transposes one tile of size x size elements, the destination is written row by
+         *      row. The generic version is a plain loop, the float one keeps the whole
+         *      tile in the registers when SSE or AVX is available.
+         */
+        template <typename T>
+        struct TransposeKernel
+        {
+            static const size_t size = 8;
+
+            static inline void run(const T *source, size_t sourceStride, T *destination, size_t destinationStride)
+            {
+                for (size_t i = 0; i < size; i++)
+                {
+                    for (size_t j = 0; j < size; j++)
+                    {
+                        destination[i * destinationStride + j] = source[j * sourceStride + i];
+                    }
+                }
+            }
+        };
+
+#if defined(__AVX__)
+        template <>
+        struct TransposeKernel<float>
+        {
+            static const size_t size = 8;
+
+            static inline void run(const float *source, size_t sourceStride, float *destination, size_t destinationStride)
+            {
+                __m256 r0 = _mm256_loadu_ps(source + 0 * sourceStride);
+                __m256 r1 = _mm256_loadu_ps(source + 1 * sourceStride);
+                __m256 r2 = _mm256_loadu_ps(source + 2 * sourceStride);
+                __m256 r3 = _mm256_loadu_ps(source + 3 * sourceStride);
+                __m256 r4 = _mm256_loadu_ps(source + 4 * sourceStride);
+                __m256 r5 = _mm256_loadu_ps(source + 5 * sourceStride);
+                __m256 r6 = _mm256_loadu_ps(source + 6 * sourceStride);
+                __m256 r7 = _mm256_loadu_ps(source + 7 * sourceStride);
+
+                // interleave the pairs of rows, then the pairs of pairs, then swap the 128-bit lanes
+                __m256 t0 = _mm256_unpacklo_ps(r0, r1);
+                __m256 t1 = _mm256_unpackhi_ps(r0, r1);
+                __m256 t2 = _mm256_unpacklo_ps(r2, r3);
+                __m256 t3 = _mm256_unpackhi_ps(r2, r3);
+                __m256 t4 = _mm256_unpacklo_ps(r4, r5);
+                __m256 t5 = _mm256_unpackhi_ps(r4, r5);
+                __m256 t6 = _mm256_unpacklo_ps(r6, r7);
+                __m256 t7 = _mm256_unpackhi_ps(r6, r7);
+
+                __m256 s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+                __m256 s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+                __m256 s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+                __m256 s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+                __m256 s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+                __m256 s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+                __m256 s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+                __m256 s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+
+                _mm256_storeu_ps(destination + 0 * destinationStride, _mm256_permute2f128_ps(s0, s4, 0x20));
+                _mm256_storeu_ps(destination + 1 * destinationStride, _mm256_permute2f128_ps(s1, s5, 0x20));
+                _mm256_storeu_ps(destination + 2 * destinationStride, _mm256_permute2f128_ps(s2, s6, 0x20));
+                _mm256_storeu_ps(destination + 3 * destinationStride, _mm256_permute2f128_ps(s3, s7, 0x20));
+                _mm256_storeu_ps(destination + 4 * destinationStride, _mm256_permute2f128_ps(s0, s4, 0x31));
+                _mm256_storeu_ps(destination + 5 * destinationStride, _mm256_permute2f128_ps(s1, s5, 0x31));
+                _mm256_storeu_ps(destination + 6 * destinationStride, _mm256_permute2f128_ps(s2, s6, 0x31));
+                _mm256_storeu_ps(destination + 7 * destinationStride, _mm256_permute2f128_ps(s3, s7, 0x31));
+            }
+        };
+#elif defined(NTT_TRANSPOSE_SSE)
+        template <>
+        struct TransposeKernel<float>
+        {
+            static const size_t size = 4;
+
+            static inline void run(const float *source, size_t sourceStride, float *destination, size_t destinationStride)
+            {
+                __m128 r0 = _mm_loadu_ps(source + 0 * sourceStride);
+                __m128 r1 = _mm_loadu_ps(source + 1 * sourceStride);
+                __m128 r2 = _mm_loadu_ps(source + 2 * sourceStride);
+                __m128 r3 = _mm_loadu_ps(source + 3 * sourceStride);
+
+                _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+
+                _mm_storeu_ps(destination + 0 * destinationStride, r0);
+                _mm_storeu_ps(destination + 1 * destinationStride, r1);
+                _mm_storeu_ps(destination + 2 * destinationStride, r2);
+                _mm_storeu_ps(destination + 3 * destinationStride, r3);
+            }
+        };
+#endif
+
+        /**
+         * Transposes a block which fits in the cache, tile by tile, the borders which are
+         *      smaller than a tile are copied element by element.
+         */
+        template <typename T>
+        void transpose_block(const T *source, size_t sourceStride, T *destination, size_t destinationStride,
+                             size_t rows, size_t columns)
+        {
+            const size_t tile = TransposeKernel<T>::size;
+            const size_t fullRows = rows - rows % tile;
+            const size_t fullColumns = columns - columns % tile;
+
+            for (size_t i = 0; i < fullRows; i += tile)
+            {
+                for (size_t j = 0; j < fullColumns; j += tile)
+                {
+                    TransposeKernel<T>::run(source + i * sourceStride + j, sourceStride,
+                                            destination + j * destinationStride + i, destinationStride);
+                }
+            }
+
+            for (size_t i = 0; i < rows; i++)
+            {
+                const size_t firstColumn = i < fullRows ? fullColumns : 0;
+                for (size_t j = firstColumn; j < columns; j++)
+                {
+                    destination[j * destinationStride + i] = source[i * sourceStride + j];
+                }
+            }
+        }
+
+        /**
+         * Cache-oblivious transpose: the longer side is halved until the blocks fit in the
+         *      cache, so both the reads and the writes stay within a few cache lines whatever
+         *      the size of the matrix is.
+         * @param source: the element (i, j) is at source[i * sourceStride + j].
+         * @param destination: the element (j, i) is written at destination[j * destinationStride + i].
+         * @param rows: the number of rows of the source.
+         * @param columns: the number of columns of the source.
+         */
+        template <typename T>
+        void transpose_matrix(const T *source, size_t sourceStride, T *destination, size_t destinationStride,
+                              size_t rows, size_t columns)
+        {
+            const size_t tile = TransposeKernel<T>::size;
+
+            if (rows <= NTT_TRANSPOSE_BLOCK_SIZE && columns <= NTT_TRANSPOSE_BLOCK_SIZE)
+            {
+                transpose_block(source, sourceStride, destination, destinationStride, rows, columns);
+                return;
+            }
+
+            // keep the split on a multiple of the tile so the halves still use the full tiles
+            if (rows >= columns)
+            {
+                const size_t half = (rows / 2 + tile - 1) / tile * tile;
+                transpose_matrix(source, sourceStride, destination, destinationStride, half, columns);
+                transpose_matrix(source + half * sourceStride, sourceStride, destination + half, destinationStride,
+                                 rows - half, columns);
+            }
+            else
+            {
+                const size_t half = (columns / 2 + tile - 1) / tile * tile;
+                transpose_matrix(source, sourceStride, destination, destinationStride, rows, half);
+                transpose_matrix(source + half, sourceStride, destination + half * destinationStride, destinationStride,
+                                 rows, columns - half);
+            }
+        }
+
+        /**
+         * Transposes a square matrix in place, the element (i, j) is at
+         *      data[i * rowStride + j * columnStride]. When the rows are contiguous the pairs
+         *      of tiles on both sides of the diagonal are swapped through the tile kernel.
+         */
+        template <typename T>
+        void transpose_square_in_place(T *data, size_t size, size_t rowStride, size_t columnStride = 1)
+        {
+            const size_t tile = TransposeKernel<T>::size;
+            size_t fullSize = 0;
+
+            if (columnStride == 1)
+            {
+                T first[TransposeKernel<T>::size * TransposeKernel<T>::size];
+                T second[TransposeKernel<T>::size * TransposeKernel<T>::size];
+                fullSize = size - size % tile;
+
+                for (size_t i = 0; i < fullSize; i += tile)
+                {
+                    for (size_t j = i; j < fullSize; j += tile)
+                    {
+                        T *upper = data + i * rowStride + j;
+                        T *lower = data + j * rowStride + i;
+
+                        TransposeKernel<T>::run(upper, rowStride, first, tile);
+                        TransposeKernel<T>::run(lower, rowStride, second, tile);
+
+                        for (size_t k = 0; k < tile; k++)
+                        {
+                            std::memcpy(lower + k * rowStride, first + k * tile, tile * sizeof(T));
+                            if (i != j)
+                            {
+                                std::memcpy(upper + k * rowStride, second + k * tile, tile * sizeof(T));
+                            }
+                        }
+                    }
+                }
+            }
+
+            // the borders (or everything when the rows are not contiguous), in blocks
+            for (size_t ib = 0; ib < size; ib += NTT_TRANSPOSE_BLOCK_SIZE)
+            {
+                for (size_t jb = ib; jb < size; jb += NTT_TRANSPOSE_BLOCK_SIZE)
+                {
+                    const size_t iEnd = ib + NTT_TRANSPOSE_BLOCK_SIZE < size ? ib + NTT_TRANSPOSE_BLOCK_SIZE : size;
+                    const size_t jEnd = jb + NTT_TRANSPOSE_BLOCK_SIZE < size ? jb + NTT_TRANSPOSE_BLOCK_SIZE : size;
+
+                    for (size_t i = ib; i < iEnd; i++)
+                    {
+                        for (size_t j = jb > i + 1 ? jb : i + 1; j < jEnd; j++)
+                        {
+                            if (i < fullSize && j < fullSize)
+                            {
+                                continue;
+                            }
+
+                            std::swap(data[i * rowStride + j * columnStride], data[j * rowStride + i * columnStride]);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+#ifdef NTT_MICRO_NN_IMPLEMENTATION
+} // namespace
+#endif // NTT_MICRO_NN_IMPLEMENTATION
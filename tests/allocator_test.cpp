@@ -0,0 +1,162 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <cstdint>
+#include <thread>
+#define NTT_MICRO_NN_IMPLEMENTATION
+#include <ntt_very_super_micro_dnn/ntt_tensor.hpp>
+
+using namespace ntt;
+
+class CountingAllocator : public Allocator
+{
+public:
+    void *allocate(size_t bytes) override
+    {
+        allocations++;
+        return m_allocator.allocate(bytes);
+    }
+
+    void deallocate(void *pointer, size_t bytes) override
+    {
+        deallocations++;
+        m_allocator.deallocate(pointer, bytes);
+    }
+
+    size_t allocations = 0;
+    size_t deallocations = 0;
+
+private:
+    AlignedAllocator m_allocator;
+};
+
+TEST(AllocatorTest, TensorDataIsAligned)
+{
+    for (size_t size = 1; size < 100; size += 7)
+    {
+        Tensor tensor({size, 3}, 1.0f);
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(tensor.get_data()) % NTT_DEFAULT_ALIGNMENT, 0);
+    }
+}
+
+TEST(AllocatorTest, AlignedAllocatorWithCustomAlignment)
+{
+    AlignedAllocator allocator(256, true, 1024);
+    void *small = allocator.allocate(10);
+    void *large = allocator.allocate(4096);
+
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(small) % 256, 0);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(large) % 256, 0);
+
+    allocator.deallocate(small, 10);
+    allocator.deallocate(large, 4096);
+}
+
+TEST(AllocatorTest, InvalidAlignment)
+{
+    EXPECT_THROW(AlignedAllocator(48), std::invalid_argument);
+}
+
+TEST(AllocatorTest, ScopedAllocatorIsUsedByTensors)
+{
+    CountingAllocator allocator;
+
+    {
+        ScopedAllocator scope(&allocator);
+        EXPECT_EQ(get_default_allocator(), &allocator);
+
+        Tensor tensor({2, 2}, 1.0f);
+        Tensor result = ReLULayer().forward(tensor);
+        Tensor shared = result;
+
+        EXPECT_EQ(allocator.allocations, 2);
+    }
+
+    EXPECT_NE(get_default_allocator(), &allocator);
+    EXPECT_EQ(allocator.deallocations, 2);
+}
+
+TEST(AllocatorTest, TensorReturnsBufferToItsOwnAllocator)
+{
+    CountingAllocator allocator;
+    Tensor *tensor = nullptr;
+
+    set_default_allocator(&allocator);
+    tensor = new Tensor({4}, 1.0f);
+    set_default_allocator(nullptr);
+
+    Tensor other({4}, 2.0f);
+    delete tensor;
+
+    EXPECT_EQ(allocator.allocations, 1);
+    EXPECT_EQ(allocator.deallocations, 1);
+}
+
+TEST(PoolAllocatorTest, ClassSizes)
+{
+    EXPECT_EQ(PoolAllocator::get_class_size(1), 64);
+    EXPECT_EQ(PoolAllocator::get_class_size(64), 64);
+    EXPECT_EQ(PoolAllocator::get_class_size(65), 80);
+    EXPECT_EQ(PoolAllocator::get_class_size(128), 128);
+    EXPECT_EQ(PoolAllocator::get_class_size(129), 160);
+    EXPECT_EQ(PoolAllocator::get_class_size(3 * 1024 * 1024 + 1), 3584 * 1024);
+}
+
+TEST(PoolAllocatorTest, RecyclesBuffersBetweenInferences)
+{
+    PoolAllocator pool;
+    ScopedAllocator scope(&pool);
+
+    Tensor input({16, 1, 8, 8}, -1.0f);
+    ReLULayer relu;
+
+    const float *firstData = nullptr;
+    {
+        Tensor output = relu.forward(input);
+        firstData = output.get_data();
+    }
+
+    EXPECT_GT(pool.get_statistics().bytesHeld, 16 * 8 * 8 * sizeof(float));
+
+    Tensor output = relu.forward(input);
+    EXPECT_EQ(output.get_data(), firstData);
+
+    PoolStatistics statistics = pool.get_statistics();
+    EXPECT_EQ(statistics.hits, 1);
+    EXPECT_EQ(statistics.misses, 2);
+    EXPECT_EQ(statistics.bytesHeld, 0);
+}
+
+TEST(PoolAllocatorTest, Trim)
+{
+    CountingAllocator upstream;
+    PoolAllocator pool(&upstream, 1024, 1);
+
+    void *first = pool.allocate(100);
+    void *second = pool.allocate(100);
+    void *large = pool.allocate(4096);
+
+    pool.deallocate(first, 100);
+    pool.deallocate(second, 100);
+    pool.deallocate(large, 4096);
+
+    EXPECT_EQ(upstream.deallocations, 1);
+    EXPECT_EQ(pool.get_statistics().bytesHeld, 2 * PoolAllocator::get_class_size(100));
+
+    pool.trim();
+    EXPECT_EQ(upstream.deallocations, 3);
+    EXPECT_EQ(pool.get_statistics().bytesHeld, 0);
+}
+
+TEST(PoolAllocatorTest, BlocksCanBeReleasedByAnotherThread)
+{
+    PoolAllocator pool;
+    void *pointer = pool.allocate(1000);
+
+    std::thread worker([&]()
+                       { pool.deallocate(pointer, 1000); });
+    worker.join();
+
+    EXPECT_EQ(pool.allocate(1000), pointer);
+    EXPECT_EQ(pool.get_statistics().hits, 1);
+    pool.deallocate(pointer, 1000);
+}
@@ -0,0 +1,141 @@
+#include <gtest/gtest.h>
+#include <future>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#define NTT_MICRO_NN_IMPLEMENTATION
+#include <ntt_very_super_micro_dnn/ntt_tensor.hpp>
+#include "test_helpers.hpp"
+
+using namespace ntt;
+
+static const shape_type s_frameShape = {2, 1, 4, 4};
+
+class ThrowingLayer : public Layer
+{
+public:
+    Tensor forward(const Tensor &input) override
+    {
+        if (input.get_data()[0] > 100.0f)
+        {
+            throw std::runtime_error("inference failed");
+        }
+        return input;
+    }
+};
+
+TEST(AsyncTest, SubmitFromSeveralThreads)
+{
+    Tensor weights({2, 2, 3, 3}, 0.0f);
+    float *w = weights.get_mutable_data();
+    for (size_t i = 0; i < weights.getTotalElements(); i++)
+    {
+        w[i] = static_cast<float>(static_cast<int>(i % 7) - 3) * 0.1f;
+    }
+
+    Conv2DLayer conv(weights, Tensor({2, 1}, 0.25f), 1, 1);
+    ReLULayer relu;
+    Graph graph;
+    graph.set_outputs({graph.add_layers({&conv, &relu}, graph.add_input())});
+
+    ThreadPool pool(4);
+    AsyncLayer model(graph, pool);
+
+    // the threads of an event loop which never wait for the inferences they submit
+    const size_t threads = 4, frames = 25;
+    std::vector<std::vector<std::future<Tensor>>> outputs(threads);
+    std::vector<std::thread> loops;
+    for (size_t t = 0; t < threads; t++)
+    {
+        loops.emplace_back([&model, &outputs, t, frames]()
+                           {
+            for (size_t i = 0; i < frames; i++)
+            {
+                outputs[t].push_back(model.submit(create_sequence(s_frameShape, 0.25f, t * frames + i)));
+            } });
+    }
+    for (std::thread &loop : loops)
+    {
+        loop.join();
+    }
+
+    for (size_t t = 0; t < threads; t++)
+    {
+        for (size_t i = 0; i < frames; i++)
+        {
+            EXPECT_EQ(outputs[t][i].get(), relu.forward(conv.forward(create_sequence(s_frameShape, 0.25f, t * frames + i))));
+        }
+    }
+    EXPECT_EQ(model.get_pending(), 0);
+}
+
+TEST(AsyncTest, ErrorsAndCallbacks)
+{
+    ThrowingLayer layer;
+    ThreadPool pool(2);
+    Tensor bad = create_sequence(s_frameShape, 0.25f);
+    bad.get_mutable_data()[0] = 1000.0f;
+
+    std::promise<bool> failed;
+    {
+        AsyncLayer model(layer, pool);
+        std::future<Tensor> error = model.submit(bad);
+        std::future<Tensor> output = model.submit(create_sequence(s_frameShape, 0.25f, 1));
+        model.submit(bad, [&failed](const Tensor *result, std::exception_ptr exception)
+                     { failed.set_value(result == nullptr && exception != nullptr); });
+
+        EXPECT_THROW(error.get(), std::runtime_error);
+        EXPECT_EQ(output.get(), create_sequence(s_frameShape, 0.25f, 1));
+    }
+    EXPECT_TRUE(failed.get_future().get());
+
+    // a pool without workers runs the layer on the caller
+    ThreadPool serial(1);
+    AsyncLayer model(layer, serial);
+    EXPECT_EQ(model.submit(create_sequence(s_frameShape, 0.25f, 2)).get(), create_sequence(s_frameShape, 0.25f, 2));
+}
+
+#ifdef NTT_COROUTINES
+struct DetachedTask
+{
+    struct promise_type
+    {
+        DetachedTask get_return_object() { return DetachedTask(); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+static DetachedTask infer(AsyncLayer &model, const Tensor input, std::promise<Tensor> &result)
+{
+    try
+    {
+        result.set_value(co_await model.forward_async(input));
+    }
+    catch (...)
+    {
+        result.set_exception(std::current_exception());
+    }
+}
+
+TEST(AsyncTest, CoroutineAwaitable)
+{
+    ReLULayer relu;
+    ThrowingLayer throwing;
+    ThreadPool pool(2);
+    AsyncLayer model(relu, pool);
+    AsyncLayer failing(throwing, pool);
+
+    Tensor bad = create_sequence(s_frameShape, 0.25f);
+    bad.get_mutable_data()[0] = 1000.0f;
+
+    std::promise<Tensor> output, error;
+    infer(model, create_sequence(s_frameShape, 0.25f, 3), output);
+    infer(failing, bad, error);
+
+    EXPECT_EQ(output.get_future().get(), relu.forward(create_sequence(s_frameShape, 0.25f, 3)));
+    EXPECT_THROW(error.get_future().get(), std::runtime_error);
+}
+#endif // NTT_COROUTINES
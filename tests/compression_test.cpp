@@ -0,0 +1,68 @@
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+#define NTT_MICRO_NN_IMPLEMENTATION
+#include <ntt_very_super_micro_dnn/ntt_compression.hpp>
+
+using namespace ntt;
+
+static std::vector<uint8_t> round_trip(const std::vector<uint8_t> &input, size_t &compressedSize)
+{
+    std::vector<uint8_t> compressed;
+    lz_compress(input.data(), input.size(), compressed);
+    compressedSize = compressed.size();
+
+    std::vector<uint8_t> output(input.size());
+    lz_decompress(compressed.data(), compressed.size(), output.data(), output.size());
+    return output;
+}
+
+TEST(CompressionTest, LzRoundTrip)
+{
+    size_t compressedSize = 0;
+    EXPECT_EQ(round_trip({}, compressedSize), std::vector<uint8_t>());
+    EXPECT_EQ(round_trip({7, 8, 9}, compressedSize), (std::vector<uint8_t>{7, 8, 9}));
+
+    // a long run uses an overlapping match with extended lengths
+    const std::vector<uint8_t> run(100000, 42);
+    EXPECT_EQ(round_trip(run, compressedSize), run);
+    EXPECT_LT(compressedSize, 500);
+
+    // repeated blocks with noise between them, and bytes which do not repeat at all
+    std::vector<uint8_t> mixed;
+    uint32_t state = 12345;
+    for (size_t i = 0; i < 50000; i++)
+    {
+        state = state * 1103515245u + 12345u;
+        mixed.push_back(i % 1000 < 700 ? static_cast<uint8_t>(i % 97) : static_cast<uint8_t>(state >> 24));
+    }
+    EXPECT_EQ(round_trip(mixed, compressedSize), mixed);
+    EXPECT_LT(compressedSize, mixed.size());
+}
+
+TEST(CompressionTest, CorruptedStreamsThrow)
+{
+    const std::vector<uint8_t> input(1000, 3);
+    std::vector<uint8_t> compressed;
+    lz_compress(input.data(), input.size(), compressed);
+
+    std::vector<uint8_t> output(input.size());
+    EXPECT_THROW(lz_decompress(compressed.data(), compressed.size() - 1, output.data(), output.size()), std::runtime_error);
+    EXPECT_THROW(lz_decompress(compressed.data(), compressed.size(), output.data(), output.size() - 1), std::runtime_error);
+
+    // a match before the start of the output
+    const uint8_t invalid[] = {0x10, 1, 5, 0};
+    EXPECT_THROW(lz_decompress(invalid, sizeof(invalid), output.data(), 5), std::runtime_error);
+}
+
+TEST(CompressionTest, ShuffleBytes)
+{
+    const uint8_t input[] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+    uint8_t shuffled[10], output[10];
+    shuffle_bytes(input, shuffled, sizeof(input), 4);
+    EXPECT_EQ(std::vector<uint8_t>(shuffled, shuffled + 10), (std::vector<uint8_t>{1, 5, 2, 6, 3, 7, 4, 8, 9, 10}));
+
+    unshuffle_bytes(shuffled, output, sizeof(input), 4);
+    EXPECT_EQ(std::vector<uint8_t>(output, output + 10), std::vector<uint8_t>(input, input + 10));
+}
@@ -0,0 +1,312 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#define NTT_MICRO_NN_IMPLEMENTATION
+#include <ntt_very_super_micro_dnn/ntt_tensor.hpp>
+#include "test_helpers.hpp"
+
+using namespace ntt;
+
+TEST(GraphTest, InvertedResidualBlock)
+{
+    Tensor input = create_sequence({4, 1, 5, 5}, 0.25f);
+    const Tensor original = input.multiply(1.0f);
+
+    Conv2DLayer expand(create_sequence({8, 4, 1, 1}, 0.125f), create_sequence({8, 1}, 0.5f));
+    Clip2DLayer clip1(0, 6);
+    Conv2DLayer depthwise(create_sequence({8, 1, 3, 3}, 0.25f), create_sequence({8, 1}, 0.25f), 1, 1, 8);
+    Clip2DLayer clip2(0, 6);
+    Conv2DLayer project(create_sequence({4, 8, 1, 1}, 0.125f), create_sequence({4, 1}, 0.5f));
+
+    Graph graph;
+    const size_t x = graph.add_input();
+    const size_t block = graph.add_layers({&expand, &clip1, &depthwise, &clip2, &project}, x);
+    const size_t sum = graph.add_node(GraphOperation::Add, {x, block});
+
+    EXPECT_EQ(graph.get_node_count(), 7);
+
+    Tensor expected = input;
+    for (Layer *layer : std::vector<Layer *>{&expand, &clip1, &depthwise, &clip2, &project})
+    {
+        expected = layer->forward(expected);
+    }
+    expected = expected + input;
+
+    EXPECT_EQ(graph.forward(input), expected);
+
+    // the sum is written into the output of the block, never into the input of the caller
+    EXPECT_TRUE(graph.is_in_place(sum));
+    EXPECT_EQ(input, original);
+
+    // the graph is a layer too
+    std::vector<Layer *> chain = {&graph, &graph};
+    Tensor twice = input;
+    for (Layer *layer : chain)
+    {
+        twice = layer->forward(twice);
+    }
+    EXPECT_EQ(twice, graph.forward(expected));
+}
+
+TEST(GraphTest, SharedOperandsAreNotOverwritten)
+{
+    Tensor input = create_sequence({3, 1, 2, 4}, 0.5f);
+    ReLULayer relu;
+    Clip2DLayer clip(-1.0f, 1.0f);
+
+    Graph graph;
+    const size_t x = graph.add_input();
+    const size_t a = graph.add_layer(relu, x);
+    const size_t b = graph.add_layer(clip, x);
+    const size_t first = graph.add_node(GraphOperation::Add, {a, b});
+    const size_t second = graph.add_node(GraphOperation::Multiply, {a, first});
+    const size_t doubled = graph.add_node(GraphOperation::Add, {second, second});
+    graph.set_outputs({first, doubled});
+
+    // a is read again by the second node, b and first are not
+    EXPECT_TRUE(graph.is_in_place(first));
+    EXPECT_TRUE(graph.is_in_place(second));
+    EXPECT_FALSE(graph.is_in_place(doubled));
+
+    const Tensor expectedA = relu.forward(input);
+    const Tensor expectedFirst = expectedA + clip.forward(input);
+    const Tensor expectedSecond = expectedA * expectedFirst;
+
+    std::vector<Tensor> outputs = graph.forward(std::vector<Tensor>{input});
+    ASSERT_EQ(outputs.size(), 2);
+    EXPECT_EQ(outputs[0], expectedFirst);
+    EXPECT_EQ(outputs[1], expectedSecond + expectedSecond);
+
+    EXPECT_THROW(graph.forward(input), std::invalid_argument);
+    EXPECT_THROW(graph.forward(std::vector<Tensor>{input, input}), std::invalid_argument);
+}
+
+TEST(GraphTest, ConcatAndBroadcastMultiply)
+{
+    Tensor left = create_sequence({2, 1, 3, 3}, 0.5f);
+    Tensor right = create_sequence({3, 1, 3, 3}, 0.25f);
+    GlobalAveragePooling2DLayer averagePooling;
+
+    // a squeeze-and-excitation like scale of every channel by its average
+    Graph graph;
+    const size_t a = graph.add_input();
+    const size_t b = graph.add_input();
+    const size_t joined = graph.add_node(GraphOperation::Concat, {a, b});
+    const size_t averages = graph.add_layer(averagePooling, joined);
+    const size_t scaled = graph.add_node(GraphOperation::Multiply, {averages, joined});
+
+    EXPECT_TRUE(graph.is_in_place(scaled));
+
+    std::vector<Tensor> outputs = graph.forward(std::vector<Tensor>{left, right});
+    ASSERT_EQ(outputs.size(), 1);
+    EXPECT_THAT(outputs[0].get_shape(), ::testing::ElementsAre(5, 1, 3, 3));
+
+    for (size_t c = 0; c < 5; c++)
+    {
+        const Tensor &source = c < 2 ? left : right;
+        const size_t channel = c < 2 ? c : c - 2;
+        const float average = averagePooling.forward(source).get_element({channel, 0, 0, 0});
+
+        for (size_t y = 0; y < 3; y++)
+        {
+            for (size_t x = 0; x < 3; x++)
+            {
+                EXPECT_FLOAT_EQ(outputs[0].get_element({c, 0, y, x}),
+                                average * source.get_element({channel, 0, y, x}));
+            }
+        }
+    }
+
+    Graph concatWidth;
+    const size_t c = concatWidth.add_input();
+    concatWidth.add_node(GraphOperation::Concat, {c, c}, 3);
+    EXPECT_THAT(concatWidth.forward(left).get_shape(), ::testing::ElementsAre(2, 1, 3, 6));
+    EXPECT_EQ(concatWidth.forward(left).get_element({1, 0, 2, 4}), left.get_element({1, 0, 2, 1}));
+
+    EXPECT_THROW(graph.add_node(GraphOperation::Add, {a, 9}), std::invalid_argument);
+    EXPECT_THROW(graph.add_node(GraphOperation::Layer, {a}), std::invalid_argument);
+    EXPECT_THROW(graph.forward(std::vector<Tensor>{left, create_sequence({3, 1, 3, 2}, 1.0f)}), std::invalid_argument);
+}
+
+TEST(GraphTest, BatchNormLayer)
+{
+    Tensor input = create_sequence({3, 2, 2, 2}, 0.5f);
+    Tensor gamma = Tensor::from_vector(vec{1.0f, 2.0f, 0.5f});
+    Tensor beta = Tensor::from_vector(vec{0.0f, -1.0f, 3.0f});
+    Tensor mean = Tensor::from_vector(vec{0.5f, -0.25f, 1.0f});
+    Tensor variance = Tensor::from_vector(vec{1.0f, 4.0f, 0.25f});
+
+    BatchNormLayer batchNorm(gamma, beta, mean, variance, 0.0f);
+    Tensor output = batchNorm.forward(input);
+
+    for (size_t c = 0; c < 3; c++)
+    {
+        for (size_t i = 0; i < 8; i++)
+        {
+            const float x = input.get_data()[c * 8 + i];
+            const float expected = gamma.get_data()[c] * (x - mean.get_data()[c]) / std::sqrt(variance.get_data()[c]) +
+                                   beta.get_data()[c];
+            EXPECT_FLOAT_EQ(output.get_data()[c * 8 + i], expected);
+        }
+    }
+
+    EXPECT_TRUE(BatchNormLayer(Tensor({2}, 1.0f), Tensor({2}, 0.0f)).is_identity());
+    EXPECT_FALSE(batchNorm.is_identity());
+    EXPECT_THROW(BatchNormLayer(gamma, Tensor({2}, 0.0f)), std::invalid_argument);
+    EXPECT_THROW(batchNorm.forward(create_sequence({2, 1, 2, 2}, 1.0f)), std::invalid_argument);
+}
+
+TEST(GraphTest, OptimizationPasses)
+{
+    Tensor input = create_sequence({3, 1, 6, 6}, 0.25f);
+
+    Conv2DLayer conv(create_sequence({4, 3, 3, 3}, 0.125f), create_sequence({4, 1}, 0.5f), 1, 1);
+    BatchNormLayer batchNorm(create_sequence({4}, 0.25f), create_sequence({4}, 0.5f),
+                             create_sequence({4}, 0.125f), Tensor({4}, 2.0f));
+    BatchNormLayer identity(Tensor({4}, 1.0f), Tensor({4}, 0.0f));
+    ReLULayer relu;
+    Clip2DLayer clip(-1.0f, 4.0f);
+    Pooling2DLayer pooling(PoolingMode::Max, 2, 2);
+    FlattenLayer flatten;
+    ReshapeLayer reshape({4, 9});
+    FlattenLayer flattenAgain;
+    FullyConnectedLayer fullyConnected(create_sequence({5, 36}, 0.0625f), create_sequence({5, 1}, 0.25f));
+    BatchNormLayer scale(create_sequence({5}, 0.5f), create_sequence({5}, 0.25f));
+
+    Graph graph;
+    const size_t x = graph.add_input();
+    graph.add_layers({&conv, &batchNorm, &identity, &relu, &clip, &pooling, &flatten, &reshape, &flattenAgain,
+                      &fullyConnected, &scale},
+                     x);
+
+    const Tensor expected = graph.forward(input);
+    graph.optimize();
+
+    // the input, the folded convolution, the merged clip, the pooling, one flatten and the folded layer
+    ASSERT_EQ(graph.get_node_count(), 6);
+    EXPECT_NE(dynamic_cast<Conv2DLayer *>(graph.get_layer(1)), nullptr);
+    EXPECT_NE(graph.get_layer(1), &conv);
+    Clip2DLayer *merged = dynamic_cast<Clip2DLayer *>(graph.get_layer(2));
+    ASSERT_NE(merged, nullptr);
+    EXPECT_EQ(merged->get_min(), 0.0f);
+    EXPECT_EQ(merged->get_max(), 4.0f);
+    EXPECT_EQ(graph.get_layer(4), &flattenAgain);
+    EXPECT_NE(dynamic_cast<FullyConnectedLayer *>(graph.get_layer(5)), nullptr);
+
+    const Tensor output = graph.forward(input);
+    ASSERT_THAT(output.get_shape(), ::testing::ElementsAreArray(expected.get_shape()));
+    for (size_t i = 0; i < expected.getTotalElements(); i++)
+    {
+        EXPECT_NEAR(output.get_data()[i], expected.get_data()[i], 1e-4f);
+    }
+}
+
+TEST(GraphTest, OptimizationKeepsSharedAndConstantNodes)
+{
+    Tensor input = create_sequence({2, 1, 3, 3}, 0.5f);
+
+    Conv2DLayer conv(create_sequence({2, 2, 1, 1}, 0.25f), create_sequence({2, 1}, 0.5f));
+    BatchNormLayer batchNorm(create_sequence({2}, 0.25f), create_sequence({2}, 0.5f));
+    ReLULayer relu;
+
+    Graph graph;
+    const size_t x = graph.add_input();
+    const size_t features = graph.add_layer(conv, x);
+    const size_t normalized = graph.add_layer(batchNorm, features);
+    const size_t activated = graph.add_layer(relu, features);
+
+    // (1 + 2) * 0.5, folded into one constant
+    const size_t one = graph.add_constant(Tensor({2, 1, 1, 1}, 1.0f));
+    const size_t two = graph.add_constant(Tensor({2, 1, 1, 1}, 2.0f));
+    const size_t sum = graph.add_node(GraphOperation::Add, {one, two});
+    const size_t weights = graph.add_node(GraphOperation::Multiply, {sum, graph.add_constant(Tensor({1}, 0.5f))});
+    const size_t scaled = graph.add_node(GraphOperation::Multiply, {activated, weights});
+    graph.set_outputs({normalized, scaled});
+
+    const std::vector<Tensor> expected = graph.forward(std::vector<Tensor>{input});
+    graph.optimize();
+
+    // the convolution has two readers so the normalization stays, the constants become one
+    EXPECT_EQ(graph.get_node_count(), 6);
+    EXPECT_EQ(graph.get_layer(1), &conv);
+    EXPECT_EQ(graph.get_layer(2), &batchNorm);
+    EXPECT_EQ(graph.get_operation(4), GraphOperation::Constant);
+
+    const std::vector<Tensor> outputs = graph.forward(std::vector<Tensor>{input});
+    ASSERT_EQ(outputs.size(), 2);
+    EXPECT_EQ(outputs[0], expected[0]);
+    EXPECT_EQ(outputs[1], expected[1]);
+    EXPECT_EQ(outputs[1], relu.forward(conv.forward(input)) * 1.5f);
+
+    // the constant is read again by the next forward
+    EXPECT_EQ(graph.forward(std::vector<Tensor>{input})[1], expected[1]);
+}
+
+class CountingClipLayer : public Clip2DLayer
+{
+public:
+    CountingClipLayer(const float &min, const float &max)
+        : Clip2DLayer(min, max), forwards(0)
+    {
+    }
+
+    Tensor forward(const Tensor &input) override
+    {
+        forwards++;
+        return Clip2DLayer::forward(input);
+    }
+
+    size_t forwards;
+};
+
+TEST(GraphTest, SplitAndConcatWithoutCopies)
+{
+    Tensor input = create_sequence({5, 1, 4, 4}, 0.5f);
+
+    Conv2DLayer conv(create_sequence({3, 2, 3, 3}, 0.125f), create_sequence({3, 1}, 0.5f), 1, 1);
+    CountingClipLayer relu(0.0f, 6.0f);
+    CountingClipLayer clip(-1.0f, 1.0f);
+
+    // two branches over the first channels, the last ones are passed as they are
+    Graph graph;
+    const size_t x = graph.add_input();
+    const std::vector<size_t> parts = graph.add_split(x, {2, 2, 1});
+    const size_t left = graph.add_layer(relu, graph.add_layer(conv, parts[0]));
+    const size_t right = graph.add_layer(clip, parts[1]);
+    graph.add_node(GraphOperation::Concat, {left, right, parts[2]});
+
+    EXPECT_TRUE(graph.writes_into_concat(left));
+    EXPECT_TRUE(graph.writes_into_concat(right));
+    EXPECT_FALSE(graph.writes_into_concat(parts[2]));
+
+    Tensor expected({6, 1, 4, 4}, 0.0f);
+    {
+        Tensor convolved = Clip2DLayer(0.0f, 6.0f).forward(conv.forward(input.slice(0, 2)));
+        Tensor clipped = Clip2DLayer(-1.0f, 1.0f).forward(input.slice(2, 4));
+        float *data = expected.get_mutable_data();
+        memcpy(data, convolved.get_data(), 48 * sizeof(float));
+        memcpy(data + 48, clipped.get_data(), 32 * sizeof(float));
+        memcpy(data + 80, input.get_data() + 64, 16 * sizeof(float));
+    }
+
+    // the first forward gives the shapes, the next ones write into the concatenation
+    EXPECT_EQ(graph.forward(input), expected);
+    EXPECT_EQ(graph.forward(input), expected);
+    EXPECT_EQ(graph.forward(input), expected);
+    EXPECT_EQ(relu.forwards, 1);
+    EXPECT_EQ(clip.forwards, 1);
+    EXPECT_EQ(input, create_sequence({5, 1, 4, 4}, 0.5f));
+
+    // other shapes fall back to the copies once
+    Tensor smaller = create_sequence({5, 1, 3, 3}, 0.25f);
+    Graph reference;
+    const size_t y = reference.add_input();
+    const std::vector<size_t> referenceParts = reference.add_split(y, {2, 2, 1});
+    reference.add_node(GraphOperation::Concat,
+                       {reference.add_layers({&conv, &relu}, referenceParts[0]),
+                        reference.add_layer(clip, referenceParts[1]), referenceParts[2]});
+
+    const Tensor expectedSmaller = reference.forward(smaller);
+    EXPECT_EQ(graph.forward(smaller), expectedSmaller);
+    EXPECT_EQ(graph.forward(smaller), expectedSmaller);
+    EXPECT_EQ(graph.forward(input), expected);
+}
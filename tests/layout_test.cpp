@@ -0,0 +1,111 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <cstdio>
+#define NTT_MICRO_NN_IMPLEMENTATION
+#include <ntt_very_super_micro_dnn/ntt_tensor.hpp>
+#include "test_helpers.hpp"
+
+using namespace ntt;
+
+static const TensorLayout s_layouts[] = {TensorLayout::NHWC, TensorLayout::NCHW8c, TensorLayout::NCHW16c};
+
+TEST(LayoutTest, ReorderRoundTrip)
+{
+    Tensor input = create_sequence({11, 1, 4, 5}, 0.5f);
+
+    Tensor nhwc = input.to_layout(TensorLayout::NHWC);
+    EXPECT_THAT(nhwc.get_shape(), ::testing::ElementsAre(1, 4, 5, 11));
+    EXPECT_EQ(nhwc.get_element({0, 2, 3, 7}), input.get_element({7, 0, 2, 3}));
+
+    Tensor blocked = input.to_layout(TensorLayout::NCHW8c);
+    EXPECT_THAT(blocked.get_shape(), ::testing::ElementsAre(1, 2, 4, 5, 8));
+    EXPECT_EQ(blocked.get_channels(), 11);
+    EXPECT_EQ(blocked.get_element({0, 1, 2, 3, 2}), input.get_element({10, 0, 2, 3}));
+    EXPECT_EQ(blocked.get_element({0, 1, 2, 3, 3}), 0.0f);
+
+    for (TensorLayout layout : s_layouts)
+    {
+        Tensor converted = input.to_layout(layout);
+        EXPECT_EQ(converted.get_layout(), layout);
+        EXPECT_EQ(converted.to_layout(TensorLayout::CNHW), input);
+        EXPECT_EQ(converted.to_layout(TensorLayout::NCHW16c).to_layout(TensorLayout::CNHW), input);
+    }
+
+    EXPECT_THROW(Tensor({2, 3}).to_layout(TensorLayout::NHWC), std::invalid_argument);
+}
+
+TEST(LayoutTest, ConvolutionMatchesDefaultLayout)
+{
+    Tensor input = create_sequence({5, 1, 9, 7}, 0.25f);
+
+    Conv2DLayer conv(create_sequence({11, 5, 3, 3}, 0.125f), create_sequence({11, 1}, 1.0f), 2, 1);
+    Conv2DLayer pointwise(create_sequence({17, 5, 1, 1}, 0.5f), create_sequence({17, 1}, 0.25f));
+    Conv2DLayer depthwise(create_sequence({5, 1, 3, 3}, 0.25f), create_sequence({5, 1}, 0.5f), 1, 1, 5);
+
+    for (Conv2DLayer *layer : {&conv, &pointwise, &depthwise})
+    {
+        Tensor expected = layer->forward(input);
+
+        for (TensorLayout layout : s_layouts)
+        {
+            EXPECT_TRUE(layer->supports_layout(layout));
+            Tensor output = layer->forward(input.to_layout(layout));
+            EXPECT_EQ(output.get_layout(), layout);
+            EXPECT_EQ(output.to_layout(TensorLayout::CNHW), expected);
+        }
+    }
+}
+
+TEST(LayoutTest, PoolingMatchesDefaultLayout)
+{
+    Tensor input = create_sequence({10, 1, 6, 6}, -0.5f);
+
+    MaxPooling2DLayer pooling(3, 2, 1);
+    AveragePooling2DLayer windowAveragePooling(3, 2, 1);
+    Pooling2DLayer l2Pooling(PoolingMode::L2, 2, 2);
+    GlobalAveragePooling2DLayer averagePooling;
+    Clip2DLayer clip(-1.0f, 2.0f);
+
+    for (Layer *layer : std::vector<Layer *>{&pooling, &windowAveragePooling, &l2Pooling, &averagePooling, &clip})
+    {
+        Tensor expected = layer->forward(input);
+
+        for (TensorLayout layout : s_layouts)
+        {
+            Tensor output = layer->forward(input.to_layout(layout));
+            EXPECT_EQ(output.get_layout(), layout);
+            EXPECT_EQ(output.to_layout(TensorLayout::CNHW), expected);
+        }
+    }
+}
+
+TEST(LayoutTest, LayoutPlanReordersAtTheBoundaries)
+{
+    Tensor input = create_sequence({3, 1, 8, 8}, 0.25f);
+
+    Conv2DLayer expand(create_sequence({12, 3, 1, 1}, 0.5f), create_sequence({12, 1}, 0.25f));
+    Clip2DLayer clip1(0, 6);
+    Conv2DLayer depthwise(create_sequence({12, 1, 3, 3}, 0.25f), create_sequence({12, 1}, 0.5f), 2, 1, 12);
+    Clip2DLayer clip2(0, 6);
+    GlobalAveragePooling2DLayer averagePooling;
+    FlattenLayer flatten;
+
+    std::vector<Layer *> layers = {&expand, &clip1, &depthwise, &clip2, &averagePooling, &flatten};
+
+    Tensor expected = input;
+    for (Layer *layer : layers)
+    {
+        expected = layer->forward(expected);
+    }
+
+    LayoutPlan plan(layers, TensorLayout::NCHW8c);
+
+    // a reorder before the first convolution and one before the flatten
+    EXPECT_EQ(plan.get_layers().size(), layers.size() + 2);
+    EXPECT_EQ(plan.get_layers()[5], &averagePooling);
+    EXPECT_EQ(plan.get_layers()[7], &flatten);
+
+    Tensor output = plan.forward(input);
+    EXPECT_EQ(output.get_layout(), TensorLayout::CNHW);
+    EXPECT_EQ(output, expected);
+}
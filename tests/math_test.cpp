@@ -0,0 +1,115 @@
+#include <gtest/gtest.h>
+#include <cmath>
+#include <limits>
+#include <vector>
+#define NTT_MICRO_NN_IMPLEMENTATION
+#include <ntt_very_super_micro_dnn/ntt_math.hpp>
+
+using namespace ntt;
+
+static std::vector<float> create_range(float first, float last, size_t size)
+{
+    std::vector<float> values(size);
+    for (size_t i = 0; i < size; i++)
+    {
+        values[i] = first + (last - first) * static_cast<float>(i) / static_cast<float>(size - 1);
+    }
+
+    return values;
+}
+
+TEST(MathTest, ExpAccuracyTiers)
+{
+    // an odd size so both the vector loop and the scalar tail are used
+    const std::vector<float> input = create_range(-87.0f, 88.5f, 10001);
+    std::vector<float> output(input.size());
+
+    const ExpAccuracy accuracies[] = {ExpAccuracy::Exact, ExpAccuracy::Accurate, ExpAccuracy::Fast};
+    const float tolerances[] = {0.0f, 3.0f * std::numeric_limits<float>::epsilon(), 1e-4f};
+
+    for (size_t t = 0; t < 3; t++)
+    {
+        exp_array(input.data(), output.data(), input.size(), accuracies[t]);
+
+        for (size_t i = 0; i < input.size(); i++)
+        {
+            const float expected = std::exp(input[i]);
+            EXPECT_LE(std::fabs(output[i] - expected), tolerances[t] * expected) << input[i];
+        }
+    }
+}
+
+TEST(MathTest, ExpSpecialValues)
+{
+    const float infinity = std::numeric_limits<float>::infinity();
+    const std::vector<float> input = {-infinity, -1000.0f, -88.0f, 0.0f, 89.0f, infinity, std::nanf(""),
+                                      -infinity, -1000.0f, -88.0f, 0.0f, 89.0f, infinity, std::nanf("")};
+
+    for (ExpAccuracy accuracy : {ExpAccuracy::Accurate, ExpAccuracy::Fast})
+    {
+        std::vector<float> output(input.size());
+        exp_array(input.data(), output.data(), input.size(), accuracy);
+
+        for (size_t i = 0; i < input.size(); i += 7)
+        {
+            EXPECT_EQ(output[i + 0], 0.0f);
+            EXPECT_EQ(output[i + 1], 0.0f);
+            EXPECT_EQ(output[i + 2], 0.0f); // below FLT_MIN
+            EXPECT_EQ(output[i + 3], 1.0f);
+            EXPECT_EQ(output[i + 4], infinity);
+            EXPECT_EQ(output[i + 5], infinity);
+            EXPECT_TRUE(std::isnan(output[i + 6]));
+        }
+    }
+}
+
+TEST(MathTest, StableSoftmax)
+{
+    // the exponentials of these inputs overflow without the maximum subtraction
+    const std::vector<float> input = {1000.0f, 1001.0f, 1002.0f, -1000.0f, 999.5f};
+    const double e0 = std::exp(-2.0), e1 = std::exp(-1.0), e4 = std::exp(-2.5);
+    const double sum = e0 + e1 + 1.0 + e4;
+
+    for (ExpAccuracy accuracy : {ExpAccuracy::Exact, ExpAccuracy::Accurate, ExpAccuracy::Fast})
+    {
+        std::vector<float> output(input);
+        softmax_array(output.data(), output.data(), output.size(), accuracy);
+
+        EXPECT_NEAR(output[0], e0 / sum, 1e-4);
+        EXPECT_NEAR(output[1], e1 / sum, 1e-4);
+        EXPECT_NEAR(output[2], 1.0 / sum, 1e-4);
+        EXPECT_EQ(output[3], 0.0f);
+        EXPECT_NEAR(output[4], e4 / sum, 1e-4);
+    }
+}
+
+TEST(MathTest, Sigmoid)
+{
+    const std::vector<float> input = create_range(-20.0f, 20.0f, 101);
+    std::vector<float> output(input.size());
+    sigmoid_array(input.data(), output.data(), input.size(), ExpAccuracy::Accurate);
+
+    for (size_t i = 0; i < input.size(); i++)
+    {
+        EXPECT_NEAR(output[i], 1.0f / (1.0f + std::exp(-input[i])), std::numeric_limits<float>::epsilon());
+    }
+}
+
+TEST(MathTest, BytesToFloat)
+{
+    // an odd size so both the vector loop and the scalar tail are used
+    std::vector<uint8_t> input(37);
+    std::vector<float> scales(input.size()), shifts(input.size()), output(input.size());
+    for (size_t i = 0; i < input.size(); i++)
+    {
+        input[i] = static_cast<uint8_t>(255 - i * 7);
+        scales[i] = 0.5f + static_cast<float>(i % 3);
+        shifts[i] = -static_cast<float>(i % 5);
+    }
+
+    bytes_to_float_array(input.data(), output.data(), input.size(), scales.data(), shifts.data());
+    for (size_t i = 0; i < input.size(); i++)
+    {
+        EXPECT_EQ(output[i], static_cast<float>(input[i]) * scales[i] + shifts[i]);
+    }
+}
@@ -160,6 +160,52 @@ TEST(MatrixFloatTest, TestVectorTranspose)
     EXPECT_TRUE(result == expectedResult);
 }
 
+TEST(MatrixFloatTest, TestBlockedTranspose)
+{
+    ntt::Matrix matrix(67, 45);
+    for (size_t i = 0; i < 67; i++)
+    {
+        for (size_t j = 0; j < 45; j++)
+        {
+            matrix.set_element(i, j, i * 45 + j);
+        }
+    }
+
+    ntt::Matrix result = matrix.transpose();
+    EXPECT_EQ(result.get_rows(), 45);
+    EXPECT_EQ(result.get_columns(), 67);
+    for (size_t i = 0; i < 67; i++)
+    {
+        for (size_t j = 0; j < 45; j++)
+        {
+            EXPECT_EQ(result.get_element(j, i), i * 45 + j);
+        }
+    }
+}
+
+TEST(MatrixFloatTest, TestTransposeInPlace)
+{
+    ntt::Matrix matrix(41, 41);
+    for (size_t i = 0; i < 41; i++)
+    {
+        for (size_t j = 0; j < 41; j++)
+        {
+            matrix.set_element(i, j, i * 41 + j);
+        }
+    }
+
+    ntt::Matrix expectedResult = matrix.transpose();
+    matrix.transpose_in_place();
+    EXPECT_TRUE(matrix == expectedResult);
+
+    ntt::Matrix vector = ntt::Matrix::create_from_vector_vector({{0.35, 0.45}});
+    vector.transpose_in_place();
+    EXPECT_EQ(vector.get_rows(), 2);
+    EXPECT_EQ(vector.get_element(1, 0), 0.45f);
+
+    EXPECT_THROW(ntt::Matrix(2, 3).transpose_in_place(), std::invalid_argument);
+}
+
 TEST(MatrixFloatTest, AddAnotherMatrix)
 {
     ntt::Matrix matrix = ntt::Matrix::create_from_vector_vector({{0.35, 0.45},
@@ -407,3 +453,94 @@ TEST(MatrixFloatTest, MatrixFloatTest_Clip_Test)
     ntt::Matrix result = ntt::ClipLayer(3, 6).forward(matrix);
     EXPECT_TRUE(result == expectedResult);
 }
+
+TEST(MatrixFloatTest, MatrixFloatTest_LazyExpression_Test)
+{
+    ntt::Matrix a = ntt::Matrix::create_from_vector_vector({{1, 2},
+                                                            {3, 4}});
+    ntt::Matrix b = ntt::Matrix::create_from_vector_vector({{1, 1},
+                                                            {1, 1}});
+    ntt::Matrix c = ntt::Matrix::create_from_vector_vector({{0.5, 0.5},
+                                                            {0.5, 0.5}});
+
+    ntt::Matrix expectedResult = ntt::Matrix::create_from_vector_vector({{2.5, 4.5},
+                                                                         {6.5, 8.5}});
+
+    ntt::Matrix result = ntt::lazy(a) * 2 + b - c;
+    EXPECT_TRUE(result == expectedResult);
+
+    // the operators between matrices give matrices
+    EXPECT_EQ((a * 2 + b - c).get_element(1, 1), 8.5);
+    EXPECT_TRUE(a * 2 + b - c == expectedResult);
+
+    // the expression may read the matrix it is assigned to
+    a = ntt::lazy(a) * b + a;
+    expectedResult = ntt::Matrix::create_from_vector_vector({{4, 5},
+                                                             {10, 11}});
+    EXPECT_TRUE(a == expectedResult);
+}
+
+TEST(MatrixFloatTest, MatrixFloatTest_DotProductWithEpilogue_Test)
+{
+    ntt::Matrix weights = ntt::Matrix::create_from_vector_vector({{1, 2, 3},
+                                                                  {4, 5, 6}});
+    ntt::Matrix input = ntt::Matrix::create_from_vector_vector({{1},
+                                                                {0.5},
+                                                                {2}});
+    ntt::Matrix bias = ntt::Matrix::create_from_vector_vector({{0.5},
+                                                               {-1}});
+
+    ntt::Matrix expectedResult = ntt::Matrix::create_from_vector_vector({{8.5},
+                                                                         {17.5}});
+
+    ntt::Matrix result = ntt::lazy(weights) * input + bias;
+    EXPECT_TRUE(result == expectedResult);
+    EXPECT_TRUE(result == weights.dot(input).add(bias));
+
+    ntt::Matrix nested = (ntt::lazy(weights) * input) * 2 - bias;
+    expectedResult = ntt::Matrix::create_from_vector_vector({{15.5},
+                                                             {38}});
+    EXPECT_TRUE(nested == expectedResult);
+}
+
+TEST(MatrixFloatTest, MatrixFloatTest_StaticMatrix_Test)
+{
+    using Matrix2x3 = ntt::StaticMatrix<float, 2, 3>;
+    Matrix2x3 matrix = Matrix2x3::create_from_vector_vector({{1, 2, 3},
+                                                             {4, 5, 6}});
+    static_assert(Matrix2x3::get_rows() == 2 && Matrix2x3::get_columns() == 3, "constexpr shape");
+
+    ntt::StaticMatrix<float, 3, 2> transposed = matrix.transpose();
+    EXPECT_EQ(transposed.get_element(2, 1), 6);
+
+    ntt::StaticMatrix<float, 2, 2> product = matrix * transposed;
+    EXPECT_TRUE(product == (ntt::StaticMatrix<float, 2, 2>::create_from_vector_vector({{14, 32},
+                                                                                      {32, 77}})));
+
+    Matrix2x3 result = (matrix + matrix) * 0.5f - 1;
+    EXPECT_TRUE(result == Matrix2x3::create_from_vector_vector({{0, 1, 2},
+                                                                {3, 4, 5}}));
+
+    EXPECT_THROW(Matrix2x3::create_from_vector_vector({{1, 2}}), std::invalid_argument);
+    EXPECT_THROW(Matrix2x3::create_from_vector_vector({{1, 2, 3}, {4}}), std::invalid_argument);
+}
+
+TEST(MatrixFloatTest, MatrixFloatTest_StaticMatrixWithDynamicMatrix_Test)
+{
+    ntt::StaticMatrix<float, 2, 3> weights = ntt::StaticMatrix<float, 2, 3>::create_from_vector_vector({{1, 2, 3},
+                                                                                                       {4, 5, 6}});
+    ntt::Matrix input = ntt::Matrix::create_from_vector_vector({{1},
+                                                                {0.5},
+                                                                {2}});
+    ntt::Matrix bias = ntt::Matrix::create_from_vector_vector({{0.5},
+                                                               {-1}});
+
+    ntt::Matrix result = weights * input + bias;
+    EXPECT_TRUE(result == ntt::Matrix::create_from_vector_vector({{8.5},
+                                                                  {17.5}}));
+    EXPECT_TRUE(ntt::Matrix(weights.to_matrix() * input) == ntt::Matrix(weights * input));
+
+    ntt::StaticMatrix<float, 2, 1> converted(result);
+    EXPECT_EQ(converted.get_element(1, 0), 17.5);
+    EXPECT_THROW((ntt::StaticMatrix<float, 3, 1>(result)), std::invalid_argument);
+}
@@ -0,0 +1,178 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#define NTT_MICRO_NN_IMPLEMENTATION
+#include <ntt_very_super_micro_dnn/ntt_tensor.hpp>
+#include "test_helpers.hpp"
+
+using namespace ntt;
+
+static const shape_type s_frameShape = {2, 1, 3, 3};
+
+class SleepingLayer : public Layer
+{
+public:
+    explicit SleepingLayer(const size_t &milliseconds)
+        : m_milliseconds(milliseconds)
+    {
+    }
+
+    Tensor forward(const Tensor &input) override
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(m_milliseconds));
+        return input;
+    }
+
+private:
+    size_t m_milliseconds;
+};
+
+class FailingLayer : public Layer
+{
+public:
+    Tensor forward(const Tensor &input) override
+    {
+        if (input.get_data()[0] > 100.0f)
+        {
+            throw std::runtime_error("frame failed");
+        }
+        return input;
+    }
+};
+
+TEST(PipelineTest, SameOutputsAsTheSequentialChunks)
+{
+    Tensor weights({2, 2, 3, 3}, 0.0f);
+    float *w = weights.get_mutable_data();
+    for (size_t i = 0; i < weights.getTotalElements(); i++)
+    {
+        w[i] = static_cast<float>(static_cast<int>(i % 5) - 2) * 0.1f;
+    }
+
+    Conv2DLayer conv(weights, Tensor({2, 1}, 0.5f), 1, 1);
+    ReLULayer relu;
+    Clip2DLayer clip(0.0f, 1.5f);
+    BatchNormLayer scale(Tensor({2, 1}, 2.0f), Tensor({2, 1}, -1.0f));
+
+    // the layers belong to the stages once the pipeline runs, the expected outputs come first
+    const size_t frames = 50;
+    std::vector<Tensor> expected;
+    for (size_t i = 0; i < frames; i++)
+    {
+        expected.push_back(scale.forward(clip.forward(relu.forward(conv.forward(create_sequence(s_frameShape, 0.25f, i))))));
+    }
+
+    const std::vector<std::vector<Layer *>> chunks = {{&conv}, {&relu}, {&clip, &scale}};
+    Pipeline pipeline(chunks, 3, 2);
+    EXPECT_EQ(pipeline.get_stage_count(), 3);
+    EXPECT_EQ(pipeline.get_boundaries(), std::vector<size_t>({0, 1, 2, 3}));
+
+    // more frames than the queues hold, the outputs are read while the inputs are pushed
+    size_t popped = 0;
+    for (size_t i = 0; i < frames; i++)
+    {
+        pipeline.push(create_sequence(s_frameShape, 0.25f, i));
+
+        Tensor output({1}, 0.0f);
+        while (pipeline.try_pop(output))
+        {
+            EXPECT_EQ(output, expected[popped]);
+            popped++;
+        }
+    }
+
+    for (; popped < frames; popped++)
+    {
+        EXPECT_EQ(pipeline.pop(), expected[popped]);
+    }
+
+    EXPECT_EQ(pipeline.get_in_flight(), 0);
+    EXPECT_THROW(pipeline.pop(), std::logic_error);
+}
+
+TEST(PipelineTest, BalanceIsolatesTheSlowChunk)
+{
+    SleepingLayer fast(1), slow(20);
+    const std::vector<std::vector<Layer *>> chunks = {{&fast}, {&fast}, {&slow}, {&fast}, {&fast}};
+
+    Pipeline pipeline(chunks, 3);
+    EXPECT_EQ(pipeline.get_boundaries(), std::vector<size_t>({0, 1, 3, 5}));
+
+    pipeline.balance(create_sequence(s_frameShape, 0.25f), 2);
+    ASSERT_EQ(pipeline.get_chunk_latencies().size(), 5);
+    EXPECT_GT(pipeline.get_chunk_latencies()[2], pipeline.get_chunk_latencies()[0]);
+
+    // the slow chunk gets a stage for itself, the fast ones are shared by the other two
+    EXPECT_EQ(pipeline.get_boundaries(), std::vector<size_t>({0, 2, 3, 5}));
+
+    pipeline.push(create_sequence(s_frameShape, 0.25f, 1));
+    EXPECT_THROW(pipeline.balance(create_sequence(s_frameShape, 0.25f)), std::logic_error);
+    EXPECT_EQ(pipeline.pop(), create_sequence(s_frameShape, 0.25f, 1));
+}
+
+TEST(PipelineTest, ErrorsComeOutInOrder)
+{
+    ReLULayer relu;
+    FailingLayer failing;
+    const Tensor first = relu.forward(create_sequence(s_frameShape, 0.25f, 1));
+    const Tensor last = relu.forward(create_sequence(s_frameShape, 0.25f, 2));
+    Pipeline pipeline({{&relu}, {&failing}}, 2);
+
+    Tensor bad = create_sequence(s_frameShape, 0.25f);
+    bad.get_mutable_data()[0] = 1000.0f;
+
+    pipeline.push(create_sequence(s_frameShape, 0.25f, 1));
+    pipeline.push(bad);
+    pipeline.push(create_sequence(s_frameShape, 0.25f, 2));
+
+    EXPECT_EQ(pipeline.pop(), first);
+    EXPECT_THROW(pipeline.pop(), std::runtime_error);
+    EXPECT_EQ(pipeline.pop(), last);
+    EXPECT_EQ(pipeline.get_in_flight(), 0);
+}
+
+TEST(PipelineTest, BalanceRestartsTheStagesWhenALayerThrows)
+{
+    SleepingLayer fast(0);
+    FailingLayer failing;
+    Pipeline pipeline({{&fast}, {&failing}, {&fast}}, 2);
+    const std::vector<size_t> boundaries = pipeline.get_boundaries();
+
+    Tensor bad = create_sequence(s_frameShape, 0.25f);
+    bad.get_mutable_data()[0] = 1000.0f;
+    EXPECT_THROW(pipeline.balance(bad), std::runtime_error);
+    EXPECT_EQ(pipeline.get_boundaries(), boundaries);
+
+    pipeline.push(create_sequence(s_frameShape, 0.25f, 1));
+    EXPECT_EQ(pipeline.pop(), create_sequence(s_frameShape, 0.25f, 1));
+}
+
+TEST(PipelineTest, PushThrowsInsteadOfWaitingForeverWithoutPops)
+{
+    SleepingLayer fast(0);
+    Pipeline pipeline({{&fast}, {&fast}}, 2, 1);
+    ASSERT_EQ(pipeline.get_max_in_flight(), 5);
+
+    // the queues and the stages hold five frames, the sixth push would wait for a pop
+    for (size_t i = 0; i < 5; i++)
+    {
+        pipeline.push(create_sequence(s_frameShape, 0.25f, i));
+    }
+
+    EXPECT_THROW(pipeline.push(create_sequence(s_frameShape, 0.25f, 5)), std::logic_error);
+    EXPECT_EQ(pipeline.get_in_flight(), 5);
+
+    // every slot is taken, so try_push finds the first queue full instead of waiting
+    EXPECT_FALSE(pipeline.try_push(create_sequence(s_frameShape, 0.25f, 5)));
+    EXPECT_EQ(pipeline.get_in_flight(), 5);
+
+    for (size_t i = 0; i < 5; i++)
+    {
+        EXPECT_EQ(pipeline.pop(), create_sequence(s_frameShape, 0.25f, i));
+    }
+
+    EXPECT_TRUE(pipeline.try_push(create_sequence(s_frameShape, 0.25f, 6)));
+    EXPECT_EQ(pipeline.pop(), create_sequence(s_frameShape, 0.25f, 6));
+}
@@ -0,0 +1,141 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <cstdio>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#define NTT_MICRO_NN_IMPLEMENTATION
+#include <ntt_very_super_micro_dnn/ntt_tensor.hpp>
+#include "test_helpers.hpp"
+
+using namespace ntt;
+
+static StreamedLayer::Factory create_conv_factory(const size_t &padding, size_t &builds)
+{
+    return [padding, &builds](const std::vector<Tensor> &weights)
+    {
+        builds++;
+        return std::unique_ptr<Layer>(new Conv2DLayer(weights[0], weights[1], 1, padding));
+    };
+}
+
+TEST(StreamingTest, LayersArePrefetchedAndReleased)
+{
+    const Tensor weights1 = create_sequence({4, 2, 3, 3}, 0.1f);
+    const Tensor bias1 = create_sequence({4, 1}, 0.5f);
+    const Tensor weights2 = create_sequence({3, 4, 1, 1}, 0.2f);
+    const Tensor bias2 = create_sequence({3, 1}, 0.25f);
+    weights1.save("streamed_weight1.bin");
+    bias1.save("streamed_bias1.bin");
+    weights2.save("streamed_weight2.bin");
+    bias2.save("streamed_bias2.bin");
+
+    size_t builds1 = 0, builds2 = 0;
+    StreamedLayer conv1({"streamed_weight1.bin", "streamed_bias1.bin"}, create_conv_factory(1, builds1));
+    ReLULayer relu;
+    StreamedLayer conv2({"streamed_weight2.bin", "streamed_bias2.bin"}, create_conv_factory(0, builds2));
+    StreamedLayer::chain({&conv1, &conv2});
+
+    Conv2DLayer eager1(weights1, bias1, 1, 1);
+    Conv2DLayer eager2(weights2, bias2, 1, 0);
+    const Tensor input = create_sequence({2, 1, 5, 5}, 0.25f);
+    const Tensor expected = eager2.forward(relu.forward(eager1.forward(input)));
+
+    for (size_t run = 1; run <= 2; run++)
+    {
+        EXPECT_FALSE(conv1.is_loaded());
+        EXPECT_FALSE(conv2.is_loaded());
+
+        // the first layer is released once it ran, the second one is loading meanwhile
+        Tensor output = conv1.forward(input);
+        EXPECT_FALSE(conv1.is_loaded());
+        EXPECT_TRUE(conv2.is_loaded());
+
+        output = conv2.forward(relu.forward(output));
+        EXPECT_FALSE(conv2.is_loaded());
+        EXPECT_EQ(output, expected);
+        EXPECT_EQ(builds1, run);
+        EXPECT_EQ(builds2, run);
+    }
+
+    // a prefetched layer which is released waits for its load if it started, else drops it,
+    // then is loaded again
+    conv1.prefetch();
+    EXPECT_TRUE(conv1.is_loaded());
+    conv1.release();
+    EXPECT_FALSE(conv1.is_loaded());
+    const size_t released = builds1;
+    EXPECT_LE(released, 3);
+    EXPECT_EQ(conv1.forward(input), eager1.forward(input));
+    EXPECT_EQ(builds1, released + 1);
+
+    std::remove("streamed_weight1.bin");
+    std::remove("streamed_bias1.bin");
+    std::remove("streamed_weight2.bin");
+    std::remove("streamed_bias2.bin");
+}
+
+TEST(StreamingTest, LoadingErrorsAreThrownByForward)
+{
+    size_t builds = 0;
+    StreamedLayer first({"streamed_weight1.bin", "streamed_bias1.bin"}, create_conv_factory(1, builds));
+    StreamedLayer missing({"missing_weight.bin"}, create_conv_factory(0, builds));
+    StreamedLayer::chain({&first, &missing});
+
+    create_sequence({4, 2, 3, 3}, 0.1f).save("streamed_weight1.bin");
+    create_sequence({4, 1}, 0.5f).save("streamed_bias1.bin");
+
+    // the prefetch fails on the pool, the error comes out of the forward of the layer
+    const Tensor output = first.forward(create_sequence({2, 1, 5, 5}, 0.25f));
+    EXPECT_THROW(missing.forward(output), std::runtime_error);
+    EXPECT_FALSE(missing.is_loaded());
+
+    std::remove("streamed_weight1.bin");
+    std::remove("streamed_bias1.bin");
+}
+
+TEST(StreamingTest, ChainRunsOnTheWorkerOfItsPool)
+{
+    create_sequence({4, 2, 3, 3}, 0.1f).save("streamed_weight1.bin");
+    create_sequence({4, 1}, 0.5f).save("streamed_bias1.bin");
+    create_sequence({3, 4, 1, 1}, 0.2f).save("streamed_weight2.bin");
+    create_sequence({3, 1}, 0.25f).save("streamed_bias2.bin");
+
+    // the only worker runs the chain, so the prefetch of conv2 cannot start before its forward
+    ThreadPool pool(2);
+    size_t builds1 = 0, builds2 = 0;
+    StreamedLayer conv1({"streamed_weight1.bin", "streamed_bias1.bin"}, create_conv_factory(1, builds1), pool);
+    ReLULayer relu;
+    StreamedLayer conv2({"streamed_weight2.bin", "streamed_bias2.bin"}, create_conv_factory(0, builds2), pool);
+    StreamedLayer::chain({&conv1, &conv2});
+
+    Graph graph;
+    graph.set_outputs({graph.add_layers({&conv1, &relu, &conv2}, graph.add_input())});
+    const Tensor input = create_sequence({2, 1, 5, 5}, 0.25f);
+    const Tensor expected = graph.forward(input);
+
+    {
+        AsyncLayer model(graph, pool);
+        std::vector<std::future<Tensor>> outputs;
+        for (size_t i = 0; i < 3; i++)
+        {
+            outputs.push_back(model.submit(input));
+        }
+
+        for (std::future<Tensor> &output : outputs)
+        {
+            ASSERT_EQ(output.wait_for(std::chrono::seconds(30)), std::future_status::ready);
+            EXPECT_EQ(output.get(), expected);
+        }
+    }
+
+    EXPECT_EQ(builds1, 4);
+    EXPECT_EQ(builds2, 4);
+
+    std::remove("streamed_weight1.bin");
+    std::remove("streamed_bias1.bin");
+    std::remove("streamed_weight2.bin");
+    std::remove("streamed_bias2.bin");
+}
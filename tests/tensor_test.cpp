@@ -1,6 +1,10 @@
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
 #include <cstdio>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <utility>
 #define NTT_MICRO_NN_IMPLEMENTATION
 #include <ntt_very_super_micro_dnn/ntt_tensor.hpp>
 
@@ -295,6 +299,115 @@ TEST(TensorTest, CopyAssignmentOperator)
     EXPECT_EQ(tensor1, tensor2);
 }
 
+TEST(TensorTest, CopySharesStorage)
+{
+    Tensor tensor = Tensor::from_vector({1.0, 2.0, 3.0});
+    Tensor copied = tensor;
+    Tensor reshaped = tensor.reshape_clone({3, 1});
+
+    EXPECT_EQ(tensor.use_count(), 3);
+    EXPECT_EQ(copied.get_data(), tensor.get_data());
+    EXPECT_EQ(reshaped.get_data(), tensor.get_data());
+}
+
+TEST(TensorTest, CopyOnWrite)
+{
+    Tensor tensor = Tensor::from_vector({1.0, 2.0, 3.0});
+    Tensor copied = tensor;
+
+    copied.set_element({0}, 5.0);
+
+    EXPECT_FALSE(tensor.is_shared());
+    EXPECT_FALSE(copied.is_shared());
+    EXPECT_NE(copied.get_data(), tensor.get_data());
+    EXPECT_EQ(tensor, Tensor::from_vector({1.0, 2.0, 3.0}));
+    EXPECT_EQ(copied, Tensor::from_vector({5.0, 2.0, 3.0}));
+}
+
+TEST(TensorTest, SliceSharesStorage)
+{
+    Tensor tensor = Tensor::from_vector(tensor2d{{1.0, 2.0}, {3.0, 4.0}, {5.0, 6.0}});
+    Tensor slice = tensor.slice(1, 3);
+
+    EXPECT_THAT(slice.get_shape(), ::testing::ElementsAre(2, 2));
+    EXPECT_EQ(slice.get_data(), tensor.get_data() + 2);
+    EXPECT_EQ(slice, Tensor::from_vector(tensor2d{{3.0, 4.0}, {5.0, 6.0}}));
+
+    // a slice is copied on write like the other copies
+    slice.set_element({0, 0}, 7.0);
+    EXPECT_EQ(tensor.get_element({1, 0}), 3.0f);
+    EXPECT_EQ(slice.get_element({0, 0}), 7.0f);
+
+    // a view writes into the storage of the tensor
+    Tensor view = tensor.write_view(0, 1);
+    view.set_element({0, 1}, 8.0);
+    EXPECT_EQ(view.get_data(), tensor.get_data());
+    EXPECT_EQ(tensor.get_element({0, 1}), 8.0f);
+
+    // so do its slices, but its copies are copied on write
+    view.slice(0, 1).set_element({0, 0}, 9.0);
+    EXPECT_EQ(tensor.get_element({0, 0}), 9.0f);
+
+    Tensor copied = view;
+    copied.set_element({0, 0}, 10.0);
+    EXPECT_NE(copied.get_data(), tensor.get_data());
+    EXPECT_EQ(tensor.get_element({0, 0}), 9.0f);
+
+    // the copies of the tensor taken while a view is alive do not see the writes through it
+    Tensor snapshot = tensor;
+    Tensor assigned({1}, 0.0f);
+    assigned = tensor;
+    view.set_element({0, 0}, 11.0);
+    EXPECT_EQ(snapshot.get_element({0, 0}), 9.0f);
+    EXPECT_EQ(assigned.get_element({0, 0}), 9.0f);
+    EXPECT_EQ(tensor.get_element({0, 0}), 11.0f);
+
+    // the tensor writes into the storage of its views instead of detaching from them
+    tensor.set_element({0, 1}, 12.0);
+    view.set_element({0, 0}, 13.0);
+    EXPECT_EQ(view.get_data(), tensor.get_data());
+    EXPECT_EQ(view.get_element({0, 1}), 12.0f);
+    EXPECT_EQ(tensor.get_element({0, 0}), 13.0f);
+
+    // a moved view stays a view, and the storage is copied on write again without views
+    Tensor moved(std::move(view));
+    moved.set_element({0, 1}, 14.0);
+    EXPECT_EQ(tensor.get_element({0, 1}), 14.0f);
+    moved = Tensor({1}, 0.0f);
+    Tensor later = tensor;
+    EXPECT_EQ(later.get_data(), tensor.get_data());
+    later.set_element({0, 0}, 15.0);
+    EXPECT_EQ(tensor.get_element({0, 0}), 13.0f);
+
+    EXPECT_THROW(tensor.slice(2, 4), std::invalid_argument);
+    EXPECT_THROW(tensor.slice(2, 1), std::invalid_argument);
+}
+
+TEST(TensorTest, AssignmentReleasesPreviousStorage)
+{
+    Tensor tensor = Tensor::from_vector({1.0, 2.0, 3.0});
+    Tensor other = tensor;
+    EXPECT_EQ(tensor.use_count(), 2);
+
+    other = Tensor::from_vector(vec{4.0});
+    EXPECT_EQ(tensor.use_count(), 1);
+
+    other = other;
+    EXPECT_EQ(other, Tensor::from_vector(vec{4.0}));
+}
+
+TEST(TensorTest, LayerSharesWeights)
+{
+    Tensor weights({2, 3}, 1.0f);
+    Tensor bias({2, 1}, 0.0f);
+
+    FullyConnectedLayer layer(weights, bias);
+    FullyConnectedLayer clonedLayer = layer;
+
+    EXPECT_EQ(weights.use_count(), 3);
+    EXPECT_EQ(bias.use_count(), 3);
+}
+
 TEST(TensorTest, GetElementByIndex_WithWrongShape)
 {
     Tensor tensor = Tensor::from_vector({1.0, 2.0, 3.0});
@@ -349,6 +462,100 @@ TEST(TensorTest, SubtractionWithDifferentShape)
     EXPECT_THROW(tensor1 - tensor2, std::invalid_argument);
 }
 
+TEST(TensorTest, BroadcastShape)
+{
+    EXPECT_EQ(Tensor::broadcast_shape({3, 1, 4}, {2, 1}), (shape_type{3, 2, 4}));
+    EXPECT_EQ(Tensor::broadcast_shape({5}, {2, 5}), (shape_type{2, 5}));
+    EXPECT_THROW(Tensor::broadcast_shape({3, 2}, {3}), std::invalid_argument);
+}
+
+TEST(TensorTest, AdditionWithBroadcasting)
+{
+    Tensor tensor = Tensor::from_vector(tensor2d{{1.0, 2.0, 3.0},
+                                                 {4.0, 5.0, 6.0}});
+    Tensor row = Tensor::from_vector(vec{10.0, 20.0, 30.0});
+    Tensor column = Tensor::from_vector(tensor2d{{100.0}, {200.0}});
+
+    EXPECT_EQ(tensor + row, Tensor::from_vector(tensor2d{{11.0, 22.0, 33.0},
+                                                         {14.0, 25.0, 36.0}}));
+    EXPECT_EQ(tensor - column, Tensor::from_vector(tensor2d{{-99.0, -98.0, -97.0},
+                                                            {-196.0, -195.0, -194.0}}));
+    EXPECT_EQ(column * row, Tensor::from_vector(tensor2d{{1000.0, 2000.0, 3000.0},
+                                                         {2000.0, 4000.0, 6000.0}}));
+}
+
+TEST(TensorTest, PerChannelBiasWithBroadcasting)
+{
+    Tensor input({2, 1, 2, 2}, 1.0f);
+    Tensor bias = Tensor::from_vector(tensor2d{{0.5}, {-1.0}}).reshape_clone({2, 1, 1, 1});
+
+    EXPECT_EQ(input + bias, Tensor::from_vector(tensor4d{{{{1.5, 1.5}, {1.5, 1.5}}},
+                                                         {{{0.0, 0.0}, {0.0, 0.0}}}}));
+}
+
+TEST(TensorTest, MaximumAndMinimum)
+{
+    Tensor tensor1 = Tensor::from_vector({1.0, 5.0, -3.0});
+    Tensor tensor2 = Tensor::from_vector({4.0, 2.0, -6.0});
+
+    EXPECT_EQ(tensor1.maximum(tensor2), Tensor::from_vector({4.0, 5.0, -3.0}));
+    EXPECT_EQ(tensor1.minimum(tensor2), Tensor::from_vector({1.0, 2.0, -6.0}));
+    EXPECT_EQ(tensor1.maximum(0.0f), Tensor::from_vector({1.0, 5.0, 0.0}));
+    EXPECT_EQ(tensor1.divide(tensor2), Tensor::from_vector({0.25, 2.5, 0.5}));
+}
+
+TEST(TensorTest, InPlaceOperations)
+{
+    Tensor tensor = Tensor::from_vector(tensor2d{{1.0, 2.0},
+                                                 {3.0, 4.0}});
+    Tensor shared = tensor;
+
+    tensor += Tensor::from_vector(vec{1.0, 2.0});
+    tensor *= 2.0f;
+    tensor -= 1.0f;
+    tensor /= Tensor::from_vector(tensor2d{{1.0}, {2.0}});
+
+    EXPECT_EQ(tensor, Tensor::from_vector(tensor2d{{3.0, 7.0},
+                                                   {3.5, 5.5}}));
+    EXPECT_EQ(shared, Tensor::from_vector(tensor2d{{1.0, 2.0},
+                                                   {3.0, 4.0}}));
+
+    tensor += tensor;
+    EXPECT_EQ(tensor, Tensor::from_vector(tensor2d{{6.0, 14.0},
+                                                   {7.0, 11.0}}));
+}
+
+TEST(TensorTest, InPlaceOperationCannotChangeShape)
+{
+    Tensor tensor = Tensor::from_vector(vec{1.0, 2.0});
+    EXPECT_THROW(tensor += Tensor({2, 2}, 1.0f), std::invalid_argument);
+}
+
+TEST(TensorTest, LazyExpression)
+{
+    Tensor a = Tensor::from_vector(tensor2d{{1.0, 2.0, 3.0},
+                                            {4.0, 5.0, 6.0}});
+    Tensor b = Tensor::from_vector(vec{1.0, 0.0, -1.0});
+    Tensor c({2, 1}, 0.5f);
+
+    Tensor result = lazy(a) * 2.0f + b - c;
+    EXPECT_EQ(result, a * 2.0f + b - c);
+    EXPECT_THAT(result.get_shape(), ::testing::ElementsAre(2, 3));
+
+    Tensor quotient = a / (lazy(b) + 2.0f);
+    EXPECT_EQ(quotient, a / (b + 2.0f));
+}
+
+TEST(TensorTest, LazyExpressionKeepsOperandsAlive)
+{
+    Tensor a = Tensor::from_vector(vec{1.0, 2.0});
+    auto expression = lazy(a) + lazy(a * 3.0f);
+    a += 1.0f;
+
+    EXPECT_EQ(Tensor(expression), Tensor::from_vector(vec{4.0, 8.0}));
+    EXPECT_THROW(lazy(a) + Tensor({3}, 1.0f), std::invalid_argument);
+}
+
 TEST(TensorTest, Negative)
 {
     Tensor tensor = Tensor::from_vector({1.0, 2.0, 3.0});
@@ -409,6 +616,121 @@ TEST(TensorTest, Argmax)
     EXPECT_EQ(tensor.argmax(1), Tensor::from_vector(tensor2d{{2}, {1}}));
 }
 
+TEST(TensorTest, FindMaxWithFractionalValues)
+{
+    Tensor tensor = Tensor::from_vector({{-1.5, 0.25, 3.5},
+                                         {-0.5, 0.75, 3.25}});
+    EXPECT_EQ(tensor.max(0), Tensor::from_vector(tensor2d{{-0.5f, 0.75f, 3.5f}}));
+    EXPECT_EQ(tensor.argmax(0), Tensor::from_vector(tensor2d{{1, 1, 0}}));
+}
+
+TEST(TensorTest, Transpose3D)
+{
+    Tensor tensor = Tensor::from_vector(tensor3d{{{1.0, 2.0, 3.0},
+                                                  {4.0, 5.0, 6.0}},
+                                                 {{7.0, 8.0, 9.0},
+                                                  {10.0, 11.0, 12.0}}});
+
+    EXPECT_EQ(tensor.transpose(0, 2), Tensor::from_vector(tensor3d{{{1.0, 7.0},
+                                                                    {4.0, 10.0}},
+                                                                   {{2.0, 8.0},
+                                                                    {5.0, 11.0}},
+                                                                   {{3.0, 9.0},
+                                                                    {6.0, 12.0}}}));
+}
+
+TEST(TensorTest, PermuteNCHWToNHWC)
+{
+    // big enough for going through the blocked transpose with partial tiles
+    Tensor tensor({2, 19, 5, 7});
+    float *data = tensor.get_mutable_data();
+    for (size_t i = 0; i < tensor.getTotalElements(); i++)
+    {
+        data[i] = static_cast<float>(i);
+    }
+
+    Tensor result = tensor.permute({0, 2, 3, 1});
+    EXPECT_THAT(result.get_shape(), ::testing::ElementsAre(2, 5, 7, 19));
+
+    for (size_t n = 0; n < 2; n++)
+        for (size_t c = 0; c < 19; c++)
+            for (size_t h = 0; h < 5; h++)
+                for (size_t w = 0; w < 7; w++)
+                    EXPECT_EQ(result.get_element({n, h, w, c}), tensor.get_element({n, c, h, w}));
+
+    EXPECT_EQ(result.permute({0, 3, 1, 2}), tensor);
+    EXPECT_EQ(tensor.permute({0, 1, 2, 3}), tensor);
+    EXPECT_THROW(tensor.permute({0, 1, 1, 2}), std::invalid_argument);
+}
+
+TEST(TensorTest, TransposeInPlace)
+{
+    Tensor tensor({3, 37, 37});
+    float *data = tensor.get_mutable_data();
+    for (size_t i = 0; i < tensor.getTotalElements(); i++)
+    {
+        data[i] = static_cast<float>(i);
+    }
+
+    Tensor copy = tensor;
+    tensor.transpose_in_place(1, 2);
+    EXPECT_EQ(tensor, copy.transpose(1, 2));
+    EXPECT_EQ(copy.get_element({0, 0, 1}), 1.0f);
+
+    tensor.transpose_in_place(0, 0);
+    EXPECT_THROW(tensor.transpose_in_place(0, 1), std::invalid_argument);
+}
+
+TEST(ShapeTest, TestNumberOfNewLinesAtFirstElement)
+{
+    Shape shape({2, 3});
+    EXPECT_EQ(shape.get_number_of_new_lines(), 2);
+}
+
+TEST(ShapeIteratorTest, CollapsesContiguousDimensions)
+{
+    Tensor tensor({2, 3, 4});
+    ShapeIterator it(tensor.get_shape(), {tensor.get_strides()});
+
+    EXPECT_FALSE(it.is_end());
+    EXPECT_EQ(it.get_inner_size(), 24);
+    EXPECT_EQ(it.get_inner_stride(0), 1);
+
+    it.next();
+    EXPECT_TRUE(it.is_end());
+}
+
+TEST(ShapeIteratorTest, TracksOffsetsOfSeveralOperands)
+{
+    // the second operand repeats one row for every outer index (a stride of 0)
+    ShapeIterator it({3, 2}, {{2, 1}, {0, 1}, {1, 3}});
+
+    std::vector<size_t> firstOffsets;
+    std::vector<size_t> thirdOffsets;
+    while (!it.is_end())
+    {
+        EXPECT_EQ(it.get_inner_size(), 2);
+        EXPECT_EQ(it.get_offset(1), 0);
+        firstOffsets.push_back(it.get_offset(0));
+        thirdOffsets.push_back(it.get_offset(2));
+        it.next();
+    }
+
+    EXPECT_THAT(firstOffsets, ::testing::ElementsAre(0, 2, 4));
+    EXPECT_THAT(thirdOffsets, ::testing::ElementsAre(0, 1, 2));
+    EXPECT_EQ(it.get_inner_stride(2), 3);
+
+    it.reset();
+    EXPECT_FALSE(it.is_end());
+    EXPECT_EQ(it.get_offset(0), 0);
+}
+
+TEST(ShapeIteratorTest, EmptyShape)
+{
+    ShapeIterator it({2, 0, 3}, {{0, 3, 1}});
+    EXPECT_TRUE(it.is_end());
+}
+
 TEST(NeuralNetTest, TestReLULayer)
 {
     Tensor input = Tensor::from_vector({-1.0, 2.0, -3.0});
@@ -455,6 +777,62 @@ TEST(NeuralNetTest, TestSoftmaxLayer)
               Tensor::from_vector(tensor2d{{0.09003057317038046, 0.24472847105479767, 0.6652409557748219}}));
 }
 
+TEST(NeuralNetTest, TestSoftmaxLayerOverAxis)
+{
+    // [classes, batch]: every column is one sample
+    Tensor input = Tensor::from_vector(tensor2d{{1.0, 5.0, -3.0},
+                                                {2.0, 5.0, 0.0},
+                                                {3.0, 5.0, 1000.0}});
+    Tensor result = SoftmaxLayer(0).forward(input);
+    Tensor logResult = LogSoftmaxLayer(0).forward(input);
+
+    EXPECT_EQ(result, Tensor::from_vector(tensor2d{{0.09003057317038046, 1.0 / 3.0, 0.0},
+                                                   {0.24472847105479767, 1.0 / 3.0, 0.0},
+                                                   {0.6652409557748219, 1.0 / 3.0, 1.0}}));
+    EXPECT_NEAR(logResult.get_element({0, 0}), std::log(0.09003057317038046), 1e-6);
+    EXPECT_NEAR(logResult.get_element({1, 1}), std::log(1.0 / 3.0), 1e-6);
+    EXPECT_NEAR(logResult.get_element({0, 2}), -1003.0, 1e-3);
+    EXPECT_EQ(SoftmaxLayer(1).forward(input.transpose(0, 1)), result.transpose(0, 1));
+
+    // a 4D tensor normalized over the channels, more columns than a block of the strided kernel
+    Tensor activations({6, 2, 17, 19}, 0.0f);
+    float *data = activations.get_mutable_data();
+    for (size_t i = 0; i < activations.getTotalElements(); i++)
+    {
+        data[i] = static_cast<float>(static_cast<int>(i * 7 % 23) - 11) / 4.0f;
+    }
+
+    for (ExpAccuracy accuracy : {ExpAccuracy::Exact, ExpAccuracy::Accurate, ExpAccuracy::Fast})
+    {
+        Tensor channels = SoftmaxLayer(0, accuracy).forward(activations);
+        Tensor logChannels = LogSoftmaxLayer(0, accuracy).forward(activations);
+        Tensor rows = LogSoftmaxLayer(3, accuracy).forward(activations);
+
+        for (size_t p = 0; p < 2 * 17 * 19; p += 37)
+        {
+            double sum = 0.0;
+            for (size_t c = 0; c < 6; c++)
+            {
+                sum += channels.get_data()[c * 2 * 17 * 19 + p];
+                EXPECT_NEAR(std::exp(logChannels.get_data()[c * 2 * 17 * 19 + p]), channels.get_data()[c * 2 * 17 * 19 + p], 1e-5);
+            }
+            EXPECT_NEAR(sum, 1.0, 1e-5);
+        }
+
+        for (size_t r = 0; r < 6 * 2 * 17; r += 5)
+        {
+            double sum = 0.0;
+            for (size_t x = 0; x < 19; x++)
+            {
+                sum += std::exp(rows.get_data()[r * 19 + x]);
+            }
+            EXPECT_NEAR(sum, 1.0, 1e-5);
+        }
+    }
+
+    EXPECT_THROW(SoftmaxLayer(4).forward(activations), std::invalid_argument);
+}
+
 TEST(NeuralNetTest, TestSigmoidLayer)
 {
     Tensor input = Tensor::from_vector(tensor2d{{1.0, -2.0, 3.0}});
@@ -506,6 +884,247 @@ TEST(NeuralNetTest, TestConv2DLayer)
     Tensor result = Conv2DLayer(weights, bias, 1, false).forward(input);
 }
 
+TEST(NeuralNetTest, TestWinogradConv2DLayer)
+{
+    Tensor input({20, 1, 11, 9}, 0.0f);
+    Tensor weights({24, 20, 3, 3}, 0.0f);
+    Tensor bias({24, 1}, 0.0f);
+    float *inputData = input.get_mutable_data();
+    float *weightsData = weights.get_mutable_data();
+    float *biasData = bias.get_mutable_data();
+
+    for (size_t i = 0; i < input.getTotalElements(); i++)
+    {
+        inputData[i] = static_cast<float>(static_cast<int>(i * 7 % 19) - 9) / 8.0f;
+    }
+    for (size_t i = 0; i < weights.getTotalElements(); i++)
+    {
+        weightsData[i] = static_cast<float>(static_cast<int>(i * 5 % 17) - 8) / 16.0f;
+    }
+    for (size_t i = 0; i < bias.getTotalElements(); i++)
+    {
+        biasData[i] = static_cast<float>(i) / 4.0f;
+    }
+
+    for (size_t padding = 0; padding < 2; padding++)
+    {
+        Conv2DLayer direct(weights, bias, 1, padding);
+        direct.set_convolution_algorithm(ConvolutionAlgorithm::Direct);
+        Tensor expected = direct.forward(input);
+
+        Conv2DLayer automatic(weights, bias, 1, padding);
+        EXPECT_EQ(automatic.get_convolution_algorithm(), ConvolutionAlgorithm::Winograd2x2);
+
+        Conv2DLayer winograd4x4(weights, bias, 1, padding);
+        winograd4x4.set_convolution_algorithm(ConvolutionAlgorithm::Winograd4x4);
+
+        for (Conv2DLayer *layer : {&automatic, &winograd4x4})
+        {
+            Tensor result = layer->forward(input);
+            ASSERT_EQ(result.get_shape(), expected.get_shape());
+
+            for (size_t i = 0; i < result.getTotalElements(); i++)
+            {
+                EXPECT_NEAR(result.get_data()[i], expected.get_data()[i], 1e-4f);
+            }
+        }
+    }
+
+    // too few channels, or not a 3x3 stride-1 convolution
+    EXPECT_EQ(Conv2DLayer(Tensor({8, 8, 3, 3}), Tensor({8, 1})).get_convolution_algorithm(),
+              ConvolutionAlgorithm::Direct);
+    EXPECT_THROW(Conv2DLayer(weights, bias, 2).set_convolution_algorithm(ConvolutionAlgorithm::Winograd2x2),
+                 std::invalid_argument);
+}
+
+TEST(NeuralNetTest, TestPackedWeights)
+{
+    Tensor weights({17, 20, 3, 3}, 0.0f);
+    Tensor bias({17, 3}, 0.0f);
+    Tensor input({20, 3, 6, 5}, 0.0f);
+    Tensor fcWeights({19, 6}, 0.0f);
+    Tensor fcBias({19, 1}, 0.5f);
+    Tensor fcInput({6, 7}, 0.0f);
+
+    for (Tensor *tensor : {&weights, &bias, &input, &fcWeights, &fcInput})
+    {
+        float *data = tensor->get_mutable_data();
+        for (size_t i = 0; i < tensor->getTotalElements(); i++)
+        {
+            data[i] = static_cast<float>(static_cast<int>(i * 5 % 17) - 8) / 16.0f;
+        }
+    }
+
+    // 19 outputs: two full panels and a partial one, 7 columns: a full tile and 3 single ones
+    FullyConnectedLayer fc(fcWeights, fcBias);
+    Tensor fcExpected({19, 7}, 0.0f);
+    for (size_t i = 0; i < 19; i++)
+    {
+        for (size_t j = 0; j < 7; j++)
+        {
+            float sum = 0.0f;
+            for (size_t k = 0; k < 6; k++)
+            {
+                sum += fcWeights.get_element({i, k}) * fcInput.get_element({k, j});
+            }
+            fcExpected.set_element({i, j}, sum + 0.5f);
+        }
+    }
+    EXPECT_EQ(fc.forward(fcInput), fcExpected);
+
+    Conv2DLayer conv(weights, bias, 1, 1);
+    EXPECT_TRUE(conv.get_packed_weights().contains("winograd2x2"));
+    EXPECT_FALSE(conv.get_packed_weights().contains("blocked8"));
+    Tensor expected = conv.forward(input);
+    EXPECT_FALSE(conv.get_packed_weights().contains("blocked8"));
+    Tensor expectedBlocked = conv.forward(input.to_layout(TensorLayout::NCHW16c));
+    EXPECT_TRUE(conv.get_packed_weights().contains("blocked16"));
+
+    conv.get_packed_weights().save("packed.bin");
+    fc.get_packed_weights().save("packed_fc.bin");
+    PackedWeightCache packed = PackedWeightCache::from_bytes("packed.bin");
+    PackedWeightCache packedFc = PackedWeightCache::from_bytes("packed_fc.bin");
+    std::remove("packed.bin");
+    std::remove("packed_fc.bin");
+
+    // the sizes of a corrupted file are not allocated
+    const size_t huge = std::numeric_limits<size_t>::max() / 2;
+    for (bool isShape : {false, true})
+    {
+        {
+            // one entry, then a huge format name or a format "b8" with a huge dimension
+            std::ofstream corrupted("packed_corrupted.bin", std::ios::binary);
+            const size_t header[] = {1, isShape ? 2 : huge};
+            corrupted.write(reinterpret_cast<const char *>(header), sizeof(header));
+            corrupted.write("b8\x01", 3);
+            corrupted.write(reinterpret_cast<const char *>(&huge), sizeof(huge));
+        }
+        EXPECT_THROW(PackedWeightCache::from_bytes("packed_corrupted.bin"), std::runtime_error);
+    }
+    std::remove("packed_corrupted.bin");
+
+    // the loaded weights are taken as they are, not packed again
+    EXPECT_EQ(FullyConnectedLayer(fcWeights, fcBias, packedFc).forward(fcInput), fcExpected);
+    EXPECT_EQ(FullyConnectedLayer(Tensor({19, 6}, 0.0f), fcBias, packedFc).forward(fcInput), fcExpected);
+
+    Conv2DLayer loaded(weights, bias, 1, 1, 1, packed);
+    EXPECT_EQ(loaded.get_packed_weights().get("winograd2x2").get_data(), packed.get("winograd2x2").get_data());
+    EXPECT_EQ(loaded.forward(input), expected);
+    EXPECT_EQ(loaded.forward(input.to_layout(TensorLayout::NCHW16c)), expectedBlocked);
+
+    // a cache of another model
+    EXPECT_THROW(FullyConnectedLayer(Tensor({19, 5}), fcBias, packedFc), std::invalid_argument);
+    EXPECT_THROW(Conv2DLayer(Tensor({17, 20, 1, 1}), bias, 1, 0, 1, packed), std::invalid_argument);
+    EXPECT_THROW(packed.get("gemm8"), std::out_of_range);
+}
+
+TEST(NeuralNetTest, TestSparseWeights)
+{
+    // about one weight in ten is kept, the others are zeros or below the threshold
+    Tensor weights({13, 22}, 0.0f);
+    Tensor input({22, 3}, 0.0f);
+    float *weightsData = weights.get_mutable_data();
+    float *inputData = input.get_mutable_data();
+    for (size_t i = 0; i < weights.getTotalElements(); i++)
+    {
+        weightsData[i] = i % 10 == 3 ? static_cast<float>(static_cast<int>(i % 7) - 3) / 4.0f : (i % 10 == 5 ? 0.01f : 0.0f);
+    }
+    for (size_t i = 0; i < input.getTotalElements(); i++)
+    {
+        inputData[i] = static_cast<float>(static_cast<int>(i * 5 % 17) - 8) / 16.0f;
+    }
+
+    Tensor pruned = weights;
+    float *prunedData = pruned.get_mutable_data();
+    for (size_t i = 0; i < pruned.getTotalElements(); i++)
+    {
+        prunedData[i] = std::fabs(prunedData[i]) > 0.02f ? prunedData[i] : 0.0f;
+    }
+
+    for (SparseFormat format : {SparseFormat::CSR, SparseFormat::Block1x4, SparseFormat::Block4x4})
+    {
+        SparseWeights sparse = SparseWeights::from_dense(weights, 0.02f, format);
+        EXPECT_EQ(sparse.get_format(), format);
+        EXPECT_EQ(sparse.to_dense(), pruned);
+
+        Tensor result({13, 3}, 0.0f);
+        sparse.multiply(input.get_data(), 3, 3, result.get_mutable_data(), 3);
+        for (size_t i = 0; i < 13; i++)
+        {
+            for (size_t j = 0; j < 3; j++)
+            {
+                float sum = 0.0f;
+                for (size_t k = 0; k < 22; k++)
+                {
+                    sum += pruned.get_element({i, k}) * input.get_element({k, j});
+                }
+                EXPECT_EQ(result.get_element({i, j}), sum);
+            }
+        }
+    }
+
+    EXPECT_NEAR(SparseWeights::from_dense(weights, 0.02f, SparseFormat::CSR).get_density(), 24.0f / 286.0f, 1e-6f);
+    EXPECT_EQ(SparseWeights::from_dense(weights, 0.02f).get_format(), SparseFormat::CSR);
+    EXPECT_THROW(SparseWeights::from_dense(Tensor({2, 3, 3, 3})), std::invalid_argument);
+
+    // the loader drops the small weights, the layer picks the sparse kernel by itself
+    weights.save("sparse.bin");
+    SparseWeights loaded = SparseWeights::from_bytes("sparse.bin", 0.02f);
+    std::remove("sparse.bin");
+
+    Tensor bias({13, 1}, 0.25f);
+    FullyConnectedLayer dense(Tensor({13, 22}, 1.0f), bias);
+    FullyConnectedLayer automatic(pruned, bias);
+    FullyConnectedLayer explicitSparse(loaded, bias);
+    EXPECT_FALSE(dense.is_sparse());
+    EXPECT_TRUE(automatic.is_sparse());
+    EXPECT_TRUE(explicitSparse.is_sparse());
+    EXPECT_EQ(automatic.forward(input), explicitSparse.forward(input));
+
+    // the explicit sparse weights are used as they are, even dense ones, without GEMM panels
+    FullyConnectedLayer forcedSparse(SparseWeights::from_dense(Tensor({13, 22}, 1.0f)), bias);
+    EXPECT_TRUE(forcedSparse.is_sparse());
+    EXPECT_TRUE(forcedSparse.get_packed_weights().empty());
+    EXPECT_EQ(forcedSparse.forward(input), dense.forward(input));
+
+    Tensor expectedOutput({13, 3}, 0.0f);
+    for (size_t i = 0; i < 13; i++)
+    {
+        for (size_t j = 0; j < 3; j++)
+        {
+            float sum = 0.0f;
+            for (size_t k = 0; k < 22; k++)
+            {
+                sum += pruned.get_element({i, k}) * input.get_element({k, j});
+            }
+            expectedOutput.set_element({i, j}, sum + 0.25f);
+        }
+    }
+    EXPECT_EQ(automatic.forward(input), expectedOutput);
+
+    // a pruned pointwise convolution
+    Tensor convInput({22, 2, 3, 4}, 0.0f);
+    float *convInputData = convInput.get_mutable_data();
+    for (size_t i = 0; i < convInput.getTotalElements(); i++)
+    {
+        convInputData[i] = static_cast<float>(static_cast<int>(i * 7 % 19) - 9) / 8.0f;
+    }
+
+    Tensor convBias({13, 2}, 0.5f);
+    Conv2DLayer pointwise(pruned.reshape_clone({13, 22, 1, 1}), convBias);
+    Conv2DLayer padded(pruned.reshape_clone({13, 22, 1, 1}), convBias, 1, 1);
+    EXPECT_TRUE(pointwise.is_sparse());
+    EXPECT_FALSE(padded.is_sparse());
+
+    Tensor expected = pointwise.forward(convInput.to_layout(TensorLayout::NCHW8c)).to_layout(TensorLayout::CNHW);
+    Tensor result = pointwise.forward(convInput);
+    ASSERT_EQ(result.get_shape(), expected.get_shape());
+    for (size_t i = 0; i < result.getTotalElements(); i++)
+    {
+        EXPECT_NEAR(result.get_data()[i], expected.get_data()[i], 1e-5f);
+    }
+}
+
 TEST(NeuralNetTest, TestCrossCorrelation_InConv2DLayer)
 {
     Tensor input = Tensor::from_vector(tensor4d{
@@ -783,6 +1402,111 @@ TEST(NeuralNetTest, TestMaxPooling2DLayer_WithPadding)
                   }}));
 }
 
+TEST(NeuralNetTest, TestMaxPooling2DLayer_NegativeWithPadding)
+{
+    // the padding is skipped, not a zero taking part in the maximum
+    Tensor input = Tensor::from_vector(tensor4d{
+        {{
+            {-1.0, -2.0, -3.0},
+            {-4.0, -5.0, -6.0},
+            {-7.0, -8.0, -9.0},
+        }},
+    });
+
+    EXPECT_EQ(MaxPooling2DLayer(2, 2, 1).forward(input),
+              Tensor::from_vector(tensor4d{
+                  {
+                      {{-1.0, -2.0},
+                       {-4.0, -5.0}},
+                  }}));
+}
+
+TEST(NeuralNetTest, TestAverageAndL2Pooling2DLayer)
+{
+    Tensor input = Tensor::from_vector(tensor4d{
+        {{
+            {1.0, 2.0, 3.0, 4.0},
+            {5.0, 6.0, 7.0, 8.0},
+            {9.0, 10.0, 11.0, 12.0},
+        }},
+        {{
+            {-1.0, 0.0, 1.0, 2.0},
+            {3.0, -4.0, 5.0, 6.0},
+            {7.0, 8.0, -9.0, 10.0},
+        }},
+    });
+
+    const size_t poolSize = 3, stride = 2, padding = 1;
+    Tensor average = AveragePooling2DLayer(poolSize, stride, padding).forward(input);
+    Tensor l2 = Pooling2DLayer(PoolingMode::L2, poolSize, stride, padding).forward(input);
+
+    EXPECT_THAT(average.get_shape(), ::testing::ElementsAre(2, 1, 2, 2));
+    EXPECT_THAT(l2.get_shape(), ::testing::ElementsAre(2, 1, 2, 2));
+
+    for (size_t c = 0; c < 2; c++)
+    {
+        for (size_t oy = 0; oy < 2; oy++)
+        {
+            for (size_t ox = 0; ox < 2; ox++)
+            {
+                float sum = 0.0f, squares = 0.0f;
+                size_t count = 0;
+                for (int iy = static_cast<int>(oy * stride) - 1; iy < static_cast<int>(oy * stride) + 2; iy++)
+                {
+                    for (int ix = static_cast<int>(ox * stride) - 1; ix < static_cast<int>(ox * stride) + 2; ix++)
+                    {
+                        if (iy >= 0 && iy < 3 && ix >= 0 && ix < 4)
+                        {
+                            const float value = input.get_element({c, 0, static_cast<size_t>(iy), static_cast<size_t>(ix)});
+                            sum += value;
+                            squares += value * value;
+                            count++;
+                        }
+                    }
+                }
+
+                EXPECT_FLOAT_EQ(average.get_element({c, 0, oy, ox}), sum / count);
+                EXPECT_FLOAT_EQ(l2.get_element({c, 0, oy, ox}), std::sqrt(squares));
+            }
+        }
+    }
+
+    EXPECT_THROW(AveragePooling2DLayer(5).forward(input), std::invalid_argument);
+    EXPECT_THROW(MaxPooling2DLayer(2, 0), std::invalid_argument);
+}
+
+TEST(NeuralNetTest, TestMaxPoolingIndices)
+{
+    Tensor input = Tensor::from_vector(tensor4d{
+        {{
+            {1.0, 7.0, 3.0, 4.0},
+            {5.0, 6.0, 7.0, 2.0},
+            {9.0, -1.0, 0.0, 12.0},
+            {13.0, 14.0, 12.0, 11.0},
+        }},
+    });
+
+    MaxPooling2DLayer pooling(2, 2);
+    Tensor indices({1}, 0.0f);
+    Tensor values = pooling.forward_with_indices(input, indices);
+
+    EXPECT_EQ(values, pooling.forward(input));
+    // the first maximum in row major order wins the ties
+    EXPECT_EQ(indices, Tensor::from_vector(tensor4d{{{{1.0, 6.0}, {13.0, 11.0}}}}));
+
+    EXPECT_EQ(Pooling2DLayer::unpool(values, indices, 4, 4),
+              Tensor::from_vector(tensor4d{
+                  {{
+                      {0.0, 7.0, 0.0, 0.0},
+                      {0.0, 0.0, 7.0, 0.0},
+                      {0.0, 0.0, 0.0, 12.0},
+                      {0.0, 14.0, 0.0, 0.0},
+                  }},
+              }));
+
+    EXPECT_THROW(AveragePooling2DLayer(2).forward_with_indices(input, indices), std::invalid_argument);
+}
+
 TEST(NeuralNetTest, TestGlobalAveragePooling2DLayer)
 {
     Tensor input = Tensor::from_vector(tensor4d{
@@ -807,6 +1531,47 @@ TEST(NeuralNetTest, TestGlobalAveragePooling2DLayer)
               }));
 }
 
+TEST(NeuralNetTest, TestConv2DPoolingLayer)
+{
+    auto fill = [](const shape_type &shape, const float &scale)
+    {
+        Tensor tensor(shape, 0.0f);
+        for (size_t i = 0; i < tensor.getTotalElements(); i++)
+        {
+            tensor.get_mutable_data()[i] = static_cast<float>(static_cast<int>(i * 5 % 17) - 8) * scale;
+        }
+        return tensor;
+    };
+
+    Tensor input = fill({4, 1, 7, 6}, 0.25f);
+
+    Conv2DLayer conv(fill({5, 4, 3, 3}, 0.125f), fill({5, 1}, 0.5f), 2, 1);
+    Conv2DLayer depthwise(fill({4, 1, 3, 3}, 0.5f), fill({4, 1}, 0.25f), 1, 1, 4);
+    Clip2DLayer clip(0.0f, 1.5f);
+    GlobalAveragePooling2DLayer averagePooling;
+
+    for (Conv2DLayer *layer : {&conv, &depthwise})
+    {
+        Tensor expected = averagePooling.forward(clip.forward(layer->forward(input)));
+        Tensor output = Conv2DPoolingLayer(*layer, clip).forward(input);
+
+        EXPECT_THAT(output.get_shape(), ::testing::ElementsAreArray(expected.get_shape()));
+        for (size_t i = 0; i < expected.getTotalElements(); i++)
+        {
+            EXPECT_NEAR(output.get_data()[i], expected.get_data()[i], 1e-5f);
+        }
+
+        Tensor unclipped = averagePooling.forward(layer->forward(input));
+        Tensor outputWithoutClip = Conv2DPoolingLayer(*layer).forward(input);
+        for (size_t i = 0; i < unclipped.getTotalElements(); i++)
+        {
+            EXPECT_NEAR(outputWithoutClip.get_data()[i], unclipped.get_data()[i], 1e-5f);
+        }
+    }
+
+    EXPECT_THROW(Conv2DPoolingLayer(conv).forward(fill({3, 1, 7, 6}, 1.0f)), std::invalid_argument);
+}
+
 TEST(TensorTest, TestToBytes)
 {
     Tensor input = Tensor::from_vector(tensor4d{
@@ -818,4 +1583,181 @@ TEST(TensorTest, TestToBytes)
     input.save("test.bin"); // -> shape_size (u8) + 4 * shape_siz  + 12 * 4 = 48 bytes
     Tensor output = Tensor::from_bytes("test.bin");
     EXPECT_EQ(input, output);
-}
\ No newline at end of file
+}
+TEST(TensorTest, FromImage)
+{
+    // a 3x5 BGR image in rows of 16 bytes, every value is used once
+    const size_t height = 3, width = 5, channels = 3, stride = 16;
+    std::vector<uint8_t> pixels(height * stride, 255);
+    for (size_t h = 0; h < height; h++)
+    {
+        for (size_t i = 0; i < width * channels; i++)
+        {
+            pixels[h * stride + i] = static_cast<uint8_t>((h * 97 + i * 31) % 256);
+        }
+    }
+
+    const std::vector<float> mean = {0.485f, 0.456f, 0.406f};
+    const std::vector<float> deviation = {0.229f, 0.224f, 0.225f};
+    const ImageNormalization normalization(1.0f / 255.0f, mean, deviation, true);
+
+    Tensor expected({channels, 1, height, width}, 0.0f);
+    for (size_t c = 0; c < channels; c++)
+    {
+        for (size_t h = 0; h < height; h++)
+        {
+            for (size_t w = 0; w < width; w++)
+            {
+                const float byte = pixels[h * stride + w * channels + (channels - 1 - c)];
+                expected.set_element({c, 0, h, w}, (byte / 255.0f - mean[c]) / deviation[c]);
+            }
+        }
+    }
+
+    for (TensorLayout layout : {TensorLayout::CNHW, TensorLayout::NHWC, TensorLayout::NCHW8c})
+    {
+        Tensor image = Tensor::from_image(pixels.data(), height, width, channels, normalization, layout, stride);
+        EXPECT_EQ(image.get_layout(), layout);
+        EXPECT_EQ(image.get_channels(), channels);
+
+        const Tensor plain = image.to_layout(TensorLayout::CNHW);
+        ASSERT_EQ(plain.get_shape(), expected.get_shape());
+        for (size_t i = 0; i < plain.getTotalElements(); i++)
+        {
+            EXPECT_NEAR(plain.get_data()[i], expected.get_data()[i], 1e-5f);
+        }
+    }
+
+    // a grayscale image is converted straight into the tensor
+    const uint8_t gray[] = {0, 51, 102, 153, 204, 255};
+    Tensor image = Tensor::from_image(gray, 2, 3, 1);
+    EXPECT_EQ(image.get_shape(), (shape_type{1, 1, 2, 3}));
+    EXPECT_NEAR(image.get_data()[1], 0.2f, 1e-6f);
+    EXPECT_EQ(image.get_data()[5], 1.0f);
+
+    EXPECT_THROW(Tensor::from_image(pixels.data(), height, width, channels, ImageNormalization(1.0f, {0.5f, 0.5f})),
+                 std::invalid_argument);
+    EXPECT_THROW(Tensor::from_image(pixels.data(), height, width, channels, ImageNormalization(), TensorLayout::CNHW, 8),
+                 std::invalid_argument);
+}
+
+TEST(TensorTest, FromImageResized)
+{
+    // a 7x9 RGB image, the crop of 5x6 at (2, 1) is enlarged to 8x10 with a reference bilinear
+    const size_t height = 7, width = 9, channels = 3;
+    std::vector<uint8_t> pixels(height * width * channels);
+    for (size_t i = 0; i < pixels.size(); i++)
+    {
+        pixels[i] = static_cast<uint8_t>(i * 37 % 256);
+    }
+
+    ImageResize resize(8, 10);
+    resize.cropX = 2;
+    resize.cropY = 1;
+    resize.cropWidth = 6;
+    resize.cropHeight = 5;
+    Tensor image = Tensor::from_image(pixels.data(), height, width, channels, resize, ImageNormalization(1.0f));
+    ASSERT_EQ(image.get_shape(), (shape_type{3, 1, 8, 10}));
+
+    for (size_t y = 0; y < 8; y++)
+    {
+        const float sy = std::max((y + 0.5f) * 5.0f / 8.0f - 0.5f, 0.0f);
+        const size_t y0 = static_cast<size_t>(sy), y1 = std::min<size_t>(y0 + 1, 4);
+        for (size_t x = 0; x < 10; x++)
+        {
+            const float sx = std::max((x + 0.5f) * 6.0f / 10.0f - 0.5f, 0.0f);
+            const size_t x0 = static_cast<size_t>(sx), x1 = std::min<size_t>(x0 + 1, 5);
+            for (size_t c = 0; c < channels; c++)
+            {
+                const auto at = [&](size_t row, size_t column)
+                { return static_cast<float>(pixels[((row + 1) * width + column + 2) * channels + c]); };
+                const float fy = sy - y0, fx = sx - x0;
+                const float expected = (at(y0, x0) * (1 - fx) + at(y0, x1) * fx) * (1 - fy) +
+                                       (at(y1, x0) * (1 - fx) + at(y1, x1) * fx) * fy;
+                EXPECT_NEAR(image.get_element({c, 0, y, x}), expected, 1e-3f);
+            }
+        }
+    }
+
+    // the same size without a crop is the plain conversion
+    EXPECT_EQ(Tensor::from_image(pixels.data(), height, width, channels, ImageResize(height, width)),
+              Tensor::from_image(pixels.data(), height, width, channels));
+
+    // halving with the area mode averages the blocks of 2x2 pixels
+    const uint8_t gray[] = {0, 10, 20, 30,
+                            40, 50, 60, 70,
+                            80, 90, 100, 110,
+                            120, 130, 140, 150};
+    Tensor area = Tensor::from_image(gray, 4, 4, 1, ImageResize(2, 2, ResizeMode::Area), ImageNormalization(1.0f),
+                                     TensorLayout::NHWC);
+    EXPECT_EQ(area.to_layout(TensorLayout::CNHW), Tensor::from_vector(tensor4d{{{{25.0f, 45.0f}, {105.0f, 125.0f}}}}));
+
+    // a 2x4 image letterboxed in 4x4 keeps its aspect ratio between two rows of padding
+    Tensor letterbox = Tensor::from_image(gray, 2, 4, 1, ImageResize(4, 4, ResizeMode::Bilinear, true, 255),
+                                          ImageNormalization(1.0f));
+    size_t top, left, rows, columns;
+    ImageResize(4, 4, ResizeMode::Bilinear, true).get_placement(2, 4, top, left, rows, columns);
+    EXPECT_EQ(top, 1);
+    EXPECT_EQ(left, 0);
+    EXPECT_EQ(rows, 2);
+    EXPECT_EQ(columns, 4);
+    for (size_t x = 0; x < 4; x++)
+    {
+        EXPECT_EQ(letterbox.get_element({0, 0, 0, x}), 255.0f);
+        EXPECT_EQ(letterbox.get_element({0, 0, 1, x}), gray[x]);
+        EXPECT_EQ(letterbox.get_element({0, 0, 2, x}), gray[4 + x]);
+        EXPECT_EQ(letterbox.get_element({0, 0, 3, x}), 255.0f);
+    }
+
+    resize.cropX = 4;
+    EXPECT_THROW(Tensor::from_image(pixels.data(), height, width, channels, resize), std::invalid_argument);
+}
+
+TEST(TensorTest, WeightBundle)
+{
+    // a tensor of several chunks, a small one and an empty one
+    Tensor large({NTT_BUNDLE_CHUNK_SIZE / 4 * 2 + 100}, 0.0f);
+    float *data = large.get_mutable_data();
+    for (size_t i = 0; i < large.getTotalElements(); i++)
+    {
+        data[i] = i % 3 == 0 ? 0.0f : std::sin(static_cast<float>(i)) * 0.05f;
+    }
+
+    WeightBundle bundle;
+    bundle.set("conv1_weight", large);
+    bundle.set("conv1_bias", Tensor::from_vector(tensor2d{{0.5f}, {-1.25f}, {3.0f}}));
+    bundle.set("empty", Tensor({0}, 0.0f));
+    bundle.save("bundle.bin");
+
+    WeightBundle loaded = WeightBundle::from_bytes("bundle.bin");
+    EXPECT_EQ(loaded.get_names(), (std::vector<std::string>{"conv1_weight", "conv1_bias", "empty"}));
+    EXPECT_EQ(loaded.get("conv1_bias"), bundle.get("conv1_bias"));
+    EXPECT_EQ(loaded.get("empty").get_shape(), (shape_type{0}));
+
+    // the values are restored bit for bit
+    const Tensor &restored = loaded.get("conv1_weight");
+    ASSERT_EQ(restored.get_shape(), large.get_shape());
+    EXPECT_EQ(std::memcmp(restored.get_data(), large.get_data(), large.getTotalElements() * sizeof(float)), 0);
+    EXPECT_THROW(loaded.get("conv2_weight"), std::out_of_range);
+
+    // the zeros compress
+    std::ifstream file("bundle.bin", std::ios::binary | std::ios::ate);
+    EXPECT_LT(static_cast<size_t>(file.tellg()), large.getTotalElements() * sizeof(float));
+    file.close();
+
+    // a truncated bundle and a file which is not a bundle
+    std::vector<char> bytes;
+    {
+        std::ifstream input("bundle.bin", std::ios::binary);
+        bytes.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+    }
+    {
+        std::ofstream output("bundle.bin", std::ios::binary);
+        output.write(bytes.data(), bytes.size() - 10);
+    }
+    EXPECT_THROW(WeightBundle::from_bytes("bundle.bin"), std::runtime_error);
+
+    large.save("bundle.bin");
+    EXPECT_THROW(WeightBundle::from_bytes("bundle.bin"), std::runtime_error);
+    std::remove("bundle.bin");
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include <ntt_very_super_micro_dnn/ntt_tensor.hpp>
+
+/**
+ * The inputs and weights of the tests: small values of both signs, exactly representable,
+ *      which differ for every offset.
+ */
+static inline ntt::Tensor create_sequence(const ntt::shape_type &shape, float scale, const size_t &offset = 0)
+{
+    ntt::Tensor tensor(shape, 0.0f);
+    float *data = tensor.get_mutable_data();
+    for (size_t i = 0; i < tensor.getTotalElements(); i++)
+    {
+        data[i] = static_cast<float>(static_cast<int>((i + offset) * 7 % 23) - 11) * scale;
+    }
+
+    return tensor;
+}
@@ -0,0 +1,106 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <future>
+#include <memory>
+#include <thread>
+#include <stdexcept>
+#include <vector>
+#define NTT_MICRO_NN_IMPLEMENTATION
+#include <ntt_very_super_micro_dnn/ntt_thread_pool.hpp>
+
+using namespace ntt;
+
+TEST(ThreadPoolTest, ParallelForCoversTheRangeOnce)
+{
+    ThreadPool pool(4);
+    EXPECT_EQ(pool.get_thread_count(), 4);
+
+    for (size_t count : {0, 1, 3, 1000})
+    {
+        std::vector<std::atomic<int>> visits(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            visits[i] = 0;
+        }
+
+        pool.parallel_for(count, 7, [&](size_t begin, size_t end)
+                          {
+            for (size_t i = begin; i < end; i++)
+            {
+                visits[i]++;
+            } });
+
+        for (size_t i = 0; i < count; i++)
+        {
+            EXPECT_EQ(visits[i], 1);
+        }
+    }
+}
+
+TEST(ThreadPoolTest, NestedLoopsAndExceptions)
+{
+    ThreadPool pool(3);
+    std::atomic<size_t> total(0);
+
+    // every thread waits on an inner loop, the callers run the inner chunks themselves
+    pool.parallel_for(12, 1, [&](size_t begin, size_t end)
+                      {
+        for (size_t i = begin; i < end; i++)
+        {
+            pool.parallel_for(100, 10, [&](size_t innerBegin, size_t innerEnd)
+                              { total += innerEnd - innerBegin; });
+        } });
+    EXPECT_EQ(total, 1200);
+
+    EXPECT_THROW(pool.parallel_for(100, 1, [](size_t begin, size_t end)
+                                   {
+                     if (begin <= 50 && 50 < end)
+                     {
+                         throw std::runtime_error("chunk failed");
+                     } }),
+                 std::runtime_error);
+}
+
+TEST(ThreadPoolTest, SpscQueueKeepsTheOrder)
+{
+    SpscQueue<std::unique_ptr<size_t>> queue(3);
+    EXPECT_EQ(queue.get_capacity(), 3);
+
+    const size_t count = 10000;
+    std::thread producer([&queue, count]()
+                         {
+        for (size_t i = 0; i < count; i++)
+        {
+            std::unique_ptr<size_t> item(new size_t(i));
+            while (!queue.try_push(item))
+            {
+                std::this_thread::yield();
+            }
+        } });
+
+    for (size_t i = 0; i < count; i++)
+    {
+        std::unique_ptr<size_t> item;
+        while (!queue.try_pop(item))
+        {
+            std::this_thread::yield();
+        }
+        ASSERT_EQ(*item, i);
+    }
+    producer.join();
+
+    std::unique_ptr<size_t> item;
+    EXPECT_FALSE(queue.try_pop(item));
+}
+
+TEST(ThreadPoolTest, SubmitReturnsAFuture)
+{
+    ThreadPool pool(2);
+    std::future<size_t> result = pool.submit([]()
+                                             { return static_cast<size_t>(42); });
+    std::future<void> error = pool.submit([]()
+                                          { throw std::runtime_error("task failed"); });
+
+    EXPECT_EQ(result.get(), 42);
+    EXPECT_THROW(error.get(), std::runtime_error);
+}